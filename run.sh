@@ -4,12 +4,22 @@
 
 # example:
 # bash ./run.sh -live 2 30
+# bash ./run.sh -pcap 2 30 ./traffic_generator/pktgen/http_1_64.pcap
+# bash ./run.sh -job 2 30 ./jobs.bin
+# bash ./run.sh -remote 2 30 /dev/hugepages/meili_ring
 # sudo kill -9 $(pidof meili)
 
 BINARY="./build/meili"
 EAL_SUFFIX="-n 1 -a 0000:03:00.0,class=net:regex:compress,rxq_cqe_comp_en=0 -a 0000:03:00.1,class=net --file-prefix dpdk0"
 REGEX_RULE_SET="-r ./rulesets/teakettle.rof2.binary"
 CMD_SUFFIX_LIVE="--input-mode dpdk_port --dpdk-primary-port 0000:03:00.0 --dpdk-second-port 0000:03:00.1 -d rxp"
+# replays a capture through the pipeline, no NIC needed
+EAL_SUFFIX_PCAP="-n 1 --no-pci --file-prefix dpdk0"
+CMD_SUFFIX_PCAP="--input-mode pcap_file"
+# replays a job file and scores the matches against the expected ones, see input_job_format.h
+CMD_SUFFIX_JOB="--input-mode job_format -d rxp"
+# serves a ring set up by a host process on this machine, see remote_mmap_ring.h
+CMD_SUFFIX_REMOTE="--input-mode remote_mmap"
 
 # Check the argument value and run the corresponding command
 case $1 in
@@ -26,6 +36,15 @@ case $1 in
             *) echo "Invalid # of cores.";;
         esac;
         CMD="$BINARY -D \"$COREMASK $EAL_SUFFIX \" $CMD_SUFFIX_LIVE $REGEX_RULE_SET -c $2 -s $3";;
+   -pcap)
+        COREMASK="-l0-$(($2 - 1))"
+        CMD="$BINARY -D \"$COREMASK $EAL_SUFFIX_PCAP \" $CMD_SUFFIX_PCAP -f ${4:-./traffic_generator/pktgen/http_1_64.pcap} -c $2 -s $3";;
+   -job)
+        COREMASK="-l0-$(($2 - 1))"
+        CMD="$BINARY -D \"$COREMASK $EAL_SUFFIX \" $CMD_SUFFIX_JOB $REGEX_RULE_SET -f $4 -c $2 -s $3";;
+   -remote)
+        COREMASK="-l0-$(($2 - 1))"
+        CMD="$BINARY -D \"$COREMASK $EAL_SUFFIX_PCAP \" $CMD_SUFFIX_REMOTE -f $4 -c $2 -s $3";;
    *) echo "Invalid argument.";;
 esac
 
@@ -8,21 +8,22 @@
 
 
 MEILI_INIT(EXAMPLE)
-/* allocate space for pipeline state */
-self->state = (struct EXAMPLE_state *)malloc(sizeof(struct EXAMPLE_state));
+/* allocate space for pipeline state, zeroed and on the NUMA node of this instance */
+self->state = Meili.state_alloc(self, "EXAMPLE_state", sizeof(struct EXAMPLE_state));
 // printf("initializing example app\n");
 struct EXAMPLE_state *mystate = (struct EXAMPLE_state *)self->state;
 if(!mystate){
     return -ENOMEM;
 }
 
-memset(self->state, 0x00, sizeof(struct EXAMPLE_state));
-
 mystate->threshold = DDOS_DEFAULT_THRESH;
 mystate->p_window = DDOS_DEFAULT_WINDOW;
-mystate->p_set = calloc(mystate->p_window, sizeof(uint32_t));
-mystate->p_tot = calloc(mystate->p_window, sizeof(uint32_t));
-mystate->p_entropy = calloc(mystate->p_window, sizeof(uint32_t));
+mystate->p_set = Meili.state_alloc(self, "EXAMPLE_p_set", mystate->p_window * sizeof(uint32_t));
+mystate->p_tot = Meili.state_alloc(self, "EXAMPLE_p_tot", mystate->p_window * sizeof(uint32_t));
+mystate->p_entropy = Meili.state_alloc(self, "EXAMPLE_p_entropy", mystate->p_window * sizeof(uint32_t));
+if(!mystate->p_set || !mystate->p_tot || !mystate->p_entropy){
+    return -ENOMEM;
+}
 mystate->head = 0;
 
 return 0;
@@ -31,10 +32,10 @@ MEILI_END_DECLS
 
 MEILI_FREE(EXAMPLE)
 struct EXAMPLE_state *mystate = (struct EXAMPLE_state *)self->state;
-free(mystate->p_set);
-free(mystate->p_tot);
-free(mystate->p_entropy);
-free(mystate);
+Meili.state_free(self, mystate->p_set);
+Meili.state_free(self, mystate->p_tot);
+Meili.state_free(self, mystate->p_entropy);
+Meili.state_free(self, mystate);
 return 0;
 MEILI_END_DECLS
 
@@ -0,0 +1,52 @@
+/* Copyright (c) 2024, Meili Authors*/
+
+/* Burst Stage Example
+ * Drops non IPv4 packets a burst at a time with MEILI_EXEC_BATCH. Dropped packets are only left out of the
+ * output, the runtime diverts or frees them. Built with -DMEILI_EXAMPLE_BATCH, pick it with "TENANT [name] EXAMPLE_BATCH"
+ * in pl.conf, a config without TENANT lines runs whichever app registered first.
+ */
+
+#ifdef MEILI_EXAMPLE_BATCH
+
+#include "../lib/meili.h"
+#include "../runtime/meili_runtime.h"
+
+MEILI_STATE_DECLS(EXAMPLE_BATCH)
+uint64_t nb_bursts;
+uint64_t nb_dropped;
+MEILI_STATE_DECLS_END
+
+
+MEILI_INIT(EXAMPLE_BATCH)
+self->state = Meili.state_alloc(self, "EXAMPLE_BATCH_state", sizeof(struct EXAMPLE_BATCH_state));
+if(!self->state){
+    return -ENOMEM;
+}
+return 0;
+MEILI_END_DECLS
+
+
+MEILI_FREE(EXAMPLE_BATCH)
+Meili.state_free(self, self->state);
+return 0;
+MEILI_END_DECLS
+
+
+// compact the burst in place, the output defaults to pkts
+MEILI_EXEC_BATCH(EXAMPLE_BATCH)
+struct EXAMPLE_BATCH_state *mystate = (struct EXAMPLE_BATCH_state *)self->state;
+int nb_pass = 0;
+
+for(int i=0; i<nb_enq; i++){
+    if(meili_pkt_is_ipv4(pkts[i])){
+        pkts[nb_pass++] = pkts[i];
+    }
+}
+mystate->nb_bursts++;
+mystate->nb_dropped += nb_enq - nb_pass;
+*nb_deq = nb_pass;
+MEILI_END_DECLS
+
+MEILI_REGISTER_BATCH(EXAMPLE_BATCH)
+
+#endif /* MEILI_EXAMPLE_BATCH */
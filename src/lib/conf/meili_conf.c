@@ -21,6 +21,7 @@
 #include <doca_version.h>
 
 #include <rte_ethdev.h>
+#include <rte_ether.h>
 #include <rte_malloc.h>
 #include <rte_string_fns.h>
 
@@ -37,10 +38,58 @@
 #define DEFAULT_ITERATIONS     1
 #define DEFAULT_CORES	       1
 #define DEFAULT_SLIDING_WINDOW 32
+#define DEFAULT_RATE_BURST_US  100
+#define MAX_RATE_BURST_US      1000000
+#define MAX_RATE_GBPS          10000
+#define MAX_RATE_MPPS          10000
+#define DEFAULT_IDLE_EXIT_US   100
+#define DEFAULT_PREFETCH_LINES 1
+#define MAX_PREFETCH_DISTANCE  32
+#define MAX_PREFETCH_LINES     4
+#define DEFAULT_EGRESS_FLUSH_US 100
+#define DEFAULT_OFFLOAD_THRESHOLD 80
+#define DEFAULT_OFFLOAD_MAX_PCT 50
+#define DEFAULT_REORDER_HOLD_US 200
+#define DEFAULT_TAP_SAMPLE     1
+#define MAX_TAP_SNAPLEN        65535
 
 #define CONFIG_FILE_LINE_LEN   200
 #define CONFIG_FILE_MAX_ARGS   100
 
+/* Options without a short form, kept clear of the short option characters. */
+enum conf_long_only_opt {
+	CONF_OPT_DISPATCH_MODE = 256,
+	CONF_OPT_DISPATCH_RETA,
+	CONF_OPT_LATENCY_TARGET,
+	CONF_OPT_RATE_GBPS,
+	CONF_OPT_RATE_MPPS,
+	CONF_OPT_RATE_BURST,
+	CONF_OPT_RATE_SCOPE,
+	CONF_OPT_PIPELINE_CREDITS,
+	CONF_OPT_MAIN_IDLE,
+	CONF_OPT_IDLE_EXIT,
+	CONF_OPT_SCALE_FIFO,
+	CONF_OPT_EXEC_MODEL,
+	CONF_OPT_PREFETCH_DIST,
+	CONF_OPT_PREFETCH_LINES,
+	CONF_OPT_EGRESS,
+	CONF_OPT_NEXT_HOP_MAC,
+	CONF_OPT_EGRESS_FLUSH,
+	CONF_OPT_OFFLOAD_PORT,
+	CONF_OPT_OFFLOAD_SERVE,
+	CONF_OPT_OFFLOAD_PEER_MAC,
+	CONF_OPT_OFFLOAD_THRESHOLD,
+	CONF_OPT_OFFLOAD_MAX_PCT,
+	CONF_OPT_REORDER,
+	CONF_OPT_REORDER_BYPASS,
+	CONF_OPT_REORDER_HOLD,
+	CONF_OPT_STATS_QUIET,
+	CONF_OPT_PCAP_MMAP,
+	CONF_OPT_TAP,
+	CONF_OPT_TAP_SAMPLE,
+	CONF_OPT_TAP_SNAPLEN,
+};
+
 /* Default config file - can be overwritten from input parameters. */
 static char *conf_file;
 
@@ -52,6 +101,11 @@ conf_init(pl_conf *conf)
 	/* User is required to specify device and input mode. */
 	conf->regex_dev_type = REGEX_DEV_UNKNOWN;
 	conf->input_mode = INPUT_UNKNOWN;
+	conf->exec_model = EXEC_MODEL_UNKNOWN;
+	conf->egress_mode = EGRESS_UNKNOWN;
+	conf->dispatch_mode = DISPATCH_UNKNOWN;
+	conf->rate_scope = RATE_SCOPE_UNKNOWN;
+	conf->main_idle = IDLE_MODE_UNKNOWN;
 
 	conf_file = NULL;
 }
@@ -178,6 +232,46 @@ conf_set_uint32_t(uint32_t *dest, char opt, char *optarg)
 	return 0;
 }
 
+/* Validate and convert optarg of a long-only option to uint32_t. */
+static inline int
+conf_set_uint32_t_long(uint32_t *dest, const char *name, char *optarg)
+{
+	long tmp;
+
+	if (*dest)
+		return 0;
+
+	if (util_str_to_dec(optarg, &tmp, sizeof(uint32_t))) {
+		MEILI_LOG_ERR("invalid param --%s %s.", name, optarg);
+		return -EINVAL;
+	}
+
+	*dest = tmp;
+
+	return 0;
+}
+
+/* Validate and convert optarg of a long-only option to a positive double. */
+static inline int
+conf_set_double_long(double *dest, const char *name, char *optarg)
+{
+	char *end;
+	double tmp;
+
+	if (*dest)
+		return 0;
+
+	tmp = strtod(optarg, &end);
+	if (end == optarg || *end != '\0' || tmp <= 0) {
+		MEILI_LOG_ERR("invalid param --%s %s.", name, optarg);
+		return -EINVAL;
+	}
+
+	*dest = tmp;
+
+	return 0;
+}
+
 /* Validate and store optarg as config string. */
 static inline int
 conf_set_string(char **dest, char *optarg)
@@ -215,7 +309,7 @@ pipeline_usage(const char *prgname)
 		"Configuration:\n"
 		"\t--regex-dev (-d): 'regex_dpdk'/'rxp', 'hyperscan'/'hs' or 'doca_regex'/'doca'\n"
 		"\t--input-mode (-m): 'dpdk_port', 'pcap_file', 'text_file', 'job_format' or 'remote_mmap'\n"
-		"\t--input-file (-f): pcap, text file, job directory, or remote memory export definition to use\n"
+		"\t--input-file (-f): pcap, text file, job file, or shared memory region of remote_mmap to use\n"
 		"\t--rules (-r): regex rules file (compiled)\n"
 		"\t--raw-rules (-R): regex rules file (uncompiled)\n"
 		"Run Specific:\n"
@@ -224,6 +318,7 @@ pipeline_usage(const char *prgname)
 		"\t--run-packets (-p): packets/jobs to read (pcap, live and job_format mode)\n"
 		"\t--run-bytes (-b): max bytes to read in file or from network\n"
 		"\t--run-app-layer (-A): use per packet app layer for buffers\n"
+		"\t--pcap-mmap: (no arg) replay the pcap file in place from a memory mapping instead of loading it (pcap mode)\n"
 		"Search Specific:\n"
 		"\t--buf-length (-l): buffer size to process (file mode)\n"
 		"\t--buf-thres (-t): minimum buf size to process (live mode)\n"
@@ -244,6 +339,48 @@ pipeline_usage(const char *prgname)
 		"DPDK Port Specific:\n"
 		"\t--dpdk-primary-port (-1): dpdk port to use in live mode\n"
 		"\t--dpdk-second-port (-2): second dpdk port to use\n"
+		"Egress Specific:\n"
+		"\t--egress: 'off' frees processed packets (default), 'drop' or 'retry' sends them on the second port when the tx queue is full\n"
+		"\t--next-hop-mac: destination mac (aa:bb:cc:dd:ee:ff) written into sent packets, kept as received if not set\n"
+		"\t--egress-flush-us: max time in us a packet waits in the tx buffer, 0 flushes every iteration (default 100)\n"
+		"Offload Specific:\n"
+		"\t--offload-port: dpdk port linked to a peer Meili instance that flows are offloaded to under load\n"
+		"\t--offload-serve: (no arg) process flows a peer offloads to the primary port and send the results back\n"
+		"\t--offload-peer-mac: destination mac of offloaded packets (default broadcast)\n"
+		"\t--offload-threshold: load in %% of main core or head rings above which flows are offloaded, 0 offloads at any load (default 80)\n"
+		"\t--offload-max-pct: max %% of flows offloaded, 0 offloads none (default 50)\n"
+		"Reorder Specific:\n"
+		"\t--reorder: (no arg) restore the arrival order of each flow before packets leave the main core\n"
+		"\t--reorder-bypass: comma separated udp, tcp, udp:PORT or tcp:PORT traffic that skips reordering\n"
+		"\t--reorder-hold-us: max time in us a flow waits for a missing packet before skipping it, at least 1 (default 200)\n"
+		"Stats Specific:\n"
+		"\t--stats-quiet: (no arg) no per queue stats every second, they stay available through dpdk telemetry (/meili/...)\n"
+		"Tap Specific:\n"
+		"\t--tap: pcapng file receiving what stages and edges flagged 'tap' in pl.conf pass or drop, all stages if none is flagged\n"
+		"\t--tap-sample: capture one in N packets of each stage instance, at least 1 (default 1)\n"
+		"\t--tap-snaplen: max bytes captured per packet (default 65535)\n"
+		"Execution Model:\n"
+		"\t--exec-model: 'pipeline' (main core dispatches to stage rings, default) or 'rtc' (each worker runs all stages on its own rx/tx queue)\n"
+		"Dispatch Specific:\n"
+		"\t--dispatch-mode: 'rr' (round-robin bursts) or 'flow' (5-tuple hash) to first stage instances\n"
+		"\t--dispatch-reta: comma separated first stage ring indexes filling the flow indirection table\n"
+		"Batch Sizing:\n"
+		"\t--latency-target-us: per-batch latency target in us, adapts stage and eth batch sizes at runtime (0 keeps them fixed)\n"
+		"Rate Limit Specific:\n"
+		"\t--rate-gbps: ingress token bucket rate in Gbps\n"
+		"\t--rate-mpps: ingress token bucket rate in Mpps\n"
+		"\t--rate-burst-us: burst tolerance in us of traffic at the configured rate, 0 allows one packet or frame (default 100, max 1000000)\n"
+		"\t--rate-scope: 'port' limits the rx port, 'ring' limits each first stage ring to the rate\n"
+		"Backpressure Specific:\n"
+		"\t--pipeline-credits: max # of packets inside the pipeline, rx drops the excess (0 disables)\n"
+		"Prefetch Specific:\n"
+		"\t--prefetch-distance: packets ahead of the executing one to prefetch in stage loops (default 0, disabled)\n"
+		"\t--prefetch-lines: payload cache lines prefetched per packet, 1 to 4 (default 1)\n"
+		"Idle Specific:\n"
+		"\t--main-idle: 'spin', 'pause' or 'sleep' when the main core finds no packets (stages set it in pl.conf)\n"
+		"\t--idle-exit-us: max time a sleeping or blocked loop takes to notice new work, at least 1 (default 100)\n"
+		"Scaling Specific:\n"
+		"\t--scale-fifo: fifo taking 'out STAGE' and 'in STAGE' lines to add or remove a stage instance at runtime\n"
 		"Support:\n"
 		"\t--help (-h): print rxpbench options\n"
 		"\t--version (-v): return version information and exit\n"
@@ -280,6 +417,7 @@ static struct option conf_opts_long[] = {
 	{"run-packets", required_argument, 0, 'p'},
 	{"run-bytes", required_argument, 0, 'b'},
 	{"run-app-layer", no_argument, 0, 'A'},
+	{"pcap-mmap", no_argument, 0, CONF_OPT_PCAP_MMAP},
 
 	/* search specific. */
 	{"buf-length", required_argument, 0, 'l'},
@@ -307,6 +445,61 @@ static struct option conf_opts_long[] = {
 	{"dpdk-primary-port", required_argument, 0, '1'},
 	{"dpdk-second-port", required_argument, 0, '2'},
 
+	/* egress specific. */
+	{"egress", required_argument, 0, CONF_OPT_EGRESS},
+	{"next-hop-mac", required_argument, 0, CONF_OPT_NEXT_HOP_MAC},
+	{"egress-flush-us", required_argument, 0, CONF_OPT_EGRESS_FLUSH},
+
+	/* offload specific. */
+	{"offload-port", required_argument, 0, CONF_OPT_OFFLOAD_PORT},
+	{"offload-serve", no_argument, 0, CONF_OPT_OFFLOAD_SERVE},
+	{"offload-peer-mac", required_argument, 0, CONF_OPT_OFFLOAD_PEER_MAC},
+	{"offload-threshold", required_argument, 0, CONF_OPT_OFFLOAD_THRESHOLD},
+	{"offload-max-pct", required_argument, 0, CONF_OPT_OFFLOAD_MAX_PCT},
+
+	/* reorder specific. */
+	{"reorder", no_argument, 0, CONF_OPT_REORDER},
+	{"reorder-bypass", required_argument, 0, CONF_OPT_REORDER_BYPASS},
+	{"reorder-hold-us", required_argument, 0, CONF_OPT_REORDER_HOLD},
+
+	/* stats specific. */
+	{"stats-quiet", no_argument, 0, CONF_OPT_STATS_QUIET},
+
+	/* tap specific. */
+	{"tap", required_argument, 0, CONF_OPT_TAP},
+	{"tap-sample", required_argument, 0, CONF_OPT_TAP_SAMPLE},
+	{"tap-snaplen", required_argument, 0, CONF_OPT_TAP_SNAPLEN},
+
+	/* execution model. */
+	{"exec-model", required_argument, 0, CONF_OPT_EXEC_MODEL},
+
+	/* dispatch specific. */
+	{"dispatch-mode", required_argument, 0, CONF_OPT_DISPATCH_MODE},
+	{"dispatch-reta", required_argument, 0, CONF_OPT_DISPATCH_RETA},
+
+	/* batch sizing specific. */
+	{"latency-target-us", required_argument, 0, CONF_OPT_LATENCY_TARGET},
+
+	/* rate limit specific. */
+	{"rate-gbps", required_argument, 0, CONF_OPT_RATE_GBPS},
+	{"rate-mpps", required_argument, 0, CONF_OPT_RATE_MPPS},
+	{"rate-burst-us", required_argument, 0, CONF_OPT_RATE_BURST},
+	{"rate-scope", required_argument, 0, CONF_OPT_RATE_SCOPE},
+
+	/* backpressure specific. */
+	{"pipeline-credits", required_argument, 0, CONF_OPT_PIPELINE_CREDITS},
+
+	/* prefetch specific. */
+	{"prefetch-distance", required_argument, 0, CONF_OPT_PREFETCH_DIST},
+	{"prefetch-lines", required_argument, 0, CONF_OPT_PREFETCH_LINES},
+
+	/* idle specific. */
+	{"main-idle", required_argument, 0, CONF_OPT_MAIN_IDLE},
+	{"idle-exit-us", required_argument, 0, CONF_OPT_IDLE_EXIT},
+
+	/* scaling specific. */
+	{"scale-fifo", required_argument, 0, CONF_OPT_SCALE_FIFO},
+
 	{"help", no_argument, 0, 'h'},
 	{"version", no_argument, 0, 'v'},
 
@@ -515,6 +708,242 @@ conf_parse_args(pl_conf *run_conf, int argc, char **argv)
 			ret = conf_set_string(&run_conf->port2, optarg);
 			break;
 
+		/* egress */
+		case CONF_OPT_EGRESS:
+			if (run_conf->egress_mode != EGRESS_UNKNOWN)
+				break;
+			if (strcmp(optarg, "off") == 0)
+				run_conf->egress_mode = EGRESS_OFF;
+			else if (strcmp(optarg, "drop") == 0)
+				run_conf->egress_mode = EGRESS_DROP;
+			else if (strcmp(optarg, "retry") == 0)
+				run_conf->egress_mode = EGRESS_RETRY;
+			else {
+				MEILI_LOG_ERR("Invalid egress mode.");
+				pipeline_usage(prgname);
+				return -EINVAL;
+			}
+			break;
+
+		/* next-hop-mac */
+		case CONF_OPT_NEXT_HOP_MAC:
+			ret = conf_set_string(&run_conf->next_hop_mac, optarg);
+			break;
+
+		/* egress-flush-us */
+		case CONF_OPT_EGRESS_FLUSH:
+			if (run_conf->egress_flush_set)
+				break;
+			ret = conf_set_uint32_t_long(&run_conf->egress_flush_us, "egress-flush-us", optarg);
+			run_conf->egress_flush_set = !ret;
+			break;
+
+		/* offload-port */
+		case CONF_OPT_OFFLOAD_PORT:
+			ret = conf_set_string(&run_conf->offload_port, optarg);
+			break;
+
+		/* offload-serve */
+		case CONF_OPT_OFFLOAD_SERVE:
+			run_conf->offload_serve = true;
+			break;
+
+		/* offload-peer-mac */
+		case CONF_OPT_OFFLOAD_PEER_MAC:
+			ret = conf_set_string(&run_conf->offload_peer_mac, optarg);
+			break;
+
+		/* offload-threshold */
+		case CONF_OPT_OFFLOAD_THRESHOLD:
+			if (run_conf->offload_threshold_set)
+				break;
+			ret = conf_set_uint32_t_long(&run_conf->offload_threshold, "offload-threshold", optarg);
+			run_conf->offload_threshold_set = !ret;
+			break;
+
+		/* offload-max-pct */
+		case CONF_OPT_OFFLOAD_MAX_PCT:
+			if (run_conf->offload_max_pct_set)
+				break;
+			ret = conf_set_uint32_t_long(&run_conf->offload_max_pct, "offload-max-pct", optarg);
+			run_conf->offload_max_pct_set = !ret;
+			break;
+
+		/* reorder */
+		case CONF_OPT_REORDER:
+			run_conf->reorder = true;
+			break;
+
+		/* reorder-bypass */
+		case CONF_OPT_REORDER_BYPASS:
+			ret = conf_set_string(&run_conf->reorder_bypass, optarg);
+			break;
+
+		/* reorder-hold-us */
+		case CONF_OPT_REORDER_HOLD:
+			ret = conf_set_uint32_t_long(&run_conf->reorder_hold_us, "reorder-hold-us", optarg);
+			/* 0 would read as unset and become the default */
+			if (!ret && !run_conf->reorder_hold_us) {
+				MEILI_LOG_ERR("reorder-hold-us must be at least 1, packets of parallel instances arrive out of order.");
+				return -EINVAL;
+			}
+			break;
+
+		/* stats-quiet */
+		case CONF_OPT_STATS_QUIET:
+			run_conf->stats_quiet = true;
+			break;
+
+		/* pcap-mmap */
+		case CONF_OPT_PCAP_MMAP:
+			run_conf->input_pcap_mmap = true;
+			break;
+
+		/* tap */
+		case CONF_OPT_TAP:
+			ret = conf_set_string(&run_conf->tap_file, optarg);
+			break;
+
+		/* tap-sample */
+		case CONF_OPT_TAP_SAMPLE:
+			ret = conf_set_uint32_t_long(&run_conf->tap_sample, "tap-sample", optarg);
+			/* 0 would read as unset and become the default */
+			if (!ret && !run_conf->tap_sample) {
+				MEILI_LOG_ERR("tap-sample must be at least 1, one in N packets is captured.");
+				return -EINVAL;
+			}
+			break;
+
+		/* tap-snaplen */
+		case CONF_OPT_TAP_SNAPLEN:
+			ret = conf_set_uint32_t_long(&run_conf->tap_snaplen, "tap-snaplen", optarg);
+			break;
+
+		/* exec-model */
+		case CONF_OPT_EXEC_MODEL:
+			if (run_conf->exec_model != EXEC_MODEL_UNKNOWN)
+				break;
+			if (strcmp(optarg, "pipeline") == 0)
+				run_conf->exec_model = EXEC_MODEL_PIPELINE;
+			else if (strcmp(optarg, "rtc") == 0)
+				run_conf->exec_model = EXEC_MODEL_RTC;
+			else {
+				MEILI_LOG_ERR("Invalid execution model.");
+				pipeline_usage(prgname);
+				return -EINVAL;
+			}
+			break;
+
+		/* dispatch-mode */
+		case CONF_OPT_DISPATCH_MODE:
+			if (run_conf->dispatch_mode != DISPATCH_UNKNOWN)
+				break;
+			if (strcmp(optarg, "rr") == 0)
+				run_conf->dispatch_mode = DISPATCH_ROUND_ROBIN;
+			else if (strcmp(optarg, "flow") == 0)
+				run_conf->dispatch_mode = DISPATCH_FLOW_HASH;
+			else {
+				MEILI_LOG_ERR("Invalid dispatch mode.");
+				pipeline_usage(prgname);
+				return -EINVAL;
+			}
+			break;
+
+		/* dispatch-reta */
+		case CONF_OPT_DISPATCH_RETA:
+			ret = conf_set_string(&run_conf->dispatch_reta, optarg);
+			break;
+
+		/* latency-target-us */
+		case CONF_OPT_LATENCY_TARGET:
+			ret = conf_set_uint32_t_long(&run_conf->latency_target_us, "latency-target-us", optarg);
+			break;
+
+		/* rate-gbps */
+		case CONF_OPT_RATE_GBPS:
+			ret = conf_set_double_long(&run_conf->rate_gbps, "rate-gbps", optarg);
+			break;
+
+		/* rate-mpps */
+		case CONF_OPT_RATE_MPPS:
+			ret = conf_set_double_long(&run_conf->rate_mpps, "rate-mpps", optarg);
+			break;
+
+		/* rate-burst-us */
+		case CONF_OPT_RATE_BURST:
+			if (run_conf->rate_burst_set)
+				break;
+			ret = conf_set_uint32_t_long(&run_conf->rate_burst_us, "rate-burst-us", optarg);
+			run_conf->rate_burst_set = !ret;
+			break;
+
+		/* pipeline-credits */
+		case CONF_OPT_PIPELINE_CREDITS:
+			ret = conf_set_uint32_t_long(&run_conf->pipeline_credits, "pipeline-credits", optarg);
+			break;
+
+		/* main-idle */
+		case CONF_OPT_MAIN_IDLE:
+			if (run_conf->main_idle != IDLE_MODE_UNKNOWN)
+				break;
+			if (strcmp(optarg, "spin") == 0)
+				run_conf->main_idle = IDLE_MODE_SPIN;
+			else if (strcmp(optarg, "pause") == 0)
+				run_conf->main_idle = IDLE_MODE_PAUSE;
+			else if (strcmp(optarg, "sleep") == 0)
+				run_conf->main_idle = IDLE_MODE_SLEEP;
+			else {
+				MEILI_LOG_ERR("Invalid main idle mode.");
+				pipeline_usage(prgname);
+				return -EINVAL;
+			}
+			break;
+
+		/* prefetch-distance */
+		case CONF_OPT_PREFETCH_DIST:
+			ret = conf_set_uint32_t_long(&run_conf->prefetch_distance, "prefetch-distance", optarg);
+			break;
+
+		/* prefetch-lines */
+		case CONF_OPT_PREFETCH_LINES:
+			ret = conf_set_uint32_t_long(&run_conf->prefetch_lines, "prefetch-lines", optarg);
+			/* 0 would read as unset and become the default */
+			if (!ret && !run_conf->prefetch_lines) {
+				MEILI_LOG_ERR("prefetch-lines must be at least 1, prefetch-distance 0 disables prefetching.");
+				return -EINVAL;
+			}
+			break;
+
+		/* idle-exit-us */
+		case CONF_OPT_IDLE_EXIT:
+			ret = conf_set_uint32_t_long(&run_conf->idle_exit_us, "idle-exit-us", optarg);
+			/* 0 would read as unset and become the default */
+			if (!ret && !run_conf->idle_exit_us) {
+				MEILI_LOG_ERR("idle-exit-us must be at least 1, idle mode spin never sleeps.");
+				return -EINVAL;
+			}
+			break;
+
+		/* scale-fifo */
+		case CONF_OPT_SCALE_FIFO:
+			ret = conf_set_string(&run_conf->scale_fifo, optarg);
+			break;
+
+		/* rate-scope */
+		case CONF_OPT_RATE_SCOPE:
+			if (run_conf->rate_scope != RATE_SCOPE_UNKNOWN)
+				break;
+			if (strcmp(optarg, "port") == 0)
+				run_conf->rate_scope = RATE_SCOPE_PORT;
+			else if (strcmp(optarg, "ring") == 0)
+				run_conf->rate_scope = RATE_SCOPE_RING;
+			else {
+				MEILI_LOG_ERR("Invalid rate scope.");
+				pipeline_usage(prgname);
+				return -EINVAL;
+			}
+			break;
+
 		/* help */
 		case 'h':
 			pipeline_usage(prgname);
@@ -703,15 +1132,13 @@ conf_validate(pl_conf *run_conf)
 			conf_validation_mode_warning(run_conf, "job_format", "buf-thres");
 	} else if (run_conf->input_mode == INPUT_REMOTE_MMAP) {
 		if (run_conf->input_packets)
-			conf_validation_mode_warning(run_conf, "text_file", "run-packets");
+			conf_validation_mode_warning(run_conf, "remote_mmap", "run-packets");
+		if (run_conf->input_iterations)
+			conf_validation_mode_warning(run_conf, "remote_mmap", "run-iterations");
 		if (run_conf->input_app_mode)
-			conf_validation_mode_warning(run_conf, "text_file", "run-app-layer");
+			conf_validation_mode_warning(run_conf, "remote_mmap", "run-app-layer");
 		if (run_conf->input_len_threshold)
-			conf_validation_mode_warning(run_conf, "text_file", "buf-thres");
-		if (run_conf->regex_dev_type != REGEX_DEV_DOCA_REGEX) {
-			MEILI_LOG_ERR("Remote mmap mode is only supported with DOCA regex");
-			return -EINVAL;
-		}
+			conf_validation_mode_warning(run_conf, "remote_mmap", "buf-thres");
 	} else if (run_conf->input_mode == INPUT_LIVE) {
 		if (!run_conf->port1) {
 			MEILI_LOG_ERR("No specified primary port.");
@@ -729,6 +1156,9 @@ conf_validate(pl_conf *run_conf)
 			conf_validation_mode_warning(run_conf, "dpdk_port", "buf-overlap");
 	}
 
+	if (run_conf->input_pcap_mmap && run_conf->input_mode != INPUT_PCAP_FILE)
+		MEILI_LOG_WARN_REC(run_conf, "pcap-mmap only applies to pcap_file mode.");
+
 	if (run_conf->regex_dev_type == REGEX_DEV_HYPERSCAN) {
 		if (run_conf->input_mode == INPUT_JOB_FORMAT) {
 			MEILI_LOG_ERR("Hyperscan does not currently support job format input.");
@@ -751,6 +1181,141 @@ conf_validate(pl_conf *run_conf)
 			conf_validation_dev_warning(run_conf, "NON hyperscan", "hs_leftmost");
 	}
 
+	if (run_conf->dispatch_reta && run_conf->dispatch_mode != DISPATCH_FLOW_HASH)
+		MEILI_LOG_WARN_REC(run_conf, "dispatch-reta only applies to flow dispatch mode.");
+
+	/* run to completion has no main core dispatch and no rings between stages */
+	if (run_conf->exec_model == EXEC_MODEL_RTC) {
+		if (run_conf->input_mode != INPUT_LIVE) {
+			MEILI_LOG_ERR("exec-model rtc needs dpdk_port input.");
+			return -EINVAL;
+		}
+		if (run_conf->cores && run_conf->cores < 2) {
+			MEILI_LOG_ERR("exec-model rtc needs at least one worker core.");
+			return -EINVAL;
+		}
+		if (run_conf->scale_fifo) {
+			MEILI_LOG_ERR("scale-fifo is not supported with exec-model rtc.");
+			return -ENOTSUP;
+		}
+		if (run_conf->dispatch_mode != DISPATCH_UNKNOWN || run_conf->dispatch_reta)
+			MEILI_LOG_WARN_REC(run_conf, "dispatch options ignored with exec-model rtc, the NIC spreads flows by RSS.");
+		if (run_conf->pipeline_credits)
+			MEILI_LOG_WARN_REC(run_conf, "pipeline-credits ignored with exec-model rtc.");
+		if (run_conf->rate_gbps || run_conf->rate_mpps)
+			MEILI_LOG_WARN_REC(run_conf, "rate limits ignored with exec-model rtc.");
+		if (run_conf->main_idle != IDLE_MODE_UNKNOWN)
+			MEILI_LOG_WARN_REC(run_conf, "main-idle ignored with exec-model rtc, workers back off as stage 0 sets in pl.conf.");
+	}
+
+	if (run_conf->egress_mode == EGRESS_DROP || run_conf->egress_mode == EGRESS_RETRY) {
+		if (run_conf->input_mode != INPUT_LIVE) {
+			MEILI_LOG_ERR("egress needs dpdk_port input.");
+			return -EINVAL;
+		}
+	} else {
+		if (run_conf->next_hop_mac)
+			MEILI_LOG_WARN_REC(run_conf, "next-hop-mac ignored without egress.");
+		if (run_conf->egress_flush_set)
+			MEILI_LOG_WARN_REC(run_conf, "egress-flush-us ignored without egress.");
+	}
+	if (run_conf->next_hop_mac) {
+		struct rte_ether_addr mac;
+
+		if (rte_ether_unformat_addr(run_conf->next_hop_mac, &mac)) {
+			MEILI_LOG_ERR("Invalid next-hop-mac %s.", run_conf->next_hop_mac);
+			return -EINVAL;
+		}
+	}
+
+	/* offload steers flows from the main core rx burst, rtc workers have none */
+	if (run_conf->offload_port || run_conf->offload_serve) {
+		if (run_conf->offload_port && run_conf->offload_serve) {
+			MEILI_LOG_ERR("offload-port and offload-serve are mutually exclusive.");
+			return -EINVAL;
+		}
+		if (run_conf->input_mode != INPUT_LIVE) {
+			MEILI_LOG_ERR("offload needs dpdk_port input.");
+			return -EINVAL;
+		}
+		if (run_conf->exec_model == EXEC_MODEL_RTC) {
+			MEILI_LOG_ERR("offload is not supported with exec-model rtc.");
+			return -ENOTSUP;
+		}
+		if (run_conf->offload_port && ((run_conf->port1 && strcmp(run_conf->offload_port, run_conf->port1) == 0) ||
+					       (run_conf->port2 && strcmp(run_conf->offload_port, run_conf->port2) == 0))) {
+			MEILI_LOG_ERR("offload-port must differ from the dpdk ports.");
+			return -EINVAL;
+		}
+	}
+	if (!run_conf->offload_port) {
+		if (run_conf->offload_threshold_set || run_conf->offload_max_pct_set)
+			MEILI_LOG_WARN_REC(run_conf, "offload thresholds ignored without offload-port.");
+		if (run_conf->offload_peer_mac && !run_conf->offload_serve)
+			MEILI_LOG_WARN_REC(run_conf, "offload-peer-mac ignored without offload.");
+	}
+	if (run_conf->offload_threshold > 100 || run_conf->offload_max_pct > 100) {
+		MEILI_LOG_ERR("offload-threshold and offload-max-pct are percentages.");
+		return -EINVAL;
+	}
+	if (run_conf->offload_peer_mac) {
+		struct rte_ether_addr mac;
+
+		if (rte_ether_unformat_addr(run_conf->offload_peer_mac, &mac)) {
+			MEILI_LOG_ERR("Invalid offload-peer-mac %s.", run_conf->offload_peer_mac);
+			return -EINVAL;
+		}
+	}
+
+	/* only the main core of the pipeline model sees packets of all workers */
+	if (run_conf->reorder && run_conf->exec_model == EXEC_MODEL_RTC)
+		MEILI_LOG_WARN_REC(run_conf, "reorder ignored with exec-model rtc, queues keep their own order.");
+	if (run_conf->reorder_bypass && !run_conf->reorder)
+		MEILI_LOG_WARN_REC(run_conf, "reorder-bypass ignored without reorder.");
+	if (run_conf->reorder_hold_us && !run_conf->reorder)
+		MEILI_LOG_WARN_REC(run_conf, "reorder-hold-us ignored without reorder.");
+
+	if (!run_conf->tap_file && (run_conf->tap_sample || run_conf->tap_snaplen))
+		MEILI_LOG_WARN_REC(run_conf, "tap-sample and tap-snaplen ignored without tap.");
+	if (run_conf->tap_snaplen > MAX_TAP_SNAPLEN) {
+		MEILI_LOG_ERR("tap-snaplen %u exceeds max of %u.", run_conf->tap_snaplen, MAX_TAP_SNAPLEN);
+		return -EINVAL;
+	}
+
+	if (run_conf->prefetch_distance > MAX_PREFETCH_DISTANCE) {
+		MEILI_LOG_ERR("prefetch-distance %u exceeds max of %u.", run_conf->prefetch_distance, MAX_PREFETCH_DISTANCE);
+		return -EINVAL;
+	}
+	if (run_conf->prefetch_lines > MAX_PREFETCH_LINES) {
+		MEILI_LOG_ERR("prefetch-lines %u exceeds max of %u.", run_conf->prefetch_lines, MAX_PREFETCH_LINES);
+		return -EINVAL;
+	}
+	if (run_conf->prefetch_lines && !run_conf->prefetch_distance)
+		MEILI_LOG_WARN_REC(run_conf, "prefetch-lines ignored without a prefetch distance.");
+
+	if (run_conf->rate_gbps && run_conf->rate_mpps) {
+		MEILI_LOG_ERR("rate-gbps and rate-mpps are mutually exclusive.");
+		return -EINVAL;
+	}
+	if (run_conf->rate_gbps < 0 || run_conf->rate_gbps > MAX_RATE_GBPS) {
+		MEILI_LOG_ERR("rate-gbps %.2f out of range, expected 0 to %u.", run_conf->rate_gbps, MAX_RATE_GBPS);
+		return -EINVAL;
+	}
+	if (run_conf->rate_mpps < 0 || run_conf->rate_mpps > MAX_RATE_MPPS) {
+		MEILI_LOG_ERR("rate-mpps %.2f out of range, expected 0 to %u.", run_conf->rate_mpps, MAX_RATE_MPPS);
+		return -EINVAL;
+	}
+	if (run_conf->rate_burst_us > MAX_RATE_BURST_US) {
+		MEILI_LOG_ERR("rate-burst-us %u exceeds max of %u.", run_conf->rate_burst_us, MAX_RATE_BURST_US);
+		return -EINVAL;
+	}
+	if (!run_conf->rate_gbps && !run_conf->rate_mpps) {
+		if (run_conf->rate_burst_set)
+			MEILI_LOG_WARN_REC(run_conf, "rate-burst-us ignored without a rate limit.");
+		if (run_conf->rate_scope != RATE_SCOPE_UNKNOWN)
+			MEILI_LOG_WARN_REC(run_conf, "rate-scope ignored without a rate limit.");
+	}
+
 	if (run_conf->regex_dev_type != REGEX_DEV_DOCA_REGEX && run_conf->sliding_window)
 		conf_validation_dev_warning(run_conf, "NON DOCA", "sliding-window");
 
@@ -793,8 +1358,53 @@ conf_set_defaults(pl_conf *run_conf)
 	if (!run_conf->sliding_window)
 		run_conf->sliding_window = DEFAULT_SLIDING_WINDOW;
 
-	/* set the number of queues per port */
-    run_conf->nb_queues_per_port =  NB_QUEUE_PER_PORT;
+	if (run_conf->exec_model == EXEC_MODEL_UNKNOWN)
+		run_conf->exec_model = EXEC_MODEL_PIPELINE;
+
+	if (run_conf->dispatch_mode == DISPATCH_UNKNOWN)
+		run_conf->dispatch_mode = DISPATCH_ROUND_ROBIN;
+
+	if (run_conf->egress_mode == EGRESS_UNKNOWN)
+		run_conf->egress_mode = EGRESS_OFF;
+
+	if (!run_conf->egress_flush_set)
+		run_conf->egress_flush_us = DEFAULT_EGRESS_FLUSH_US;
+
+	if (!run_conf->offload_threshold_set)
+		run_conf->offload_threshold = DEFAULT_OFFLOAD_THRESHOLD;
+
+	if (!run_conf->offload_max_pct_set)
+		run_conf->offload_max_pct = DEFAULT_OFFLOAD_MAX_PCT;
+
+	if (!run_conf->reorder_hold_us)
+		run_conf->reorder_hold_us = DEFAULT_REORDER_HOLD_US;
+
+	if (!run_conf->rate_burst_set)
+		run_conf->rate_burst_us = DEFAULT_RATE_BURST_US;
+
+	if (run_conf->rate_scope == RATE_SCOPE_UNKNOWN)
+		run_conf->rate_scope = RATE_SCOPE_PORT;
+
+	if (run_conf->main_idle == IDLE_MODE_UNKNOWN)
+		run_conf->main_idle = IDLE_MODE_SPIN;
+
+	if (!run_conf->idle_exit_us)
+		run_conf->idle_exit_us = DEFAULT_IDLE_EXIT_US;
+
+	if (!run_conf->tap_sample)
+		run_conf->tap_sample = DEFAULT_TAP_SAMPLE;
+
+	if (!run_conf->tap_snaplen)
+		run_conf->tap_snaplen = MAX_TAP_SNAPLEN;
+
+	if (!run_conf->prefetch_lines)
+		run_conf->prefetch_lines = DEFAULT_PREFETCH_LINES;
+
+	/* set the number of queues per port, one per worker when workers poll the NIC themselves */
+	if (run_conf->exec_model == EXEC_MODEL_RTC)
+		run_conf->nb_queues_per_port = run_conf->cores - 1;
+	else
+		run_conf->nb_queues_per_port = NB_QUEUE_PER_PORT;
 }
 
 int
@@ -855,5 +1465,12 @@ conf_clean(pl_conf *run_conf)
 	free(run_conf->raw_rules_file);
 	free(run_conf->port1);
 	free(run_conf->port2);
+	free(run_conf->next_hop_mac);
+	free(run_conf->offload_port);
+	free(run_conf->offload_peer_mac);
+	free(run_conf->reorder_bypass);
+	free(run_conf->dispatch_reta);
+	free(run_conf->scale_fifo);
+	free(run_conf->tap_file);
 	free(conf_file);
 }
@@ -50,6 +50,44 @@ enum meili_comp_dev
 	COMP_DEV_UNKNOWN
 };
 
+enum meili_dispatch_mode
+{
+	DISPATCH_ROUND_ROBIN,
+	DISPATCH_FLOW_HASH,
+	DISPATCH_UNKNOWN
+};
+
+enum meili_exec_model
+{
+	EXEC_MODEL_PIPELINE,	/* main core dispatches to stage rings */
+	EXEC_MODEL_RTC,		/* every worker runs all stages on its own rx/tx queue */
+	EXEC_MODEL_UNKNOWN
+};
+
+enum meili_egress_mode
+{
+	EGRESS_OFF,		/* processed packets are freed */
+	EGRESS_DROP,		/* buffered tx, packets the NIC does not take are dropped */
+	EGRESS_RETRY,		/* buffered tx, a few more bursts before dropping */
+	EGRESS_UNKNOWN
+};
+
+enum meili_rate_scope
+{
+	RATE_SCOPE_PORT,
+	RATE_SCOPE_RING,
+	RATE_SCOPE_UNKNOWN
+};
+
+/* same order as enum idle_level of the runtime */
+enum meili_idle_mode
+{
+	IDLE_MODE_SPIN,
+	IDLE_MODE_PAUSE,
+	IDLE_MODE_SLEEP,
+	IDLE_MODE_UNKNOWN
+};
+
 enum rxpbench_input_type
 {
 	INPUT_PCAP_FILE,
@@ -81,6 +119,7 @@ typedef struct _pl_conf {
 	uint32_t input_packets;
 	uint32_t input_bytes;
 	bool input_app_mode;
+	bool input_pcap_mmap;
 
 	/* Config: Preloaded data */
 	char *input_data;
@@ -91,6 +130,8 @@ typedef struct _pl_conf {
 	uint16_t **input_subset_ids;
 	exp_matches_t *input_exp_matches;
 	pkt_stats_t *input_pkt_stats;
+	/* pcap replayed in place instead of preloaded, see input_pcap_map.h */
+	struct input_pcap_map *input_map;
 
 	/* Config: Remote mmap specific. */
 	void *remote_mmap_desc;
@@ -125,6 +166,65 @@ typedef struct _pl_conf {
 	char *port2;
 	int nb_queues_per_port;
 
+	/* Config: pipelined stages behind the main core, or run to completion on workers. */
+	enum meili_exec_model exec_model;
+
+	/* Config: tx of processed packets on the second port, or the primary one without it. */
+	enum meili_egress_mode egress_mode;
+	char *next_hop_mac;
+	uint32_t egress_flush_us;
+	bool egress_flush_set;	/* 0 is a valid egress_flush_us, flush on every iteration */
+
+	/* Config: partial offload of flows to a peer Meili instance, see offload.h. */
+	char *offload_port;
+	bool offload_serve;
+	char *offload_peer_mac;
+	uint32_t offload_threshold;
+	bool offload_threshold_set;	/* 0 is a valid offload_threshold, offload at any load */
+	uint32_t offload_max_pct;
+	bool offload_max_pct_set;	/* 0 is a valid offload_max_pct, offload no flow */
+
+	/* Config: per flow reorder at the main core, see packet_ordering.h. */
+	bool reorder;
+	char *reorder_bypass;
+	uint32_t reorder_hold_us;
+
+	/* Config: no stats printout while running, see telemetry.h. */
+	bool stats_quiet;
+
+	/* Config: pcapng capture of stage output and drops, NULL disables, see tap.h. */
+	char *tap_file;
+	uint32_t tap_sample;
+	uint32_t tap_snaplen;
+
+	/* Config: dispatch from main core to first pipeline stages. */
+	enum meili_dispatch_mode dispatch_mode;
+	char *dispatch_reta;
+
+	/* Config: per-batch latency target driving adaptive batch sizes, 0 disables. */
+	uint32_t latency_target_us;
+
+	/* Config: ingress rate limit, 0 disables. */
+	double rate_gbps;
+	double rate_mpps;
+	uint32_t rate_burst_us;
+	bool rate_burst_set;	/* 0 is a valid rate_burst_us, a bucket of one packet or frame */
+	enum meili_rate_scope rate_scope;
+
+	/* Config: max # of packets inside the pipeline before rx sheds load, 0 disables. */
+	uint32_t pipeline_credits;
+
+	/* Config: software prefetch in stage loops, distance 0 disables. */
+	uint32_t prefetch_distance;
+	uint32_t prefetch_lines;
+
+	/* Config: idle backoff of polling loops. */
+	enum meili_idle_mode main_idle;
+	uint32_t idle_exit_us;
+
+	/* Config: control fifo for adding/removing stage instances at runtime, NULL disables. */
+	char *scale_fifo;
+
 	/* Function pointers for each module */
 	input_func_t *input_funcs;
 	regex_func_t *regex_dev_funcs;
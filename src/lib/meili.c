@@ -14,6 +14,7 @@
 #include "./net/meili_pkt.h"
 #include "./regex/meili_regex.h"
 #include "./log/meili_log.h"
+#include "../utils/stats/stats.h"
 
 /* pkt_trans
 *   - Run a packet transformation operation specified by UCO.  
@@ -27,17 +28,22 @@ void pkt_trans(struct pipeline_stage *self, int (*trans)(struct pipeline_stage *
 
 /* pkt_flt
 *   - Filter packets with the operation specified by UCO.
+*   - A check returning 1 marks the packet, the runtime removes it from the stage output burst.
 */
 void pkt_flt(struct pipeline_stage *self, int (*check)(struct pipeline_stage *self, meili_pkt *pkt), meili_pkt *pkt){
     // printf("Meili api pkt_lt called\n");
     if(!check){
         return; 
     }
+    /* already filtered by an earlier check */
+    if(self->pkt_verdict != MEILI_PKT_PASS){
+        return;
+    }
     int flag = check(self, pkt);
 
     if(flag == 1){
         /* filter the packet */
-        ;
+        self->pkt_verdict = MEILI_PKT_DROP;
     }
 }
 
@@ -102,8 +108,8 @@ void regex(struct pipeline_stage *self, meili_pkt *pkt){
     
     int qid = self->worker_qid;
     struct pipeline *pl = (struct pipeline *)(self->pl);
-    regex_stats_t temp_stats;
     pl_conf *run_conf = &(pl->conf);
+    regex_stats_t *stats = &run_conf->stats->regex_stats[qid];
 
 	int to_send = 0;
 	int ret;
@@ -111,21 +117,44 @@ void regex(struct pipeline_stage *self, meili_pkt *pkt){
 
 
     /* Prepare ops in regex_dev_search_live */
-    to_send = regex_dev_search_live(run_conf, qid, pkt, &temp_stats);
+    to_send = regex_dev_search_live(run_conf, qid, pkt, stats);
     // if (ret)
     //     return ret;
 
     /* If to_send signal is set, push the batch( and pull at the same time to avoid full queue) */
     if (to_send) {
-        regex_dev_force_batch_push(run_conf, qid, &temp_stats, &nb_dequeued_op, NULL);
+        regex_dev_force_batch_push(run_conf, qid, stats, &nb_dequeued_op, NULL);
     }	
 	else{
 		/* If batch is not full, pull finished ops */
-		regex_dev_force_batch_pull(run_conf, qid, &temp_stats, &nb_dequeued_op, NULL);	
+		regex_dev_force_batch_pull(run_conf, qid, stats, &nb_dequeued_op, NULL);	
 	}
 	return;        
 };
 
+/* state_alloc
+*   - Allocate zeroed, cache-aligned stage state on hugepages of the NUMA node of the instance's lcore.
+*/
+void *state_alloc(struct pipeline_stage *self, const char *name, size_t size){
+    return stage_mem_alloc(self, name, size);
+};
+
+/* state_alloc_shared
+*   - Map a region shared by all instances of the stage, zeroed by the first one. 
+*   - Instances run concurrently, access it with __atomic builtins only.
+*/
+void *state_alloc_shared(struct pipeline_stage *self, const char *name, size_t size){
+    return stage_mem_alloc_shared(self, name, size);
+};
+
+/* state_free
+*   - Free state from state_alloc or unmap a region from state_alloc_shared.
+*   - State still allocated when the instance is freed is released by the runtime.
+*/
+void state_free(struct pipeline_stage *self, void *ptr){
+    stage_mem_free(self, ptr);
+};
+
 /* AES
 *   - The built-in AES Encryption API.
 */
@@ -147,5 +176,8 @@ int register_meili_apis(){
     Meili.regex         = regex;
     Meili.AES           = AES;
     Meili.compression   = compression;
+    Meili.state_alloc   = state_alloc;
+    Meili.state_alloc_shared = state_alloc_shared;
+    Meili.state_free    = state_free;
     return 0;
 }
\ No newline at end of file
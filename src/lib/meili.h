@@ -5,6 +5,7 @@
 
 #include "./net/meili_pkt.h"
 #include "../runtime/pipeline.h"
+#include "../runtime/tenant.h"
 
 #define MEILI_STATE_DECLS(x) struct x##_state {
 #define MEILI_STATE_DECLS_END };
@@ -18,14 +19,23 @@
 #define MEILI_EXEC(x)  int x##_stage_exec(struct pipeline_stage *self, \
                             meili_pkt *pkt){
 
+/* burst version of MEILI_EXEC: pkts[0..nb_enq) are visible at once. Output defaults to the input burst,
+   a stage that drops or reorders packets updates *pkts_out and *nb_deq. Dropped packets are not freed
+   by the stage, the runtime diverts or frees them like packets filtered by Meili.pkt_flt */
+#define MEILI_EXEC_BATCH(x)  int x##_stage_exec_batch(struct pipeline_stage *self, \
+                            meili_pkt **pkts, int nb_enq, meili_pkt ***pkts_out, int *nb_deq){ \
+                            *pkts_out = pkts; *nb_deq = nb_enq;
+
 #define MEILI_END_DECLS  return 0;}
 
-//test
-#define MEILI_REGISTER(x) int meili_pipeline_stage_func_reg(struct pipeline_stage *stage){ \
-                                stage->funcs->pipeline_stage_init = x##_stage_init;\
-	                            stage->funcs->pipeline_stage_free = x##_stage_free;\
-	                            stage->funcs->pipeline_stage_exec = x##_stage_exec;}
- 
+/* register an app under its name x, several apps may be linked in and are picked per tenant in pl.conf */
+#define MEILI_REGISTER(x) RTE_INIT(x##_app_register){ \
+                                meili_app_register(#x, x##_stage_init, x##_stage_free, x##_stage_exec, NULL);}
+
+/* register an app that implements MEILI_EXEC_BATCH instead of MEILI_EXEC, it must not free the packets it drops */
+#define MEILI_REGISTER_BATCH(x) RTE_INIT(x##_app_register){ \
+                                meili_app_register(#x, x##_stage_init, x##_stage_free, NULL, x##_stage_exec_batch);}
+
 
 
 
@@ -40,6 +50,9 @@ typedef struct _meili_apis{
     void (*regex)(struct pipeline_stage *self, meili_pkt *pkt);
     void (*compression)();
     void (*AES)();
+    void *(*state_alloc)(struct pipeline_stage *self, const char *name, size_t size);
+    void *(*state_alloc_shared)(struct pipeline_stage *self, const char *name, size_t size);
+    void (*state_free)(struct pipeline_stage *self, void *ptr);
 }meili_apis;
 
 volatile struct _meili_apis Meili;
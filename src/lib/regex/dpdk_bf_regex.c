@@ -31,6 +31,7 @@
 #include "meili_regex.h"
 #include "meili_regex_stats.h"
 #include "../../utils/str/str_helpers.h"
+#include "../../utils/input_mode/input_job_format.h"
 
 /* Number of dpdk queue descriptors is 1024 so need more mbuf pool entries. */
 #define MBUF_POOL_SIZE		     2047 /* Should be n = (2^q - 1)*/
@@ -57,7 +58,6 @@ struct per_core_globals {
 			uint64_t last_idle_time;
 			uint64_t total_enqueued;
 			uint64_t total_dequeued;
-			uint64_t buf_id;
 			uint16_t op_offset;
 		};
 		unsigned char cache_align[CACHE_LINE_SIZE];
@@ -302,10 +302,10 @@ regex_dev_dpdk_bf_init(pl_conf *run_conf)
 	// }
 
 	/* Init min latency stats to large value. */
-	// for (i = 0; i < num_queues; i++) {
-	// 	stats = (rxp_stats_t *)(run_conf->stats->regex_stats[i].custom);
-	// 	stats->min_lat = UINT64_MAX;
-	// }
+	for (i = 0; i < num_queues; i++) {
+		stats = (rxp_stats_t *)(run_conf->stats->regex_stats[i].custom);
+		stats->min_lat = UINT64_MAX;
+	}
 
 	/* Grab a copy of job format specific arrays. */
 	input_subset_ids = run_conf->input_subset_ids;
@@ -364,36 +364,33 @@ regex_dev_dpdk_bf_get_array_offset(uint64_t job_id)
 // 	}
 // }
 
-// static void
-// regex_dev_dpdk_bf_exp_matches(struct rte_regex_ops *resp, rxp_stats_t *rxp_stats, bool max)
-// {
-// 	const uint16_t num_matches = resp->nb_matches;
-// 	struct rte_mbuf *mbuf = resp->user_ptr;
-// 	exp_match_t actual_match[num_matches];
-// 	struct rte_regexdev_match *matches;
-// 	exp_matches_t actual_matches;
-// 	rxp_exp_match_stats_t *stats;
-// 	exp_matches_t *exp_matches;
-// 	uint64_t job_id;
-// 	uint16_t i;
-
-// 	/* Copy matches to shared type - exp matches are for validation so perf is not a priority here. */
-// 	matches = resp->matches;
-// 	for (i = 0; i < num_matches; i++) {
-// 		actual_match[i].rule_id = matches[i].rule_id;
-// 		actual_match[i].start_ptr = matches[i].start_offset;
-// 		actual_match[i].length = matches[i].len;
-// 	}
+/* Score a response against the expected matches of its job, jobs that hit a device limit go to max_exp. */
+static void
+regex_dev_dpdk_bf_exp_matches(struct rte_regex_ops *resp, rxp_stats_t *rxp_stats, bool max)
+{
+	const uint16_t num_matches = resp->nb_matches;
+	exp_match_t actual_match[num_matches ? num_matches : 1];
+	struct rte_regexdev_match *matches;
+	exp_matches_t actual_matches;
+	rxp_exp_match_stats_t *stats;
+	uint16_t i;
+
+	/* Copy matches to shared type. */
+	matches = resp->matches;
+	for (i = 0; i < num_matches; i++) {
+		actual_match[i].rule_id = matches[i].rule_id;
+		actual_match[i].start_ptr = matches[i].start_offset;
+		actual_match[i].length = matches[i].len;
+	}
 
-// 	actual_matches.num_matches = num_matches;
-// 	actual_matches.matches = &actual_match[0];
+	actual_matches.num_matches = num_matches;
+	actual_matches.matches = &actual_match[0];
 
-// 	stats = max ? &rxp_stats->max_exp : &rxp_stats->exp;
-// 	job_id = util_get_64_bit_from_2_32(&mbuf->dynfield1[DF_USER_ID_HIGH]);
-// 	exp_matches = &input_exp_matches[regex_dev_dpdk_bf_get_array_offset(job_id)];
+	stats = max ? &rxp_stats->max_exp : &rxp_stats->exp;
 
-// 	regex_dev_verify_exp_matches(exp_matches, &actual_matches, stats);
-// }
+	/* The job index was stored in the op by prep_op. */
+	regex_dev_verify_exp_matches(&input_exp_matches[resp->user_id], &actual_matches, stats);
+}
 
 static void
 regex_dev_dpdk_bf_process_resp(int qid, struct rte_regex_ops *resp, regex_stats_t *stats)
@@ -427,27 +424,25 @@ regex_dev_dpdk_bf_process_resp(int qid, struct rte_regex_ops *resp, regex_stats_
 		rxp_stats->rx_invalid++;
 
 		/* Still check expected matches if job failed. */
-		// if (input_exp_matches)
-		// 	regex_dev_dpdk_bf_exp_matches(resp, rxp_stats, res_flags);
-
+		if (input_exp_matches)
+			regex_dev_dpdk_bf_exp_matches(resp, rxp_stats, res_flags);
 
-		printf("response flags available\n");		
 		return;
 	}
 
-	// stats->rx_valid++;
+	stats->rx_valid++;
 
-	// const uint16_t num_matches = resp->nb_matches;
-	// if (num_matches) {
-	// 	stats->rx_buf_match_cnt++;
-	// 	stats->rx_total_match += num_matches;
+	const uint16_t num_matches = resp->nb_matches;
+	if (num_matches) {
+		stats->rx_buf_match_cnt++;
+		stats->rx_total_match += num_matches;
 
-	// 	if (verbose)
-	// 		regex_dev_dpdk_bf_matches(qid, resp->user_ptr, num_matches, resp->matches);
-	// }
+		// if (verbose)
+		// 	regex_dev_dpdk_bf_matches(qid, resp->user_ptr, num_matches, resp->matches);
+	}
 
-	// if (input_exp_matches)
-	// 	regex_dev_dpdk_bf_exp_matches(resp, rxp_stats, res_flags);
+	if (input_exp_matches)
+		regex_dev_dpdk_bf_exp_matches(resp, rxp_stats, res_flags);
 }
 
 static void
@@ -488,7 +483,7 @@ regex_dev_dpdk_bf_dequeue(int qid, regex_stats_t *stats, uint16_t wait_on_dequeu
 
 		for (i = 0; i < num_dequeued; i++) {
 			mbuf = ops[i]->user_ptr;
-			//regex_dev_dpdk_bf_process_resp(qid, ops[i], stats);
+			regex_dev_dpdk_bf_process_resp(qid, ops[i], stats);
 			//regex_dev_dpdk_bf_release_mbuf(mbuf, stats, time);
 		}
 
@@ -689,28 +684,30 @@ regex_dev_dpdk_bf_send_ops_pipeline(int qid, regex_stats_t *stats, int *nb_deque
 
 
 static inline void
-regex_dev_dpdk_bf_prep_op(int qid, struct rte_regex_ops *op)
+regex_dev_dpdk_bf_prep_op(int qid __rte_unused, struct rte_regex_ops *op)
 {
-	/* Store the buffer id in the mbuf metadata. */
-	util_store_64_bit_as_2_32(&op->mbuf->dynfield1[DF_USER_ID_HIGH], ++(core_vars[qid].buf_id));
+	uint32_t job;
 
-	
 	if (input_subset_ids) {
-		printf("input_subset_ids has valid value\n");
-		const int job_offset = regex_dev_dpdk_bf_get_array_offset(core_vars[qid].buf_id);
+		/* Job format replay tags each mbuf with the index of its job. */
+		job = *input_job_idx(op->mbuf);
 
-		op->group_id0 = input_subset_ids[job_offset][0];
-		op->group_id1 = input_subset_ids[job_offset][1];
-		op->group_id2 = input_subset_ids[job_offset][2];
-		op->group_id3 = input_subset_ids[job_offset][3];
+		op->group_id0 = input_subset_ids[job][0];
+		op->group_id1 = input_subset_ids[job][1];
+		op->group_id2 = input_subset_ids[job][2];
+		op->group_id3 = input_subset_ids[job][3];
 		op->req_flags = RTE_REGEX_OPS_REQ_GROUP_ID0_VALID_F | RTE_REGEX_OPS_REQ_GROUP_ID1_VALID_F |
 				RTE_REGEX_OPS_REQ_GROUP_ID2_VALID_F | RTE_REGEX_OPS_REQ_GROUP_ID3_VALID_F;
-	} else {
-		op->group_id0 = 1;
-		op->req_flags = RTE_REGEX_OPS_REQ_GROUP_ID0_VALID_F;
+
+		/* The mbuf moves on through the pipeline before the response, keep the job in the op. */
+		op->user_id = job;
+		return;
 	}
 
-	/* User id of the job is the address of it's mbuf - mbuf is not released until response is handled. */
+	op->group_id0 = 1;
+	op->req_flags = RTE_REGEX_OPS_REQ_GROUP_ID0_VALID_F;
+
+	/* User id of the job is the address of it's mbuf. */
 	op->user_ptr = op->mbuf;
 }
 
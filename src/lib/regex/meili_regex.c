@@ -3,6 +3,7 @@
 #include "meili_regex.h"
 #include "../log/meili_log.h"
 #include "../../runtime/meili_runtime.h"
+#include "../../utils/stats/stats.h"
 
 int meili_regex_init(pl_conf *run_conf){
     
@@ -30,4 +31,16 @@ int meili_regex_init(pl_conf *run_conf){
 		return -EINVAL;
 	}
 	return 0;
-}
\ No newline at end of file
+}
+
+/* Push the partial batch of each queue and score every op still in flight, call once the workers stopped */
+void meili_regex_flush(pl_conf *run_conf){
+	regex_stats_t *stats = run_conf->stats->regex_stats;
+	int nb_dequeued_op;
+	uint32_t q;
+
+	for (q = 0; q < run_conf->cores; q++) {
+		regex_dev_force_batch_push(run_conf, q, &stats[q], &nb_dequeued_op, NULL);
+		regex_dev_post_search(run_conf, q, &stats[q]);
+	}
+}
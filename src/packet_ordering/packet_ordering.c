@@ -3,13 +3,14 @@
 /*
  * Packet ordering
  * - Split flows based on five-tuple
- * - Assign unique seq number for packets 
+ * - Assign unique seq number for packets
  * - Reorder packets based on seq num before leaving pipleine
  */
 
 #include "packet_ordering.h"
 
 
+#include <stdio.h>
 #include <stdlib.h>
 //#include <pthread.h>
 #include <math.h>
@@ -18,6 +19,7 @@
 
 #include <rte_eal.h>
 #include <rte_common.h>
+#include <rte_cycles.h>
 #include <rte_errno.h>
 #include <rte_ethdev.h>
 #include <rte_lcore.h>
@@ -28,26 +30,105 @@
 #include "../utils/rte_reorder/rte_reorder.h"
 
 #include "../lib/log/meili_log.h"
+#include "../runtime/dispatch.h"
+#include "../utils/str/str_helpers.h"
 
+int seq_flow_dynfield_offset = -1;
 
 int
 seq_init(struct pipeline_stage *self)
 {
+    static const struct rte_mbuf_dynfield seq_flow_dynfield_desc = {
+        .name = "meili_seq_flow",
+        .size = sizeof(uint16_t),
+        .align = __alignof__(uint16_t),
+    };
+
+    seq_flow_dynfield_offset = rte_mbuf_dynfield_register(&seq_flow_dynfield_desc);
+    if(seq_flow_dynfield_offset < 0){
+        MEILI_LOG_ERR("Failed to register mbuf field for flow ordering, rte_errno: %i", rte_errno);
+        return -ENOMEM;
+    }
+
     /* allocate space for pipeline state */
-    self->state = (struct seq_state *)malloc(sizeof(struct seq_state));
+    self->state = (struct seq_state *)calloc(1, sizeof(struct seq_state));
     struct seq_state *mystate = (struct seq_state *)self->state;
     if(!mystate){
         return -ENOMEM;
     }
 
     self->batch_size = SEQUENCE_DEFAULT_BATCH_SIZE;
-    //memset(self->state, 0x00, sizeof(struct entropy_state));
 
-    mystate->seqn = SEQ_NUM_START;
+    for(int f=0; f<SEQ_FLOW_BUCKETS; f++){
+        mystate->seqn[f] = SEQ_NUM_START;
+    }
 
     return 0;
 }
 
+/* Parse a comma separated list of 'udp', 'tcp', 'udp:PORT' or 'tcp:PORT' whose packets skip reordering */
+int
+seq_set_bypass(struct pipeline_stage *self, const char *bypass_str)
+{
+    struct seq_state *mystate = (struct seq_state *)self->state;
+    struct reorder_bypass *entry;
+    char *saveptr;
+    char *str;
+    char *tok;
+    char *port;
+    long val;
+    int ret = 0;
+
+    str = strdup(bypass_str);
+    if(!str){
+        MEILI_LOG_ERR("Memory failure parsing reorder bypass.");
+        return -ENOMEM;
+    }
+
+    mystate->nb_bypass = 0;
+    for(tok = strtok_r(str, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr)){
+        tok = util_trim_whitespace(tok);
+        if(mystate->nb_bypass >= REORDER_BYPASS_MAX){
+            MEILI_LOG_ERR("Reorder bypass has more than %d entries.", REORDER_BYPASS_MAX);
+            ret = -EINVAL;
+            goto out;
+        }
+        entry = &mystate->bypass[mystate->nb_bypass];
+
+        port = strchr(tok, ':');
+        if(port){
+            *port++ = '\0';
+        }
+        if(strcmp(tok, "udp") == 0){
+            entry->proto = IP_PROTO_UDP;
+        }
+        else if(strcmp(tok, "tcp") == 0){
+            entry->proto = IP_PROTO_TCP;
+        }
+        else{
+            MEILI_LOG_ERR("Invalid reorder bypass protocol %s, expected udp or tcp.", tok);
+            ret = -EINVAL;
+            goto out;
+        }
+
+        entry->port = 0;
+        if(port){
+            if(util_str_to_dec(port, &val, 2) || val <= 0){
+                MEILI_LOG_ERR("Invalid reorder bypass port %s.", port);
+                ret = -EINVAL;
+                goto out;
+            }
+            entry->port = rte_cpu_to_be_16((uint16_t)val);
+        }
+        mystate->nb_bypass++;
+    }
+
+out:
+    free(str);
+
+    return ret;
+}
+
 int
 seq_free(struct pipeline_stage *self)
 {
@@ -58,18 +139,40 @@ seq_free(struct pipeline_stage *self)
     return 0;
 }
 
+static inline bool
+seq_bypass(struct seq_state *mystate, struct rte_mbuf *mbuf)
+{
+    struct ipv4_5tuple key;
+
+    if(flow_table_fill_key(&key, mbuf) < 0){
+        return false;
+    }
+    for(int b=0; b<mystate->nb_bypass; b++){
+        if(key.proto == mystate->bypass[b].proto &&
+           (!mystate->bypass[b].port || key.dst_port == mystate->bypass[b].port)){
+            return true;
+        }
+    }
+    return false;
+}
+
 int
 seq_exec(struct pipeline_stage *self, struct rte_mbuf **mbuf, int nb_mbuf)
 {
     /* rte_reorder_seqn_t a.k.a uint32_t */
     struct seq_state *mystate = (struct seq_state *)self->state;
-    uint32_t *seqn = &(mystate->seqn);
+    uint16_t flow;
 
     for(int i=0; i<nb_mbuf; i++){
-        /* assign seq num for the packet */
-        *rte_reorder_seqn(mbuf[i]) = *seqn;
-        
-        *seqn = *seqn + 1;
+        if(unlikely(mystate->nb_bypass) && seq_bypass(mystate, mbuf[i])){
+            *seq_flow(mbuf[i]) = SEQ_FLOW_UNORDERED;
+            continue;
+        }
+
+        /* assign seq num for the packet within its flow bucket */
+        flow = dispatch_flow_hash(mbuf[i]) & (SEQ_FLOW_BUCKETS - 1);
+        *seq_flow(mbuf[i]) = flow;
+        *rte_reorder_seqn(mbuf[i]) = mystate->seqn[flow]++;
     }
 
 
@@ -80,120 +183,282 @@ seq_exec(struct pipeline_stage *self, struct rte_mbuf **mbuf, int nb_mbuf)
 int
 reorder_init(struct pipeline_stage *self)
 {
+    /* every bucket has its own reorder buffer, all carved out of one allocation */
+    const unsigned int flow_size = RTE_ALIGN_CEIL(rte_reorder_memory_footprint_get(REORDER_FLOW_WINDOW),
+        RTE_CACHE_LINE_SIZE);
+    struct pipeline *pl = (struct pipeline *)self->pl;
+    struct rte_reorder_buffer *b;
+    uint64_t hold_cycles;
+    char name[32];
+
     /* allocate space for pipeline state */
-    self->state = (struct reorder_state *)malloc(sizeof(struct reorder_state));
+    self->state = (struct reorder_state *)calloc(1, sizeof(struct reorder_state));
     struct reorder_state *mystate = (struct reorder_state *)self->state;
     if(!mystate){
         return -ENOMEM;
     }
-    
+
     self->batch_size = REORDER_DEFAULT_BATCH_SIZE;
-    mystate->reorder_buf = rte_reorder_create("PKT_RO", rte_socket_id(),
-				REORDER_BUFFER_SIZE);
-    
-    rte_reorder_min_seqn_set(mystate->reorder_buf, SEQ_NUM_START);
 
-    mystate->last_seq_nb = SEQ_NUM_START-1;
-    mystate->nb_staged_buf = 0;
-    // mystate->verify = true;
+    mystate->flow_mem = rte_zmalloc_socket("PKT_RO", (size_t)flow_size * SEQ_FLOW_BUCKETS, RTE_CACHE_LINE_SIZE,
+        rte_socket_id());
+    if(!mystate->flow_mem){
+        free(mystate);
+        self->state = NULL;
+        return -ENOMEM;
+    }
+
+    /* a gap is skipped once packets behind it waited this long */
+    hold_cycles = (rte_get_timer_hz() / 1000000) * pl->conf.reorder_hold_us;
+
+    for(int f=0; f<SEQ_FLOW_BUCKETS; f++){
+        snprintf(name, sizeof(name), "PKT_RO_%d", f);
+        b = RTE_PTR_ADD(mystate->flow_mem, (size_t)flow_size * f);
+        mystate->flows[f] = rte_reorder_init(b, flow_size, name, REORDER_FLOW_WINDOW);
+        if(!mystate->flows[f]){
+            goto err;
+        }
+        rte_reorder_min_seqn_set(mystate->flows[f], SEQ_NUM_START);
+        rte_reorder_hold_set(mystate->flows[f], hold_cycles);
+    }
+
+    if(pl->conf.reorder){
+        mystate->tombstones = rte_ring_create("PKT_RO_TOMBSTONES", REORDER_TOMBSTONE_RING_SIZE, rte_socket_id(),
+            RING_F_SC_DEQ);
+        if(!mystate->tombstones){
+            MEILI_LOG_ERR("Failed to create reorder tombstone ring, rte_errno: %i", rte_errno);
+            goto err;
+        }
+    }
 
     return 0;
+
+err:
+    rte_free(mystate->flow_mem);
+    free(mystate);
+    self->state = NULL;
+    return -ENOMEM;
 }
 
 int
 reorder_free(struct pipeline_stage *self)
 {
     struct reorder_state *mystate = (struct reorder_state *)self->state;
-    //free(mystate->reorder_buf);
+
+    if(!mystate){
+        return 0;
+    }
+
+    /* frees the packets still held back */
+    for(int f=0; f<SEQ_FLOW_BUCKETS; f++){
+        rte_reorder_reset(mystate->flows[f]);
+    }
+    rte_ring_free(mystate->tombstones);
+    rte_free(mystate->flow_mem);
     free(mystate);
-    
+
     return 0;
 }
 
+static inline void
+reorder_mark_pending(struct reorder_state *mystate, uint16_t flow)
+{
+    if(mystate->is_pending[flow]){
+        return;
+    }
+    mystate->is_pending[flow] = true;
+    mystate->pending[(mystate->pending_head + mystate->nb_pending++) & (SEQ_FLOW_BUCKETS - 1)] = flow;
+}
+
+/* Stages dropping packets after sequencing give their seq nums up, so their bucket does not wait for them.
+ * Any lcore, call it before the packets are freed.
+ */
+void
+reorder_tombstone(struct pipeline *pl, struct rte_mbuf **mbufs, int nb_pkts)
+{
+    struct reorder_state *mystate = (struct reorder_state *)pl->reorder_stage.state;
+    void *objs[REORDER_TOMBSTONE_BURST];
+    unsigned int nb_enq;
+    int nb_obj = 0;
+    uint16_t flow;
+
+    if(!mystate || !mystate->tombstones){
+        return;
+    }
+
+    for(int i=0; i<nb_pkts; i++){
+        flow = *seq_flow(mbufs[i]);
+        if(flow != SEQ_FLOW_UNORDERED){
+            objs[nb_obj++] = (void *)(((uintptr_t)flow << 32) | *rte_reorder_seqn(mbufs[i]));
+        }
+        if(nb_obj == REORDER_TOMBSTONE_BURST || (i == nb_pkts - 1 && nb_obj)){
+            nb_enq = rte_ring_enqueue_burst(mystate->tombstones, objs, nb_obj, NULL);
+            if(nb_enq < (unsigned int)nb_obj){
+                __atomic_fetch_add(&mystate->tombstone_lost_cnt, nb_obj - nb_enq, __ATOMIC_RELAXED);
+            }
+            nb_obj = 0;
+        }
+    }
+}
+
+/* Same for a seq num whose packet is not at hand, e.g. one a peer instance never returned */
+void
+reorder_tombstone_seqn(struct pipeline *pl, uint16_t flow, uint32_t seqn)
+{
+    struct reorder_state *mystate = (struct reorder_state *)pl->reorder_stage.state;
+
+    if(!mystate || !mystate->tombstones || flow == SEQ_FLOW_UNORDERED){
+        return;
+    }
+    if(rte_ring_enqueue(mystate->tombstones, (void *)(((uintptr_t)flow << 32) | seqn))){
+        __atomic_fetch_add(&mystate->tombstone_lost_cnt, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* Apply the tombstones posted since the last call, main core only */
+static inline void
+reorder_tombstone_apply(struct reorder_state *mystate)
+{
+    void *objs[REORDER_TOMBSTONE_BURST];
+    unsigned int nb_deq;
+    uintptr_t obj;
+    uint16_t flow;
+
+    if(!mystate->tombstones){
+        return;
+    }
+
+    while((nb_deq = rte_ring_dequeue_burst(mystate->tombstones, objs, REORDER_TOMBSTONE_BURST, NULL)) > 0){
+        for(unsigned int i=0; i<nb_deq; i++){
+            obj = (uintptr_t)objs[i];
+            flow = (obj >> 32) & (SEQ_FLOW_BUCKETS - 1);
+            /* seq nums the bucket already skipped fail, nothing to release then */
+            if(rte_reorder_tombstone(mystate->flows[flow], (uint32_t)obj) == 0){
+                reorder_mark_pending(mystate, flow);
+            }
+        }
+    }
+}
+
+/* In-order packets of some bucket are waiting to be released, the caller should not go idle */
+bool
+reorder_pending(struct pipeline_stage *self)
+{
+    struct reorder_state *mystate = (struct reorder_state *)self->state;
+
+    return mystate->nb_pending > 0;
+}
+
+/* Insert a burst and release in-order packets bucket by bucket, so a missing packet only holds back
+ * its own bucket. Packets that skip reordering are released right away.
+ * At most self->batch_size in-order packets are released per call, buckets with more left are released
+ * first on the next call. mbuf_drain must have room for nb_mbuf + self->batch_size packets.
+ */
 int
 reorder_exec(struct pipeline_stage *self, struct rte_mbuf **mbuf, int nb_mbuf, struct rte_mbuf **mbuf_drain, int *nb_deq)
 {
     int ret;
     int dret;
     int batch_size = self->batch_size;
-
-    int seq_num;
+    int nb_out = 0;
+    uint32_t nb_visit;
+    uint16_t flow;
 
     struct reorder_state *mystate = (struct reorder_state *)self->state;
 
+    reorder_tombstone_apply(mystate);
 
     for(int i=0 ; i<nb_mbuf; i++){
-        seq_num = *rte_reorder_seqn(mbuf[i]);
-        ret = rte_reorder_insert(mystate->reorder_buf, mbuf[i]);
-        if (unlikely(ret == -1 && rte_errno == ERANGE)) {
-            /* Too early pkts should be transmitted out directly */
-
-            printf("%s():Cannot reorder early packet, seq=%d\n", __func__, *rte_reorder_seqn(mbuf[i]));
-        } else if (unlikely(ret == -1 && rte_errno == ENOSPC)) {
-            /**
-                * Early pkts just outside of window should be dropped
-                */
-            printf("%s():No space in reorder buffer, seq=%d\n", __func__,*rte_reorder_seqn(mbuf[i]));
-
-        }
-        // debug 
-        // else if(*rte_reorder_seqn(mbuf[i]) < 512){
-        //     //printf("%s():Succesfully insert mbuf into reorder buf, seq=%d\n", __func__,*rte_reorder_seqn(mbuf[i]));
-        //     ;
-        // }
-    }
-        
-        // debug 
-        // printf("tot_enq %d\n",tot_enq);
-        // printf("nb_mbuf %d\n",nb_mbuf);
-        //printf("dret %d\n",dret);
-    
-    //mystate->nb_staged_buf += nb_mbuf;
-    
+        flow = *seq_flow(mbuf[i]);
+        if(flow == SEQ_FLOW_UNORDERED){
+            mystate->unordered_cnt++;
+            mbuf_drain[nb_out++] = mbuf[i];
+            continue;
+        }
+
+        ret = rte_reorder_insert(mystate->flows[flow], mbuf[i]);
+        if (unlikely(ret == -1)) {
+            /* late, or too early for the window of its bucket: transmitted out directly */
+            mystate->outside_cnt++;
+            mbuf_drain[nb_out++] = mbuf[i];
+            continue;
+        }
+        reorder_mark_pending(mystate, flow);
+    }
+
     /*
     * drain batch_size of reordered mbufs to leave pipeline processing
+    * buckets blocked on a gap go to the back of the line until it fills or times out
     */
-    
-    dret = rte_reorder_drain(mystate->reorder_buf, mbuf_drain, batch_size);
-    *nb_deq = dret;
+    nb_visit = mystate->nb_pending;
+    while(nb_visit-- && batch_size > 0){
+        flow = mystate->pending[mystate->pending_head];
+        dret = rte_reorder_drain(mystate->flows[flow], &mbuf_drain[nb_out], batch_size);
+        #ifdef REORDER_VERIFY_ON
+        reorder_verify(self, &mbuf_drain[nb_out], dret);
+        #endif
+        nb_out += dret;
+        batch_size -= dret;
+        /* the bucket may have more, it stays first in line */
+        if(!batch_size){
+            break;
+        }
+        mystate->pending_head = (mystate->pending_head + 1) & (SEQ_FLOW_BUCKETS - 1);
+        if(rte_reorder_held_count(mystate->flows[flow])){
+            mystate->pending[(mystate->pending_head + mystate->nb_pending - 1) & (SEQ_FLOW_BUCKETS - 1)] = flow;
+            continue;
+        }
+        mystate->is_pending[flow] = false;
+        mystate->nb_pending--;
+    }
 
-    // debug
-    // if(nb_mbuf>0 && *rte_reorder_seqn(mbuf[0]) < 1024){
-    // //if(nb_mbuf>0){
-    //     printf("dret = %d\n",dret);
-    // }
-    //printf("dret = %d\n",dret);
-
-    #ifdef REORDER_VERIFY_ON
-    reorder_verify(self, mbuf_drain, dret);
-    #endif
+    *nb_deq = nb_out;
 
     return 0;
 }
 
-
-int reorder_verify(struct pipeline_stage *self, struct rte_mbuf **mbuf, int nb_mbuf){
-    
+void
+reorder_stats_print(struct pipeline_stage *self)
+{
     struct reorder_state *mystate = (struct reorder_state *)self->state;
+    uint64_t timeout_cnt = 0;
+    uint64_t tombstone_cnt = 0;
+    uint64_t cnt[2];
 
-
-    if(nb_mbuf == 0){
-        return 0;
+    if(!mystate){
+        return;
     }
 
-    if((*rte_reorder_seqn(mbuf[0])) != mystate->last_seq_nb+1){
-        MEILI_LOG_ERR("Error seq order, seq_num=%d, %d", mystate->last_seq_nb,*rte_reorder_seqn(mbuf[0]));
+    for(int f=0; f<SEQ_FLOW_BUCKETS; f++){
+        rte_reorder_gap_stats_get(mystate->flows[f], &cnt[0], &cnt[1]);
+        timeout_cnt += cnt[0];
+        tombstone_cnt += cnt[1];
     }
 
-    for(int i=1; i<nb_mbuf; i++){
-        if((*rte_reorder_seqn(mbuf[i-1])+1) != *rte_reorder_seqn(mbuf[i])){
-            MEILI_LOG_ERR("Error seq order, seq_num=%d, %d", *rte_reorder_seqn(mbuf[i-1]),*rte_reorder_seqn(mbuf[i]));
-        }  
-    }		
-    
-    mystate->last_seq_nb = *rte_reorder_seqn(mbuf[nb_mbuf-1]);
-
-    return 0;
+    printf("%16s %16s %16s %16s %16s %16s\n", "Reorder buckets", "Unordered", "Outside window", "Gaps timed out",
+        "Tombstones", "Tombstones lost");
+    printf("%16d %16lu %16lu %16lu %16lu %16lu\n", SEQ_FLOW_BUCKETS, mystate->unordered_cnt, mystate->outside_cnt,
+        timeout_cnt, tombstone_cnt, mystate->tombstone_lost_cnt);
 }
 
 
+/* Packets released from one bucket must carry consecutive seq nums of that bucket */
+int reorder_verify(struct pipeline_stage *self, struct rte_mbuf **mbuf, int nb_mbuf){
+
+    #ifdef REORDER_VERIFY_ON
+    struct reorder_state *mystate = (struct reorder_state *)self->state;
+    uint16_t flow;
+
+    for(int i=0; i<nb_mbuf; i++){
+        flow = *seq_flow(mbuf[i]);
+        if(mystate->seen[flow] && (mystate->last_seq_nb[flow]+1) != *rte_reorder_seqn(mbuf[i])){
+            MEILI_LOG_ERR("Error seq order in flow %u, seq_num=%u, %u", flow, mystate->last_seq_nb[flow],
+                *rte_reorder_seqn(mbuf[i]));
+        }
+        mystate->last_seq_nb[flow] = *rte_reorder_seqn(mbuf[i]);
+        mystate->seen[flow] = true;
+    }
+    #endif
+
+    return 0;
+}
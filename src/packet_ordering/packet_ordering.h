@@ -6,6 +6,8 @@
 #include "../runtime/meili_runtime.h"
 #include <stdint.h>
 #include <rte_mbuf.h>
+#include <rte_mbuf_dyn.h>
+#include <rte_ring.h>
 #include "../utils/rte_reorder/rte_reorder.h"
 
 /* packet sequencing/reordering are two special type of pipeline stage object 
@@ -15,33 +17,79 @@
 
 #define SEQUENCE_DEFAULT_BATCH_SIZE 64
 
-#define REORDER_BUFFER_SIZE (1 << 16)
 #define REORDER_DEFAULT_BATCH_SIZE 64
 
 #define SEQ_NUM_START 0
 
+/* packets are numbered and reordered per flow hash bucket, a gap only holds back its own bucket */
+#define SEQ_FLOW_BUCKETS 1024           /* power of 2 */
+#define SEQ_FLOW_UNORDERED 0xffff       /* flow id of packets that skip reordering */
+#define REORDER_FLOW_WINDOW 128         /* packets held back per bucket, power of 2 */
+#define REORDER_BYPASS_MAX 8
+
+/* seq nums of packets dropped after sequencing, posted by any lcore and applied by the main core */
+#define REORDER_TOMBSTONE_RING_SIZE 16384
+#define REORDER_TOMBSTONE_BURST 64
+
 //#define REORDER_VERIFY_ON
 
+extern int seq_flow_dynfield_offset;
+
+/* Flow bucket of a packet, set by seq_exec */
+static inline uint16_t *
+seq_flow(struct rte_mbuf *mbuf)
+{
+    return RTE_MBUF_DYNFIELD(mbuf, seq_flow_dynfield_offset, uint16_t *);
+}
+
+/* Traffic with no ordering requirement, port 0 matches any destination port */
+struct reorder_bypass{
+    uint8_t proto;
+    uint16_t port;              /* network order */
+};
+
 struct seq_state{
-    uint32_t seqn; 
+    uint32_t seqn[SEQ_FLOW_BUCKETS];
+    struct reorder_bypass bypass[REORDER_BYPASS_MAX];
+    int nb_bypass;
 };
 
 struct reorder_state{
-    struct rte_reorder_buffer* reorder_buf;
-    uint32_t nb_staged_buf;
-    uint32_t last_seq_nb;
-    uint32_t missing_mbuf;
-    bool verify;
+    struct rte_reorder_buffer *flows[SEQ_FLOW_BUCKETS];
+    void *flow_mem;
+
+    /* buckets that may hold in-order packets not released yet, in arrival order */
+    uint16_t pending[SEQ_FLOW_BUCKETS];
+    bool is_pending[SEQ_FLOW_BUCKETS];
+    uint32_t pending_head;
+    uint32_t nb_pending;
+
+    /* NULL unless reordering is on */
+    struct rte_ring *tombstones;
+
+    uint64_t unordered_cnt;     /* released without reordering */
+    uint64_t outside_cnt;       /* outside the window of their bucket, released as they came */
+    uint64_t tombstone_lost_cnt;    /* ring full, the bucket waits out the hold time instead */
+
+    #ifdef REORDER_VERIFY_ON
+    uint32_t last_seq_nb[SEQ_FLOW_BUCKETS];
+    bool seen[SEQ_FLOW_BUCKETS];
+    #endif
 };
 
 
 int seq_exec(struct pipeline_stage *self, struct rte_mbuf **mbuf, int nb_mbuf);
 int seq_free(struct pipeline_stage *self);
 int seq_init(struct pipeline_stage *self);
+int seq_set_bypass(struct pipeline_stage *self, const char *bypass_str);
 
 int reorder_exec(struct pipeline_stage *self, struct rte_mbuf **mbuf, int nb_mbuf, struct rte_mbuf **mbuf_out, int *nb_deq);
 int reorder_init(struct pipeline_stage *self);
 int reorder_free(struct pipeline_stage *self);
+bool reorder_pending(struct pipeline_stage *self);
+void reorder_tombstone(struct pipeline *pl, struct rte_mbuf **mbufs, int nb_pkts);
+void reorder_tombstone_seqn(struct pipeline *pl, uint16_t flow, uint32_t seqn);
+void reorder_stats_print(struct pipeline_stage *self);
 
 int reorder_verify(struct pipeline_stage *self, struct rte_mbuf **mbuf, int nb_mbuf);
 
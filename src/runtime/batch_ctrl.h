@@ -0,0 +1,83 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_BATCH_CTRL_H
+#define _INCLUDE_BATCH_CTRL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <rte_common.h>
+#include <rte_cycles.h>
+
+/* # of batches between two decisions of the controller */
+#define BATCH_CTRL_PERIOD 64
+
+/* Runtime batch size controller.
+ * Every BATCH_CTRL_PERIOD batches it compares the average per-batch processing time with the latency target:
+ *  - above target: halve the batch size
+ *  - below target with packets left behind in most batches: double it, if the predicted batch time stays under target
+ *  - nothing left behind: shrink slowly, so a burst after an idle period is not handled as one huge batch
+ */
+struct batch_ctrl {
+    bool enabled;
+    uint32_t size;              /* current batch size */
+    uint32_t min_size;
+    uint32_t max_size;
+    uint64_t target_cycles;     /* per-batch latency target */
+
+    /* counters of the running period */
+    uint64_t tot_cycles;
+    uint32_t nb_batches;
+    uint32_t nb_backlogged;
+};
+
+/* target_us == 0 keeps the batch size fixed at init_size */
+static inline void
+batch_ctrl_init(struct batch_ctrl *ctrl, uint32_t init_size, uint32_t max_size, uint32_t target_us)
+{
+    ctrl->enabled = target_us != 0;
+    ctrl->size = RTE_MIN(init_size, max_size);
+    ctrl->min_size = 1;
+    ctrl->max_size = max_size;
+    ctrl->target_cycles = (rte_get_timer_hz() / 1000000) * target_us;
+    ctrl->tot_cycles = 0;
+    ctrl->nb_batches = 0;
+    ctrl->nb_backlogged = 0;
+}
+
+/* Record one batch that took cycles to process and left backlog packets waiting. Returns the batch size to use next. */
+static inline uint32_t
+batch_ctrl_update(struct batch_ctrl *ctrl, uint64_t cycles, uint32_t backlog)
+{
+    uint64_t avg_cycles;
+    uint32_t size;
+
+    ctrl->tot_cycles += cycles;
+    ctrl->nb_batches++;
+    if (backlog >= ctrl->size)
+        ctrl->nb_backlogged++;
+
+    if (ctrl->nb_batches < BATCH_CTRL_PERIOD)
+        return ctrl->size;
+
+    avg_cycles = ctrl->tot_cycles / ctrl->nb_batches;
+    size = ctrl->size;
+
+    if (avg_cycles > ctrl->target_cycles) {
+        size = RTE_MAX(size / 2, ctrl->min_size);
+    } else if (ctrl->nb_backlogged > ctrl->nb_batches / 2) {
+        if (avg_cycles * 2 <= ctrl->target_cycles)
+            size = RTE_MIN(size * 2, ctrl->max_size);
+    } else if (!ctrl->nb_backlogged) {
+        size = RTE_MAX(size - size / 4, ctrl->min_size);
+    }
+
+    ctrl->size = size;
+    ctrl->tot_cycles = 0;
+    ctrl->nb_batches = 0;
+    ctrl->nb_backlogged = 0;
+
+    return size;
+}
+
+#endif /* _INCLUDE_BATCH_CTRL_H */
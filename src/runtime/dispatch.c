@@ -0,0 +1,507 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rte_malloc.h>
+
+#include "dispatch.h"
+#include "run_mode.h"
+#include "../packet_ordering/packet_ordering.h"
+#include "../utils/str/str_helpers.h"
+
+/* Fill the indirection table by repeating a comma separated list of head ring indexes */
+static int
+dispatch_reta_parse(struct pipeline_dispatch *dispatch, char *reta_str)
+{
+    uint16_t entries[DISPATCH_RETA_SIZE];
+    int nb_entries = 0;
+    char *saveptr;
+    char *str;
+    char *tok;
+    long val;
+    int ret = 0;
+
+    str = strdup(reta_str);
+    if (!str) {
+        MEILI_LOG_ERR("Memory failure parsing dispatch reta.");
+        return -ENOMEM;
+    }
+
+    for (tok = strtok_r(str, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr)) {
+        tok = util_trim_whitespace(tok);
+        if (util_str_to_dec(tok, &val, 2) || val >= dispatch->nb_ring) {
+            MEILI_LOG_ERR("Invalid dispatch reta entry %s, %d head ring(s) available.", tok, dispatch->nb_ring);
+            ret = -EINVAL;
+            goto out;
+        }
+        if (nb_entries >= DISPATCH_RETA_SIZE) {
+            MEILI_LOG_ERR("Dispatch reta has more than %d entries.", DISPATCH_RETA_SIZE);
+            ret = -EINVAL;
+            goto out;
+        }
+        entries[nb_entries++] = val;
+    }
+
+    if (!nb_entries) {
+        MEILI_LOG_ERR("Empty dispatch reta.");
+        ret = -EINVAL;
+        goto out;
+    }
+
+    for (int i = 0; i < DISPATCH_RETA_SIZE; i++)
+        dispatch->reta[i] = entries[i % nb_entries];
+
+out:
+    free(str);
+
+    return ret;
+}
+
+/* Default indirection: spread buckets evenly over nb_ring head rings */
+static void
+dispatch_reta_spread(struct pipeline_dispatch *dispatch, int nb_ring)
+{
+    for (int i = 0; i < DISPATCH_RETA_SIZE; i++)
+        dispatch->reta[i] = i % nb_ring;
+}
+
+int
+dispatch_init(struct pipeline *pl)
+{
+    struct pipeline_dispatch *dispatch;
+    pl_conf *run_conf = &pl->conf;
+    int ret;
+
+    dispatch = rte_zmalloc(NULL, sizeof(*dispatch), RTE_CACHE_LINE_SIZE);
+    if (!dispatch) {
+        MEILI_LOG_ERR("Memory failure allocating dispatcher.");
+        return -ENOMEM;
+    }
+
+    dispatch->mode = run_conf->dispatch_mode;
+    #ifdef SHARED_BUFFER
+    dispatch->rings = &pl->ring_in;
+    dispatch->nb_ring = 1;
+    dispatch->wake[0] = NULL;
+    #else
+    dispatch->rings = pl->ring_in;
+    dispatch->nb_ring = pl->nb_ring_in;
+    for (int i = 0; i < dispatch->nb_ring; i++)
+        dispatch->wake[i] = pl->ring_in_consumer[i] ? &pl->ring_in_consumer[i]->idle : NULL;
+    #endif
+    dispatch->rr_index = 0;
+
+    dispatch_reta_spread(dispatch, dispatch->nb_ring);
+
+    if (dispatch->mode == DISPATCH_FLOW_HASH && run_conf->dispatch_reta) {
+        /* reta entries are head ring indexes, tenants each spread flows over their own rings */
+        if (pl->nb_tenants > 1) {
+            MEILI_LOG_ERR("--dispatch-reta is not supported with several tenants.");
+            rte_free(dispatch);
+            return -EINVAL;
+        }
+        ret = dispatch_reta_parse(dispatch, run_conf->dispatch_reta);
+        if (ret) {
+            rte_free(dispatch);
+            return ret;
+        }
+    }
+
+    for (int i = 0; i < NB_MAX_RING; i++)
+        dispatch->ring_all[i] = i;
+
+    for (int i = 0; i < dispatch->nb_ring; i++)
+        rate_limit_init_conf(&dispatch->limit[i], run_conf, RATE_SCOPE_RING);
+
+    dispatch->tenants = NULL;
+    dispatch->nb_tenants = pl->nb_tenants;
+    if (pl->nb_tenants > 1) {
+        dispatch->tenants = rte_zmalloc(NULL, sizeof(struct dispatch_tenant) * pl->nb_tenants, RTE_CACHE_LINE_SIZE);
+        if (!dispatch->tenants) {
+            MEILI_LOG_ERR("Memory failure allocating tenant queues.");
+            rte_free(dispatch);
+            return -ENOMEM;
+        }
+        for (int t = 0; t < pl->nb_tenants; t++)
+            dispatch->tenants[t].quantum = pl->tenants[t].weight * DISPATCH_DRR_QUANTUM;
+    }
+
+    pl->dispatch = dispatch;
+
+    MEILI_LOG_INFO("Dispatching to %d head ring(s) of %d tenant(s) in %s mode", dispatch->nb_ring,
+        pl->nb_tenants, dispatch->mode == DISPATCH_FLOW_HASH ? "flow" : "round-robin");
+
+    return 0;
+}
+
+#ifndef SHARED_BUFFER
+/* Head ring of an instance added at runtime.
+ * The ring is filled in before it is counted, the main core sees either the old or the new set of rings.
+ * Flows are spread again over all rings, a --dispatch-reta is not kept.
+ */
+int
+dispatch_ring_add(struct pipeline *pl, struct rte_ring *ring, struct pipeline_stage *consumer)
+{
+    struct pipeline_dispatch *dispatch = pl->dispatch;
+    int idx = dispatch->nb_ring;
+
+    if (idx >= NB_MAX_RING)
+        return -ENOSPC;
+
+    pl->ring_in[idx] = ring;
+    pl->ring_in_consumer[idx] = consumer;
+    dispatch->wake[idx] = &consumer->idle;
+    rate_limit_init_conf(&dispatch->limit[idx], &pl->conf, RATE_SCOPE_RING);
+    __atomic_store_n(&pl->nb_ring_in, idx + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&dispatch->nb_ring, idx + 1, __ATOMIC_RELEASE);
+
+    dispatch_reta_spread(dispatch, idx + 1);
+
+    return 0;
+}
+
+/* Stop dispatching to head ring idx, the last ring takes its slot.
+ * The main core may still hold the ring until its next quiescent state.
+ */
+void
+dispatch_ring_remove(struct pipeline *pl, int idx)
+{
+    struct pipeline_dispatch *dispatch = pl->dispatch;
+    int last = dispatch->nb_ring - 1;
+
+    /* no bucket may point at a slot that goes away */
+    dispatch_reta_spread(dispatch, last);
+
+    pl->ring_in[idx] = pl->ring_in[last];
+    pl->ring_in_consumer[idx] = pl->ring_in_consumer[last];
+    dispatch->wake[idx] = dispatch->wake[last];
+    dispatch->limit[idx] = dispatch->limit[last];
+    __atomic_store_n(&pl->nb_ring_in, last, __ATOMIC_RELEASE);
+    __atomic_store_n(&dispatch->nb_ring, last, __ATOMIC_RELEASE);
+}
+#endif
+
+void
+dispatch_free(struct pipeline *pl)
+{
+    struct pipeline_dispatch *dispatch = pl->dispatch;
+    struct dispatch_tenant *tq;
+
+    if (!dispatch)
+        return;
+
+    for (int t = 0; dispatch->tenants && t < dispatch->nb_tenants; t++) {
+        tq = &dispatch->tenants[t];
+        for (; tq->head != tq->tail; tq->head++)
+            rte_pktmbuf_free(tq->queue[tq->head & (DISPATCH_TENANT_QUEUE_SIZE - 1)]);
+    }
+    rte_free(dispatch->tenants);
+    rte_free(dispatch);
+    pl->dispatch = NULL;
+}
+
+/* Enqueue as much of a burst to a ring as it and its limiter take now.
+ * Returns the # of packets enqueued.
+ */
+static inline int
+dispatch_ring_enqueue(struct rte_ring *ring, struct rate_limiter *limit, struct idle_ctrl *wake,
+    struct rte_mbuf **mbufs, int nb_pkts)
+{
+    uint32_t budget;
+    int nb_enq;
+
+    budget = rate_limit_budget(limit, nb_pkts);
+    nb_enq = budget ? rte_ring_enqueue_burst(ring, (void *)mbufs, budget, NULL) : 0;
+    rate_limit_consume(limit, mbufs, nb_enq);
+    if (nb_enq)
+        idle_doorbell(wake);
+
+    return nb_enq;
+}
+
+/* Hand a burst to the head rings ids[0..nb_ids).
+ * Round-robin mode puts the whole burst on the next ring of the set.
+ * Flow mode regroups the burst so each flow always reaches the same ring.
+ * With wait, rings are retried in turn until the burst is in, so a full or rate limited ring
+ * is skipped for the round instead of holding up the others: round-robin moves on to the next ring
+ * with the rest of the burst, flow mode fills the other groups first.
+ * Packets that are not enqueued are moved to the front of mbufs, in arrival order.
+ * Returns the # of packets enqueued.
+ */
+static int
+dispatch_rings(struct pipeline_dispatch *dispatch, const int *ids, int nb_ids, int *rr_index,
+    struct rte_mbuf **mbufs, int nb_pkts, bool wait)
+{
+    int offset[NB_MAX_RING];
+    int nb_enq[NB_MAX_RING];
+    int tot_enq = 0;
+    int nb_left = 0;
+    int ring;
+    int idx;
+    int i;
+    int n;
+
+    /* head rings may have been added or removed, see scale.c */
+    if (unlikely(*rr_index >= nb_ids))
+        *rr_index = 0;
+
+    if (dispatch->mode != DISPATCH_FLOW_HASH || nb_ids == 1) {
+        do {
+            ring = ids[*rr_index];
+            tot_enq += dispatch_ring_enqueue(dispatch->rings[ring], &dispatch->limit[ring], dispatch->wake[ring],
+                &mbufs[tot_enq], nb_pkts - tot_enq);
+            *rr_index = (*rr_index + 1) % nb_ids;
+        } while (wait && tot_enq < nb_pkts && !force_quit);
+        if (tot_enq < nb_pkts)
+            memmove(mbufs, &mbufs[tot_enq], sizeof(*mbufs) * (nb_pkts - tot_enq));
+        return tot_enq;
+    }
+
+    /* counting sort by destination ring keeps per-flow arrival order */
+    memset(dispatch->nb_per_ring, 0, sizeof(int) * nb_ids);
+    for (i = 0; i < nb_pkts; i++) {
+        idx = dispatch->reta[dispatch_flow_hash(mbufs[i]) & (DISPATCH_RETA_SIZE - 1)];
+        if (unlikely(idx >= nb_ids))
+            idx %= nb_ids;
+        dispatch->ring_idx[i] = idx;
+        dispatch->nb_per_ring[idx]++;
+    }
+
+    offset[0] = 0;
+    for (idx = 1; idx < nb_ids; idx++)
+        offset[idx] = offset[idx-1] + dispatch->nb_per_ring[idx-1];
+
+    for (i = 0; i < nb_pkts; i++)
+        dispatch->sorted[offset[dispatch->ring_idx[i]]++] = mbufs[i];
+
+    /* offset[idx] now points at the end of ring idx's group */
+    memset(nb_enq, 0, sizeof(int) * nb_ids);
+    do {
+        for (idx = 0; idx < nb_ids; idx++) {
+            if (nb_enq[idx] == dispatch->nb_per_ring[idx])
+                continue;
+            ring = ids[idx];
+            n = dispatch_ring_enqueue(dispatch->rings[ring], &dispatch->limit[ring], dispatch->wake[ring],
+                &dispatch->sorted[offset[idx] - dispatch->nb_per_ring[idx] + nb_enq[idx]],
+                dispatch->nb_per_ring[idx] - nb_enq[idx]);
+            nb_enq[idx] += n;
+            tot_enq += n;
+        }
+    } while (wait && tot_enq < nb_pkts && !force_quit);
+
+    if (tot_enq == nb_pkts)
+        return tot_enq;
+
+    /* each ring took the head of its group, keep the rest */
+    for (i = 0; i < nb_pkts; i++) {
+        idx = dispatch->ring_idx[i];
+        if (nb_enq[idx])
+            nb_enq[idx]--;
+        else
+            mbufs[nb_left++] = mbufs[i];
+    }
+
+    return tot_enq;
+}
+
+/* One deficit round robin pass over the tenant queues.
+ * Each backlogged tenant may put weight * DISPATCH_DRR_QUANTUM bytes on its head rings per pass,
+ * so under contention the main core's dispatch is shared by weight. A tenant whose rings are full
+ * keeps its backlog and at most one quantum of deficit, the others are not held up by it.
+ * Returns the # of packets still queued.
+ */
+int
+dispatch_poll(struct pipeline *pl)
+{
+    struct pipeline_dispatch *dispatch = pl->dispatch;
+    struct rte_mbuf **burst = dispatch->drr_burst;
+    struct pipeline_stage *consumer;
+    struct dispatch_tenant *tq;
+    struct rte_mbuf *mbuf;
+    int ids[NB_TENANT_MAX][NB_MAX_RING];
+    int nb_ids[NB_TENANT_MAX] = {0};
+    uint32_t backlog;
+    uint32_t bytes;
+    int nb_ring;
+    int nb_enq;
+    int nb_left;
+    int remain = 0;
+    int n;
+
+    if (!dispatch->tenants)
+        return 0;
+
+    /* group head rings by tenant, instances may have been scaled since the last pass */
+    nb_ring = __atomic_load_n(&dispatch->nb_ring, __ATOMIC_ACQUIRE);
+    for (int r = 0; r < nb_ring; r++) {
+        consumer = pl->ring_in_consumer[r];
+        n = consumer ? consumer->tenant : 0;
+        ids[n][nb_ids[n]++] = r;
+    }
+
+    for (int t = 0; t < dispatch->nb_tenants; t++) {
+        tq = &dispatch->tenants[t];
+        backlog = tq->tail - tq->head;
+        if (!backlog) {
+            tq->deficit = 0;
+            continue;
+        }
+        remain += backlog;
+        if (!nb_ids[t])
+            continue;
+
+        tq->deficit += tq->quantum;
+        bytes = 0;
+        for (n = 0; n < (int)backlog && n < DISPATCH_DRR_BURST; n++) {
+            mbuf = tq->queue[(tq->head + n) & (DISPATCH_TENANT_QUEUE_SIZE - 1)];
+            if (bytes + mbuf->pkt_len > tq->deficit)
+                break;
+            bytes += mbuf->pkt_len;
+            burst[n] = mbuf;
+        }
+        /* packet larger than the deficit, it goes out after more passes */
+        if (!n)
+            continue;
+
+        nb_enq = dispatch_rings(dispatch, ids[t], nb_ids[t], &tq->rr_index, burst, n, false);
+        nb_left = n - nb_enq;
+        for (int i = 0; i < nb_left; i++)
+            bytes -= burst[i]->pkt_len;
+        tq->deficit -= bytes;
+        tq->tx_cnt += nb_enq;
+
+        /* what did not fit goes back in front of the rest of the backlog */
+        tq->head += nb_enq;
+        for (int i = 0; i < nb_left; i++)
+            tq->queue[(tq->head + i) & (DISPATCH_TENANT_QUEUE_SIZE - 1)] = burst[i];
+
+        remain -= nb_enq;
+        if (tq->head == tq->tail)
+            tq->deficit = 0;
+        else if (tq->deficit > tq->quantum)
+            tq->deficit = tq->quantum;
+    }
+
+    return remain;
+}
+
+/* Classify a burst into the tenant queues and run a scheduling pass.
+ * Packets no tenant takes, or whose tenant queue is full, are freed.
+ * Returns the # of packets kept.
+ */
+static int
+dispatch_tenant_enqueue(struct pipeline *pl, struct rte_mbuf **mbufs, int nb_pkts)
+{
+    struct pipeline_dispatch *dispatch = pl->dispatch;
+    struct dispatch_tenant *tq;
+    int nb_drop = 0;
+    int t;
+
+    for (int i = 0; i < nb_pkts; i++) {
+        t = tenant_classify(pl, mbufs[i]);
+        if (t < 0) {
+            dispatch->unmatched_cnt++;
+            mbufs[nb_drop++] = mbufs[i];
+            continue;
+        }
+        tq = &dispatch->tenants[t];
+        tq->rx_cnt++;
+        if (tq->tail - tq->head >= DISPATCH_TENANT_QUEUE_SIZE) {
+            tq->drop_cnt++;
+            mbufs[nb_drop++] = mbufs[i];
+            continue;
+        }
+        tq->queue[tq->tail++ & (DISPATCH_TENANT_QUEUE_SIZE - 1)] = mbufs[i];
+    }
+
+    if (nb_drop) {
+        reorder_tombstone(pl, mbufs, nb_drop);
+        rte_pktmbuf_free_bulk(mbufs, nb_drop);
+        pipeline_credit_return(pl, nb_drop);
+    }
+
+    dispatch_poll(pl);
+
+    return nb_pkts - nb_drop;
+}
+
+/* Hand a burst to the first pipeline stages.
+ * With a single tenant the burst goes straight to the head rings, waiting for room until quit.
+ * Several tenants are first classified into their own queues, see dispatch_poll().
+ * Returns the # of packets kept, the rest are freed.
+ */
+int
+dispatch_enqueue(struct pipeline *pl, struct rte_mbuf **mbufs, int nb_pkts)
+{
+    struct pipeline_dispatch *dispatch = pl->dispatch;
+    int nb_ring;
+    int nb_enq;
+
+    if (dispatch->tenants)
+        return dispatch_tenant_enqueue(pl, mbufs, nb_pkts);
+
+    nb_ring = __atomic_load_n(&dispatch->nb_ring, __ATOMIC_ACQUIRE);
+    nb_enq = dispatch_rings(dispatch, dispatch->ring_all, nb_ring, &dispatch->rr_index, mbufs, nb_pkts, true);
+
+    /* only on quit, what did not fit was moved to the front of mbufs */
+    if (unlikely(nb_enq < nb_pkts)) {
+        reorder_tombstone(pl, mbufs, nb_pkts - nb_enq);
+        rte_pktmbuf_free_bulk(mbufs, nb_pkts - nb_enq);
+        pipeline_credit_return(pl, nb_pkts - nb_enq);
+    }
+
+    return nb_enq;
+}
+
+/* Credit based admission at rx: admit as many packets as there are free credits and free the rest,
+ * so overload is shed before any pipeline work is spent on it.
+ */
+int
+dispatch_admit(struct pipeline *pl, struct rte_mbuf **mbufs, int nb_pkts)
+{
+    uint32_t nb_inflight;
+    int nb_admit;
+
+    if (!pl->credits)
+        return nb_pkts;
+
+    nb_inflight = __atomic_load_n(&pl->nb_inflight, __ATOMIC_RELAXED);
+    nb_admit = nb_inflight >= pl->credits ? 0 : RTE_MIN((uint32_t)nb_pkts, pl->credits - nb_inflight);
+    if (nb_admit < nb_pkts)
+        rte_pktmbuf_free_bulk(&mbufs[nb_admit], nb_pkts - nb_admit);
+
+    __atomic_fetch_add(&pl->nb_inflight, nb_admit, __ATOMIC_RELAXED);
+
+    return nb_admit;
+}
+
+/* Packets drained from the tail rings give their credits back */
+void
+dispatch_release(struct pipeline *pl, int nb_pkts)
+{
+    pipeline_credit_return(pl, nb_pkts);
+}
+
+/* Per tenant classifier and scheduler counters, only printed with several tenants */
+void
+dispatch_tenant_stats_print(struct pipeline *pl)
+{
+    struct pipeline_dispatch *dispatch = pl->dispatch;
+    struct dispatch_tenant *tq;
+
+    if (!dispatch || !dispatch->tenants)
+        return;
+
+    printf("%16s %16s %8s %16s %16s %16s %16s\n", "Tenant", "App", "Weight", "Received", "Dispatched",
+        "Dropped", "Queued");
+    for (int t = 0; t < dispatch->nb_tenants; t++) {
+        tq = &dispatch->tenants[t];
+        printf("%16s %16s %8u %16lu %16lu %16lu %16u\n", pl->tenants[t].name, pl->tenants[t].app->name,
+            pl->tenants[t].weight, tq->rx_cnt, tq->tx_cnt, tq->drop_cnt, tq->tail - tq->head);
+    }
+    if (dispatch->unmatched_cnt)
+        printf("%16s %16s %8s %16lu %16s %16lu %16s\n", "(unmatched)", "-", "-", dispatch->unmatched_cnt, "-",
+            dispatch->unmatched_cnt, "-");
+}
@@ -0,0 +1,94 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_DISPATCH_H
+#define _INCLUDE_DISPATCH_H
+
+#include <rte_ether.h>
+#include <rte_mbuf.h>
+#include <rte_ring.h>
+
+#include "pipeline.h"
+#include "rate_limit.h"
+#include "../lib/net/meili_flow.h"
+
+/* flow indirection table, power of 2 */
+#define DISPATCH_RETA_SIZE 512
+
+/* tenant scheduling, used when pl.conf has several tenants */
+#define DISPATCH_TENANT_QUEUE_SIZE 4096                 /* packets queued per tenant, power of 2 */
+#define DISPATCH_DRR_QUANTUM (16 * RTE_ETHER_MAX_LEN)   /* bytes per round of a weight 1 tenant */
+#define DISPATCH_DRR_BURST 512                          /* max packets a tenant sends per round */
+
+/* Packets classified to a tenant and not yet on its head rings, main core only */
+struct dispatch_tenant{
+    struct rte_mbuf *queue[DISPATCH_TENANT_QUEUE_SIZE];
+    uint32_t head;                          /* free running, masked on access */
+    uint32_t tail;
+    uint32_t quantum;                       /* weight * DISPATCH_DRR_QUANTUM */
+    uint32_t deficit;                       /* bytes the tenant may still send */
+    int rr_index;                           /* next of its head rings in round-robin mode */
+
+    uint64_t rx_cnt;                        /* packets classified to the tenant */
+    uint64_t tx_cnt;                        /* packets put on its head rings */
+    uint64_t drop_cnt;                      /* packets that found the queue full */
+};
+
+/* Distributes packets received by the main core over the head rings of the pipeline */
+struct pipeline_dispatch{
+    enum meili_dispatch_mode mode;
+
+    struct rte_ring **rings;                /* head rings, i.e. pl->ring_in */
+    int nb_ring;
+    int rr_index;                           /* next ring in round-robin mode */
+
+    /* flow mode: hash bucket -> head ring index */
+    uint16_t reta[DISPATCH_RETA_SIZE];
+
+    /* flow mode: burst regrouped per head ring */
+    struct rte_mbuf *sorted[MAX_PKTS_BURST];
+    uint16_t ring_idx[MAX_PKTS_BURST];
+    int nb_per_ring[NB_MAX_RING];
+
+    /* per head ring ingress limit, --rate-scope ring */
+    struct rate_limiter limit[NB_MAX_RING];
+
+    /* doorbell of the instance reading each head ring */
+    struct idle_ctrl *wake[NB_MAX_RING];
+
+    /* identity map, all head rings as one set */
+    int ring_all[NB_MAX_RING];
+
+    /* per tenant queues served by deficit round robin, NULL with a single tenant */
+    struct dispatch_tenant *tenants;
+    int nb_tenants;
+    uint64_t unmatched_cnt;                 /* packets no tenant takes */
+    struct rte_mbuf *drr_burst[DISPATCH_DRR_BURST];
+};
+
+/* Use the NIC RSS hash when present, otherwise hash the 5-tuple in software */
+static inline uint32_t
+dispatch_flow_hash(struct rte_mbuf *mbuf)
+{
+    struct ipv4_5tuple key;
+
+    if (mbuf->ol_flags & PKT_RX_RSS_HASH)
+        return mbuf->hash.rss;
+
+    /* non-ipv4 traffic all lands in bucket 0 */
+    if (flow_table_fill_key(&key, mbuf) < 0)
+        return 0;
+
+    return DEFAULT_HASH_FUNC(&key, sizeof(key), 0);
+}
+
+int dispatch_init(struct pipeline *pl);
+void dispatch_free(struct pipeline *pl);
+int dispatch_ring_add(struct pipeline *pl, struct rte_ring *ring, struct pipeline_stage *consumer);
+void dispatch_ring_remove(struct pipeline *pl, int idx);
+int dispatch_enqueue(struct pipeline *pl, struct rte_mbuf **mbufs, int nb_pkts);
+int dispatch_poll(struct pipeline *pl);
+void dispatch_tenant_stats_print(struct pipeline *pl);
+int dispatch_admit(struct pipeline *pl, struct rte_mbuf **mbufs, int nb_pkts);
+void dispatch_release(struct pipeline *pl, int nb_pkts);
+
+#endif /* _INCLUDE_DISPATCH_H */
@@ -0,0 +1,131 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#include <errno.h>
+#include <stdio.h>
+
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+
+#include "egress.h"
+#include "pipeline.h"
+#include "../lib/log/meili_log.h"
+#include "../utils/net/port_utils.h"
+
+/* Unsent packets of a flush with --egress retry: try a few more bursts, then drop */
+static void
+egress_retry_cb(struct rte_mbuf **unsent, uint16_t count, void *userdata)
+{
+    struct egress *eg = userdata;
+    uint16_t sent = 0;
+
+    for (int r = 0; r < EGRESS_RETRY_MAX && sent < count; r++) {
+        eg->retry_cnt++;
+        sent += rte_eth_tx_burst(eg->port_id, eg->queue_id, &unsent[sent], count - sent);
+    }
+    eg->tx_cnt += sent;
+
+    if (sent < count) {
+        rte_pktmbuf_free_bulk(&unsent[sent], count - sent);
+        eg->drop_cnt += count - sent;
+    }
+}
+
+/* Set up egress of worker qid on tx queue queue_id, on the NUMA node of the calling lcore.
+ * Packets leave on the second port if there is one, on the primary port otherwise.
+ * *egress is NULL with --egress off, processed packets are freed then.
+ */
+int
+egress_create(struct pipeline *pl, int qid, uint16_t queue_id, struct egress **egress)
+{
+    pl_conf *conf = &pl->conf;
+    const char *port_name = conf->port2 ? conf->port2 : conf->port1;
+    struct egress *eg;
+    int ret;
+
+    *egress = NULL;
+    if (conf->egress_mode == EGRESS_OFF)
+        return 0;
+
+    eg = rte_zmalloc_socket(NULL, sizeof(*eg), RTE_CACHE_LINE_SIZE, rte_socket_id());
+    if (!eg)
+        return -ENOMEM;
+
+    if (rte_eth_dev_get_port_by_name(port_name, &eg->port_id)) {
+        MEILI_LOG_ERR("Cannot find port %s.", port_name);
+        rte_free(eg);
+        return -EINVAL;
+    }
+    if (get_port_macaddr(eg->port_id, &eg->src_mac)) {
+        MEILI_LOG_ERR("Cannot get port %s eth addr.", port_name);
+        rte_free(eg);
+        return -EINVAL;
+    }
+    if (conf->next_hop_mac) {
+        rte_ether_unformat_addr(conf->next_hop_mac, &eg->dst_mac);
+        eg->rewrite_dst = true;
+    }
+    eg->queue_id = queue_id;
+    eg->flush_cycles = (rte_get_timer_hz() / 1000000) * conf->egress_flush_us;
+    eg->last_flush = rte_rdtsc();
+
+    eg->buf = rte_zmalloc_socket(NULL, RTE_ETH_TX_BUFFER_SIZE(EGRESS_BUF_SIZE), RTE_CACHE_LINE_SIZE, rte_socket_id());
+    if (!eg->buf) {
+        rte_free(eg);
+        return -ENOMEM;
+    }
+    rte_eth_tx_buffer_init(eg->buf, EGRESS_BUF_SIZE);
+    if (conf->egress_mode == EGRESS_RETRY)
+        ret = rte_eth_tx_buffer_set_err_callback(eg->buf, egress_retry_cb, eg);
+    else
+        ret = rte_eth_tx_buffer_set_err_callback(eg->buf, rte_eth_tx_buffer_count_callback, &eg->drop_cnt);
+    if (ret) {
+        rte_free(eg->buf);
+        rte_free(eg);
+        return ret;
+    }
+
+    pl->egress[qid] = eg;
+    *egress = eg;
+
+    return 0;
+}
+
+/* Send everything still buffered, when the loop owning the queue exits */
+void
+egress_flush(struct egress *eg)
+{
+    if (eg && eg->buf->length)
+        eg->tx_cnt += rte_eth_tx_buffer_flush(eg->port_id, eg->queue_id, eg->buf);
+}
+
+void
+egress_free(struct pipeline *pl)
+{
+    for (int q = 0; q < RTE_MAX_LCORE; q++) {
+        if (!pl->egress[q])
+            continue;
+        rte_free(pl->egress[q]->buf);
+        rte_free(pl->egress[q]);
+        pl->egress[q] = NULL;
+    }
+}
+
+void
+egress_stats_print(struct pipeline *pl)
+{
+    struct egress *eg;
+    bool header = false;
+
+    for (int q = 0; q < RTE_MAX_LCORE; q++) {
+        eg = pl->egress[q];
+        if (!eg)
+            continue;
+        if (!header) {
+            printf("%8s %8s %8s %16s %16s %16s\n", "Queue", "Port", "TxQ", "Sent", "Dropped", "Retries");
+            header = true;
+        }
+        printf("%8d %8u %8u %16lu %16lu %16lu\n", q, eg->port_id, eg->queue_id, eg->tx_cnt, eg->drop_cnt,
+            eg->retry_cnt);
+    }
+}
@@ -0,0 +1,64 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_EGRESS_H
+#define _INCLUDE_EGRESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <rte_ethdev.h>
+#include <rte_ether.h>
+#include <rte_mbuf.h>
+
+#define EGRESS_BUF_SIZE 32          /* packets buffered per tx queue before a tx burst goes out */
+#define EGRESS_RETRY_MAX 4          /* tx bursts tried on unsent packets with --egress retry */
+
+struct pipeline;
+
+/* Buffered transmission on one tx queue, owned by the loop polling that queue */
+struct egress {
+    uint16_t port_id;
+    uint16_t queue_id;
+    struct rte_ether_addr src_mac;
+    struct rte_ether_addr dst_mac;
+    bool rewrite_dst;               /* next hop known, packets keep their destination otherwise */
+    uint64_t flush_cycles;          /* longest time a packet waits in the buffer */
+    uint64_t last_flush;
+    uint64_t tx_cnt;
+    uint64_t drop_cnt;
+    uint64_t retry_cnt;
+    struct rte_eth_dev_tx_buffer *buf;
+} __rte_cache_aligned;
+
+int egress_create(struct pipeline *pl, int qid, uint16_t queue_id, struct egress **egress);
+void egress_flush(struct egress *eg);
+void egress_free(struct pipeline *pl);
+void egress_stats_print(struct pipeline *pl);
+
+/* Rewrite L2 and buffer a burst, full buffers go out right away */
+static inline void
+egress_send(struct egress *eg, struct rte_mbuf **mbufs, int nb_pkts)
+{
+    struct rte_ether_hdr *eth;
+
+    for (int i = 0; i < nb_pkts; i++) {
+        eth = rte_pktmbuf_mtod(mbufs[i], struct rte_ether_hdr *);
+        rte_ether_addr_copy(&eg->src_mac, &eth->s_addr);
+        if (eg->rewrite_dst)
+            rte_ether_addr_copy(&eg->dst_mac, &eth->d_addr);
+        eg->tx_cnt += rte_eth_tx_buffer(eg->port_id, eg->queue_id, eg->buf, mbufs[i]);
+    }
+}
+
+/* Send what has waited in the buffer for flush_cycles, call it on every loop iteration */
+static inline void
+egress_flush_timer(struct egress *eg, uint64_t now)
+{
+    if (now - eg->last_flush < eg->flush_cycles)
+        return;
+    eg->last_flush = now;
+    if (eg->buf->length)
+        eg->tx_cnt += rte_eth_tx_buffer_flush(eg->port_id, eg->queue_id, eg->buf);
+}
+
+#endif /* _INCLUDE_EGRESS_H */
@@ -0,0 +1,146 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_IDLE_H
+#define _INCLUDE_IDLE_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/select.h>
+
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_pause.h>
+
+/* empty polls spent in each level before backing off to the next one */
+#define IDLE_SPIN_POLLS 64
+#define IDLE_PAUSE_POLLS 1024
+
+/* Levels a polling loop backs off through while it finds no work, a loop stops at its configured level.
+ * The exit latency, i.e. how late work found while idle is picked up, is bounded by exit_us for
+ * IDLE_SLEEP and IDLE_WAKE, producers ring the doorbell of IDLE_WAKE consumers to cut it further.
+ */
+enum idle_level {
+    IDLE_SPIN,
+    IDLE_PAUSE,                 /* rte_pause between polls */
+    IDLE_SLEEP,                 /* sleep exit_us between polls */
+    IDLE_WAKE,                  /* block on an eventfd for at most exit_us */
+};
+
+struct idle_ctrl {
+    enum idle_level max_level;
+    uint32_t exit_us;
+    uint32_t nb_empty;          /* consecutive empty polls */
+    int efd;                    /* doorbell with IDLE_WAKE, -1 otherwise */
+    uint32_t sleeping;          /* set while blocked on efd */
+};
+
+static inline int
+idle_ctrl_init(struct idle_ctrl *ctrl, enum idle_level max_level, uint32_t exit_us)
+{
+    ctrl->max_level = max_level;
+    ctrl->exit_us = exit_us;
+    ctrl->nb_empty = 0;
+    ctrl->sleeping = 0;
+    ctrl->efd = -1;
+
+    if (max_level == IDLE_WAKE) {
+        ctrl->efd = eventfd(0, EFD_NONBLOCK);
+        if (ctrl->efd < 0)
+            return -errno;
+    }
+
+    return 0;
+}
+
+static inline void
+idle_ctrl_free(struct idle_ctrl *ctrl)
+{
+    if (ctrl->efd >= 0)
+        close(ctrl->efd);
+    ctrl->efd = -1;
+}
+
+/* Work found, go back to spinning */
+static inline void
+idle_ctrl_reset(struct idle_ctrl *ctrl)
+{
+    ctrl->nb_empty = 0;
+}
+
+/* Level to wait at after one more empty poll */
+static inline enum idle_level
+idle_ctrl_level(struct idle_ctrl *ctrl)
+{
+    enum idle_level level;
+
+    if (ctrl->nb_empty < IDLE_SPIN_POLLS + IDLE_PAUSE_POLLS)
+        ctrl->nb_empty++;
+
+    if (ctrl->nb_empty < IDLE_SPIN_POLLS)
+        level = IDLE_SPIN;
+    else if (ctrl->nb_empty < IDLE_SPIN_POLLS + IDLE_PAUSE_POLLS)
+        level = IDLE_PAUSE;
+    else
+        level = IDLE_WAKE;
+
+    return RTE_MIN(level, ctrl->max_level);
+}
+
+/* Wait at level, except IDLE_WAKE which needs idle_ctrl_arm and a recheck for work first */
+static inline void
+idle_ctrl_wait(struct idle_ctrl *ctrl, enum idle_level level)
+{
+    switch (level) {
+    case IDLE_PAUSE:
+        rte_pause();
+        break;
+    case IDLE_SLEEP:
+        rte_delay_us_sleep(ctrl->exit_us);
+        break;
+    default:
+        break;
+    }
+}
+
+/* Tell producers to ring the doorbell from now on, the caller then rechecks for work before idle_ctrl_block */
+static inline void
+idle_ctrl_arm(struct idle_ctrl *ctrl)
+{
+    __atomic_store_n(&ctrl->sleeping, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline void
+idle_ctrl_disarm(struct idle_ctrl *ctrl)
+{
+    __atomic_store_n(&ctrl->sleeping, 0, __ATOMIC_RELAXED);
+}
+
+/* Block until the doorbell rings or exit_us passes */
+static inline void
+idle_ctrl_block(struct idle_ctrl *ctrl)
+{
+    struct timeval timeout = {
+        .tv_sec = ctrl->exit_us / 1000000,
+        .tv_usec = ctrl->exit_us % 1000000,
+    };
+    eventfd_t val;
+    fd_set fds;
+
+    FD_ZERO(&fds);
+    FD_SET(ctrl->efd, &fds);
+    if (select(ctrl->efd + 1, &fds, NULL, NULL, &timeout) > 0)
+        eventfd_read(ctrl->efd, &val);
+}
+
+/* Producer side: wake the consumer if it is blocked */
+static inline void
+idle_doorbell(struct idle_ctrl *ctrl)
+{
+    if (ctrl && __atomic_load_n(&ctrl->sleeping, __ATOMIC_SEQ_CST))
+        eventfd_write(ctrl->efd, 1);
+}
+
+#endif /* _INCLUDE_IDLE_H */
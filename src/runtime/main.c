@@ -26,9 +26,14 @@
 
 #include "run_mode.h"
 #include "meili_runtime.h"
+#include "dispatch.h"
+#include "offload.h"
+#include "tap.h"
+#include "../packet_ordering/packet_ordering.h"
 
 #include "../utils/utils.h"
 #include "../utils/input_mode/input.h"
+#include "../utils/stats/telemetry.h"
 
 volatile bool force_quit;
 
@@ -104,14 +109,32 @@ main(int argc, char **argv)
 	MEILI_LOG_INFO("Beginning Processing...");
 	start_cycles = rte_get_timer_cycles();
 
+	/* counters are read from telemetry and the printout thread, not from the packet loops */
+	ret = stats_telemetry_init(run_conf);
+	if (ret) {
+		snprintf(err, ERR_STR_SIZE, "Failed to start stats thread");
+		goto clean_pipeline;
+	}
+
 	/* Start each worker lcore and then main core. */
 	/* Each pipeline stage is assigned to a worker */
 	ret = pipeline_run(&pl);
+	stats_telemetry_stop(run_conf);
 
 	end_cycles = rte_get_timer_cycles();
 	run_time = ((double)end_cycles - start_cycles) / rte_get_timer_hz();
 
+	/* ops left on the regex queues still count towards the match stats */
+	meili_regex_flush(run_conf);
+
 	stats_print_end_of_run(run_conf, run_time);
+	pipeline_edge_stats_print(&pl);
+	dispatch_tenant_stats_print(&pl);
+	egress_stats_print(&pl);
+	offload_stats_print(&pl);
+	tap_stats_print(&pl);
+	if (run_conf->reorder)
+		reorder_stats_print(&pl.reorder_stage);
 
 
 // clean_regex:
@@ -68,8 +68,8 @@ int meili_runtime_init(struct pipeline *pl, pl_conf *run_conf, char *err){
      * 1) INPUT_TEXT_FILE       Load txt file into memory. Note that for txt files, it may take up large space.
      * 2) INPUT_PCAP_FILE       Load pcap file into memory. Note that for pcap files, it may take up large space.
      * 3) INPUT_LIVE            Use dpdk port to receive pkts. 
-     * 4) INPUT_JOB_FORMAT      N/A
-     * 5) INPUT_REMOTE_MMAP     N/A
+     * 4) INPUT_JOB_FORMAT      Map a job file with per job rule subsets and expected matches, see input_job_format.h.
+     * 5) INPUT_REMOTE_MMAP     Serve a shared memory ring of a co-located host process, see remote_mmap_ring.h.
     */
 	ret = input_register(run_conf);
 	if (ret) {
@@ -99,13 +99,13 @@ int meili_runtime_init(struct pipeline *pl, pl_conf *run_conf, char *err){
 
     /* construct pipeline topo based on pl.conf file */
     /* TODO: add regex related structures */
-	// ret = pipeline_init_safe(pl, PL_CONFIG_PATH);
-    ret = pipeline_init_safe(pl);
+	ret = pipeline_init_safe(pl, PL_CONFIG_PATH);
 	if (ret) {
 		snprintf(err, ERR_STR_SIZE, "Pipeline initialising failed");
 		
 		goto clean_pipeline;
 	}
+	stage_mem_report(pl);
 
     /* register main thread run function based on input mode (local txt/pcap, dpdk port, ...) */
     ret = run_mode_register(pl);
@@ -10,6 +10,8 @@ int register_meili_apis();
 
 int meili_regex_init(pl_conf *run_conf);
 
+void meili_regex_flush(pl_conf *run_conf);
+
 int meili_compression_init();
 
 int meili_runtime_init(struct pipeline *pl, pl_conf *run_conf, char *err);
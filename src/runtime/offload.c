@@ -0,0 +1,466 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <rte_byteorder.h>
+#include <rte_cycles.h>
+#include <rte_errno.h>
+#include <rte_jhash.h>
+#include <rte_malloc.h>
+#include <rte_mbuf_dyn.h>
+
+#include "offload.h"
+#include "dispatch.h"
+#include "run_mode.h"
+#include "../lib/log/meili_log.h"
+#include "../utils/net/port_utils.h"
+#include "../packet_ordering/packet_ordering.h"
+#include "../utils/rte_reorder/rte_reorder.h"
+
+static const struct rte_mbuf_dynfield offload_meta_desc = {
+    .name = "meili_offload_meta",
+    .size = sizeof(struct offload_meta),
+    .align = __alignof__(struct offload_meta),
+};
+
+/* Both instances must run the same stages on offloaded packets, requests of another chain are not served */
+static uint16_t
+offload_pipeline_id(struct pipeline *pl)
+{
+    uint32_t h = rte_jhash(pl->stage_types, sizeof(pl->stage_types[0]) * pl->nb_pl_stages, pl->nb_pl_stages);
+
+    return (h >> 16) ^ (h & 0xffff);
+}
+
+/* high bits pick the bucket, the low ones already pick the head ring in flow dispatch mode */
+static inline int
+offload_bucket(struct rte_mbuf *mbuf)
+{
+    return (dispatch_flow_hash(mbuf) >> 16) & (OFFLOAD_BUCKETS - 1);
+}
+
+static inline int
+offload_encap(struct pipeline_offload *off, struct rte_mbuf *mbuf, uint8_t type, uint16_t flow, uint32_t seqn,
+    uint16_t slot, uint64_t tsc)
+{
+    struct rte_ether_hdr *eth;
+    struct offload_hdr *hdr;
+
+    eth = (struct rte_ether_hdr *)rte_pktmbuf_prepend(mbuf, OFFLOAD_ENCAP_LEN);
+    if (!eth)
+        return -ENOSPC;
+
+    rte_ether_addr_copy(&off->peer_mac, &eth->d_addr);
+    rte_ether_addr_copy(&off->src_mac, &eth->s_addr);
+    eth->ether_type = rte_cpu_to_be_16(OFFLOAD_ETHER_TYPE);
+
+    hdr = (struct offload_hdr *)(eth + 1);
+    hdr->version = OFFLOAD_VERSION;
+    hdr->type = type;
+    hdr->pipeline = rte_cpu_to_be_16(off->pipeline);
+    hdr->flow = rte_cpu_to_be_16(flow);
+    hdr->slot = rte_cpu_to_be_16(slot);
+    hdr->seqn = rte_cpu_to_be_32(seqn);
+    hdr->tsc = tsc;
+
+    return 0;
+}
+
+/* Offload header of a packet of type from the peer, NULL if it is none */
+static inline struct offload_hdr *
+offload_decap_hdr(struct pipeline_offload *off, struct rte_mbuf *mbuf, uint8_t type)
+{
+    struct rte_ether_hdr *eth = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+    struct offload_hdr *hdr;
+
+    if (mbuf->data_len < OFFLOAD_ENCAP_LEN || eth->ether_type != rte_cpu_to_be_16(OFFLOAD_ETHER_TYPE))
+        return NULL;
+
+    hdr = (struct offload_hdr *)(eth + 1);
+    if (hdr->version != OFFLOAD_VERSION || hdr->type != type || rte_be_to_cpu_16(hdr->pipeline) != off->pipeline) {
+        off->bad_cnt++;
+        return NULL;
+    }
+
+    return hdr;
+}
+
+static void
+offload_drop_cb(struct rte_mbuf **unsent, uint16_t count, void *userdata)
+{
+    struct pipeline_offload *off = userdata;
+    struct offload_hdr *hdr;
+
+    /* requests that never left give their seq nums up now instead of waiting to expire */
+    if (!off->serve) {
+        for (uint16_t i = 0; i < count; i++) {
+            hdr = rte_pktmbuf_mtod_offset(unsent[i], struct offload_hdr *, sizeof(struct rte_ether_hdr));
+            off->track[rte_be_to_cpu_16(hdr->slot) & (OFFLOAD_TRACK_SIZE - 1)].live = false;
+        }
+        reorder_tombstone(off->pl, unsent, count);
+    }
+    rte_pktmbuf_free_bulk(unsent, count);
+    off->drop_cnt += count;
+}
+
+/* Set up offload as origin (--offload-port) or peer (--offload-serve), pl->offload stays NULL without either */
+int
+offload_init(struct pipeline *pl)
+{
+    pl_conf *conf = &pl->conf;
+    struct pipeline_offload *off;
+    const char *port_name;
+    int ret;
+
+    pl->offload = NULL;
+    if (!conf->offload_port && !conf->offload_serve)
+        return 0;
+
+    if (pl->nb_tenants > 1) {
+        MEILI_LOG_ERR("Offload is not supported with several tenants.");
+        return -ENOTSUP;
+    }
+
+    off = rte_zmalloc(NULL, sizeof(*off), RTE_CACHE_LINE_SIZE);
+    if (!off) {
+        MEILI_LOG_ERR("Memory failure allocating offload.");
+        return -ENOMEM;
+    }
+
+    /* the peer sends requests to the primary port and takes the results back from it */
+    off->pl = pl;
+    off->serve = conf->offload_serve;
+    port_name = off->serve ? conf->port1 : conf->offload_port;
+    if (rte_eth_dev_get_port_by_name(port_name, &off->port_id)) {
+        MEILI_LOG_ERR("Cannot find port %s.", port_name);
+        ret = -EINVAL;
+        goto err;
+    }
+    if (get_port_macaddr(off->port_id, &off->src_mac)) {
+        MEILI_LOG_ERR("Cannot get port %s eth addr.", port_name);
+        ret = -EINVAL;
+        goto err;
+    }
+    if (conf->offload_peer_mac)
+        rte_ether_unformat_addr(conf->offload_peer_mac, &off->peer_mac);
+    else
+        memset(&off->peer_mac, 0xff, sizeof(off->peer_mac));
+
+    off->pipeline = offload_pipeline_id(pl);
+    off->meta_offset = rte_mbuf_dynfield_register(&offload_meta_desc);
+    if (off->meta_offset < 0) {
+        MEILI_LOG_ERR("Failed to register mbuf field for offload, rte_errno: %i", rte_errno);
+        ret = -ENOMEM;
+        goto err;
+    }
+
+    off->threshold = conf->offload_threshold;
+    off->max_remote = OFFLOAD_BUCKETS * conf->offload_max_pct / 100;
+    off->eval_cycles = (rte_get_timer_hz() / 1000000) * OFFLOAD_EVAL_US;
+    off->expire_cycles = (rte_get_timer_hz() / 1000000) * OFFLOAD_EXPIRE_US;
+    off->last_eval = rte_rdtsc();
+
+    off->buf = rte_zmalloc(NULL, RTE_ETH_TX_BUFFER_SIZE(OFFLOAD_BUF_SIZE), RTE_CACHE_LINE_SIZE);
+    if (!off->buf) {
+        ret = -ENOMEM;
+        goto err;
+    }
+    rte_eth_tx_buffer_init(off->buf, OFFLOAD_BUF_SIZE);
+    ret = rte_eth_tx_buffer_set_err_callback(off->buf, offload_drop_cb, off);
+    if (ret)
+        goto err;
+
+    pl->offload = off;
+
+    if (off->serve)
+        MEILI_LOG_INFO("Serving offloaded flows on port %s, pipeline id %04x", port_name, off->pipeline);
+    else
+        MEILI_LOG_INFO("Offloading up to %u%% of flows to port %s above %u%% load, pipeline id %04x",
+            conf->offload_max_pct, port_name, off->threshold, off->pipeline);
+
+    return 0;
+
+err:
+    rte_free(off->buf);
+    rte_free(off);
+    return ret;
+}
+
+void
+offload_free(struct pipeline *pl)
+{
+    struct pipeline_offload *off = pl->offload;
+
+    if (!off)
+        return;
+
+    rte_free(off->buf);
+    rte_free(off);
+    pl->offload = NULL;
+}
+
+/* Origin: send the packets of steered flows to the peer with their sequence numbers.
+ * They do not occupy the local pipeline and give their credits back right away.
+ * Packets of steered flows stay local while OFFLOAD_TRACK_SIZE results are outstanding.
+ * The local ones are moved to the front of mbufs, in arrival order. Returns their #.
+ */
+int
+offload_steer(struct pipeline *pl, struct rte_mbuf **mbufs, int nb_pkts)
+{
+    struct pipeline_offload *off = pl->offload;
+    struct offload_track *track;
+    struct rte_mbuf *mbuf;
+    int nb_local = 0;
+    int nb_remote = 0;
+    uint16_t slot;
+    uint64_t now;
+
+    if (!off || off->serve || !off->nb_remote)
+        return nb_pkts;
+
+    now = rte_rdtsc();
+    for (int i = 0; i < nb_pkts; i++) {
+        mbuf = mbufs[i];
+        slot = off->track_tail & (OFFLOAD_TRACK_SIZE - 1);
+        if (!off->remote[offload_bucket(mbuf)] || off->track_tail - off->track_head == OFFLOAD_TRACK_SIZE ||
+            offload_encap(off, mbuf, OFFLOAD_REQ, *seq_flow(mbuf), *rte_reorder_seqn(mbuf), slot, now)) {
+            mbufs[nb_local++] = mbuf;
+            continue;
+        }
+        track = &off->track[slot];
+        track->tsc = now;
+        track->seqn = *rte_reorder_seqn(mbuf);
+        track->flow = *seq_flow(mbuf);
+        track->live = true;
+        off->track_tail++;
+        off->tx_cnt += rte_eth_tx_buffer(off->port_id, 0, off->buf, mbuf);
+        nb_remote++;
+    }
+
+    if (nb_remote)
+        pipeline_credit_return(pl, nb_remote);
+
+    return nb_local;
+}
+
+/* Peer: strip the encapsulation of requests in a received burst and remember where they came from.
+ * Every packet gets its metadata set, only requests go back to the origin.
+ */
+void
+offload_ingress(struct pipeline *pl, struct rte_mbuf **mbufs, int nb_pkts)
+{
+    struct pipeline_offload *off = pl->offload;
+    struct rte_ether_hdr *eth;
+    struct offload_hdr *hdr;
+    struct offload_meta *meta;
+
+    if (!off || !off->serve)
+        return;
+
+    for (int i = 0; i < nb_pkts; i++) {
+        meta = offload_meta(off, mbufs[i]);
+        meta->remote = false;
+        hdr = offload_decap_hdr(off, mbufs[i], OFFLOAD_REQ);
+        if (!hdr)
+            continue;
+
+        eth = rte_pktmbuf_mtod(mbufs[i], struct rte_ether_hdr *);
+        rte_ether_addr_copy(&eth->s_addr, &off->peer_mac);
+        meta->remote = true;
+        meta->seqn = rte_be_to_cpu_32(hdr->seqn);
+        meta->flow = rte_be_to_cpu_16(hdr->flow);
+        meta->slot = rte_be_to_cpu_16(hdr->slot);
+        meta->tsc = hdr->tsc;
+        rte_pktmbuf_adj(mbufs[i], OFFLOAD_ENCAP_LEN);
+        /* the NIC hashed the outer header, dispatch must hash the original flow */
+        mbufs[i]->ol_flags &= ~PKT_RX_RSS_HASH;
+        off->rx_cnt++;
+    }
+}
+
+/* Origin: receive up to max_pkts results from the peer, decapsulated and with their sequence numbers back.
+ * Returns their #, anything else arriving on the link is freed.
+ */
+int
+offload_poll(struct pipeline *pl, struct rte_mbuf **mbufs, int max_pkts)
+{
+    struct pipeline_offload *off = pl->offload;
+    struct offload_track *track;
+    struct offload_hdr *hdr;
+    uint64_t now;
+    int nb_rx;
+    int nb_res = 0;
+
+    if (!off || off->serve)
+        return 0;
+
+    nb_rx = rte_eth_rx_burst(off->port_id, 0, mbufs, max_pkts);
+    if (!nb_rx)
+        return 0;
+
+    now = rte_rdtsc();
+    for (int i = 0; i < nb_rx; i++) {
+        hdr = offload_decap_hdr(off, mbufs[i], OFFLOAD_RESP);
+        if (!hdr) {
+            rte_pktmbuf_free(mbufs[i]);
+            continue;
+        }
+        *rte_reorder_seqn(mbufs[i]) = rte_be_to_cpu_32(hdr->seqn);
+        *seq_flow(mbufs[i]) = rte_be_to_cpu_16(hdr->flow);
+        /* a result of an expired packet is late for its bucket, the reorder stage passes it on as such */
+        track = &off->track[rte_be_to_cpu_16(hdr->slot) & (OFFLOAD_TRACK_SIZE - 1)];
+        if (track->live && track->seqn == *rte_reorder_seqn(mbufs[i]) && track->flow == *seq_flow(mbufs[i]))
+            track->live = false;
+        else
+            off->late_cnt++;
+        off->rtt_cycles += now - hdr->tsc;
+        rte_pktmbuf_adj(mbufs[i], OFFLOAD_ENCAP_LEN);
+        mbufs[nb_res++] = mbufs[i];
+    }
+    off->rx_cnt += nb_res;
+
+    return nb_res;
+}
+
+/* Peer: send processed requests back to their origin.
+ * The local packets are moved to the front of mbufs, in order. Returns their #.
+ */
+int
+offload_return(struct pipeline *pl, struct rte_mbuf **mbufs, int nb_pkts)
+{
+    struct pipeline_offload *off = pl->offload;
+    struct offload_meta *meta;
+    int nb_local = 0;
+
+    if (!off || !off->serve)
+        return nb_pkts;
+
+    for (int i = 0; i < nb_pkts; i++) {
+        meta = offload_meta(off, mbufs[i]);
+        if (!meta->remote) {
+            mbufs[nb_local++] = mbufs[i];
+            continue;
+        }
+        if (offload_encap(off, mbufs[i], OFFLOAD_RESP, meta->flow, meta->seqn, meta->slot, meta->tsc)) {
+            rte_pktmbuf_free(mbufs[i]);
+            off->drop_cnt++;
+            continue;
+        }
+        off->tx_cnt += rte_eth_tx_buffer(off->port_id, 0, off->buf, mbufs[i]);
+    }
+
+    return nb_local;
+}
+
+/* Origin: results may still be on their way back, the main core should not go idle */
+bool
+offload_pending(struct pipeline *pl, uint64_t now __rte_unused)
+{
+    struct pipeline_offload *off = pl->offload;
+
+    return off && !off->serve && off->track_head != off->track_tail;
+}
+
+/* Origin: give up on steered packets older than OFFLOAD_EXPIRE_US, oldest first */
+static void
+offload_expire(struct pipeline *pl, struct pipeline_offload *off, uint64_t now)
+{
+    struct offload_track *track;
+
+    while (off->track_head != off->track_tail) {
+        track = &off->track[off->track_head & (OFFLOAD_TRACK_SIZE - 1)];
+        if (track->live) {
+            if (now - track->tsc < off->expire_cycles)
+                break;
+            reorder_tombstone_seqn(pl, track->flow, track->seqn);
+            track->live = false;
+            off->expire_cnt++;
+        }
+        off->track_head++;
+    }
+}
+
+/* Local load in %: the busier of the main core and the fullest head ring since the last evaluation */
+static uint32_t
+offload_load(struct pipeline *pl, struct pipeline_offload *off)
+{
+    run_mode_stats_t *rm_stats = &pl->conf.stats->rm_stats[0];
+    struct pipeline_dispatch *dispatch = pl->dispatch;
+    uint64_t busy = rm_stats->busy_cycles - off->last_busy;
+    uint64_t idle = rm_stats->idle_cycles - off->last_idle;
+    int nb_ring = __atomic_load_n(&dispatch->nb_ring, __ATOMIC_ACQUIRE);
+    uint32_t load = 0;
+    uint32_t occ;
+
+    off->last_busy = rm_stats->busy_cycles;
+    off->last_idle = rm_stats->idle_cycles;
+    if (busy + idle)
+        load = busy * 100 / (busy + idle);
+
+    for (int r = 0; r < nb_ring; r++) {
+        occ = rte_ring_count(dispatch->rings[r]) * 100 / rte_ring_get_capacity(dispatch->rings[r]);
+        load = RTE_MAX(load, occ);
+    }
+
+    return load;
+}
+
+void
+offload_flush(struct pipeline *pl)
+{
+    struct pipeline_offload *off = pl->offload;
+
+    if (off && off->buf->length)
+        off->tx_cnt += rte_eth_tx_buffer_flush(off->port_id, 0, off->buf);
+}
+
+/* Call once per main core iteration: sends what the iteration buffered for the peer and,
+ * on the origin, expires unanswered packets and steers a step of flows out above the threshold or back well below it.
+ * Moving a bucket may reorder packets of its flows in flight.
+ */
+void
+offload_update(struct pipeline *pl, uint64_t now)
+{
+    struct pipeline_offload *off = pl->offload;
+
+    if (!off)
+        return;
+
+    offload_flush(pl);
+
+    if (off->serve)
+        return;
+    offload_expire(pl, off, now);
+
+    if (now - off->last_eval < off->eval_cycles)
+        return;
+    off->last_eval = now;
+
+    off->load = offload_load(pl, off);
+    if (off->load >= off->threshold) {
+        for (int k = 0; k < OFFLOAD_STEP && off->nb_remote < off->max_remote; k++)
+            off->remote[off->nb_remote++] = 1;
+    }
+    else if (off->load + OFFLOAD_HYSTERESIS_PCT < off->threshold) {
+        for (int k = 0; k < OFFLOAD_STEP && off->nb_remote > 0; k++)
+            off->remote[--off->nb_remote] = 0;
+    }
+}
+
+void
+offload_stats_print(struct pipeline *pl)
+{
+    struct pipeline_offload *off = pl->offload;
+
+    if (!off)
+        return;
+
+    printf("%16s %8s %16s %16s %16s %16s %16s %16s %12s %12s\n", "Offload", "Port", "Sent", "Received", "Dropped",
+        "Bad", "Expired", "Late", "Flows (%)", "RTT (us)");
+    printf("%16s %8u %16lu %16lu %16lu %16lu %16lu %16lu %12.2f %12.2f\n", off->serve ? "serve" : "origin",
+        off->port_id, off->tx_cnt, off->rx_cnt, off->drop_cnt, off->bad_cnt, off->expire_cnt, off->late_cnt,
+        (double)off->nb_remote * 100 / OFFLOAD_BUCKETS,
+        off->serve || !off->rx_cnt ? 0.0 : (double)off->rtt_cycles / off->rx_cnt * 1000000 / rte_get_timer_hz());
+}
@@ -0,0 +1,124 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_OFFLOAD_H
+#define _INCLUDE_OFFLOAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <rte_ethdev.h>
+#include <rte_ether.h>
+#include <rte_mbuf.h>
+
+#include "pipeline.h"
+
+#define OFFLOAD_ETHER_TYPE 0x88b5               /* IEEE 802 local experimental ethertype */
+#define OFFLOAD_VERSION 3
+
+#define OFFLOAD_BUCKETS 512                     /* flow steering table, power of 2 */
+#define OFFLOAD_STEP (OFFLOAD_BUCKETS / 16)     /* buckets moved per evaluation */
+#define OFFLOAD_EVAL_US 1000                    /* load evaluation interval */
+#define OFFLOAD_HYSTERESIS_PCT 20               /* flows come back once load is this far below the threshold */
+#define OFFLOAD_EXPIRE_US 1000                  /* a result not back after this long is given up */
+#define OFFLOAD_TRACK_SIZE 4096                 /* steered packets awaiting their result, power of 2 */
+#define OFFLOAD_BURST 32                        /* results merged per main core iteration */
+#define OFFLOAD_BUF_SIZE 64                     /* packets buffered for the peer before a tx burst goes out */
+
+enum offload_type {
+    OFFLOAD_REQ = 1,                            /* origin to peer, packet to process */
+    OFFLOAD_RESP,                               /* peer back to origin, processed packet */
+};
+
+/* Follows the outer ethernet header of an offloaded packet, the original frame follows it.
+ * Fields are big endian on the wire except tsc, which only the origin reads.
+ */
+struct offload_hdr {
+    uint8_t version;
+    uint8_t type;
+    uint16_t pipeline;                          /* id of the stage chain, both instances must run the same one */
+    uint16_t flow;                              /* reorder bucket and sequence number given by the origin */
+    uint16_t slot;                              /* origin's tracking entry, echoed back */
+    uint32_t seqn;
+    uint64_t tsc;                               /* origin send time, echoed back */
+} __rte_packed;
+
+#define OFFLOAD_ENCAP_LEN (sizeof(struct rte_ether_hdr) + sizeof(struct offload_hdr))
+
+/* Origin of a packet a peer offloaded to us, kept in an mbuf dynfield while it runs through the stages */
+struct offload_meta {
+    uint64_t tsc;
+    uint32_t seqn;
+    uint16_t flow;
+    uint16_t slot;
+    bool remote;
+};
+
+/* Origin: a steered packet, live until its result is back or it expires */
+struct offload_track {
+    uint64_t tsc;
+    uint32_t seqn;
+    uint16_t flow;
+    bool live;
+};
+
+/* Partial offload of flows to a peer Meili instance, main core only.
+ * The origin steers hash buckets of flows to the peer while local load is above the threshold,
+ * the peer (--offload-serve) processes them like its own traffic and sends the results back.
+ */
+struct pipeline_offload {
+    struct pipeline *pl;
+    bool serve;
+    uint16_t port_id;                           /* link to the peer, tx and result rx on queue 0 */
+    struct rte_ether_addr src_mac;
+    struct rte_ether_addr peer_mac;             /* learnt from requests when serving */
+    uint16_t pipeline;
+    int meta_offset;
+
+    /* origin: hash bucket -> steered to the peer, buckets [0, nb_remote) are */
+    uint8_t remote[OFFLOAD_BUCKETS];
+    int nb_remote;
+    int max_remote;
+    uint32_t threshold;                         /* load in % above which more flows are steered */
+    uint32_t load;                              /* at the last evaluation */
+    uint64_t eval_cycles;
+    uint64_t last_eval;
+    uint64_t last_busy;
+    uint64_t last_idle;
+    uint64_t expire_cycles;
+
+    /* origin: steered packets in send order, [track_head, track_tail) may still be live.
+     * Expired ones get their seq num tombstoned so the reorder stage does not wait for them.
+     */
+    struct offload_track track[OFFLOAD_TRACK_SIZE];
+    uint32_t track_head;
+    uint32_t track_tail;
+
+    struct rte_eth_dev_tx_buffer *buf;
+
+    uint64_t tx_cnt;                            /* packets sent to the peer, or back to it when serving */
+    uint64_t rx_cnt;                            /* packets received from the peer */
+    uint64_t drop_cnt;                          /* not sent, tx queue full or no headroom */
+    uint64_t bad_cnt;                           /* encapsulated packets of another version or pipeline */
+    uint64_t expire_cnt;                        /* steered packets whose result never came back in time */
+    uint64_t late_cnt;                          /* results back after their packet expired */
+    uint64_t rtt_cycles;                        /* sum over the results received */
+};
+
+static inline struct offload_meta *
+offload_meta(struct pipeline_offload *off, struct rte_mbuf *mbuf)
+{
+    return RTE_MBUF_DYNFIELD(mbuf, off->meta_offset, struct offload_meta *);
+}
+
+int offload_init(struct pipeline *pl);
+void offload_free(struct pipeline *pl);
+int offload_steer(struct pipeline *pl, struct rte_mbuf **mbufs, int nb_pkts);
+void offload_ingress(struct pipeline *pl, struct rte_mbuf **mbufs, int nb_pkts);
+int offload_poll(struct pipeline *pl, struct rte_mbuf **mbufs, int max_pkts);
+int offload_return(struct pipeline *pl, struct rte_mbuf **mbufs, int nb_pkts);
+bool offload_pending(struct pipeline *pl, uint64_t now);
+void offload_update(struct pipeline *pl, uint64_t now);
+void offload_flush(struct pipeline *pl);
+void offload_stats_print(struct pipeline *pl);
+
+#endif /* _INCLUDE_OFFLOAD_H */
@@ -6,10 +6,20 @@
 #include <stdbool.h>
 #include <string.h>
 #include <rte_errno.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_prefetch.h>
 
 #include "pipeline.h"
 #include "run_mode.h"
+#include "dispatch.h"
+#include "offload.h"
+#include "placement.h"
+#include "scale.h"
+#include "tap.h"
+#include "tenant.h"
 #include "../utils/utils.h"
+#include "../utils/str/str_helpers.h"
 
 #include "../packet_ordering/packet_ordering.h"
 #include "../packet_timestamping/packet_timestamping.h"
@@ -43,17 +53,345 @@ typedef int (*pl_register_functions)(struct pipeline_stage *);
 
 
 
+#define PL_MBUF_SEEN 1UL     /* low bit of a cache aligned mbuf pointer, marks inputs found in the output */
 
+static int
+pipeline_mbuf_cmp(const void *a, const void *b)
+{
+    uintptr_t x = *(const uintptr_t *)a & ~PL_MBUF_SEEN;
+    uintptr_t y = *(const uintptr_t *)b & ~PL_MBUF_SEEN;
 
+    return (x > y) - (x < y);
+}
 
+/* Inputs of a batch stage missing from its output. mbufs holds the inputs on entry and the dropped ones on return.
+ * Only run once the stage handed back fewer packets than it got, bursts that pass whole never sort.
+ */
+static int
+pipeline_batch_dropped(struct rte_mbuf **mbufs, int nb_in, struct rte_mbuf **mbufs_out, int nb_out)
+{
+    uintptr_t *found;
+    int nb_drop = 0;
+
+    qsort(mbufs, nb_in, sizeof(mbufs[0]), pipeline_mbuf_cmp);
+    for(int i=0; i<nb_out; i++){
+        found = bsearch(&mbufs_out[i], mbufs, nb_in, sizeof(mbufs[0]), pipeline_mbuf_cmp);
+        if(found){
+            *found |= PL_MBUF_SEEN;
+        }
+    }
+    for(int i=0; i<nb_in; i++){
+        if(!((uintptr_t)mbufs[i] & PL_MBUF_SEEN)){
+            mbufs[nb_drop++] = mbufs[i];
+        }
+    }
+
+    return nb_drop;
+}
+
+#ifndef SHARED_BUFFER
+/* Take one burst from the fullest input ring of a sibling instance.
+ * Only rings holding more than STEAL_MIN_BACKLOG bursts are considered, so
+ * siblings that keep up are left alone.
+ */
+static inline int
+pipeline_stage_steal(struct pipeline_stage *self, struct rte_mbuf **mbufs, int burst_size)
+{
+    struct pipeline *pl = (struct pipeline *)self->pl;
+    struct pipeline_stage *sibling;
+    struct rte_ring *victim = NULL;
+    unsigned int max_cnt = burst_size * STEAL_MIN_BACKLOG;
+    unsigned int cnt;
+
+    for(int k=0; k<pl->nb_inst_per_pl_stage[self->stage_idx]; k++){
+        if(k == self->inst_idx){
+            continue;
+        }
+        sibling = pl->stages[self->stage_idx][k];
+        for(int r=0; r<sibling->nb_ring_in; r++){
+            cnt = rte_ring_count(sibling->ring_in[r]);
+            if(cnt > max_cnt){
+                max_cnt = cnt;
+                victim = sibling->ring_in[r];
+            }
+        }
+    }
+
+    if(!victim){
+        return 0;
+    }
+
+    return rte_ring_dequeue_burst(victim, (void *)mbufs, burst_size, NULL);
+}
+#endif
+
+/* Hand filtered packets to the divert ring of the stage if there is one, free the rest */
+static inline void
+pipeline_stage_filter_out(struct pipeline_stage *self, struct rte_mbuf **mbufs, int nb_pkts, run_mode_stats_t *rm_stats)
+{
+    int nb_divert = 0;
+
+    tap_burst(self, mbufs, nb_pkts, TAP_DROP);
+    pipeline_pkts_exit((struct pipeline *)self->pl, nb_pkts);
+    /* diverted or freed, they do not come back to the main core either way */
+    reorder_tombstone((struct pipeline *)self->pl, mbufs, nb_pkts);
+
+    if(self->divert_ring){
+        nb_divert = rte_ring_enqueue_burst(self->divert_ring, (void *)mbufs, nb_pkts, NULL);
+        rm_stats->flt_divert_cnt += nb_divert;
+    }
+
+    /* no divert ring or it is full */
+    if(nb_pkts > nb_divert){
+        rte_pktmbuf_free_bulk(&mbufs[nb_divert], nb_pkts - nb_divert);
+        rm_stats->flt_drop_cnt += nb_pkts - nb_divert;
+    }
+}
+
+static const char *bp_policy_names[] = {"block", "drop", "prio", "spill"};
+
+static inline bool
+pipeline_pkt_high_prio(struct rte_mbuf *mbuf)
+{
+    struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+    struct rte_ipv4_hdr *ipv4_hdr;
+
+    if(eth_hdr->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4)){
+        return false;
+    }
+    ipv4_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
+
+    return (ipv4_hdr->type_of_service >> 2) >= BP_PRIO_DSCP_MIN;
+}
+
+/* Enqueue a burst on ring_out[ring_idx]. A tapped edge captures only what the ring takes, before the enqueue
+ * since the consumer may free the packets right after it. The instance is the only producer of the ring,
+ * what fits before the enqueue still fits at it.
+ */
+static inline int
+pipeline_stage_enqueue(struct pipeline_stage *self, int ring_idx, struct rte_mbuf **mbufs, int nb_pkts)
+{
+    struct rte_ring *ring = self->ring_out[ring_idx];
+
+    if(likely(!self->out_tap[ring_idx])){
+        return rte_ring_enqueue_burst(ring, (void *)mbufs, nb_pkts, NULL);
+    }
+    nb_pkts = RTE_MIN(nb_pkts, (int)rte_ring_free_count(ring));
+    tap_edge_burst(self, ring_idx, mbufs, nb_pkts, TAP_PASS);
+    return rte_ring_enqueue_burst(ring, (void *)mbufs, nb_pkts, NULL);
+}
+
+/* Apply the backpressure policy of full ring_out[ring_idx] to the nb_pkts packets that did not fit.
+ * Returns # of packets still forwarded, they are moved to the front of mbufs. The rest are freed.
+ */
+static int
+pipeline_stage_overflow(struct pipeline_stage *self, int ring_idx, struct rte_mbuf **mbufs, int nb_pkts, run_mode_stats_t *rm_stats)
+{
+    int nb_fwd = 0;
+    int nb_drop = 0;
+    int tot_enq = 0;
+
+    switch(self->out_policy[ring_idx]){
+    case BP_SPILL:
+        /* the spill ring has several producers, the packets are captured before the spin */
+        tap_edge_burst(self, ring_idx, mbufs, nb_pkts, TAP_PASS);
+        /* only spin when the shared spill ring is full as well */
+        while(nb_fwd < nb_pkts && !force_quit){
+            nb_fwd += rte_ring_enqueue_burst(self->out_spill[ring_idx], (void *)(&mbufs[nb_fwd]), nb_pkts - nb_fwd, NULL);
+        }
+        return nb_fwd;
+    case BP_PRIO_DROP:
+        for(int i=0; i<nb_pkts; i++){
+            if(pipeline_pkt_high_prio(mbufs[i])){
+                mbufs[nb_fwd++] = mbufs[i];
+            }
+            else{
+                tap_burst(self, &mbufs[i], 1, TAP_SHED);
+                tap_edge_burst(self, ring_idx, &mbufs[i], 1, TAP_SHED);
+                reorder_tombstone((struct pipeline *)self->pl, &mbufs[i], 1);
+                rte_pktmbuf_free(mbufs[i]);
+                nb_drop++;
+            }
+        }
+        while(tot_enq < nb_fwd && !force_quit){
+            tot_enq += pipeline_stage_enqueue(self, ring_idx, &mbufs[tot_enq], nb_fwd - tot_enq);
+        }
+        break;
+    case BP_TAIL_DROP:
+    default:
+        tap_burst(self, mbufs, nb_pkts, TAP_SHED);
+        tap_edge_burst(self, ring_idx, mbufs, nb_pkts, TAP_SHED);
+        reorder_tombstone((struct pipeline *)self->pl, mbufs, nb_pkts);
+        rte_pktmbuf_free_bulk(mbufs, nb_pkts);
+        nb_drop = nb_pkts;
+        break;
+    }
+
+    self->out_drop_cnt[ring_idx] += nb_drop;
+    rm_stats->bp_drop_cnt += nb_drop;
+    pipeline_pkts_exit((struct pipeline *)self->pl, nb_drop);
+
+    return nb_fwd;
+}
+
+#ifndef SHARED_BUFFER
+static inline bool
+pipeline_stage_rings_empty(struct pipeline_stage *self)
+{
+    for(int r=0; r<self->nb_ring_in; r++){
+        if(!rte_ring_empty(self->ring_in[r])){
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Back off after an empty poll. Sleeping and blocking only happen once every input ring is empty,
+ * which keeps the exit latency at idle_exit_us however many rings the instance reads.
+ */
+static inline void
+pipeline_stage_idle(struct pipeline_stage *self)
+{
+    struct pipeline *pl = (struct pipeline *)self->pl;
+    enum idle_level level = idle_ctrl_level(&self->idle);
+
+    if(level <= IDLE_PAUSE){
+        idle_ctrl_wait(&self->idle, level);
+        return;
+    }
+    if(!pipeline_stage_rings_empty(self)){
+        return;
+    }
+
+    /* no ring is in use while sleeping, rescaling need not wait for us */
+    scale_offline(pl, self->core_id);
+    if(level == IDLE_SLEEP){
+        idle_ctrl_wait(&self->idle, level);
+    }
+    else{
+        idle_ctrl_arm(&self->idle);
+        /* a producer may have enqueued before it could see the flag */
+        if(pipeline_stage_rings_empty(self)){
+            idle_ctrl_block(&self->idle);
+        }
+        idle_ctrl_disarm(&self->idle);
+    }
+    scale_online(pl, self->core_id);
+}
+#endif
+
+static inline void
+pipeline_pkt_prefetch(struct rte_mbuf *mbuf, int nb_lines)
+{
+    char *data = rte_pktmbuf_mtod(mbuf, char *);
+
+    for(int l=0; l<nb_lines; l++){
+        rte_prefetch0(data + l * RTE_CACHE_LINE_SIZE);
+    }
+}
+
+/* Prefetch ahead of packet i of a burst: the payload of packet i+dist, and the mbuf of packet i+2*dist
+ * so that its data pointer is cached by the time its payload is prefetched.
+ */
+static inline void
+pipeline_burst_prefetch(struct pipeline_stage *self, struct rte_mbuf **mbufs, int i, int nb_pkts)
+{
+    int dist = self->prefetch_dist;
+
+    if(i + 2 * dist < nb_pkts){
+        rte_prefetch0(mbufs[i + 2 * dist]);
+    }
+    if(i + dist < nb_pkts){
+        pipeline_pkt_prefetch(mbufs[i + dist], self->prefetch_lines);
+    }
+}
+
+/* Prefetch the head of a burst before the first packet is executed */
+static inline void
+pipeline_burst_prefetch_head(struct pipeline_stage *self, struct rte_mbuf **mbufs, int nb_pkts)
+{
+    int dist = self->prefetch_dist;
+
+    for(int k=0; k<RTE_MIN(2 * dist, nb_pkts); k++){
+        rte_prefetch0(mbufs[k]);
+    }
+    for(int k=0; k<RTE_MIN(dist, nb_pkts); k++){
+        pipeline_pkt_prefetch(mbufs[k], self->prefetch_lines);
+    }
+}
+
+/* Run one stage over a burst. Returns # of packets passed on, *mbufs_out points to them.
+ * Filtered packets are diverted or freed here and counted in the stats of worker_qid.
+ * Passed and filtered packets are captured here when the stage is tapped.
+ */
+int
+pipeline_stage_exec_burst(struct pipeline_stage *self, struct rte_mbuf **mbufs_in, int nb_deq,
+                          struct rte_mbuf ***mbufs_out)
+{
+    struct pipeline *pl = (struct pipeline *)self->pl;
+    run_mode_stats_t *rm_stats = &pl->conf.stats->rm_stats[self->worker_qid];
+    struct pipeline_func *funcs = self->funcs;
+    struct rte_mbuf *mbufs_flt[MAX_PKTS_BURST];
+    int nb_flt = 0;
+    int out_num = 0;
+    uint64_t start;
+
+    *mbufs_out = mbufs_in;
+    if(!nb_deq){
+        return 0;
+    }
+
+    start = rte_rdtsc();
+    rm_stats->exec_pkt_cnt += nb_deq;
+
+    if(self->prefetch_dist){
+        pipeline_burst_prefetch_head(self, mbufs_in, nb_deq);
+    }
+
+    if(funcs->pipeline_stage_exec_batch){
+        /* the stage may compact the burst in place, keep the inputs to tell what it dropped */
+        memcpy(mbufs_flt, mbufs_in, sizeof(mbufs_in[0]) * nb_deq);
+        /* one call per burst, stage may hand back a compacted output burst */
+        funcs->pipeline_stage_exec_batch(self, mbufs_in, nb_deq, mbufs_out, &out_num);
+        if(out_num < nb_deq){
+            nb_flt = pipeline_batch_dropped(mbufs_flt, nb_deq, *mbufs_out, out_num);
+            if(nb_flt){
+                pipeline_stage_filter_out(self, mbufs_flt, nb_flt, rm_stats);
+            }
+        }
+        rm_stats->exec_cycles += rte_rdtsc() - start;
+        tap_burst(self, *mbufs_out, out_num, TAP_PASS);
+        return out_num;
+    }
+
+    /* filtered packets are compacted out of the burst in place */
+    for(int i=0; i<nb_deq; i++){
+        if(self->prefetch_dist){
+            pipeline_burst_prefetch(self, mbufs_in, i, nb_deq);
+        }
+        self->pkt_verdict = MEILI_PKT_PASS;
+        funcs->pipeline_stage_exec(self, mbufs_in[i]);
+        if(self->pkt_verdict == MEILI_PKT_PASS){
+            mbufs_in[out_num++] = mbufs_in[i];
+        }
+        else{
+            mbufs_flt[nb_flt++] = mbufs_in[i];
+        }
+    }
+    if(nb_flt){
+        pipeline_stage_filter_out(self, mbufs_flt, nb_flt, rm_stats);
+    }
+    rm_stats->exec_cycles += rte_rdtsc() - start;
+    tap_burst(self, mbufs_in, out_num, TAP_PASS);
+
+    return out_num;
+}
 
 /* worker function for a pipeline */
 int pipeline_stage_run_safe(struct pipeline_stage *self){
     int burst_size = self->batch_size;
     struct rte_ring **ring_in_array = self->ring_in;
-    struct rte_ring **ring_out_array = self->ring_out;
     struct rte_ring *ring_in = NULL;
-    struct rte_ring *ring_out = NULL;
     int nb_ring_in = self->nb_ring_in;
     int nb_ring_out = self->nb_ring_out;
     int ring_in_index = 0;
@@ -62,9 +400,8 @@ int pipeline_stage_run_safe(struct pipeline_stage *self){
     
 
     struct rte_mbuf *mbufs_in[MAX_PKTS_BURST];
-    struct rte_mbuf *mbufs_out_static[MAX_PKTS_BURST];
 
-    struct rte_mbuf **mbufs_out = mbufs_out_static;
+    struct rte_mbuf **mbufs_out = mbufs_in;
 
 
     int out_num = 0;
@@ -84,6 +421,12 @@ int pipeline_stage_run_safe(struct pipeline_stage *self){
     int nb_enq = 0;
     int to_enq = 0;
     int tot_enq = 0;
+    int idle_polls = 0;
+    bool ring_full;
+    unsigned int backlog = 0;
+    uint64_t batch_start = 0;
+    uint64_t last_tsc;
+    uint64_t now;
     
     struct pipeline_func *funcs =  self->funcs;
 
@@ -92,39 +435,85 @@ int pipeline_stage_run_safe(struct pipeline_stage *self){
         return -EINVAL;
     }
 
-	if (!funcs->pipeline_stage_exec){
+	if (!funcs->pipeline_stage_exec && !funcs->pipeline_stage_exec_batch){
         MEILI_LOG_WARN("Invalid execution function");
         return -EINVAL;
     }
 
+    scale_register(pl, self->core_id);
+
+    last_tsc = rte_rdtsc();
     // main loop of pipeline stage
-    while(!force_quit && conf->running == true){
+    while(!force_quit && conf->running == true && !__atomic_load_n(&self->stop, __ATOMIC_ACQUIRE)){
+        /* no ring taken in the previous iteration is in use anymore */
+        scale_quiescent(pl, self->core_id);
+        #ifndef SHARED_BUFFER
+        /* rings may be added or removed while running, see scale.c */
+        nb_ring_in = __atomic_load_n(&self->nb_ring_in, __ATOMIC_ACQUIRE);
+        nb_ring_out = __atomic_load_n(&self->nb_ring_out, __ATOMIC_ACQUIRE);
+        if(ring_in_index >= nb_ring_in){
+            ring_in_index = 0;
+        }
+        if(ring_out_index >= nb_ring_out){
+            ring_out_index = 0;
+        }
+        #endif
+
         /* read packets from ring_in in a round-robin manner */
         ring_in = ring_in_array[ring_in_index];
-        nb_deq = rte_ring_dequeue_burst(ring_in, (void *)mbufs_in, burst_size, NULL);
+        nb_deq = rte_ring_dequeue_burst(ring_in, (void *)mbufs_in, burst_size, &backlog);
         ring_in_index = (ring_in_index+1)%nb_ring_in;
 
+        #ifndef SHARED_BUFFER
+        /* own rings stayed empty for a while, help the most loaded sibling */
+        if(self->steal){
+            if(nb_deq){
+                idle_polls = 0;
+            }
+            else if(++idle_polls >= STEAL_IDLE_ROUNDS * nb_ring_in){
+                idle_polls = 0;
+                nb_deq = pipeline_stage_steal(self, mbufs_in, burst_size);
+                if(nb_deq){
+                    rm_stats->steal_burst_cnt++;
+                    rm_stats->steal_pkt_cnt += nb_deq;
+                }
+            }
+        }
+        #endif
+
+        if(self->bctrl.enabled && nb_deq){
+            batch_start = rte_rdtsc();
+        }
+
         //pkt_ts_exec(self->ts_start_offset, mbufs_in, nb_deq);
         /* process packets */
-        //pipeline_stage_exec_safe(self, mbufs_in, nb_deq, &mbufs_out, &out_num);
-        for(int i=0; i<nb_deq; i++){
-            funcs->pipeline_stage_exec(self, mbufs_in[i]);
-            mbufs_out[i] = mbufs_in[i];  
-            out_num++;
-        }
+        out_num = pipeline_stage_exec_burst(self, mbufs_in, nb_deq, &mbufs_out);
         
         
         //pkt_ts_exec(self->ts_end_offset, mbufs_out, out_num);
 
         /* put packets into ring_out in a round-robin manner */
-        ring_out = ring_out_array[ring_out_index];
-        
         tot_enq = 0;
-        while(out_num > 0) {
+        ring_full = false;
+        while(out_num > 0 && !force_quit) {
             to_enq = RTE_MIN(out_num, burst_size);
-            nb_enq = rte_ring_enqueue_burst(ring_out, (void *)(&mbufs_out[tot_enq]), to_enq, NULL);
+            nb_enq = pipeline_stage_enqueue(self, ring_out_index, &mbufs_out[tot_enq], to_enq);
             tot_enq += nb_enq;
             out_num -= nb_enq;
+            if(nb_enq < to_enq){
+                if(!ring_full){
+                    ring_full = true;
+                    self->out_full_cnt[ring_out_index]++;
+                    rm_stats->bp_full_cnt++;
+                }
+                if(self->out_policy[ring_out_index] != BP_BLOCK){
+                    tot_enq += pipeline_stage_overflow(self, ring_out_index, &mbufs_out[tot_enq], out_num, rm_stats);
+                    out_num = 0;
+                }
+            }
+        }
+        if(tot_enq){
+            idle_doorbell(self->out_wake[ring_out_index]);
         }
         ring_out_index = (ring_out_index+1)%nb_ring_out;
         /* update statics */
@@ -133,22 +522,389 @@ int pipeline_stage_run_safe(struct pipeline_stage *self){
             rm_stats->tx_buf_bytes += mbufs_out[k]->data_len;
         }
         rm_stats->tx_buf_cnt += tot_enq;
+
+        /* adapt batch size to measured batch latency and what is left in the ring */
+        if(self->bctrl.enabled && nb_deq){
+            burst_size = batch_ctrl_update(&self->bctrl, rte_rdtsc() - batch_start, backlog);
+            self->batch_size = burst_size;
+        }
+
+        /* back off while there is no work */
+        if(nb_deq){
+            idle_ctrl_reset(&self->idle);
+        }
+        else{
+            pipeline_stage_idle(self);
+        }
+        now = rte_rdtsc();
+        if(nb_deq){
+            rm_stats->busy_cycles += now - last_tsc;
+        }
+        else{
+            rm_stats->idle_cycles += now - last_tsc;
+        }
+        last_tsc = now;
     }
 
+    scale_unregister(pl, self->core_id);
+
     printf("Worker %d exiting\n",self->worker_qid);
     return 0;
 }
 
 
 
-int pipeline_init_safe(struct pipeline *pl){
-    /* TODO optional: connect pipeline stages based on DAG, currently we connect them using very simple topo(fully connected topo) */
-    
+static int
+pipeline_bp_policy_parse(const char *str, enum pipeline_bp_policy *policy)
+{
+    for (int i = 0; i < (int)RTE_DIM(bp_policy_names); i++) {
+        if (strcmp(str, bp_policy_names[i]) == 0) {
+            *policy = i;
+            return 0;
+        }
+    }
+    MEILI_LOG_ERR("Unknown backpressure policy: %s.", str);
+
+    return -EINVAL;
+}
+
+/* Parse pl.conf into stage types, instance counts, batch sizes, edges and tenants.
+ * Stage lines:  [Stage Type] [# of instances | auto] [batch size (optional)] [flags (optional)]
+ * Edge lines:   EDGE [src stage index] [dst stage index] [block | drop | prio | spill (optional)] [tap (optional)]
+ * Tenant lines: TENANT [name] [app] [weight (optional)], followed by the tenant's MATCH and stage lines
+ * Stage indexes follow the order stage lines appear in. Without any edge
+ * line the stages of each tenant are chained in that order.
+ */
+static int
+pipeline_conf_parse(struct pipeline *pl, char *config_path)
+{
+    pl_conf *run_conf = &(pl->conf);
+    char line[CONFIG_BUF_LEN];
+    char *fields[PL_CONFIG_MAX_FIELDS];
+    char *saveptr;
+    char *entry;
+    FILE *config_file;
+    int nb_fields;
+    int stage_type;
+    int nb_auto = 0;
+    int nb_auto_inst = 0;
+    int nb_fixed_inst = 0;
+    long val;
+    int ret = 0;
+    int i;
+
+    pl->nb_pl_stages = 0;
+    pl->nb_edges = 0;
+    pl->nb_tenants = 0;
+    pl->nb_rules = 0;
+
+    config_file = fopen(config_path, "r");
+    if (!config_file) {
+        MEILI_LOG_WARN("No pipeline config file at %s, using a single PL_MAIN stage.", config_path);
+        pl->nb_pl_stages = 1;
+        pl->stage_types[0] = PL_MAIN;
+        pl->nb_inst_per_pl_stage[0] = run_conf->cores-1;
+        pl->batch_size_per_pl_stage[0] = DEFAULT_BATCH_SIZE;
+        pl->steal_per_pl_stage[0] = false;
+        pl->divert_per_pl_stage[0] = false;
+        pl->idle_per_pl_stage[0] = IDLE_SPIN;
+        pl->tap_per_pl_stage[0] = false;
+        pl->tenant_per_pl_stage[0] = 0;
+        return 0;
+    }
+
+    while (fgets(line, CONFIG_BUF_LEN, config_file) != NULL) {
+        entry = util_trim_whitespace(line);
+        if (!strlen(entry) || entry[0] == '#')
+            continue;
+
+        nb_fields = 0;
+        fields[nb_fields] = strtok_r(entry, " \t", &saveptr);
+        while (fields[nb_fields] && ++nb_fields < PL_CONFIG_MAX_FIELDS)
+            fields[nb_fields] = strtok_r(NULL, " \t", &saveptr);
+
+        if (nb_fields < 2) {
+            MEILI_LOG_ERR("Malformed pipeline config line: %s.", entry);
+            ret = -EINVAL;
+            goto out;
+        }
+
+        /* tenant and classifier rule lines */
+        if (strcmp(fields[0], PL_CONFIG_TENANT_KEY) == 0) {
+            ret = tenant_conf_parse(pl, fields, nb_fields);
+            if (ret)
+                goto out;
+            continue;
+        }
+        if (strcmp(fields[0], PL_CONFIG_MATCH_KEY) == 0) {
+            ret = tenant_rule_parse(pl, fields, nb_fields);
+            if (ret)
+                goto out;
+            continue;
+        }
+
+        /* edge line */
+        if (strcmp(fields[0], PL_CONFIG_EDGE_KEY) == 0) {
+            if (nb_fields < 3 || nb_fields > 5 || pl->nb_edges >= NB_PIPELINE_EDGE_MAX) {
+                MEILI_LOG_ERR("Invalid pipeline edge: %s.", entry);
+                ret = -EINVAL;
+                goto out;
+            }
+            if (util_str_to_dec(fields[1], &val, 1)) {
+                MEILI_LOG_ERR("Invalid source stage of edge: %s.", fields[1]);
+                ret = -EINVAL;
+                goto out;
+            }
+            pl->edges[pl->nb_edges].src = val;
+            if (util_str_to_dec(fields[2], &val, 1)) {
+                MEILI_LOG_ERR("Invalid destination stage of edge: %s.", fields[2]);
+                ret = -EINVAL;
+                goto out;
+            }
+            pl->edges[pl->nb_edges].dst = val;
+            pl->edges[pl->nb_edges].policy = BP_BLOCK;
+            pl->edges[pl->nb_edges].tap = false;
+            for (int k = 3; k < nb_fields; k++) {
+                if (strcmp(fields[k], PL_CONFIG_TAP_FLAG) == 0) {
+                    pl->edges[pl->nb_edges].tap = true;
+                    continue;
+                }
+                if (k != 3) {
+                    MEILI_LOG_ERR("Invalid flag of edge: %s.", fields[k]);
+                    ret = -EINVAL;
+                    goto out;
+                }
+                ret = pipeline_bp_policy_parse(fields[k], &pl->edges[pl->nb_edges].policy);
+                if (ret)
+                    goto out;
+            }
+            pl->nb_edges++;
+            continue;
+        }
+
+        /* stage line */
+        if (pl->nb_pl_stages >= NB_PIPELINE_STAGE_MAX) {
+            MEILI_LOG_ERR("Max %d pipeline stages supported.", NB_PIPELINE_STAGE_MAX);
+            ret = -EINVAL;
+            goto out;
+        }
+        i = pl->nb_pl_stages;
+
+        GET_STAGE_TYPE_NUMBER(fields[0], &stage_type);
+        if (stage_type < 0) {
+            MEILI_LOG_ERR("Unknown pipeline stage type: %s.", fields[0]);
+            ret = -EINVAL;
+            goto out;
+        }
+        pl->stage_types[i] = stage_type;
+        pl->tenant_per_pl_stage[i] = pl->nb_tenants ? pl->nb_tenants - 1 : 0;
+
+        if (strcmp(fields[1], PL_CONFIG_AUTO_INST) == 0) {
+            /* resolved once all fixed instance counts are known */
+            pl->nb_inst_per_pl_stage[i] = 0;
+            nb_auto++;
+        } else {
+            if (util_str_to_dec(fields[1], &val, 1) || val < 1 || val > NB_INSTANCE_PER_PIPELINE_STAGE_MAX) {
+                MEILI_LOG_ERR("Invalid # of instances for %s: %s.", fields[0], fields[1]);
+                ret = -EINVAL;
+                goto out;
+            }
+            pl->nb_inst_per_pl_stage[i] = val;
+            nb_fixed_inst += val;
+        }
+
+        pl->batch_size_per_pl_stage[i] = DEFAULT_BATCH_SIZE;
+        pl->steal_per_pl_stage[i] = false;
+        pl->divert_per_pl_stage[i] = false;
+        pl->idle_per_pl_stage[i] = IDLE_SPIN;
+        pl->tap_per_pl_stage[i] = false;
+        for (int k = 2; k < nb_fields; k++) {
+            if (strcmp(fields[k], PL_CONFIG_STEAL_FLAG) == 0) {
+                pl->steal_per_pl_stage[i] = true;
+                continue;
+            }
+            if (strcmp(fields[k], PL_CONFIG_DIVERT_FLAG) == 0) {
+                pl->divert_per_pl_stage[i] = true;
+                continue;
+            }
+            if (strcmp(fields[k], PL_CONFIG_TAP_FLAG) == 0) {
+                pl->tap_per_pl_stage[i] = true;
+                continue;
+            }
+            if (strcmp(fields[k], PL_CONFIG_IDLE_PAUSE_FLAG) == 0) {
+                pl->idle_per_pl_stage[i] = IDLE_PAUSE;
+                continue;
+            }
+            if (strcmp(fields[k], PL_CONFIG_IDLE_SLEEP_FLAG) == 0) {
+                pl->idle_per_pl_stage[i] = IDLE_SLEEP;
+                continue;
+            }
+            if (strcmp(fields[k], PL_CONFIG_IDLE_WAKE_FLAG) == 0) {
+                pl->idle_per_pl_stage[i] = IDLE_WAKE;
+                continue;
+            }
+            if (k != 2 || util_str_to_dec(fields[k], &val, 4) || val < 1 || val > MAX_PKTS_BURST) {
+                MEILI_LOG_ERR("Invalid batch size or flag for %s: %s.", fields[0], fields[k]);
+                ret = -EINVAL;
+                goto out;
+            }
+            pl->batch_size_per_pl_stage[i] = val;
+        }
+
+        pl->nb_pl_stages++;
+    }
+
+    if (!pl->nb_pl_stages) {
+        MEILI_LOG_ERR("No pipeline stage found in %s.", config_path);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    /* split worker cores left over by fixed stages evenly among auto stages */
+    if (nb_auto) {
+        nb_auto_inst = (run_conf->cores - 1 - nb_fixed_inst) / nb_auto;
+        nb_auto_inst = RTE_MIN(nb_auto_inst, NB_INSTANCE_PER_PIPELINE_STAGE_MAX);
+        if (nb_auto_inst < 1) {
+            MEILI_LOG_ERR("Not enough cores for auto-sized pipeline stages.");
+            ret = -EINVAL;
+            goto out;
+        }
+        for (i = 0; i < pl->nb_pl_stages; i++) {
+            if (!pl->nb_inst_per_pl_stage[i])
+                pl->nb_inst_per_pl_stage[i] = nb_auto_inst;
+        }
+    }
+
+    /* default topo: chain the stages of each tenant in the order they are listed */
+    if (!pl->nb_edges) {
+        for (i = 0; i < pl->nb_pl_stages-1; i++) {
+            if (pl->tenant_per_pl_stage[i] != pl->tenant_per_pl_stage[i+1])
+                continue;
+            pl->edges[pl->nb_edges].src = i;
+            pl->edges[pl->nb_edges].dst = i+1;
+            pl->edges[pl->nb_edges].policy = BP_BLOCK;
+            pl->edges[pl->nb_edges].tap = false;
+            pl->nb_edges++;
+        }
+    }
+
+    /* edges may only point forward, which keeps the graph acyclic */
+    for (i = 0; i < pl->nb_edges; i++) {
+        if (pl->edges[i].src < 0 || pl->edges[i].dst >= pl->nb_pl_stages
+        || pl->edges[i].src >= pl->edges[i].dst) {
+            MEILI_LOG_ERR("Invalid pipeline edge %d -> %d.", pl->edges[i].src, pl->edges[i].dst);
+            ret = -EINVAL;
+            goto out;
+        }
+        /* tenants run separate stage graphs */
+        if (pl->tenant_per_pl_stage[pl->edges[i].src] != pl->tenant_per_pl_stage[pl->edges[i].dst]) {
+            MEILI_LOG_ERR("Pipeline edge %d -> %d crosses tenants.", pl->edges[i].src, pl->edges[i].dst);
+            ret = -EINVAL;
+            goto out;
+        }
+        for (int k = 0; k < i; k++) {
+            if (pl->edges[k].src == pl->edges[i].src && pl->edges[k].dst == pl->edges[i].dst) {
+                MEILI_LOG_ERR("Duplicated pipeline edge %d -> %d.", pl->edges[i].src, pl->edges[i].dst);
+                ret = -EINVAL;
+                goto out;
+            }
+        }
+    }
+
+out:
+    fclose(config_file);
+
+    return ret;
+}
+
+/* Stages without upstream edges are fed by the main core */
+bool
+pipeline_stage_is_source(struct pipeline *pl, int stage)
+{
+    for (int i = 0; i < pl->nb_edges; i++) {
+        if (pl->edges[i].dst == stage)
+            return false;
+    }
+    return true;
+}
+
+/* Stages without downstream edges are drained by the main core */
+bool
+pipeline_stage_is_sink(struct pipeline *pl, int stage)
+{
+    for (int i = 0; i < pl->nb_edges; i++) {
+        if (pl->edges[i].src == stage)
+            return false;
+    }
+    return true;
+}
+
+/* Allocate and initialize instance inst of stage on lcore, rings are wired by the caller.
+ * The lcore is known before the app's init runs, so stage state lands on its NUMA node.
+ */
+int pipeline_stage_create(struct pipeline *pl, int stage, int inst, unsigned int lcore){
+    struct pipeline_stage *self = NULL;
+    pl_conf *run_conf = &(pl->conf);
+    char stage_type_name[32];
+    int ret;
+
+    /* allocated space for each stage */
+    self = (struct pipeline_stage *)malloc(sizeof(struct pipeline_stage));
+    if(!self){
+        return -ENOMEM;
+    }
+
+    self->pl = (void *)pl;
+    self->tenant = pl->tenant_per_pl_stage[stage];
+    self->core_id = lcore;
+    self->stage_idx = stage;
+    self->inst_idx = inst;
+
+    ret = pipeline_stage_init_safe(self, pl->stage_types[stage]);
+
+    /* ---------TODO: reload meili api functions based on control plane requirements -------------*/
+
+    if(ret){
+        GET_STAGE_TYPE_STRING(pl->stage_types[stage],stage_type_name);
+        MEILI_LOG_ERR("Initialization for %s pipeline stage failed",stage_type_name);
+        /* the app's init failed or never ran, nothing for its free to undo */
+        if(self->funcs){
+            stage_mem_release(self);
+            free(self->funcs);
+        }
+        free(self);
+        return ret;
+    }
+    self->batch_size = pl->batch_size_per_pl_stage[stage];
+    self->steal = pl->steal_per_pl_stage[stage];
+    self->pkt_verdict = MEILI_PKT_PASS;
+    self->divert_ring = pl->divert_rings[stage];
+    self->stop = 0;
+    self->prefetch_dist = run_conf->prefetch_distance;
+    self->prefetch_lines = run_conf->prefetch_lines;
+    self->tap = pl->tap_per_pl_stage[stage] ? pl->tap : NULL;
+    self->tap_skip = 0;
+    ret = idle_ctrl_init(&self->idle, pl->idle_per_pl_stage[stage], run_conf->idle_exit_us);
+    if(ret){
+        MEILI_LOG_ERR("Failed to create doorbell for stage %d", stage);
+        pipeline_stage_free_safe(self);
+        return ret;
+    }
+    batch_ctrl_init(&self->bctrl, self->batch_size, RTE_MAX(self->batch_size, MAX_ADAPTIVE_BATCH_SIZE),
+        run_conf->latency_target_us);
+    pl->stages[stage][inst] = self;
+
+    return 0;
+}
+
+int pipeline_init_safe(struct pipeline *pl, char *config_path){
     int nb_pl_stages = 0 ;
     enum pipeline_type *stage_types =NULL;
     int *nb_inst_per_pl_stage = NULL;
     struct pipeline_stage *self = NULL;
     struct pipeline_stage *child = NULL;
+    struct pipeline_edge *edge = NULL;
+    int lcore;
 
     char ring_name[64];
 
@@ -157,6 +913,15 @@ int pipeline_init_safe(struct pipeline *pl){
     /* assign initial value for each stage to NULL */
     pl->nb_pl_stages = 0;
     pl->nb_pl_stage_inst = 0;
+    pl->nb_edges = 0;
+    pl->nb_ring_in = 0;
+    pl->nb_ring_out = 0;
+    pl->dispatch = NULL;
+    pl->offload = NULL;
+    pl->tap = NULL;
+    pl->qsv = NULL;
+    pl->scale_thread_on = false;
+    memset(pl->egress, 0, sizeof(pl->egress));
     
     pl->mbuf_pool = NULL;
 
@@ -166,16 +931,35 @@ int pipeline_init_safe(struct pipeline *pl){
     memset(&pl->seq_stage, 0x00, sizeof(struct pipeline_stage));
     memset(&pl->reorder_stage, 0x00, sizeof(struct pipeline_stage));
 
+    /* nothing is admitted against credits until dispatch is set up */
+    pl->credits = 0;
+    pl->nb_inflight = 0;
+    pl->nb_exited = 0;
+
 
     char pool_name[50];
-    char stage_type_name[32];
 
     int ret = 0;
     MEILI_LOG_INFO("Starting pipeline initialization...");
     /* ---------------control plane specified values------------------ */
-    pl->nb_pl_stages = 1;
-    pl->stage_types[0] = PL_MAIN;
-    pl->nb_inst_per_pl_stage[0] = run_conf->cores-1;
+    ret = pipeline_conf_parse(pl, config_path);
+    if(ret){
+        MEILI_LOG_ERR("Failed to parse pipeline config %s", config_path);
+        return ret;
+    }
+
+    ret = tenant_resolve(pl);
+    if(ret){
+        return ret;
+    }
+
+    /* one instance of every stage per worker */
+    if(run_conf->exec_model == EXEC_MODEL_RTC){
+        ret = run_rtc_check(pl);
+        if(ret){
+            return ret;
+        }
+    }
 
     nb_pl_stages = pl->nb_pl_stages;
     stage_types = pl->stage_types;
@@ -183,7 +967,8 @@ int pipeline_init_safe(struct pipeline *pl){
     
     
     /* Allocate space for mempool if using local run mode */
-    if(run_conf->input_mode != INPUT_TEXT_FILE && run_conf->input_mode != INPUT_PCAP_FILE){
+    if(run_conf->input_mode != INPUT_TEXT_FILE && run_conf->input_mode != INPUT_PCAP_FILE &&
+       run_conf->input_mode != INPUT_JOB_FORMAT && run_conf->input_mode != INPUT_REMOTE_MMAP){
         pl->mbuf_pool = NULL;
     }
     else{
@@ -198,6 +983,12 @@ int pipeline_init_safe(struct pipeline *pl){
         }
     }
 
+    /* instances pick up the tap when they are created */
+    ret = tap_init(pl);
+    if(ret){
+        return ret;
+    }
+
     /*----------------------------Start of per-stage initialization----------------------------------------*/
     /* Print initialization info beforehand */
     MEILI_LOG_INFO("Initializing pipeline stages...");
@@ -207,6 +998,14 @@ int pipeline_init_safe(struct pipeline *pl){
         return -EINVAL;
     }
 
+    /* pick lcores while creating instances, so stage state and rings land on the NUMA node of their user */
+    if(run_conf->exec_model != EXEC_MODEL_RTC){
+        ret = placement_init(pl);
+        if(ret){
+            return ret;
+        }
+    }
+
     /* Init each stage */
     for(int i=0; i<nb_pl_stages ; i++){
 
@@ -214,31 +1013,47 @@ int pipeline_init_safe(struct pipeline *pl){
         || nb_inst_per_pl_stage[i] < 0){
             return -EINVAL;
         }
+
+        /* all instances of a stage share one divert ring for filtered packets, drained outside the pipeline */
+        pl->divert_rings[i] = NULL;
+        pl->handoff_rings[i] = NULL;
+        if(pl->divert_per_pl_stage[i]){
+            snprintf(ring_name,64,"divert_ring_%d", i);
+            pl->divert_rings[i] = rte_ring_create(ring_name, RING_SIZE, rte_socket_id(), RING_F_SC_DEQ);
+            if(!pl->divert_rings[i]){
+                return -ENOMEM;
+            }
+        }
         
         for(int j=0; j<nb_inst_per_pl_stage[i]; j++){
-             /* allocated space for each stage */
-            self = (struct pipeline_stage *)malloc(sizeof(struct pipeline_stage));
-            
-            self->pl = (void *)pl;
-
-            ret = pipeline_stage_init_safe(self, stage_types[i]);
-
-            /* ---------TODO: reload meili api functions based on control plane requirements -------------*/
-
+            if(run_conf->exec_model == EXEC_MODEL_RTC){
+                lcore = run_rtc_pick(j);
+            }
+            else{
+                lcore = placement_pick(pl, i);
+            }
+            if(lcore < 0){
+                return lcore;
+            }
+            ret = pipeline_stage_create(pl, i, j, lcore);
             if(ret){
-                GET_STAGE_TYPE_STRING(stage_types[i],stage_type_name);
-                MEILI_LOG_ERR("Initialization for %s pipeline stage failed",stage_type_name);
                 return ret;
             }
-            pl->stages[i][j] = self;
-            
         }
         pl->nb_pl_stage_inst += nb_inst_per_pl_stage[i];
     }
 
+    if(run_conf->exec_model == EXEC_MODEL_RTC){
+        run_rtc_print(pl);
+    }
+    else{
+        placement_print(pl);
+    }
+
     /* Init special stages: timestamping start/end, sequencing and reordering */
     pl->seq_stage.type = PL_MAIN;
     pl->reorder_stage.type = PL_MAIN;
+    pl->reorder_stage.pl = (void *)pl;
 
     ret = pkt_ts_init(&pl->ts_start_offset);
 	if(ret){
@@ -253,6 +1068,12 @@ int pipeline_init_safe(struct pipeline *pl){
 	if(ret){
 		return -EINVAL;
 	}
+    if(run_conf->reorder_bypass){
+        ret = seq_set_bypass(&pl->seq_stage, run_conf->reorder_bypass);
+        if(ret){
+            return ret;
+        }
+    }
 	ret = reorder_init(&pl->reorder_stage);
 	if(ret){
 		return -EINVAL;
@@ -260,12 +1081,29 @@ int pipeline_init_safe(struct pipeline *pl){
 
     MEILI_LOG_INFO("Seq and reorder initialized");
 
+    /* workers poll the NIC and run every stage themselves, there are no rings to build */
+    if(run_conf->exec_model == EXEC_MODEL_RTC){
+        return 0;
+    }
+
     /*----------------------------End of per-stage initialization----------------------------------------*/
 
     /*----------------------------Start of topology construction-----------------------------------------*/
     /* Create head ring_in/tail ring_out for PL. Rings are shared. */
     #ifdef SHARED_BUFFER
     MEILI_LOG_INFO("Using shared ring buffer for inter-core communication");
+    /* shared rings only support a chain of stages */
+    for(int i=0; i<pl->nb_edges; i++){
+        if(pl->edges[i].src != i || pl->edges[i].dst != i+1){
+            MEILI_LOG_ERR("Shared ring buffer only supports chained pipeline stages");
+            return -ENOTSUP;
+        }
+        if(pl->edges[i].policy != BP_BLOCK){
+            MEILI_LOG_ERR("Shared ring buffer only supports the block backpressure policy");
+            return -ENOTSUP;
+        }
+    }
+
     pl->ring_in = rte_ring_create("head_ring_in", RING_SIZE, rte_socket_id(),RING_F_SP_ENQ | RING_F_MC_HTS_DEQ);
     /* another mode of shared rte ring */
     //pl->ring_in = rte_ring_create("head_ring_in", RING_SIZE, rte_socket_id(),RING_F_SP_ENQ | RING_F_MC_RTS_DEQ);
@@ -273,6 +1111,8 @@ int pipeline_init_safe(struct pipeline *pl){
     if(!pl->ring_in){
         return -ENOMEM;
     }
+    pl->nb_ring_in = 1;
+    pl->nb_ring_out = 1;
 
     if(nb_pl_stages == 0){
         /* no worker stages */
@@ -308,31 +1148,57 @@ int pipeline_init_safe(struct pipeline *pl){
             return -ENOMEM;
         }
         pl->ring_out[0] = pl->ring_in[0];
+        pl->ring_in_consumer[0] = NULL;
+        pl->nb_ring_in = 1;
+        pl->nb_ring_out = 1;
     }
     else{
-        /* connect head ring_in to first stages */
-        for(int j=0; j<nb_inst_per_pl_stage[0]; j++){
-            snprintf(ring_name,64,"head_ring_in_%d", j);
-            pl->ring_in[j] = rte_ring_create(ring_name, RING_SIZE, rte_socket_id(),RING_F_SP_ENQ | RING_F_SC_DEQ);
-    
-            if(!pl->ring_in[j]){
-                return -ENOMEM;
+        /* connect head ring_in to every instance of source stages */
+        for(int i=0; i<nb_pl_stages; i++){
+            if(!pipeline_stage_is_source(pl, i)){
+                continue;
+            }
+            if(pl->steal_per_pl_stage[i] && run_conf->dispatch_mode == DISPATCH_FLOW_HASH){
+                MEILI_LOG_WARN("Stage %d steals bursts, flows reaching it are not kept on one instance", i);
+            }
+            for(int j=0; j<nb_inst_per_pl_stage[i]; j++){
+                if(pl->nb_ring_in >= NB_MAX_RING){
+                    MEILI_LOG_ERR("Too many source stage instances, max %d", NB_MAX_RING);
+                    return -EINVAL;
+                }
+                snprintf(ring_name,64,"head_ring_in_%d", pl->nb_ring_in);
+                self = pl->stages[i][j];
+                pl->ring_in[pl->nb_ring_in] = rte_ring_create(ring_name, RING_SIZE, placement_socket(self),RING_F_SP_ENQ | pipeline_ring_deq_flags(self));
+                if(!pl->ring_in[pl->nb_ring_in]){
+                    return -ENOMEM;
+                }
+                self->ring_in[self->nb_ring_in] = pl->ring_in[pl->nb_ring_in];
+                self->nb_ring_in++;
+                pl->ring_in_consumer[pl->nb_ring_in] = self;
+                pl->nb_ring_in++;
             }
-            self = pl->stages[0][j];
-            self->ring_in[0] = pl->ring_in[j];
-            self->nb_ring_in++;
         }
 
-        /* connect tail ring_out to last stages */
-        for(int j=0; j<nb_inst_per_pl_stage[nb_pl_stages-1]; j++){
-            snprintf(ring_name,64,"tail_ring_out_%d", j);
-            pl->ring_out[j] = rte_ring_create(ring_name, RING_SIZE, rte_socket_id(), RING_F_SP_ENQ | RING_F_SC_DEQ);
-            if(!pl->ring_out[j]){
-                return -ENOMEM;
+        /* connect tail ring_out to every instance of sink stages */
+        for(int i=0; i<nb_pl_stages; i++){
+            if(!pipeline_stage_is_sink(pl, i)){
+                continue;
+            }
+            for(int j=0; j<nb_inst_per_pl_stage[i]; j++){
+                if(pl->nb_ring_out >= NB_MAX_RING){
+                    MEILI_LOG_ERR("Too many sink stage instances, max %d", NB_MAX_RING);
+                    return -EINVAL;
+                }
+                snprintf(ring_name,64,"tail_ring_out_%d", pl->nb_ring_out);
+                pl->ring_out[pl->nb_ring_out] = rte_ring_create(ring_name, RING_SIZE, rte_socket_id(), RING_F_SP_ENQ | RING_F_SC_DEQ);
+                if(!pl->ring_out[pl->nb_ring_out]){
+                    return -ENOMEM;
+                }
+                self = pl->stages[i][j];
+                self->ring_out[self->nb_ring_out] = pl->ring_out[pl->nb_ring_out];
+                self->nb_ring_out++;
+                pl->nb_ring_out++;
             }
-            self = pl->stages[nb_pl_stages-1][j];
-            self->ring_out[0] = pl->ring_out[j];
-            self->nb_ring_out++;
         }
     }
     #endif
@@ -392,28 +1258,62 @@ int pipeline_init_safe(struct pipeline *pl){
     
     #else
     /* Separate rings. */
-    /* Queues are all sp/sc, so we adopt fully connected topo for (n,m) */
-    /* TODO(optional): when assigning cores to workers, take into consideration the microarch, i.e., core 2 and core 3 worker should have connection.  */
-    /* create i+1 ring_in, and put these rings into i ring_out */
-    for(int i=0; i<nb_pl_stages-1 ; i++){
+    /* Queues are all sp/sc, so we adopt fully connected topo for (n,m) instances on each edge */
+    /* A stage with several downstream edges spreads its output over all of them */
+    /* Instances got their lcore when created, rings are allocated on the consumer's NUMA node */
+    for(int e=0; e<pl->nb_edges ; e++){
+        edge = &pl->edges[e];
+
+        edge->retired_full_cnt = 0;
+        edge->retired_drop_cnt = 0;
+
+        /* overflow of every ring on this edge goes to one ring read by all downstream instances */
+        edge->spill_ring = NULL;
+        if(edge->policy == BP_SPILL){
+            snprintf(ring_name,64,"spill_ring_%d_%d", edge->src, edge->dst);
+            edge->spill_ring = rte_ring_create(ring_name, RING_SIZE, placement_socket(pl->stages[edge->dst][0]), 0);
+            if(!edge->spill_ring){
+                return -ENOMEM;
+            }
+        }
 
-        for(int j=0; j<nb_inst_per_pl_stage[i]; j++){
-            self = pl->stages[i][j];
-            for(int k=0; k<nb_inst_per_pl_stage[i+1]; k++){
-                child = pl->stages[i+1][k];
-                snprintf(ring_name,64,"inter_worker_ring_%d_%d_%d_%d", i, i+1, j, k);
+        for(int j=0; j<nb_inst_per_pl_stage[edge->src]; j++){
+            self = pl->stages[edge->src][j];
+            for(int k=0; k<nb_inst_per_pl_stage[edge->dst]; k++){
+                child = pl->stages[edge->dst][k];
+                if(self->nb_ring_out >= NB_MAX_RING || child->nb_ring_in >= NB_MAX_RING){
+                    MEILI_LOG_ERR("Too many rings for edge %d -> %d, max %d per instance", edge->src, edge->dst, NB_MAX_RING);
+                    return -EINVAL;
+                }
+                snprintf(ring_name,64,"inter_worker_ring_%d_%d_%d_%d", edge->src, edge->dst, j, k);
                 //debug
                 MEILI_LOG_INFO("creating inter-stage buffer:%s",ring_name);
-                self->ring_out[self->nb_ring_out] = rte_ring_create(ring_name, RING_SIZE, rte_socket_id(),RING_F_SP_ENQ | RING_F_SC_DEQ);
-                if (self->ring_out == NULL){
+                self->ring_out[self->nb_ring_out] = rte_ring_create(ring_name, RING_SIZE, placement_socket(child),RING_F_SP_ENQ | pipeline_ring_deq_flags(child));
+                if (self->ring_out[self->nb_ring_out] == NULL){
                     return -ENOMEM;
                 }
                 
                 child->ring_in[child->nb_ring_in] = self->ring_out[self->nb_ring_out];
+                self->out_policy[self->nb_ring_out] = edge->policy;
+                self->out_spill[self->nb_ring_out] = edge->spill_ring;
+                self->out_edge[self->nb_ring_out] = e;
+                self->out_wake[self->nb_ring_out] = &child->idle;
+                self->out_tap[self->nb_ring_out] = tap_edge(pl, self, e);
                 self->nb_ring_out++;
                 child->nb_ring_in++;
             }
         }
+
+        if(edge->spill_ring){
+            for(int k=0; k<nb_inst_per_pl_stage[edge->dst]; k++){
+                child = pl->stages[edge->dst][k];
+                if(child->nb_ring_in >= NB_MAX_RING){
+                    MEILI_LOG_ERR("No room for spill ring of edge %d -> %d, max %d rings per instance", edge->src, edge->dst, NB_MAX_RING);
+                    return -EINVAL;
+                }
+                child->ring_in[child->nb_ring_in++] = edge->spill_ring;
+            }
+        }
     }
     #endif
 
@@ -421,14 +1321,14 @@ int pipeline_init_safe(struct pipeline *pl){
 
     /* Print pipeline topology */
     MEILI_LOG_INFO("Pipeline stages initialized");
-    MEILI_LOG_INFO("Total %d stage(s)", nb_pl_stages);
-    printf("%8s %16s %16s %16s %16s\n","Stage","Type","# Instance","# RING_IN","# RING_OUT");
+    MEILI_LOG_INFO("Total %d stage(s), %d edge(s)", nb_pl_stages, pl->nb_edges);
+    printf("%8s %16s %16s %16s %16s %16s\n","Stage","Type","# Instance","Batch Size","# RING_IN","# RING_OUT");
     #ifdef SHARED_BUFFER
     for(int i=0; i<nb_pl_stages; i++){
         self = pl->stages[i][0];
         printf("%8d ", i);
         PRINT_STAGE_TYPE(stage_types[i]);
-        printf("%16d %16d %16d\n", nb_inst_per_pl_stage[i], 1, 1);
+        printf("%16d %16d %16d %16d\n", nb_inst_per_pl_stage[i], self->batch_size, 1, 1);
         
     }
     #else
@@ -436,20 +1336,40 @@ int pipeline_init_safe(struct pipeline *pl){
         self = pl->stages[i][0];
         printf("%8d ", i);
         PRINT_STAGE_TYPE(stage_types[i]);
-        printf("%16d %16d %16d\n", nb_inst_per_pl_stage[i], 1, 1);
+        printf("%16d %16d %16d %16d\n", nb_inst_per_pl_stage[i], self->batch_size, self->nb_ring_in, self->nb_ring_out);
         
     }
     #endif
+    for(int e=0; e<pl->nb_edges; e++){
+        printf("%8s %d -> %d (%s)\n", "Edge", pl->edges[e].src, pl->edges[e].dst, bp_policy_names[pl->edges[e].policy]);
+    }
+
+    pl->credits = run_conf->pipeline_credits;
+    pl->nb_inflight = 0;
+
+    ret = dispatch_init(pl);
+    if(ret){
+        return ret;
+    }
+
+    ret = offload_init(pl);
+    if(ret){
+        return ret;
+    }
+
+    ret = scale_init(pl);
+    if(ret){
+        return ret;
+    }
 
     return 0;
 }
 
 /* REGISTER FUNCTION HERE */
 int pipeline_stage_register_safe(struct pipeline_stage *self, enum pipeline_type pp_type){
-    /* register all functions for this pipeline */
-    meili_pipeline_stage_func_reg(self);
-
-    return -EINVAL;
+    /* register the functions of the app this stage's tenant runs, pp_type is only a label the app may
+       switch on through self->type, there are no per type implementations to bind */
+    return meili_pipeline_stage_func_reg(self);
 }
 
 
@@ -467,7 +1387,7 @@ int pipeline_stage_register_safe(struct pipeline_stage *self, enum pipeline_type
 
 /*  pipeline_stage_init_safe
  *  - allocate space for and initialize some fields of a pipeline_stage structure
- *  - fields that are not initalized here: core_id(init before launching), worker_qid(init before launching), pl(init by pipeline topo init)
+ *  - fields that are not initalized here: core_id(init by pipeline_stage_create), worker_qid(init before launching), pl(init by pipeline topo init)
  */
 int pipeline_stage_init_safe(struct pipeline_stage *self, enum pipeline_type pp_type){
     
@@ -490,9 +1410,23 @@ int pipeline_stage_init_safe(struct pipeline_stage *self, enum pipeline_type pp_
     self->nb_ring_in = 0;
     self->nb_ring_out = 0;
     #endif
+    for(int r=0; r<NB_MAX_RING; r++){
+        self->out_policy[r] = BP_BLOCK;
+        self->out_spill[r] = NULL;
+        self->out_edge[r] = -1;
+        self->out_full_cnt[r] = 0;
+        self->out_drop_cnt[r] = 0;
+        self->out_wake[r] = NULL;
+        self->out_tap[r] = NULL;
+    }
+    self->idle.efd = -1;
+    stage_mem_init(self);
 
     /* register functions for this stage */
-    pipeline_stage_register_safe(self, pp_type);
+    ret = pipeline_stage_register_safe(self, pp_type);
+    if (ret){
+        return ret;
+    }
 
     /* type-specific initialization */
 	if (funcs->pipeline_stage_init){
@@ -516,6 +1450,8 @@ int pipeline_stage_free_safe(struct pipeline_stage *self){
         return -EINVAL;
     }
 
+    stage_mem_release(self);
+    idle_ctrl_free(&self->idle);
     free(self->funcs);
     /* we assume all pp stages are allocated using malloc */
     free(self);
@@ -532,6 +1468,75 @@ int pipeline_stage_free_safe(struct pipeline_stage *self){
 		
 }
 
+/* Sum per-ring backpressure counters of the source instances of each edge */
+void pipeline_edge_stats_print(struct pipeline *pl){
+    struct pipeline_stage *self;
+    uint64_t full_cnt;
+    uint64_t drop_cnt;
+
+    if(!pl->nb_edges){
+        return;
+    }
+
+    printf("%8s %16s %16s %16s\n","Edge","Policy","Full Events","Dropped");
+    for(int e=0; e<pl->nb_edges; e++){
+        full_cnt = pl->edges[e].retired_full_cnt;
+        drop_cnt = pl->edges[e].retired_drop_cnt;
+        for(int j=0; j<pl->nb_inst_per_pl_stage[pl->edges[e].src]; j++){
+            self = pl->stages[pl->edges[e].src][j];
+            for(int r=0; r<self->nb_ring_out; r++){
+                if(self->out_edge[r] != e){
+                    continue;
+                }
+                full_cnt += self->out_full_cnt[r];
+                drop_cnt += self->out_drop_cnt[r];
+            }
+        }
+        printf("%4d->%-3d %16s %16lu %16lu\n", pl->edges[e].src, pl->edges[e].dst,
+            bp_policy_names[pl->edges[e].policy], full_cnt, drop_cnt);
+    }
+}
+
+/* Take up to nb_pkts packets filtered by the divert stage, for a slow path outside the pipeline.
+ * Divert rings are single consumer: one thread per stage, the caller owns the packets it gets.
+ * While nobody reads the ring, filtered packets past its size are freed by the stage.
+ */
+int
+pipeline_divert_dequeue(struct pipeline *pl, int stage, struct rte_mbuf **mbufs, unsigned int nb_pkts)
+{
+    if(stage < 0 || stage >= pl->nb_pl_stages){
+        return -EINVAL;
+    }
+    if(!pl->divert_rings[stage]){
+        return -ENOENT;
+    }
+    return rte_ring_dequeue_burst(pl->divert_rings[stage], (void **)mbufs, nb_pkts, NULL);
+}
+
+/* packets still diverted at exit go back to the pool with their ring */
+static void
+pipeline_divert_free(struct pipeline *pl)
+{
+    struct rte_mbuf *mbufs[DEFAULT_BATCH_SIZE];
+    uint64_t nb_left = 0;
+    int nb_deq;
+
+    for(int i=0; i<pl->nb_pl_stages; i++){
+        if(!pl->divert_rings[i]){
+            continue;
+        }
+        while((nb_deq = pipeline_divert_dequeue(pl, i, mbufs, DEFAULT_BATCH_SIZE)) > 0){
+            rte_pktmbuf_free_bulk(mbufs, nb_deq);
+            nb_left += nb_deq;
+        }
+        rte_ring_free(pl->divert_rings[i]);
+        pl->divert_rings[i] = NULL;
+    }
+    if(nb_left){
+        MEILI_LOG_INFO("%lu diverted packets were never dequeued", nb_left);
+    }
+}
+
 int pipeline_free(struct pipeline *pl){
     int nb_pl_stages = pl->nb_pl_stages;
     enum pipeline_type *stage_types = pl->stage_types;
@@ -551,6 +1556,13 @@ int pipeline_free(struct pipeline *pl){
         }
     }
 
+    dispatch_free(pl);
+    offload_free(pl);
+    scale_free(pl);
+    egress_free(pl);
+    tap_free(pl);
+    pipeline_divert_free(pl);
+
     /* free stage-specific states */
     seq_free(&pl->seq_stage);
     reorder_free(&pl->reorder_stage);
@@ -577,7 +1589,12 @@ launch_worker(void *args)
     
     MEILI_LOG_INFO("worker qid %d on socket %d launched",self->worker_qid, rte_socket_id());
 	/* Kick off a pipeline stage thread for this worker. */
-    ret = pipeline_stage_run_safe(self);
+    if(((struct pipeline *)self->pl)->conf.exec_model == EXEC_MODEL_RTC){
+        ret = run_rtc_worker(self);
+    }
+    else{
+        ret = pipeline_stage_run_safe(self);
+    }
 
     //printf("worker finished\n");
 
@@ -585,6 +1602,30 @@ launch_worker(void *args)
 }
 
 
+/* Start an instance on its lcore, its stats are recorded in queue worker_qid */
+int pipeline_stage_launch(struct pipeline_stage *self, int worker_qid){
+    struct pipeline *pl = (struct pipeline *)self->pl;
+    rb_stats_t *stats = pl->conf.stats;
+    unsigned int lcore_id = self->core_id;
+    int ret = 0;
+
+    stats->rm_stats[worker_qid].lcore_id = lcore_id;
+    stats->rm_stats[worker_qid].self = self;
+    stats->rm_stats[worker_qid].stage_type = self->type;
+
+    self->worker_qid = worker_qid;
+
+    #ifndef BASELINE_MODE
+    MEILI_LOG_INFO("starting core %d, worker_qid %d", lcore_id, self->worker_qid);
+    ret = rte_eal_remote_launch(launch_worker, self, lcore_id);
+    if(ret){
+        MEILI_LOG_ERR("Failed to launch core %d, worker_qid %d", lcore_id, self->worker_qid);
+    }
+    #endif
+
+    return ret;
+}
+
 int pipeline_post_search(struct pipeline *pl){
     struct pipeline_stage *seq_stage;
 	struct pipeline_stage *reorder_stage = &pl->reorder_stage;
@@ -598,7 +1639,7 @@ int pipeline_post_search(struct pipeline *pl){
 	int nb_deq;
 
     int ring_out_index = 0;
-    int nb_ring_out = pl->nb_inst_per_pl_stage[pl->nb_pl_stages-1];
+    int nb_ring_out = pl->nb_ring_out;
 
     /* flush all packets from the pipeline */
     while(batch_cnt != 0){
@@ -654,11 +1695,22 @@ int pipeline_run(struct pipeline *pl){
     // launch workers and main core
     MEILI_LOG_INFO("Total cores: %d", conf->cores);
     MEILI_LOG_INFO("Total stage instances: %d", pl->nb_pl_stage_inst);
-    if (pl->nb_pl_stage_inst >= conf->cores){
+    if (conf->exec_model != EXEC_MODEL_RTC && pl->nb_pl_stage_inst >= conf->cores){
         MEILI_LOG_ERR("Not enough cores for workers");
         return -EINVAL; 
     }
 
+    /* the writer outlives the workers and drains what they captured */
+    ret = tap_start(pl);
+    if(ret){
+        return ret;
+    }
+    if (conf->exec_model == EXEC_MODEL_RTC){
+        ret = run_rtc_launch(pl);
+        tap_stop(pl);
+        return ret;
+    }
+
     run_conf->running = true;
 
     // allocate core for each pipeline stage
@@ -666,31 +1718,15 @@ int pipeline_run(struct pipeline *pl){
     // worker_qid - the id of stats recording
     worker_qid = 1;
     
-    RTE_LCORE_FOREACH_WORKER(lcore_id) {
-
-        if(i >= nb_pl_stages){
-            printf("Lcores more than # of PL stages\n");
-            break;
-        }
-
+    /* lcores were picked by placement_init() */
+    while(i < nb_pl_stages) {
         self = pl->stages[i][j];
 
-		stats->rm_stats[worker_qid].lcore_id = lcore_id;
-        stats->rm_stats[worker_qid].self = self;
-
-		self->core_id = lcore_id;
-        self->worker_qid = worker_qid;
-
-
-        worker_qid++;
-        #ifndef BASELINE_MODE
-        MEILI_LOG_INFO("starting core %d, worker_qid %d", lcore_id, self->worker_qid);
-		ret = rte_eal_remote_launch(launch_worker, self, lcore_id);
+        ret = pipeline_stage_launch(self, worker_qid);
         if(ret){
-            MEILI_LOG_ERR("Failed to launch core %d, worker_qid %d", lcore_id, self->worker_qid);
             goto post_run;
         }
-        #endif
+        worker_qid++;
 
         /* launch next pl stage */
         j++;
@@ -705,6 +1741,14 @@ int pipeline_run(struct pipeline *pl){
 	/* traffic is always received on main core and can be split to other cores */
 
     stats->rm_stats[0].self = &pl->seq_stage;
+    stats->rm_stats[0].stage_type = pl->seq_stage.type;
+
+    /* the main core reads the head and tail ring arrays as well */
+    scale_register(pl, rte_get_main_lcore());
+    ret = scale_ctrl_start(pl);
+    if(ret){
+        goto post_run;
+    }
 
     MEILI_LOG_INFO("Starting on main core...");
     ret = run_mode_launch(pl);
@@ -715,6 +1759,10 @@ post_run:
     /* set running flag to false to notice all workers of end of run */
     run_conf->running = false;
 
+    /* a rescale in progress may be waiting for the main core */
+    scale_unregister(pl, rte_get_main_lcore());
+    scale_ctrl_stop(pl);
+
 	if (ret) {
         MEILI_LOG_ERR("Failure in run mode");
 	}
@@ -733,6 +1781,7 @@ post_run:
             MEILI_LOG_ERR("Lcore %u returned a runtime error", lcore_id);
         }		
 	}
+    tap_stop(pl);
 
     return ret;
 }
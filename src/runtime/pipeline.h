@@ -4,6 +4,9 @@
 #define _INCLUDE_PIPELINE_H
 
 #include <rte_mbuf.h>
+#include <rte_ring.h>
+#include <rte_rcu_qsbr.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <resolv.h>
 #include <sys/epoll.h>
@@ -13,6 +16,12 @@
 
 #include "../lib/net/meili_pkt.h"
 
+#include "batch_ctrl.h"
+#include "idle.h"
+#include "tenant.h"
+#include "stage_mem.h"
+#include "egress.h"
+
 
 #define MEILI_MAX_EPOLL_EVENTS 1024
 #define MEILI_EPOLL_TIMEOUT 1024
@@ -29,6 +38,7 @@
 #define NB_MAX_RING 16
 #define MAX_PKTS_BURST 8192
 #define RING_SIZE 8192
+#define MAX_ADAPTIVE_BATCH_SIZE 1024    /* upper bound the batch controller grows a stage batch to */
 
 // /* Note that when batch size of pipeline processing is too small, sending rate can not be high or mbuf pool of rx/tx queue is not big enough */
 // /* for example, 1500 byte pkt will trigger this issue with 1Kpps */
@@ -37,6 +47,7 @@
 /* pl stage macros */
 #define NB_PIPELINE_STAGE_MAX 8
 #define NB_INSTANCE_PER_PIPELINE_STAGE_MAX 8
+#define NB_PIPELINE_EDGE_MAX (NB_PIPELINE_STAGE_MAX*NB_PIPELINE_STAGE_MAX)
 
 /* error message macros */
 #define ERR_STR_SIZE 50
@@ -44,6 +55,22 @@
 /* pl topo */
 #define CONFIG_BUF_LEN 512
 #define PL_CONFIG_PATH "./src/pl.conf"
+#define PL_CONFIG_EDGE_KEY "EDGE"
+#define PL_CONFIG_AUTO_INST "auto"
+#define PL_CONFIG_STEAL_FLAG "steal"
+#define PL_CONFIG_DIVERT_FLAG "divert"
+#define PL_CONFIG_IDLE_PAUSE_FLAG "idle_pause"
+#define PL_CONFIG_IDLE_SLEEP_FLAG "idle_sleep"
+#define PL_CONFIG_IDLE_WAKE_FLAG "idle_wake"
+#define PL_CONFIG_TAP_FLAG "tap"
+#define PL_CONFIG_MAX_FIELDS 16
+
+/* backpressure: with the prio policy packets at or above this DSCP are never dropped */
+#define BP_PRIO_DSCP_MIN 32
+
+/* work stealing between instances of the same stage */
+#define STEAL_IDLE_ROUNDS 4         /* empty polls over all own rings before looking at siblings */
+#define STEAL_MIN_BACKLOG 2         /* victim ring must hold more than this many bursts */
 
 
 enum pipeline_type {
@@ -145,15 +172,45 @@ enum pipeline_type {
                                     else if(strcmp(x,"PL_MAIN")==0)                 {*y = PL_MAIN;}\
                                     else{*y = -1;}
 
+/* what a stage does with packets that do not fit in a full output ring, set per edge in pl.conf */
+enum pipeline_bp_policy {
+    BP_BLOCK,                   /* spin until the downstream instance makes room */
+    BP_TAIL_DROP,               /* free what does not fit */
+    BP_PRIO_DROP,               /* free low priority packets, spin on the rest */
+    BP_SPILL,                   /* move the overflow to a ring shared by all downstream instances */
+};
+
+/* per-packet verdict of Meili.pkt_flt */
+enum meili_pkt_verdict {
+    MEILI_PKT_PASS,
+    MEILI_PKT_DROP,
+};
+
+struct pipeline_tap;
+
 struct pipeline_stage{
     void *apis;
 
     enum pipeline_type type;    /* stage workload type */
     //bool push_batch;
     void *state;                /* stage private state */
+    struct stage_mem mem;       /* state allocated through Meili.state_alloc */
     int core_id;                /* stage core id */
     int worker_qid;             /* stage qid */
     int batch_size;             /* stage batch size */
+    int stage_idx;              /* index of the stage this instance belongs to */
+    int inst_idx;               /* index of this instance within its stage */
+    int tenant;                 /* index of the tenant whose app this instance runs */
+    bool steal;                 /* take bursts from siblings' ring_in when idle, stateless stages only */
+    struct batch_ctrl bctrl;    /* adapts batch_size at runtime when a latency target is set */
+    enum meili_pkt_verdict pkt_verdict; /* verdict of the packet being executed */
+    struct rte_ring *divert_ring;       /* filtered packets go here instead of being freed, optional */
+    struct idle_ctrl idle;              /* backoff while input rings are empty */
+    uint32_t stop;                      /* leave the run loop, set when the instance is scaled in */
+    int prefetch_dist;                  /* packets ahead whose payload is prefetched, 0 disables */
+    int prefetch_lines;                 /* payload cache lines prefetched per packet */
+    struct pipeline_tap *tap;           /* pcapng capture of what the stage emits or drops, NULL if not tapped */
+    uint32_t tap_skip;                  /* packets to go before the next one is captured */
 
     #ifdef SHARED_BUFFER 
     /* i/o buffer */
@@ -167,6 +224,15 @@ struct pipeline_stage{
     int nb_ring_out;
     #endif
 
+    /* backpressure of each ring_out */
+    enum pipeline_bp_policy out_policy[NB_MAX_RING];
+    struct rte_ring *out_spill[NB_MAX_RING];   /* overflow ring with BP_SPILL */
+    int out_edge[NB_MAX_RING];                 /* edge index, -1 for tail rings */
+    uint64_t out_full_cnt[NB_MAX_RING];        /* bursts that found the ring full */
+    uint64_t out_drop_cnt[NB_MAX_RING];        /* packets dropped by the policy */
+    struct idle_ctrl *out_wake[NB_MAX_RING];   /* doorbell of the consumer, NULL if there is none to ring */
+    struct pipeline_tap *out_tap[NB_MAX_RING]; /* capture of a tapped edge, NULL if not tapped or the stage is */
+
     /* socket processing */
     int sockfd;
     int epfd;
@@ -188,15 +254,46 @@ struct pipeline_stage{
 };
 
 
+struct pipeline_dispatch;
+
+/* directed edge between two pipeline stages, all instances of src are connected to all instances of dst */
+struct pipeline_edge{
+    int src;                    /* index of upstream stage */
+    int dst;                    /* index of downstream stage */
+    enum pipeline_bp_policy policy;
+    bool tap;                   /* with --tap, what src puts on the edge or loses to it is captured */
+    struct rte_ring *spill_ring;/* shared overflow ring with BP_SPILL */
+    uint64_t retired_full_cnt;  /* backpressure counters of rings removed at runtime */
+    uint64_t retired_drop_cnt;
+};
+
 /* pipeline */
 struct pipeline{
     /* fields for pipeline information */
     struct pipeline_stage *stages[NB_PIPELINE_STAGE_MAX][NB_INSTANCE_PER_PIPELINE_STAGE_MAX]; 
     enum pipeline_type stage_types[NB_PIPELINE_STAGE_MAX];
     int nb_inst_per_pl_stage[NB_PIPELINE_STAGE_MAX];
+    int batch_size_per_pl_stage[NB_PIPELINE_STAGE_MAX];
+    bool steal_per_pl_stage[NB_PIPELINE_STAGE_MAX];
+    bool divert_per_pl_stage[NB_PIPELINE_STAGE_MAX];
+    struct rte_ring *divert_rings[NB_PIPELINE_STAGE_MAX];
+    enum idle_level idle_per_pl_stage[NB_PIPELINE_STAGE_MAX];
+    bool tap_per_pl_stage[NB_PIPELINE_STAGE_MAX];
+    int tenant_per_pl_stage[NB_PIPELINE_STAGE_MAX];
     int nb_pl_stages;
     int nb_pl_stage_inst;
 
+    /* tenants sharing the main core and their classifier rules, see tenant.c */
+    struct pipeline_tenant tenants[NB_TENANT_MAX];
+    int nb_tenants;
+    struct tenant_rule rules[NB_TENANT_RULE_MAX];
+    int nb_rules;
+    int default_tenant;         /* takes packets no rule matches, -1 to drop them */
+
+    /* stage graph read from pl.conf */
+    struct pipeline_edge edges[NB_PIPELINE_EDGE_MAX];
+    int nb_edges;
+
     /* mempool for storing preloaded mbufs in preloaded mode */
     struct rte_mempool *mbuf_pool;
 
@@ -209,6 +306,32 @@ struct pipeline{
     struct rte_ring *ring_in[NB_MAX_RING];
 	struct rte_ring *ring_out[NB_MAX_RING];
     #endif
+    int nb_ring_in;             /* # of head rings (instances of source stages) */
+    struct pipeline_stage *ring_in_consumer[NB_MAX_RING]; /* instance reading each head ring */
+    int nb_ring_out;            /* # of tail rings (instances of sink stages) */
+
+    /* distributes main core bursts over head rings */
+    struct pipeline_dispatch *dispatch;
+
+    /* steers flows to a peer instance under load, NULL without offload, see offload.c */
+    struct pipeline_offload *offload;
+
+    /* captures stage output and drops to --tap, NULL without it, see tap.c */
+    struct pipeline_tap *tap;
+
+    /* online scaling, see scale.c */
+    struct rte_rcu_qsbr *qsv;   /* lcores reading the ring arrays, NULL when scaling is off */
+    struct rte_ring *handoff_rings[NB_PIPELINE_STAGE_MAX]; /* packets left by removed instances, read by all instances */
+    pthread_t scale_thread;
+    bool scale_thread_on;
+
+    /* credit based admission at rx, 0 credits disables it */
+    uint32_t credits;           /* max # of packets inside the pipeline */
+    uint32_t nb_inflight;       /* packets admitted and not yet out of the pipeline */
+    uint32_t nb_exited;         /* dispatched packets freed or diverted before the tail rings, taken by the main core */
+
+    /* buffered tx of processed packets per stats queue, NULL when that queue does not send */
+    struct egress *egress[RTE_MAX_LCORE];
 
     /* run config read from command line options */
     pl_conf conf;
@@ -223,23 +346,59 @@ struct pipeline{
 
 };
 
+/* packets leaving the pipeline before the tail rings give their credit back to the dispatcher */
+static inline void
+pipeline_credit_return(struct pipeline *pl, uint32_t nb_pkts)
+{
+    if(pl->credits){
+        __atomic_fetch_sub(&pl->nb_inflight, nb_pkts, __ATOMIC_RELAXED);
+    }
+}
+
+/* dispatched packets dropped or diverted by a stage, they never reach the main core through a tail ring */
+static inline void
+pipeline_pkts_exit(struct pipeline *pl, uint32_t nb_pkts)
+{
+    pipeline_credit_return(pl, nb_pkts);
+    __atomic_fetch_add(&pl->nb_exited, nb_pkts, __ATOMIC_RELAXED);
+}
+
+/* # of packets that left inside the pipeline since the last call, main core only */
+static inline uint32_t
+pipeline_pkts_exited(struct pipeline *pl)
+{
+    if(!__atomic_load_n(&pl->nb_exited, __ATOMIC_RELAXED)){
+        return 0;
+    }
+    return __atomic_exchange_n(&pl->nb_exited, 0, __ATOMIC_RELAXED);
+}
+
+
+/* Input rings of stealing stages are also drained by sibling instances */
+static inline unsigned int
+pipeline_ring_deq_flags(struct pipeline_stage *consumer)
+{
+    return consumer->steal ? 0 : RING_F_SC_DEQ;
+}
+
 
 /* Function pointers each pipeline stage should implement. 
-   1. pipeline_stage_exec: process total number of nb_enq mbufs in mbuf, and store the number of mbufs in *nb_deq, and corresponding mbufs in *mbuf_out.
+   1. pipeline_stage_exec: process a single packet.
+   2. pipeline_stage_exec_batch (optional): process total number of nb_enq mbufs in mbuf, and store the number of mbufs in *nb_deq, and corresponding mbufs in *mbuf_out.
       For sequential processing pl stages(i.e. ddos), to avoid copying mbuf pointers from mbuf to *mbuf_out, simple change the value of *mbuf_out to mbuf 
-
-
+      When it is set, the runtime calls it once per burst instead of calling pipeline_stage_exec per packet.
+      Inputs missing from *mbuf_out are treated as filtered, the stage must not free them.
 */
 
 typedef struct pipeline_func {
     int (*pipeline_stage_init)(struct pipeline_stage *self);
     int (*pipeline_stage_free)(struct pipeline_stage *self);
-    // int (*pipeline_stage_exec)(struct pipeline_stage *self, 
-    //                         struct rte_mbuf **mbuf,
-    //                         int nb_enq,
-    //                         struct rte_mbuf ***mbuf_out,
-    //                         int *nb_deq);
     int (*pipeline_stage_exec)(struct pipeline_stage *self, meili_pkt *pkt);
+    int (*pipeline_stage_exec_batch)(struct pipeline_stage *self, 
+                            meili_pkt **mbuf,
+                            int nb_enq,
+                            meili_pkt ***mbuf_out,
+                            int *nb_deq);
 } pipeline_func_t;
 
 
@@ -279,13 +438,20 @@ int pipeline_stage_free_safe(struct pipeline_stage *self);
 //                             int nb_enq,
 //                             struct rte_mbuf ***mbuf_out,
 //                             int *nb_deq);
+int pipeline_stage_exec_burst(struct pipeline_stage *self, struct rte_mbuf **mbufs_in, int nb_deq,
+                              struct rte_mbuf ***mbufs_out);
 int pipeline_stage_run_safe(struct pipeline_stage *self);
+int pipeline_stage_create(struct pipeline *pl, int stage, int inst, unsigned int lcore);
+int pipeline_stage_launch(struct pipeline_stage *self, int worker_qid);
 
 /* functions for pipelines */
-int pipeline_init_safe(struct pipeline *pl);
-// int pipeline_init_safe(struct pipeline *pl, char *config_path);
+int pipeline_init_safe(struct pipeline *pl, char *config_path);
 int pipeline_free(struct pipeline *pl);
+bool pipeline_stage_is_source(struct pipeline *pl, int stage);
+bool pipeline_stage_is_sink(struct pipeline *pl, int stage);
+void pipeline_edge_stats_print(struct pipeline *pl);
 int pipeline_run(struct pipeline *pl);
+int pipeline_divert_dequeue(struct pipeline *pl, int stage, struct rte_mbuf **mbufs, unsigned int nb_pkts);
 
 
 
@@ -0,0 +1,234 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "placement.h"
+#include "../lib/log/meili_log.h"
+
+/* Read a single integer from a sysfs file, -1 if it can not be read */
+static int
+placement_sysfs_read_int(const char *path)
+{
+    FILE *file;
+    int val;
+
+    file = fopen(path, "r");
+    if (!file)
+        return -1;
+    if (fscanf(file, "%d", &val) != 1)
+        val = -1;
+    fclose(file);
+
+    return val;
+}
+
+/* Id of the data or unified cache of a level that cpu uses, -1 if there is none.
+ * Kernels without the "id" file get the first cpu sharing the cache instead, which is just as unique.
+ */
+static int
+placement_cache_id(unsigned int cpu_id, int level)
+{
+    char path[PATH_MAX];
+    char type[16];
+    FILE *file;
+    int cache_level;
+    int id;
+
+    for (int idx = 0; ; idx++) {
+        snprintf(path, sizeof(path), SYSFS_CPU_PATH "/cpu%u/cache/index%d/level", cpu_id, idx);
+        cache_level = placement_sysfs_read_int(path);
+        if (cache_level < 0)
+            return -1;
+        if (cache_level != level)
+            continue;
+
+        snprintf(path, sizeof(path), SYSFS_CPU_PATH "/cpu%u/cache/index%d/type", cpu_id, idx);
+        file = fopen(path, "r");
+        if (file) {
+            if (fscanf(file, "%15s", type) == 1 && strcmp(type, "Instruction") == 0) {
+                fclose(file);
+                continue;
+            }
+            fclose(file);
+        }
+
+        snprintf(path, sizeof(path), SYSFS_CPU_PATH "/cpu%u/cache/index%d/id", cpu_id, idx);
+        id = placement_sysfs_read_int(path);
+        if (id >= 0)
+            return id;
+
+        snprintf(path, sizeof(path), SYSFS_CPU_PATH "/cpu%u/cache/index%d/shared_cpu_list", cpu_id, idx);
+        return placement_sysfs_read_int(path);
+    }
+}
+
+static void
+placement_topo_read(struct lcore_topo *topo, unsigned int lcore_id)
+{
+    char path[PATH_MAX];
+
+    topo->lcore_id = lcore_id;
+    topo->cpu_id = rte_lcore_to_cpu_id(lcore_id);
+    topo->socket_id = rte_lcore_to_socket_id(lcore_id);
+    topo->l2_id = placement_cache_id(topo->cpu_id, 2);
+    topo->l3_id = placement_cache_id(topo->cpu_id, 3);
+    snprintf(path, sizeof(path), SYSFS_CPU_PATH "/cpu%u/topology/cluster_id", topo->cpu_id);
+    topo->cluster_id = placement_sysfs_read_int(path);
+    topo->used = false;
+}
+
+static int
+placement_score(struct lcore_topo *a, struct lcore_topo *b)
+{
+    if (a->l2_id >= 0 && a->l2_id == b->l2_id)
+        return PLACEMENT_SCORE_L2;
+    if (a->socket_id != b->socket_id)
+        return 0;
+    if ((a->l3_id >= 0 && a->l3_id == b->l3_id) || (a->cluster_id >= 0 && a->cluster_id == b->cluster_id))
+        return PLACEMENT_SCORE_CLUSTER;
+
+    return PLACEMENT_SCORE_SOCKET;
+}
+
+/* Worker lcores and whether an instance runs on them, kept for instances added at runtime */
+static struct lcore_topo placement_topo[RTE_MAX_LCORE];
+static struct lcore_topo placement_main_topo;
+static int placement_nb_topo;
+
+static struct lcore_topo *
+placement_lookup(unsigned int lcore_id)
+{
+    for (int t = 0; t < placement_nb_topo; t++) {
+        if (placement_topo[t].lcore_id == lcore_id)
+            return &placement_topo[t];
+    }
+    return NULL;
+}
+
+/* Free lcore closest to the instances feeding stage, and to the main core if it feeds or drains the stage.
+ * Instances of upstream stages must have their lcore already.
+ */
+static struct lcore_topo *
+placement_best(struct pipeline *pl, int stage)
+{
+    struct lcore_topo *best = NULL;
+    struct lcore_topo *topo;
+    struct lcore_topo *src;
+    struct pipeline_edge *edge;
+    int best_score = -1;
+    int score;
+
+    for (int t = 0; t < placement_nb_topo; t++) {
+        topo = &placement_topo[t];
+        if (topo->used)
+            continue;
+
+        score = 0;
+        if (pipeline_stage_is_source(pl, stage))
+            score += placement_score(topo, &placement_main_topo);
+        if (pipeline_stage_is_sink(pl, stage))
+            score += placement_score(topo, &placement_main_topo);
+        for (int e = 0; e < pl->nb_edges; e++) {
+            edge = &pl->edges[e];
+            if (edge->dst != stage)
+                continue;
+            for (int k = 0; k < pl->nb_inst_per_pl_stage[edge->src]; k++) {
+                src = placement_lookup(pl->stages[edge->src][k]->core_id);
+                if (src)
+                    score += placement_score(topo, src);
+            }
+        }
+
+        if (score > best_score) {
+            best_score = score;
+            best = topo;
+        }
+    }
+
+    return best;
+}
+
+/* Read the topology of the worker lcores, instances then take theirs with placement_pick().
+ * Instances are created in stage index order, which is a topological order as edges only point forward.
+ */
+int
+placement_init(struct pipeline *pl)
+{
+    unsigned int lcore_id;
+    int nb_inst = 0;
+
+    placement_nb_topo = 0;
+    placement_topo_read(&placement_main_topo, rte_get_main_lcore());
+    RTE_LCORE_FOREACH_WORKER(lcore_id) {
+        placement_topo_read(&placement_topo[placement_nb_topo++], lcore_id);
+    }
+
+    for (int i = 0; i < pl->nb_pl_stages; i++)
+        nb_inst += pl->nb_inst_per_pl_stage[i];
+    if (nb_inst > placement_nb_topo) {
+        MEILI_LOG_ERR("%d stage instances but only %d worker lcores", nb_inst, placement_nb_topo);
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/* Print the lcore and cache/NUMA position of the main core and every stage instance */
+void
+placement_print(struct pipeline *pl)
+{
+    struct lcore_topo *best;
+
+    best = &placement_main_topo;
+    printf("%8s %8s %8s %8s %8s %8s %8s %8s\n", "Stage", "Instance", "Lcore", "Cpu", "Socket", "L2", "L3", "Cluster");
+    printf("%8s %8s %8u %8u %8d %8d %8d %8d\n", "main", "-", best->lcore_id, best->cpu_id,
+        best->socket_id, best->l2_id, best->l3_id, best->cluster_id);
+    for (int i = 0; i < pl->nb_pl_stages; i++) {
+        for (int j = 0; j < pl->nb_inst_per_pl_stage[i]; j++) {
+            best = placement_lookup(pl->stages[i][j]->core_id);
+            printf("%8d %8d %8u %8u %8d %8d %8d %8d\n", i, j, best->lcore_id, best->cpu_id,
+                best->socket_id, best->l2_id, best->l3_id, best->cluster_id);
+        }
+    }
+}
+
+/* Take an lcore for one more instance of stage, -EBUSY when all worker lcores run an instance.
+ * It is the free lcore closest to the instances feeding stage, and to the main core for stages the
+ * main core feeds or drains. Without topology information lcores are taken in order, as
+ * RTE_LCORE_FOREACH_WORKER would.
+ */
+int
+placement_pick(struct pipeline *pl, int stage)
+{
+    struct lcore_topo *best = placement_best(pl, stage);
+
+    if (!best)
+        return -EBUSY;
+    best->used = true;
+
+    return best->lcore_id;
+}
+
+/* Give back the lcore of a removed instance */
+void
+placement_release(unsigned int lcore_id)
+{
+    struct lcore_topo *topo = placement_lookup(lcore_id);
+
+    if (topo)
+        topo->used = false;
+}
+
+/* NUMA node to allocate a ring on, the one of the lcore reading it. NULL stands for the main core. */
+int
+placement_socket(struct pipeline_stage *consumer)
+{
+    if (!consumer)
+        return rte_lcore_to_socket_id(rte_get_main_lcore());
+
+    return rte_lcore_to_socket_id(consumer->core_id);
+}
@@ -0,0 +1,36 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_PLACEMENT_H
+#define _INCLUDE_PLACEMENT_H
+
+#include <stdbool.h>
+
+#include <rte_lcore.h>
+
+#include "pipeline.h"
+
+#define SYSFS_CPU_PATH "/sys/devices/system/cpu"
+
+/* affinity weights of two lcores, the closest shared level counts */
+#define PLACEMENT_SCORE_L2 8
+#define PLACEMENT_SCORE_CLUSTER 4    /* shared L3 slice, or Arm cluster */
+#define PLACEMENT_SCORE_SOCKET 1
+
+/* Where an lcore sits in the cache/NUMA hierarchy, -1 when sysfs does not tell */
+struct lcore_topo {
+    unsigned int lcore_id;
+    unsigned int cpu_id;
+    int socket_id;
+    int l2_id;
+    int l3_id;
+    int cluster_id;
+    bool used;
+};
+
+int placement_init(struct pipeline *pl);
+void placement_print(struct pipeline *pl);
+int placement_socket(struct pipeline_stage *consumer);
+int placement_pick(struct pipeline *pl, int stage);
+void placement_release(unsigned int lcore_id);
+
+#endif /* _INCLUDE_PLACEMENT_H */
@@ -0,0 +1,133 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_RATE_LIMIT_H
+#define _INCLUDE_RATE_LIMIT_H
+
+#include <stdint.h>
+
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_ether.h>
+#include <rte_mbuf.h>
+
+#include "../lib/conf/meili_conf.h"
+
+enum rate_limit_unit {
+    RATE_LIMIT_NONE,
+    RATE_LIMIT_BYTES,           /* tokens are bytes */
+    RATE_LIMIT_PKTS,            /* tokens are packets */
+};
+
+/* TSC token bucket.
+ * Credit is kept in tokens * timer hz so refilling is one multiplication and no division is needed on the fast path.
+ * In byte mode the packet sizes are only known after a burst is taken, so credit may go negative and the debt is repaid before the next burst.
+ */
+struct rate_limiter {
+    enum rate_limit_unit unit;
+    uint64_t rate;              /* tokens per second */
+    uint64_t hz;
+    int64_t credit;             /* tokens * hz */
+    int64_t burst;              /* max credit, tokens * hz */
+    uint64_t fill_cycles;       /* cycles to refill an empty bucket */
+    uint64_t last_tsc;
+};
+
+/* rate == 0 or unit == RATE_LIMIT_NONE disables the limiter.
+ * The bucket is capped at a quarter of the int64 range in tokens * hz, so a refill added to a full bucket cannot
+ * overflow, large rates with long bursts get a shorter burst than asked for.
+ */
+static inline void
+rate_limit_init(struct rate_limiter *rl, enum rate_limit_unit unit, uint64_t rate, uint32_t burst_us)
+{
+    uint64_t burst_tokens;
+    uint64_t max_tokens;
+
+    rl->unit = rate ? unit : RATE_LIMIT_NONE;
+    rl->rate = rate;
+    rl->hz = rte_get_timer_hz();
+    max_tokens = INT64_MAX / 4 / rl->hz;
+
+    /* allow at least one packet (or one max sized frame) per refill */
+    burst_tokens = RTE_MIN((unsigned __int128)rate * burst_us / 1000000, (unsigned __int128)max_tokens);
+    if (unit == RATE_LIMIT_BYTES)
+        burst_tokens = RTE_MAX(burst_tokens, (uint64_t)RTE_ETHER_MAX_LEN);
+    else
+        burst_tokens = RTE_MAX(burst_tokens, (uint64_t)1);
+
+    rl->burst = burst_tokens * rl->hz;
+    rl->credit = rl->burst;
+    rl->fill_cycles = rate ? burst_tokens * rl->hz / rate + 1 : 0;
+    rl->last_tsc = rte_rdtsc();
+}
+
+static inline void
+rate_limit_refill(struct rate_limiter *rl)
+{
+    uint64_t now = rte_rdtsc();
+    uint64_t delta = now - rl->last_tsc;
+
+    rl->last_tsc = now;
+    /* long idle periods saturate the bucket, also keeps delta * rate from overflowing */
+    if (delta >= rl->fill_cycles) {
+        rl->credit = rl->burst;
+        return;
+    }
+    rl->credit = RTE_MIN(rl->credit + (int64_t)(delta * rl->rate), rl->burst);
+}
+
+/* Set up a limiter from the command line rate if it applies to scope, otherwise disable it */
+static inline void
+rate_limit_init_conf(struct rate_limiter *rl, pl_conf *run_conf, enum meili_rate_scope scope)
+{
+    if (run_conf->rate_scope != scope)
+        rate_limit_init(rl, RATE_LIMIT_NONE, 0, 0);
+    else if (run_conf->rate_gbps)
+        rate_limit_init(rl, RATE_LIMIT_BYTES, (uint64_t)(run_conf->rate_gbps * 1000000000.0 / 8), run_conf->rate_burst_us);
+    else if (run_conf->rate_mpps)
+        rate_limit_init(rl, RATE_LIMIT_PKTS, (uint64_t)(run_conf->rate_mpps * 1000000.0), run_conf->rate_burst_us);
+    else
+        rate_limit_init(rl, RATE_LIMIT_NONE, 0, 0);
+}
+
+/* # of packets, at most nb_pkts, that may be taken now */
+static inline uint32_t
+rate_limit_budget(struct rate_limiter *rl, uint32_t nb_pkts)
+{
+    int64_t nb_avail;
+
+    if (rl->unit == RATE_LIMIT_NONE)
+        return nb_pkts;
+
+    rate_limit_refill(rl);
+    if (rl->credit <= 0)
+        return 0;
+    if (rl->unit == RATE_LIMIT_BYTES)
+        return nb_pkts;
+
+    if (rl->credit >= (int64_t)(nb_pkts * rl->hz))
+        return nb_pkts;
+    nb_avail = rl->credit / rl->hz;
+
+    return nb_avail;
+}
+
+/* Charge the limiter for packets that have been taken */
+static inline void
+rate_limit_consume(struct rate_limiter *rl, struct rte_mbuf **mbufs, uint32_t nb_pkts)
+{
+    uint64_t nb_tokens = 0;
+
+    if (rl->unit == RATE_LIMIT_NONE)
+        return;
+
+    if (rl->unit == RATE_LIMIT_BYTES) {
+        for (uint32_t i = 0; i < nb_pkts; i++)
+            nb_tokens += mbufs[i]->pkt_len;
+    } else {
+        nb_tokens = nb_pkts;
+    }
+
+    rl->credit -= nb_tokens * rl->hz;
+}
+
+#endif /* _INCLUDE_RATE_LIMIT_H */
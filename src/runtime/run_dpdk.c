@@ -23,6 +23,11 @@
 #include <unistd.h>
 #include "run_mode.h"
 #include "pipeline.h"
+#include "dispatch.h"
+#include "rate_limit.h"
+#include "scale.h"
+#include "egress.h"
+#include "offload.h"
 
 #include "../utils/input_mode/dpdk_live_shared.h"
 #include "../utils/utils.h"
@@ -39,38 +44,6 @@ struct rte_ether_addr primary_mac_addr;
 struct rte_ether_addr second_mac_addr;
 
 
-static void
-update_addr(struct rte_mbuf *m, unsigned dest_portid)
-{
-	struct rte_ether_hdr *eth;
-	struct rte_ipv4_hdr *iph;
-	void *tmp;
-
-	eth = (struct rte_ether_hdr *)(rte_pktmbuf_mtod(m, uint8_t*));
-	iph = (struct rte_ipv4_hdr*)(rte_pktmbuf_mtod(m, uint8_t*) + sizeof(struct rte_ether_hdr));
-
-
-	
-	tmp = &eth->d_addr.addr_bytes[0];
-	/* proj91: b8:ce:f6:83:b8:fc */
-	//*((uint64_t *)tmp) = 0xfcb883f6ceb8; 
-	/* proj92: b8:ce:f6:88:b2:2e */
-	*((uint64_t *)tmp) =  0x2eb288f6ceb8; 
-	//iph->src_addr = rte_cpu_to_be_32(info->sa);
-    //iph->dst_addr = rte_cpu_to_be_32((uint32_t)RTE_IPV4(100, 100, 100, 92));
-
-	
-	/* some random macs 02:00:00:00:00:xx */
-	//*((uint64_t *)tmp) = 0x000000000002 + ((uint64_t)dest_portid << 40);
-
-	// /* proj88 p1: 08:c0:eb:8e:d6:87 */
-	// *((uint64_t *)tmp) = 0x87d68eebc008; 
-
-	/* src addr */
-	rte_ether_addr_copy(&second_mac_addr, &eth->s_addr);
-
-}
-
 #ifdef MEILI_MODE
 static int
 run_dpdk(struct pipeline *pl)
@@ -103,13 +76,10 @@ run_dpdk(struct pipeline *pl)
 	bool dual_port;
 
 	/* time keeping */
-	uint64_t prev_cycles;
 	uint64_t prev_cycles_debug = 0;
 	uint64_t max_cycles;
 	uint64_t cycles;
-	double run_time;
 	uint64_t start;
-	double rate = 0;
 
 	bool main_lcore;
 	
@@ -126,22 +96,41 @@ run_dpdk(struct pipeline *pl)
 	// debug for not reordering 
 	//struct rte_mbuf *mbuf_out[MAX_PKTS_BURST];
 	struct rte_mbuf **mbuf_out;
+	/* released by per flow reorder: a burst plus up to batch_size_out held back before */
+	struct rte_mbuf *mbuf_ro[2 * MAX_PKTS_BURST];
 	int nb_enq;
 	int to_enq;
 	int tot_enq;
 
 	int nb_deq_reorder;
 
-	int nb_tx;
-	int to_tx;
-	int tot_tx;
+	/* flows steered to a peer instance */
+	int nb_local;
+	int nb_back;
+
+	/* adaptive eth burst */
+	struct batch_ctrl eth_bctrl;
+	uint32_t eth_batch_size;
+	uint64_t eth_batch_start = 0;
+
+	/* ingress token bucket, --rate-scope port */
+	struct rate_limiter rx_limit;
+	uint32_t rx_budget;
+	int nb_admit;
+
+	/* idle backoff, same order of levels in both enums */
+	struct idle_ctrl main_idle;
+	uint64_t loop_tsc;
+
+	/* buffered tx of processed pkts, NULL with --egress off */
+	struct egress *egress;
 
 
 	//debug
 	int ring_in_index = 0;
 	int ring_out_index = 0;
-	int nb_first_stage = pl->nb_pl_stages? pl->nb_inst_per_pl_stage[0]:1;
-	int nb_last_stage = pl->nb_pl_stages? pl->nb_inst_per_pl_stage[pl->nb_pl_stages-1]:1;
+	int nb_first_stage = pl->nb_ring_in;
+	int nb_last_stage = pl->nb_ring_out;
 
 	int temp;
 
@@ -152,7 +141,6 @@ run_dpdk(struct pipeline *pl)
 
 	/* Convert duration to cycles. */
 	max_cycles = max_duration * rte_get_timer_hz();
-	prev_cycles = 0;
 	cycles = 0;
 
 	main_lcore = rte_lcore_id() == rte_get_main_lcore();
@@ -222,16 +210,33 @@ run_dpdk(struct pipeline *pl)
 	batch_size_out = MAX_PKTS_BURST;
 	//batch_size_out = batch_size * nb_last_stage;
 	//batch_size_out = batch_size;
+	reorder_stage->batch_size = batch_size_out;
 
 
 	start = rte_rdtsc();
 
-	MEILI_LOG_INFO("Eth batch size = %d, batch_size_in = %d, batch_size_out = %d",DEFAULT_ETH_BATCH_SIZE, batch_size_in, batch_size_out);
+	/* eth burst size adapts at runtime when a latency target is set */
+	batch_ctrl_init(&eth_bctrl, DEFAULT_ETH_BATCH_SIZE, MAX_ETH_BATCH_SIZE, run_conf->latency_target_us);
+	eth_batch_size = eth_bctrl.size;
+	seq_stage->batch_size = eth_batch_size;
+
+	MEILI_LOG_INFO("Eth batch size = %d, batch_size_in = %d, batch_size_out = %d",eth_batch_size, batch_size_in, batch_size_out);
+
+	rate_limit_init_conf(&rx_limit, run_conf, RATE_SCOPE_PORT);
+	ret = idle_ctrl_init(&main_idle, (enum idle_level)run_conf->main_idle, run_conf->idle_exit_us);
+	if (ret) {
+		MEILI_LOG_ERR("Failed to set up idle backoff on main core.");
+		return ret;
+	}
+
+	ret = egress_create(pl, qid, qid, &egress);
+	if (ret) {
+		MEILI_LOG_ERR("Failed to set up egress on main core.");
+		return ret;
+	}
 
 	// /* temporary remedy for reorder bug */
-	// #ifdef RATE_LIMIT_BPS_ON
-	// #elif defined(RATE_LIMIT_PPS_ON)
-	// #elif defined(LATENCY_MODE_ON)
+	// #ifdef LATENCY_MODE_ON
 	// #elif defined(ONLY_MAIN_MODE_ON)
 	// #else
 	// /* normal running mode */
@@ -253,36 +258,31 @@ run_dpdk(struct pipeline *pl)
 	while (!force_quit 
 			&& (!max_cycles || cycles <= max_cycles)) 
 		{
+			loop_tsc = rte_rdtsc();
+
+			/* rings of the previous iteration are released, sink instances may have changed since */
+			scale_quiescent(pl, rte_lcore_id());
+			#ifndef SHARED_BUFFER
+			nb_last_stage = __atomic_load_n(&pl->nb_ring_out, __ATOMIC_ACQUIRE);
+			if (ring_out_index >= nb_last_stage)
+				ring_out_index = 0;
+			#endif
 
 			/* Hint: rte_eth_rx_burst(dpdk_port_id, queue_id, mbuf_pointer_array, batch_size) */
 			/* for main core, queue_id is always 0 */
-			#ifdef RATE_LIMIT_BPS_ON
-			/* limit the loading speed based on bps */
-			run_time = (double)cycles / rte_get_timer_hz();
-			rate = ((rm_stats->rx_buf_bytes * 8) / run_time)/ 1000000000.0;
-			if(rate < RATE_Gbps){
-				batch_cnt = rte_eth_rx_burst(cur_rx, qid, mbuf_in, DEFAULT_ETH_BATCH_SIZE);
-			}
-			else{;}
-			#elif defined(RATE_LIMIT_PPS_ON)
-			/* limit the loading speed based on pps */
-			run_time = (double)cycles / rte_get_timer_hz();
-			rate = ((rm_stats->rx_buf_cnt ) / run_time)/ 1000000.0;
-			if(rate < RATE_Mpps){
-				batch_cnt = rte_eth_rx_burst(cur_rx, qid, mbuf_in, DEFAULT_ETH_BATCH_SIZE);
-			}
-			else{;}
-			#elif defined(LATENCY_MODE_ON)
+			/* rx is held off while the ingress limiter is out of tokens */
+			rx_budget = rate_limit_budget(&rx_limit, eth_batch_size);
+			#if defined(LATENCY_MODE_ON)
 			/* load pkts batch after previous batch finished to measure latency */
 			/* In latency mode, inner loop will only exit when batch_cnt_tot_deq == batch_cnt_tot_enq to ensure all pkts enqueued has been dequeued from the pipeline.  */
 			/* However, we do not count total # of pkts dequeued from reorder stage but count that from the last worker stages, as batch_cnt_tot_deq. This is because some pkts may remain in reorder stage until more pkts arrive. */
-			batch_cnt = rte_eth_rx_burst(cur_rx, qid, mbuf_in, DEFAULT_ETH_BATCH_SIZE);	
+			batch_cnt = rx_budget ? rte_eth_rx_burst(cur_rx, qid, mbuf_in, rx_budget) : 0;
 			#elif defined(ONLY_MAIN_MODE_ON)
 			/* debug for not lauching work threads and only run the main thread, without any enqueuing/dequeuing */
-			batch_cnt = rte_eth_rx_burst(cur_rx, qid, mbuf, DEFAULT_ETH_BATCH_SIZE);
+			batch_cnt = rx_budget ? rte_eth_rx_burst(cur_rx, qid, mbuf, rx_budget) : 0;
 			#else
 			/* normal running mode */
-			batch_cnt = rte_eth_rx_burst(cur_rx, qid, mbuf_in, DEFAULT_ETH_BATCH_SIZE);
+			batch_cnt = rx_budget ? rte_eth_rx_burst(cur_rx, qid, mbuf_in, rx_budget) : 0;
 			#endif
 			
 
@@ -291,13 +291,34 @@ run_dpdk(struct pipeline *pl)
 			if(batch_cnt <= 0){
 				/* no pkt received, directly goto get packets out if there is packet waiting to be dequeued */
 				//printf("no packet received, batch_cnt_wait_on_deq = %d\n",batch_cnt_wait_on_deq);
-				if(batch_cnt_wait_on_deq > 0){
+				/* tenant queues left behind full head rings keep draining */
+				if(dispatch_poll(pl) > 0 || batch_cnt_wait_on_deq > 0 || offload_pending(pl, loop_tsc) ||
+				   (run_conf->reorder && reorder_pending(reorder_stage))){
 					goto aggregate_packets;
 				}
 				else{
+					/* nothing received and nothing in flight, pkts still buffered for tx go out on the timer */
+					idle_ctrl_wait(&main_idle, idle_ctrl_level(&main_idle));
+					if (egress)
+						egress_flush_timer(egress, rte_rdtsc());
+					offload_update(pl, rte_rdtsc());
+					rm_stats->idle_cycles += rte_rdtsc() - loop_tsc;
 					continue;
 				}
 			}
+			idle_ctrl_reset(&main_idle);
+
+			#ifdef ONLY_MAIN_MODE_ON
+			rate_limit_consume(&rx_limit, mbuf, batch_cnt);
+			#else
+			rate_limit_consume(&rx_limit, mbuf_in, batch_cnt);
+			/* pkts a peer instance offloaded to us lose their encapsulation here */
+			offload_ingress(pl, mbuf_in, batch_cnt);
+			#endif
+
+			if(eth_bctrl.enabled){
+				eth_batch_start = rte_rdtsc();
+			}
 
 			// // debug for eth device
 			// if(batch_cnt > 0){
@@ -318,6 +339,19 @@ run_dpdk(struct pipeline *pl)
 				#endif		
 			}
 
+			#ifndef ONLY_MAIN_MODE_ON
+			/* shed load here rather than inside the pipeline once all credits are in flight */
+			nb_admit = dispatch_admit(pl, mbuf_in, batch_cnt);
+			rm_stats->bp_drop_cnt += batch_cnt - nb_admit;
+			batch_cnt = nb_admit;
+			if(batch_cnt <= 0){
+				if(batch_cnt_wait_on_deq > 0){
+					goto aggregate_packets;
+				}
+				continue;
+			}
+			#endif
+
 			batch_cnt_wait_on_enq = batch_cnt;
 			batch_cnt_tot_enq = 0;
 			batch_cnt_tot_deq = 0;
@@ -406,30 +440,15 @@ run_dpdk(struct pipeline *pl)
 					
 					/* sequencing packets that are processed locally */
 					seq_exec(seq_stage, &mbuf_in[batch_cnt_tot_enq], batch_cnt_enq);
+					/* flows steered to a peer instance leave here with their seq num, the rest stay local */
+					nb_local = offload_steer(pl, &mbuf_in[batch_cnt_tot_enq], batch_cnt_enq);
 					//debug
 					//printf("enqueue batch\n");
-					#ifdef SHARED_BUFFER
-					while(tot_enq < batch_cnt_enq && !force_quit){
-						nb_enq = rte_ring_enqueue_burst(pl->ring_in, (void *)(&mbuf_in[batch_cnt_tot_enq+tot_enq]), to_enq, NULL);
-						tot_enq += nb_enq;
-						to_enq -= nb_enq;
-					}
-					#else
-					while(tot_enq < batch_cnt_enq && !force_quit){
-						nb_enq = rte_ring_enqueue_burst(pl->ring_in[ring_in_index], (void *)(&mbuf_in[batch_cnt_tot_enq+tot_enq]), to_enq, NULL);
-						tot_enq += nb_enq;
-						to_enq -= nb_enq;
-					}
-
-				
-
-					// // debug
-					//printf("enqueue to ring %d\n",ring_in_index);
-
-					ring_in_index = (ring_in_index+1)%nb_first_stage;
-					/* debug for only using one pipeline */
-					//temp = (ring_in_index+1)%nb_first_stage;
-					#endif
+					/* round-robin bursts or flow-affine, depending on dispatch mode */
+					tot_enq = dispatch_enqueue(pl, &mbuf_in[batch_cnt_tot_enq], nb_local);
+					/* packets of no tenant, of a tenant whose queue is full, or still waiting at quit are freed */
+					rm_stats->bp_drop_cnt += nb_local - tot_enq;
+					batch_cnt_wait_on_deq -= batch_cnt_enq - tot_enq;
 				#else 
 					#ifdef SHARED_BUFFER
 					;
@@ -470,13 +489,16 @@ run_dpdk(struct pipeline *pl)
 					/* read packets from last ring_out(reorder) */
 					/* reorder packets based on sequence number */
 				aggregate_packets:
+					nb_back = 0;
 					#ifndef ONLY_MAIN_MODE_ON
+						/* results of steered flows come back from the peer and merge with the local ones */
+						nb_back = offload_poll(pl, mbuf, OFFLOAD_BURST);
 
 						#ifdef SHARED_BUFFER
-							batch_cnt_deq = rte_ring_dequeue_burst(pl->ring_out,(void *)mbuf, batch_size_out, NULL);
+							batch_cnt_deq = rte_ring_dequeue_burst(pl->ring_out,(void *)&mbuf[nb_back], batch_size_out - nb_back, NULL);
 						#else
 							//batch_cnt_deq = rte_ring_dequeue_burst(pl->ring_out[ring_out_index],(void *)mbuf, batch_size_out, NULL);
-							batch_cnt_deq = rte_ring_dequeue_burst(pl->ring_out[ring_out_index],(void *)mbuf, batch_size_out, &nb_out_ring_remain);
+							batch_cnt_deq = rte_ring_dequeue_burst(pl->ring_out[ring_out_index],(void *)&mbuf[nb_back], batch_size_out - nb_back, &nb_out_ring_remain);
 							/* debug */
 							#ifdef LATENCY_MODE_ON 
 							/* In latency mode, do not change the ring buffer index in the inner-inner loop. Only change the index after inner-inner loop ends and simulate the mod operation here. */
@@ -512,7 +534,15 @@ run_dpdk(struct pipeline *pl)
 					// 	prev_cycles_debug = cycles;
 					// }
 					mbuf_out = mbuf;
-					nb_deq_reorder = batch_cnt_deq;
+					nb_deq_reorder = nb_back + batch_cnt_deq;
+					dispatch_release(pl, batch_cnt_deq);
+					/* each flow bucket leaves in its arrival order, a gap only holds back its own bucket */
+					#ifndef ONLY_MAIN_MODE_ON
+					if(run_conf->reorder){
+						reorder_exec(reorder_stage, mbuf, nb_deq_reorder, mbuf_ro, &nb_deq_reorder);
+						mbuf_out = mbuf_ro;
+					}
+					#endif
 
 
 					/* end of aggregation/end2end time keeping */
@@ -543,29 +573,19 @@ run_dpdk(struct pipeline *pl)
 						rm_stats->tx_buf_bytes += mbuf_out[i]->data_len;
 					}
 
-					/* transmit pkts to destination */
-					#ifdef ALL_REMOTE_AFTER_PROCESSING
-						to_tx = nb_deq_reorder;
-						tot_tx = 0;
-						/* prefetch pkts to be redirected and modify their mac */
-						for(int i=0; i<to_tx; i++){
-							rte_prefetch0(rte_pktmbuf_mtod(mbuf_out[i], void *));
-							update_addr(mbuf_out[i], cur_tx); 
-						}
+					/* pkts processed for a peer instance go back to it */
+					nb_deq_reorder = offload_return(pl, mbuf_out, nb_deq_reorder);
 
-						while(tot_tx < nb_deq_reorder){
-							nb_tx = rte_eth_tx_burst(cur_tx, qid, mbuf_out, to_tx);
-							// //debug 
-							// printf("to_tx=%d, nb_txed=%d\n",to_tx,nb_tx);
-							tot_tx += nb_tx;
-							to_tx -= nb_tx;
+					/* transmit pkts to destination, tx never waits on a slow peer */
+					if (egress) {
+						egress_send(egress, mbuf_out, nb_deq_reorder);
+					}
+					else {
+						/* post-processing of pkts */ 
+						for (int i = 0; i < nb_deq_reorder; i++) {
+							/* here we simply free the mbuf */
+							rte_pktmbuf_free(mbuf_out[i]);
 						}
-					#endif /* ALL_REMOTE_AFTER_PROCESSING */
-
-					/* post-processing of pkts */ 
-					for (int i = 0; i < nb_deq_reorder; i++) {
-						/* here we simply free the mbuf */
-						rte_pktmbuf_free(mbuf_out[i]);
 					}
 
 					/* change inner loop counters */
@@ -584,8 +604,9 @@ run_dpdk(struct pipeline *pl)
 				
 					
 
-					/* # of pkts still left in the pipeline */
-					batch_cnt_wait_on_deq -= nb_deq_reorder;
+					/* # of pkts still left in the pipeline, steered and dropped ones were taken out at dispatch,
+					 * those dropped or diverted by stages are reported by the workers */
+					batch_cnt_wait_on_deq -= batch_cnt_deq + pipeline_pkts_exited(pl);
 
 
 					//debug 
@@ -610,19 +631,24 @@ run_dpdk(struct pipeline *pl)
 
 			}/* End of inner loop. Proceed to process next pipeline batch. */
 
-			/* Print pipeline stats every 1s */
-			cycles = rte_rdtsc() - start;
-
-			if (!main_lcore){
-				continue;
-			}
-			
-			if (cycles - prev_cycles > STATS_INTERVAL_CYCLES) {
-				run_time = (double)cycles / rte_get_timer_hz();
-				prev_cycles = cycles;
-				stats_print_update(stats, run_conf->cores, run_time, false);
+			/* adapt eth burst size, a full burst means more packets wait in the rx queue */
+			if(eth_bctrl.enabled && batch_cnt > 0){
+				eth_batch_size = batch_ctrl_update(&eth_bctrl, rte_rdtsc() - eth_batch_start,
+					batch_cnt == eth_batch_size ? eth_batch_size : 0);
+				seq_stage->batch_size = eth_batch_size;
 			}
+
+			if (egress)
+				egress_flush_timer(egress, rte_rdtsc());
+			offload_update(pl, rte_rdtsc());
+
+			rm_stats->busy_cycles += rte_rdtsc() - loop_tsc;
+
+			/* stats are printed by the stats thread, see telemetry.h */
+			cycles = rte_rdtsc() - start;
 		}/* End of outer loop. Proceed to receive and process next eth batch. */
+	egress_flush(egress);
+	offload_flush(pl);
 	printf("Exiting on main core\n");	
 	return 0;
 }
@@ -630,6 +656,39 @@ run_dpdk(struct pipeline *pl)
 
 
 #ifdef ALL_REMOTE_ON_ARRIVAL
+/* fixed next hop of the arrival test mode, MEILI_MODE takes it from --next-hop-mac */
+static void
+update_addr(struct rte_mbuf *m, unsigned dest_portid)
+{
+	struct rte_ether_hdr *eth;
+	struct rte_ipv4_hdr *iph;
+	void *tmp;
+
+	eth = (struct rte_ether_hdr *)(rte_pktmbuf_mtod(m, uint8_t*));
+	iph = (struct rte_ipv4_hdr*)(rte_pktmbuf_mtod(m, uint8_t*) + sizeof(struct rte_ether_hdr));
+
+
+	
+	tmp = &eth->d_addr.addr_bytes[0];
+	/* proj91: b8:ce:f6:83:b8:fc */
+	//*((uint64_t *)tmp) = 0xfcb883f6ceb8; 
+	/* proj92: b8:ce:f6:88:b2:2e */
+	*((uint64_t *)tmp) =  0x2eb288f6ceb8; 
+	//iph->src_addr = rte_cpu_to_be_32(info->sa);
+    //iph->dst_addr = rte_cpu_to_be_32((uint32_t)RTE_IPV4(100, 100, 100, 92));
+
+	
+	/* some random macs 02:00:00:00:00:xx */
+	//*((uint64_t *)tmp) = 0x000000000002 + ((uint64_t)dest_portid << 40);
+
+	// /* proj88 p1: 08:c0:eb:8e:d6:87 */
+	// *((uint64_t *)tmp) = 0x87d68eebc008; 
+
+	/* src addr */
+	rte_ether_addr_copy(&second_mac_addr, &eth->s_addr);
+
+}
+
 static int
 run_dpdk(struct pipeline *pl)
 {
@@ -661,11 +720,9 @@ run_dpdk(struct pipeline *pl)
 	bool dual_port;
 
 	/* time keeping */
-	uint64_t prev_cycles;
 	uint64_t prev_cycles_debug = 0;
 	uint64_t max_cycles;
 	uint64_t cycles;
-	double run_time;
 	uint64_t start;
 	double rate = 0;
 
@@ -698,8 +755,8 @@ run_dpdk(struct pipeline *pl)
 	//debug
 	int ring_in_index = 0;
 	int ring_out_index = 0;
-	int nb_first_stage = pl->nb_pl_stages? pl->nb_inst_per_pl_stage[0]:1;
-	int nb_last_stage = pl->nb_pl_stages? pl->nb_inst_per_pl_stage[pl->nb_pl_stages-1]:1;
+	int nb_first_stage = pl->nb_ring_in;
+	int nb_last_stage = pl->nb_ring_out;
 
 	int temp;
 
@@ -710,7 +767,6 @@ run_dpdk(struct pipeline *pl)
 
 	/* Convert duration to cycles. */
 	max_cycles = max_duration * rte_get_timer_hz();
-	prev_cycles = 0;
 	cycles = 0;
 
 	main_lcore = rte_lcore_id() == rte_get_main_lcore();
@@ -865,18 +921,8 @@ run_dpdk(struct pipeline *pl)
 			}
 
 
-			/* Print pipeline stats every 1s */
+			/* stats are printed by the stats thread, see telemetry.h */
 			cycles = rte_rdtsc() - start;
-
-			if (!main_lcore){
-				continue;
-			}
-			
-			if (cycles - prev_cycles > STATS_INTERVAL_CYCLES) {
-				run_time = (double)cycles / rte_get_timer_hz();
-				prev_cycles = cycles;
-				stats_print_update(stats, run_conf->cores, run_time, false);
-			}
 		}/* End of outer loop. Proceed to receive and process next eth batch. */
 
 	return 0;
@@ -915,11 +961,9 @@ run_dpdk(struct pipeline *pl)
 	bool dual_port;
 
 	/* time keeping */
-	uint64_t prev_cycles;
 	uint64_t prev_cycles_debug = 0;
 	uint64_t max_cycles;
 	uint64_t cycles;
-	double run_time;
 	uint64_t start;
 	double rate = 0;
 
@@ -950,8 +994,8 @@ run_dpdk(struct pipeline *pl)
 	//debug
 	int ring_in_index = 0;
 	int ring_out_index = 0;
-	int nb_first_stage = pl->nb_pl_stages? pl->nb_inst_per_pl_stage[0]:1;
-	int nb_last_stage = pl->nb_pl_stages? pl->nb_inst_per_pl_stage[pl->nb_pl_stages-1]:1;
+	int nb_first_stage = pl->nb_ring_in;
+	int nb_last_stage = pl->nb_ring_out;
 
 	struct pipeline_stage *self;
 
@@ -964,7 +1008,6 @@ run_dpdk(struct pipeline *pl)
 
 	/* Convert duration to cycles. */
 	max_cycles = max_duration * rte_get_timer_hz();
-	prev_cycles = 0;
 	cycles = 0;
 
 	main_lcore = rte_lcore_id() == rte_get_main_lcore();
@@ -1099,18 +1142,8 @@ run_dpdk(struct pipeline *pl)
 			#endif
 
 
-			/* Print pipeline stats every 1s */
+			/* stats are printed by the stats thread, see telemetry.h */
 			cycles = rte_rdtsc() - start;
-
-			if (!main_lcore){
-				continue;
-			}
-			
-			if (cycles - prev_cycles > STATS_INTERVAL_CYCLES) {
-				run_time = (double)cycles / rte_get_timer_hz();
-				prev_cycles = cycles;
-				stats_print_update(stats, run_conf->cores, run_time, false);
-			}
 		}/* End of outer loop. Proceed to receive and process next eth batch. */
 
 	return 0;
@@ -28,31 +28,22 @@
 // #include "../lib/log/meili_log.h"
 
 #define DEFAULT_ETH_BATCH_SIZE 64
+#define MAX_ETH_BATCH_SIZE 512		/* upper bound the batch controller grows the eth burst to */
 
 /* rte ring working mode */
 //#define SHARED_BUFFER
 
 /* defines in set 0 is compatible with defines in set 1 */
 /* exclusvie runing modes set 0 */
-//#define RATE_LIMIT_BPS_ON 	/* throughput mode with bps rate limit on */ 
-//#define RATE_LIMIT_PPS_ON		/* throughput mode with pps rate limit on */  
 //#define LATENCY_MODE_ON 		/* per pkt latency measurement mode */  
 //#define ONLY_MAIN_MODE_ON		/* only running main loop without enqueue/dequeue */ 
 
 /* exclusvie runing modes set 1 */
 // #define ALL_REMOTE_ON_ARRIVAL 			/* direct all traffic to remote pipelines right after receiving them */
-//#define ALL_REMOTE_AFTER_PROCESSING		/* direct all traffic to remote pipelines after processing them locally */
+/* processed traffic is sent out to the next hop with --egress drop|retry, see egress.h */
 #define MEILI_MODE
 // #define BASELINE_MODE
 
-#ifdef RATE_LIMIT_BPS_ON   
-#define RATE_Gbps 10
-#endif
-
-#ifdef RATE_LIMIT_PPS_ON  
-#define RATE_Mpps 1
-#endif
-
 #ifdef LATENCY_MODE_ON
 	/* which latency to record */
 	#define LATENCY_END2END
@@ -86,6 +77,14 @@ void run_local_reg(run_func_t *funcs);
 
 void run_dpdk_reg(run_func_t *funcs);
 
+/* run to completion, see run_rtc.c */
+void run_rtc_reg(run_func_t *funcs);
+int run_rtc_check(struct pipeline *pl);
+int run_rtc_pick(int w);
+void run_rtc_print(struct pipeline *pl);
+int run_rtc_worker(struct pipeline_stage *head);
+int run_rtc_launch(struct pipeline *pl);
+
 /* Register run mode functions as dicatated by input mode selected. */
 static inline int
 run_mode_register(struct pipeline *pl)
@@ -108,7 +107,10 @@ run_mode_register(struct pipeline *pl)
 		break;
 
 	case INPUT_LIVE:
-		run_dpdk_reg(funcs);
+		if (run_conf->exec_model == EXEC_MODEL_RTC)
+			run_rtc_reg(funcs);
+		else
+			run_dpdk_reg(funcs);
 		break;
 
 	default:
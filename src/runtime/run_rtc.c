@@ -0,0 +1,302 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <rte_ethdev.h>
+#include <rte_lcore.h>
+
+#include "run_mode.h"
+#include "pipeline.h"
+#include "idle.h"
+#include "egress.h"
+
+#include "../utils/utils.h"
+
+/* how often the main core looks at the clock and the quit flag */
+#define RTC_MAIN_POLL_US 1000
+
+/* Run to completion needs a chain of stages of one tenant, every worker runs one instance of each.
+ * Called before stage instances are created.
+ */
+int
+run_rtc_check(struct pipeline *pl)
+{
+    int nb_workers = pl->conf.cores - 1;
+
+    if (pl->nb_tenants > 1) {
+        MEILI_LOG_ERR("exec-model rtc runs a single tenant, %d configured", pl->nb_tenants);
+        return -ENOTSUP;
+    }
+    if (pl->nb_pl_stages == 0) {
+        MEILI_LOG_ERR("exec-model rtc needs at least one stage");
+        return -EINVAL;
+    }
+    if (pl->nb_edges != pl->nb_pl_stages - 1) {
+        MEILI_LOG_ERR("exec-model rtc only supports chained pipeline stages");
+        return -ENOTSUP;
+    }
+    for (int e = 0; e < pl->nb_edges; e++) {
+        if (pl->edges[e].dst != pl->edges[e].src + 1) {
+            MEILI_LOG_ERR("exec-model rtc only supports chained pipeline stages");
+            return -ENOTSUP;
+        }
+    }
+    if (nb_workers > NB_INSTANCE_PER_PIPELINE_STAGE_MAX) {
+        MEILI_LOG_ERR("exec-model rtc runs one instance per worker, max %d workers", NB_INSTANCE_PER_PIPELINE_STAGE_MAX);
+        return -EINVAL;
+    }
+    if (nb_workers > (int)rte_lcore_count() - 1) {
+        MEILI_LOG_ERR("%d workers but only %u worker lcores", nb_workers, rte_lcore_count() - 1);
+        return -EINVAL;
+    }
+
+    /* instance counts from pl.conf do not apply, and there are no sibling rings to steal from */
+    for (int i = 0; i < pl->nb_pl_stages; i++) {
+        if (pl->nb_inst_per_pl_stage[i] != nb_workers)
+            MEILI_LOG_INFO("Stage %d runs %d instance(s), one per worker", i, nb_workers);
+        pl->nb_inst_per_pl_stage[i] = nb_workers;
+        pl->steal_per_pl_stage[i] = false;
+    }
+
+    return 0;
+}
+
+/* Lcore of worker w, the w-th worker lcore. Worker w polls queue w, whose mempool was set up
+ * on the NUMA node of that lcore, see input_dpdk_port.c.
+ */
+int
+run_rtc_pick(int w)
+{
+    unsigned int lcore_id;
+    int k = 0;
+
+    RTE_LCORE_FOREACH_WORKER(lcore_id) {
+        if (k++ == w)
+            return lcore_id;
+    }
+
+    return -EINVAL;
+}
+
+void
+run_rtc_print(struct pipeline *pl)
+{
+    unsigned int lcore_id;
+
+    printf("%8s %8s %8s %8s\n", "Worker", "Lcore", "Socket", "Queue");
+    for (int w = 0; w < pl->nb_inst_per_pl_stage[0]; w++) {
+        lcore_id = pl->stages[0][w]->core_id;
+        printf("%8d %8u %8u %8d\n", w, lcore_id, rte_lcore_to_socket_id(lcore_id), w);
+    }
+}
+
+/* Back off after an empty poll. Nobody rings a doorbell for the NIC, blocking just times out. */
+static inline void
+run_rtc_idle(struct idle_ctrl *idle)
+{
+    enum idle_level level = idle_ctrl_level(idle);
+
+    if (level == IDLE_WAKE && idle->efd >= 0)
+        idle_ctrl_block(idle);
+    else
+        idle_ctrl_wait(idle, level);
+}
+
+/* Worker loop: rx a burst on the own queue, run it through every stage and tx it on the own queue.
+ * head is the instance of the first stage, the instances of later stages with the same index run here too.
+ */
+int
+run_rtc_worker(struct pipeline_stage *head)
+{
+    struct pipeline *pl = (struct pipeline *)head->pl;
+    pl_conf *conf = &pl->conf;
+    run_mode_stats_t *rm_stats = &conf->stats->rm_stats[head->worker_qid];
+    struct pipeline_stage *chain[NB_PIPELINE_STAGE_MAX];
+    struct rte_mbuf *mbufs[MAX_PKTS_BURST];
+    struct rte_mbuf **mbufs_in;
+    struct rte_mbuf **mbufs_out;
+    uint16_t queue = head->inst_idx;
+    uint16_t rx_port;
+    int burst_size = RTE_MIN(head->batch_size, MAX_PKTS_BURST);
+    int nb_rx;
+    int nb_pkts;
+    uint64_t batch_start = 0;
+    uint64_t last_tsc;
+    uint64_t now;
+    struct egress *egress;
+    int ret;
+
+    if (rte_eth_dev_get_port_by_name(conf->port1, &rx_port)) {
+        MEILI_LOG_ERR("Cannot find port %s.", conf->port1);
+        return -EINVAL;
+    }
+    /* processed packets leave on the own tx queue */
+    ret = egress_create(pl, head->worker_qid, queue, &egress);
+    if (ret) {
+        MEILI_LOG_ERR("Failed to set up egress of worker %d", head->worker_qid);
+        return ret;
+    }
+
+    for (int i = 0; i < pl->nb_pl_stages; i++) {
+        chain[i] = pl->stages[i][head->inst_idx];
+        if (!chain[i]->funcs ||
+            (!chain[i]->funcs->pipeline_stage_exec && !chain[i]->funcs->pipeline_stage_exec_batch)) {
+            MEILI_LOG_WARN("Invalid execution function");
+            return -EINVAL;
+        }
+        /* filtered packets of every stage are counted with the worker */
+        chain[i]->worker_qid = head->worker_qid;
+    }
+
+    last_tsc = rte_rdtsc();
+    while (!force_quit && conf->running == true) {
+        nb_rx = rte_eth_rx_burst(rx_port, queue, mbufs, burst_size);
+        if (nb_rx <= 0) {
+            run_rtc_idle(&head->idle);
+            now = rte_rdtsc();
+            if (egress)
+                egress_flush_timer(egress, now);
+            rm_stats->idle_cycles += now - last_tsc;
+            last_tsc = now;
+            continue;
+        }
+        idle_ctrl_reset(&head->idle);
+
+        if (head->bctrl.enabled)
+            batch_start = rte_rdtsc();
+
+        rm_stats->rx_batch_cnt++;
+        rm_stats->rx_buf_cnt += nb_rx;
+        for (int k = 0; k < nb_rx; k++)
+            rm_stats->rx_buf_bytes += mbufs[k]->data_len;
+
+        /* the burst stays on this core from rx to tx */
+        mbufs_in = mbufs;
+        nb_pkts = nb_rx;
+        for (int i = 0; i < pl->nb_pl_stages && nb_pkts; i++) {
+            nb_pkts = pipeline_stage_exec_burst(chain[i], mbufs_in, nb_pkts, &mbufs_out);
+            mbufs_in = mbufs_out;
+        }
+
+        if (nb_pkts)
+            rm_stats->tx_batch_cnt++;
+        rm_stats->tx_buf_cnt += nb_pkts;
+        for (int k = 0; k < nb_pkts; k++)
+            rm_stats->tx_buf_bytes += mbufs_in[k]->data_len;
+
+        if (egress)
+            egress_send(egress, mbufs_in, nb_pkts);
+        else
+            rte_pktmbuf_free_bulk(mbufs_in, nb_pkts);
+
+        /* a full burst means more packets wait in the rx queue */
+        if (head->bctrl.enabled) {
+            burst_size = batch_ctrl_update(&head->bctrl, rte_rdtsc() - batch_start,
+                nb_rx == burst_size ? burst_size : 0);
+            burst_size = RTE_MIN(burst_size, MAX_PKTS_BURST);
+            head->batch_size = burst_size;
+        }
+
+        now = rte_rdtsc();
+        if (egress)
+            egress_flush_timer(egress, now);
+        rm_stats->busy_cycles += now - last_tsc;
+        last_tsc = now;
+    }
+    egress_flush(egress);
+
+    printf("Worker %d exiting\n", head->worker_qid);
+    return 0;
+}
+
+/* Sum the worker counters into queue 0, which stands for the whole run in the stats */
+static void
+run_rtc_stats_sum(struct pipeline *pl)
+{
+    run_mode_stats_t *rm_stats = pl->conf.stats->rm_stats;
+    run_mode_stats_t *total = &rm_stats[0];
+    int nb_workers = pl->nb_inst_per_pl_stage[0];
+
+    total->rx_buf_cnt = 0;
+    total->rx_buf_bytes = 0;
+    total->tx_buf_cnt = 0;
+    total->tx_buf_bytes = 0;
+    for (int q = 1; q <= nb_workers; q++) {
+        total->rx_buf_cnt += rm_stats[q].rx_buf_cnt;
+        total->rx_buf_bytes += rm_stats[q].rx_buf_bytes;
+        total->tx_buf_cnt += rm_stats[q].tx_buf_cnt;
+        total->tx_buf_bytes += rm_stats[q].tx_buf_bytes;
+    }
+}
+
+/* Main core only keeps time and sums stats, packets never reach it */
+static int
+run_rtc(struct pipeline *pl)
+{
+    pl_conf *run_conf = &pl->conf;
+    uint64_t max_cycles = run_conf->input_duration * rte_get_timer_hz();
+    uint64_t prev_cycles = 0;
+    uint64_t cycles = 0;
+    uint64_t start = rte_rdtsc();
+
+    while (!force_quit && (!max_cycles || cycles <= max_cycles)) {
+        rte_delay_us_sleep(RTC_MAIN_POLL_US);
+        cycles = rte_rdtsc() - start;
+        /* queue 0 totals for the stats thread and telemetry */
+        if (cycles - prev_cycles > STATS_INTERVAL_CYCLES) {
+            prev_cycles = cycles;
+            run_rtc_stats_sum(pl);
+        }
+    }
+    run_rtc_stats_sum(pl);
+
+    printf("Exiting on main core\n");
+    return 0;
+}
+
+/* Start one worker per rx queue, run the main loop and wait for the workers */
+int
+run_rtc_launch(struct pipeline *pl)
+{
+    pl_conf *run_conf = &pl->conf;
+    rb_stats_t *stats = run_conf->stats;
+    unsigned int lcore_id;
+    int ret = 0;
+
+    run_conf->running = true;
+    stats->rm_stats[0].self = &pl->seq_stage;
+    stats->rm_stats[0].stage_type = pl->seq_stage.type;
+
+    /* worker w is instance w of every stage and records its stats in queue w + 1 */
+    for (int w = 0; w < pl->nb_inst_per_pl_stage[0]; w++) {
+        ret = pipeline_stage_launch(pl->stages[0][w], w + 1);
+        if (ret)
+            break;
+    }
+
+    if (!ret) {
+        MEILI_LOG_INFO("Starting on main core...");
+        ret = run_mode_launch(pl);
+    }
+
+    /* set running flag to false to notice all workers of end of run */
+    run_conf->running = false;
+    if (ret)
+        MEILI_LOG_ERR("Failure in run mode");
+
+    RTE_LCORE_FOREACH_WORKER(lcore_id) {
+        if (rte_eal_wait_lcore(lcore_id)) {
+            MEILI_LOG_ERR("Lcore %u returned a runtime error", lcore_id);
+            ret = -EINVAL;
+        }
+    }
+
+    return ret;
+}
+
+void
+run_rtc_reg(run_func_t *funcs)
+{
+    funcs->run = run_rtc;
+}
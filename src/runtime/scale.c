@@ -0,0 +1,711 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+
+#include "scale.h"
+#include "dispatch.h"
+#include "placement.h"
+#include "run_mode.h"
+#include "tap.h"
+#include "../packet_ordering/packet_ordering.h"
+#include "../lib/log/meili_log.h"
+
+int
+scale_init(struct pipeline *pl)
+{
+    size_t size;
+    int ret;
+
+    pl->qsv = NULL;
+    if (!pl->conf.scale_fifo)
+        return 0;
+
+    #if defined(SHARED_BUFFER) || !defined(MEILI_MODE)
+    MEILI_LOG_ERR("Online scaling needs separate rings and MEILI_MODE");
+    return -ENOTSUP;
+    #endif
+
+    size = rte_rcu_qsbr_get_memsize(RTE_MAX_LCORE);
+    pl->qsv = rte_zmalloc(NULL, size, RTE_CACHE_LINE_SIZE);
+    if (!pl->qsv) {
+        MEILI_LOG_ERR("Memory failure allocating scaling qsbr variable.");
+        return -ENOMEM;
+    }
+
+    ret = rte_rcu_qsbr_init(pl->qsv, RTE_MAX_LCORE);
+    if (ret) {
+        rte_free(pl->qsv);
+        pl->qsv = NULL;
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+void
+scale_free(struct pipeline *pl)
+{
+    rte_free(pl->qsv);
+    pl->qsv = NULL;
+}
+
+#ifndef SHARED_BUFFER
+/* A ring of a new instance and the instance at its other end, NULL for the main core */
+struct scale_link {
+    struct rte_ring *ring;
+    struct pipeline_stage *peer;
+    int edge;                   /* -1 for head and tail rings */
+};
+
+static int
+scale_link_create(struct scale_link *links, int *nb_links, const char *name, int socket_id, unsigned int flags,
+    struct pipeline_stage *peer, int edge)
+{
+    if (*nb_links >= NB_MAX_RING)
+        return -ENOSPC;
+
+    links[*nb_links].ring = rte_ring_create(name, RING_SIZE, socket_id, flags);
+    if (!links[*nb_links].ring)
+        return -ENOMEM;
+    links[*nb_links].peer = peer;
+    links[*nb_links].edge = edge;
+    (*nb_links)++;
+
+    return 0;
+}
+
+static int
+scale_ring_find(struct rte_ring **rings, int nb_rings, struct rte_ring *ring)
+{
+    for (int r = 0; r < nb_rings; r++) {
+        if (rings[r] == ring)
+            return r;
+    }
+    return -1;
+}
+
+static int
+scale_ring_in_add(struct pipeline_stage *self, struct rte_ring *ring)
+{
+    int r = self->nb_ring_in;
+
+    if (r >= NB_MAX_RING)
+        return -ENOSPC;
+
+    self->ring_in[r] = ring;
+    __atomic_store_n(&self->nb_ring_in, r + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+static void
+scale_ring_in_del(struct pipeline_stage *self, int r)
+{
+    int last = self->nb_ring_in - 1;
+
+    self->ring_in[r] = self->ring_in[last];
+    __atomic_store_n(&self->nb_ring_in, last, __ATOMIC_RELEASE);
+}
+
+static int
+scale_ring_out_add(struct pipeline *pl, struct pipeline_stage *self, struct rte_ring *ring, int e,
+    struct idle_ctrl *wake)
+{
+    int r = self->nb_ring_out;
+
+    if (r >= NB_MAX_RING)
+        return -ENOSPC;
+
+    self->ring_out[r] = ring;
+    self->out_policy[r] = e >= 0 ? pl->edges[e].policy : BP_BLOCK;
+    self->out_spill[r] = e >= 0 ? pl->edges[e].spill_ring : NULL;
+    self->out_edge[r] = e;
+    self->out_full_cnt[r] = 0;
+    self->out_drop_cnt[r] = 0;
+    self->out_wake[r] = wake;
+    self->out_tap[r] = tap_edge(pl, self, e);
+    __atomic_store_n(&self->nb_ring_out, r + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+static void
+scale_ring_out_del(struct pipeline *pl, struct pipeline_stage *self, int r)
+{
+    int last = self->nb_ring_out - 1;
+    int e = self->out_edge[r];
+
+    /* edge totals keep what the ring went through */
+    if (e >= 0) {
+        pl->edges[e].retired_full_cnt += self->out_full_cnt[r];
+        pl->edges[e].retired_drop_cnt += self->out_drop_cnt[r];
+    }
+
+    self->ring_out[r] = self->ring_out[last];
+    self->out_policy[r] = self->out_policy[last];
+    self->out_spill[r] = self->out_spill[last];
+    self->out_edge[r] = self->out_edge[last];
+    self->out_full_cnt[r] = self->out_full_cnt[last];
+    self->out_drop_cnt[r] = self->out_drop_cnt[last];
+    self->out_wake[r] = self->out_wake[last];
+    self->out_tap[r] = self->out_tap[last];
+    __atomic_store_n(&self->nb_ring_out, last, __ATOMIC_RELEASE);
+
+    self->out_edge[last] = -1;
+    self->out_tap[last] = NULL;
+    self->out_full_cnt[last] = 0;
+    self->out_drop_cnt[last] = 0;
+}
+
+static void
+scale_tail_ring_del(struct pipeline *pl, int r)
+{
+    int last = pl->nb_ring_out - 1;
+
+    pl->ring_out[r] = pl->ring_out[last];
+    __atomic_store_n(&pl->nb_ring_out, last, __ATOMIC_RELEASE);
+}
+
+/* Rings an instance reads together with its siblings */
+static bool
+scale_ring_shared(struct pipeline *pl, int stage, struct rte_ring *ring)
+{
+    if (ring == pl->handoff_rings[stage])
+        return true;
+    for (int e = 0; e < pl->nb_edges; e++) {
+        if (pl->edges[e].dst == stage && pl->edges[e].spill_ring == ring)
+            return true;
+    }
+    return false;
+}
+
+/* Stats queue not used by any instance, queue 0 is the main core */
+static int
+scale_free_qid(struct pipeline *pl)
+{
+    run_mode_stats_t *rm_stats = pl->conf.stats->rm_stats;
+
+    for (int q = 1; q < (int)pl->conf.cores; q++) {
+        if (!rm_stats[q].self)
+            return q;
+    }
+    return -EBUSY;
+}
+
+/* Ring read by all instances of stage, created when an instance first leaves packets behind */
+static struct rte_ring *
+scale_handoff_ring(struct pipeline *pl, int stage)
+{
+    struct rte_ring *ring;
+    char ring_name[64];
+
+    if (pl->handoff_rings[stage])
+        return pl->handoff_rings[stage];
+
+    for (int k = 0; k < pl->nb_inst_per_pl_stage[stage]; k++) {
+        if (pl->stages[stage][k]->nb_ring_in >= NB_MAX_RING)
+            return NULL;
+    }
+
+    snprintf(ring_name, 64, "handoff_ring_%d", stage);
+    ring = rte_ring_create(ring_name, RING_SIZE, placement_socket(pl->stages[stage][0]), 0);
+    if (!ring)
+        return NULL;
+
+    for (int k = 0; k < pl->nb_inst_per_pl_stage[stage]; k++)
+        scale_ring_in_add(pl->stages[stage][k], ring);
+    pl->handoff_rings[stage] = ring;
+
+    return ring;
+}
+
+/* Move what a removed instance left in one of its input rings to the surviving instances */
+static void
+scale_ring_handoff(struct pipeline *pl, int stage, struct rte_ring *ring)
+{
+    struct rte_mbuf *mbufs[MAX_PKTS_BURST];
+    struct rte_ring *handoff;
+    int nb_deq;
+    int nb_enq;
+
+    if (rte_ring_empty(ring))
+        return;
+
+    handoff = scale_handoff_ring(pl, stage);
+    if (!handoff)
+        MEILI_LOG_ERR("No handoff ring for stage %d, packets left by the removed instance are dropped", stage);
+
+    while ((nb_deq = rte_ring_dequeue_burst(ring, (void *)mbufs, MAX_PKTS_BURST, NULL)) > 0) {
+        nb_enq = 0;
+        while (handoff && nb_enq < nb_deq && !force_quit && pl->conf.running) {
+            nb_enq += rte_ring_enqueue_burst(handoff, (void *)(&mbufs[nb_enq]), nb_deq - nb_enq, NULL);
+            for (int k = 0; k < pl->nb_inst_per_pl_stage[stage]; k++)
+                idle_doorbell(&pl->stages[stage][k]->idle);
+            if (nb_enq < nb_deq)
+                rte_delay_us_sleep(SCALE_DRAIN_US);
+        }
+        if (nb_enq < nb_deq) {
+            reorder_tombstone(pl, &mbufs[nb_enq], nb_deq - nb_enq);
+            rte_pktmbuf_free_bulk(&mbufs[nb_enq], nb_deq - nb_enq);
+            pipeline_pkts_exit(pl, nb_deq - nb_enq);
+        }
+    }
+}
+
+/* Drop what is left in a ring no one reads anymore */
+static void
+scale_ring_drop(struct pipeline *pl, struct rte_ring *ring)
+{
+    struct rte_mbuf *mbufs[MAX_PKTS_BURST];
+    int nb_deq;
+
+    while ((nb_deq = rte_ring_dequeue_burst(ring, (void *)mbufs, MAX_PKTS_BURST, NULL)) > 0) {
+        reorder_tombstone(pl, mbufs, nb_deq);
+        rte_pktmbuf_free_bulk(mbufs, nb_deq);
+        pipeline_pkts_exit(pl, nb_deq);
+    }
+}
+
+/* Add one instance to stage while the pipeline runs.
+ * The instance is set up, wired and launched before any producer or consumer can see its rings,
+ * then its rings are appended to the arrays of its peers. Nothing has to wait for readers.
+ */
+int
+scale_stage_out(struct pipeline *pl, int stage)
+{
+    struct scale_link in[NB_MAX_RING];
+    struct scale_link out[NB_MAX_RING];
+    struct pipeline_stage *self;
+    struct pipeline_stage *peer;
+    struct pipeline_edge *edge;
+    char ring_name[64];
+    int nb_in = 0;
+    int nb_out = 0;
+    int inst;
+    int qid;
+    int lcore;
+    int ret;
+
+    if (!pl->qsv)
+        return -ENOTSUP;
+    if (stage < 0 || stage >= pl->nb_pl_stages)
+        return -EINVAL;
+
+    inst = pl->nb_inst_per_pl_stage[stage];
+    if (inst >= NB_INSTANCE_PER_PIPELINE_STAGE_MAX)
+        return -ENOSPC;
+
+    /* every ring of the new instance needs a free slot at its other end */
+    if (pipeline_stage_is_source(pl, stage) && pl->nb_ring_in >= NB_MAX_RING)
+        return -ENOSPC;
+    if (pipeline_stage_is_sink(pl, stage) && pl->nb_ring_out >= NB_MAX_RING)
+        return -ENOSPC;
+    for (int e = 0; e < pl->nb_edges; e++) {
+        edge = &pl->edges[e];
+        if (edge->dst == stage) {
+            for (int j = 0; j < pl->nb_inst_per_pl_stage[edge->src]; j++) {
+                if (pl->stages[edge->src][j]->nb_ring_out >= NB_MAX_RING)
+                    return -ENOSPC;
+            }
+        }
+        if (edge->src == stage) {
+            for (int k = 0; k < pl->nb_inst_per_pl_stage[edge->dst]; k++) {
+                if (pl->stages[edge->dst][k]->nb_ring_in >= NB_MAX_RING)
+                    return -ENOSPC;
+            }
+        }
+    }
+
+    qid = scale_free_qid(pl);
+    if (qid < 0)
+        return qid;
+    lcore = placement_pick(pl, stage);
+    if (lcore < 0)
+        return lcore;
+
+    ret = pipeline_stage_create(pl, stage, inst, lcore);
+    if (ret) {
+        placement_release(lcore);
+        return ret;
+    }
+    self = pl->stages[stage][inst];
+
+    /* rings into the new instance, on its NUMA node */
+    if (pipeline_stage_is_source(pl, stage)) {
+        snprintf(ring_name, 64, "head_ring_in_%d_%d", stage, inst);
+        ret = scale_link_create(in, &nb_in, ring_name, placement_socket(self),
+            RING_F_SP_ENQ | pipeline_ring_deq_flags(self), NULL, -1);
+        if (ret)
+            goto err;
+    }
+    for (int e = 0; e < pl->nb_edges; e++) {
+        edge = &pl->edges[e];
+        if (edge->dst != stage)
+            continue;
+        for (int j = 0; j < pl->nb_inst_per_pl_stage[edge->src]; j++) {
+            snprintf(ring_name, 64, "inter_worker_ring_%d_%d_%d_%d", edge->src, edge->dst, j, inst);
+            ret = scale_link_create(in, &nb_in, ring_name, placement_socket(self),
+                RING_F_SP_ENQ | pipeline_ring_deq_flags(self), pl->stages[edge->src][j], e);
+            if (ret)
+                goto err;
+        }
+    }
+
+    /* rings out of the new instance, on the NUMA node of each consumer */
+    for (int e = 0; e < pl->nb_edges; e++) {
+        edge = &pl->edges[e];
+        if (edge->src != stage)
+            continue;
+        for (int k = 0; k < pl->nb_inst_per_pl_stage[edge->dst]; k++) {
+            peer = pl->stages[edge->dst][k];
+            snprintf(ring_name, 64, "inter_worker_ring_%d_%d_%d_%d", edge->src, edge->dst, inst, k);
+            ret = scale_link_create(out, &nb_out, ring_name, placement_socket(peer),
+                RING_F_SP_ENQ | pipeline_ring_deq_flags(peer), peer, e);
+            if (ret)
+                goto err;
+        }
+    }
+    if (pipeline_stage_is_sink(pl, stage)) {
+        snprintf(ring_name, 64, "tail_ring_out_%d_%d", stage, inst);
+        ret = scale_link_create(out, &nb_out, ring_name, placement_socket(NULL),
+            RING_F_SP_ENQ | RING_F_SC_DEQ, NULL, -1);
+        if (ret)
+            goto err;
+    }
+
+    for (int i = 0; i < nb_in; i++) {
+        ret = scale_ring_in_add(self, in[i].ring);
+        if (ret)
+            goto err;
+    }
+    /* shared rings the siblings read as well */
+    for (int e = 0; e < pl->nb_edges; e++) {
+        if (pl->edges[e].dst == stage && pl->edges[e].spill_ring) {
+            ret = scale_ring_in_add(self, pl->edges[e].spill_ring);
+            if (ret)
+                goto err;
+        }
+    }
+    if (pl->handoff_rings[stage]) {
+        ret = scale_ring_in_add(self, pl->handoff_rings[stage]);
+        if (ret)
+            goto err;
+    }
+    for (int i = 0; i < nb_out; i++) {
+        ret = scale_ring_out_add(pl, self, out[i].ring, out[i].edge, out[i].peer ? &out[i].peer->idle : NULL);
+        if (ret)
+            goto err;
+    }
+
+    ret = pipeline_stage_launch(self, qid);
+    if (ret) {
+        pl->conf.stats->rm_stats[qid].self = NULL;
+        pl->conf.stats->rm_stats[qid].stage_type = PL_NB_OF_STAGE_TYPES;
+        goto err;
+    }
+
+    /* running, let the rest of the pipeline see it */
+    __atomic_store_n(&pl->nb_inst_per_pl_stage[stage], inst + 1, __ATOMIC_RELEASE);
+    pl->nb_pl_stage_inst++;
+    for (int i = 0; i < nb_in; i++) {
+        if (in[i].peer)
+            scale_ring_out_add(pl, in[i].peer, in[i].ring, in[i].edge, &self->idle);
+        else
+            dispatch_ring_add(pl, in[i].ring, self);
+    }
+    for (int i = 0; i < nb_out; i++) {
+        if (out[i].peer) {
+            scale_ring_in_add(out[i].peer, out[i].ring);
+        }
+        else {
+            pl->ring_out[pl->nb_ring_out] = out[i].ring;
+            __atomic_store_n(&pl->nb_ring_out, pl->nb_ring_out + 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    return 0;
+
+err:
+    for (int i = 0; i < nb_in; i++)
+        rte_ring_free(in[i].ring);
+    for (int i = 0; i < nb_out; i++)
+        rte_ring_free(out[i].ring);
+    pl->stages[stage][inst] = NULL;
+    pipeline_stage_free_safe(self);
+    placement_release(lcore);
+
+    return ret;
+}
+
+/* Remove the last instance of stage while the pipeline runs.
+ * Its input rings are unhooked first and the instance stops once no reader can still hold them.
+ * Packets it did not get to move to a handoff ring read by the survivors, and its output rings are
+ * unhooked and freed after their consumers emptied them. On quit the teardown still completes, what the
+ * consumers did not get to is dropped, and -ECANCELED is returned.
+ */
+int
+scale_stage_in(struct pipeline *pl, int stage)
+{
+    struct pipeline_stage *self;
+    struct pipeline_stage *peer;
+    struct pipeline_edge *edge;
+    struct rte_ring *ring;
+    bool cancel = false;
+    int inst;
+    int idx;
+    int ret;
+
+    if (!pl->qsv)
+        return -ENOTSUP;
+    if (stage < 0 || stage >= pl->nb_pl_stages)
+        return -EINVAL;
+
+    /* a stage keeps at least one instance */
+    inst = pl->nb_inst_per_pl_stage[stage] - 1;
+    if (inst < 1)
+        return -EINVAL;
+    self = pl->stages[stage][inst];
+
+    /* stop feeding it: siblings no longer steal from it, producers and the dispatcher drop its rings */
+    __atomic_store_n(&pl->nb_inst_per_pl_stage[stage], inst, __ATOMIC_RELEASE);
+    for (int r = 0; r < self->nb_ring_in; r++) {
+        ring = self->ring_in[r];
+        if (scale_ring_shared(pl, stage, ring))
+            continue;
+
+        idx = scale_ring_find(pl->ring_in, pl->nb_ring_in, ring);
+        if (idx >= 0) {
+            dispatch_ring_remove(pl, idx);
+            continue;
+        }
+        for (int e = 0; e < pl->nb_edges; e++) {
+            edge = &pl->edges[e];
+            if (edge->dst != stage)
+                continue;
+            for (int j = 0; j < pl->nb_inst_per_pl_stage[edge->src]; j++) {
+                peer = pl->stages[edge->src][j];
+                idx = scale_ring_find(peer->ring_out, peer->nb_ring_out, ring);
+                if (idx >= 0)
+                    scale_ring_out_del(pl, peer, idx);
+            }
+        }
+    }
+    rte_rcu_qsbr_synchronize(pl->qsv, RTE_QSBR_THRID_INVALID);
+
+    /* nothing reaches its input rings anymore, it finishes the burst at hand and leaves.
+     * The control thread stands in for the main lcore here, nothing else waits on workers while it runs.
+     */
+    __atomic_store_n(&self->stop, 1, __ATOMIC_RELEASE);
+    idle_doorbell(&self->idle);
+    rte_eal_wait_lcore(self->core_id);
+
+    for (int r = 0; r < self->nb_ring_in; r++) {
+        ring = self->ring_in[r];
+        if (scale_ring_shared(pl, stage, ring))
+            continue;
+        scale_ring_handoff(pl, stage, ring);
+        rte_ring_free(ring);
+    }
+
+    /* consumers empty its output rings before they are unhooked */
+    for (int r = 0; r < self->nb_ring_out && !cancel; r++) {
+        while (!rte_ring_empty(self->ring_out[r])) {
+            if (force_quit || !pl->conf.running) {
+                cancel = true;
+                break;
+            }
+            rte_delay_us_sleep(SCALE_DRAIN_US);
+        }
+    }
+    for (int r = 0; r < self->nb_ring_out; r++) {
+        ring = self->ring_out[r];
+        if (self->out_edge[r] < 0) {
+            idx = scale_ring_find(pl->ring_out, pl->nb_ring_out, ring);
+            if (idx >= 0)
+                scale_tail_ring_del(pl, idx);
+            continue;
+        }
+
+        edge = &pl->edges[self->out_edge[r]];
+        edge->retired_full_cnt += self->out_full_cnt[r];
+        edge->retired_drop_cnt += self->out_drop_cnt[r];
+        for (int k = 0; k < pl->nb_inst_per_pl_stage[edge->dst]; k++) {
+            peer = pl->stages[edge->dst][k];
+            idx = scale_ring_find(peer->ring_in, peer->nb_ring_in, ring);
+            if (idx >= 0)
+                scale_ring_in_del(peer, idx);
+        }
+    }
+    /* stats printing on the main core reads the instance as well */
+    pl->conf.stats->rm_stats[self->worker_qid].stage_type = PL_NB_OF_STAGE_TYPES;
+    pl->conf.stats->rm_stats[self->worker_qid].self = NULL;
+    rte_rcu_qsbr_synchronize(pl->qsv, RTE_QSBR_THRID_INVALID);
+
+    for (int r = 0; r < self->nb_ring_out; r++) {
+        scale_ring_drop(pl, self->ring_out[r]);
+        rte_ring_free(self->ring_out[r]);
+    }
+
+    placement_release(self->core_id);
+    pl->stages[stage][inst] = NULL;
+    pl->nb_pl_stage_inst--;
+
+    ret = pipeline_stage_free_safe(self);
+
+    return cancel ? -ECANCELED : ret;
+}
+
+#else
+int
+scale_stage_out(struct pipeline *pl __rte_unused, int stage __rte_unused)
+{
+    return -ENOTSUP;
+}
+
+int
+scale_stage_in(struct pipeline *pl __rte_unused, int stage __rte_unused)
+{
+    return -ENOTSUP;
+}
+#endif
+
+static void
+scale_ctrl_cmd(struct pipeline *pl, char *line)
+{
+    char op[8];
+    int stage;
+    int ret;
+
+    if (sscanf(line, "%7s %d", op, &stage) != 2) {
+        MEILI_LOG_WARN("Invalid scale command: %s", line);
+        return;
+    }
+
+    if (strcmp(op, "out") == 0)
+        ret = scale_stage_out(pl, stage);
+    else if (strcmp(op, "in") == 0)
+        ret = scale_stage_in(pl, stage);
+    else {
+        MEILI_LOG_WARN("Invalid scale command: %s", line);
+        return;
+    }
+
+    if (ret)
+        MEILI_LOG_ERR("Scaling stage %d %s failed: %s", stage, op, strerror(-ret));
+    else
+        MEILI_LOG_INFO("Stage %d scaled %s to %d instance(s)", stage, op, pl->nb_inst_per_pl_stage[stage]);
+}
+
+/* Read newline separated commands from the scale fifo until the end of run */
+static void *
+scale_ctrl_thread(void *arg)
+{
+    struct pipeline *pl = arg;
+    pl_conf *run_conf = &pl->conf;
+    char buf[SCALE_CMD_LEN];
+    struct timeval timeout;
+    size_t len = 0;
+    fd_set fds;
+    char *eol;
+    ssize_t n;
+    int fd;
+
+    fd = open(run_conf->scale_fifo, O_RDONLY | O_NONBLOCK);
+    if (fd < 0) {
+        MEILI_LOG_ERR("Failed to open scale fifo %s", run_conf->scale_fifo);
+        return NULL;
+    }
+
+    while (!force_quit && run_conf->running) {
+        timeout.tv_sec = 0;
+        timeout.tv_usec = SCALE_POLL_US;
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+        if (select(fd + 1, &fds, NULL, NULL, &timeout) <= 0)
+            continue;
+
+        n = read(fd, buf + len, sizeof(buf) - 1 - len);
+        if (n <= 0) {
+            /* the last writer went away, reopen so select waits for the next one */
+            close(fd);
+            fd = open(run_conf->scale_fifo, O_RDONLY | O_NONBLOCK);
+            if (fd < 0) {
+                MEILI_LOG_ERR("Failed to reopen scale fifo %s", run_conf->scale_fifo);
+                return NULL;
+            }
+            continue;
+        }
+
+        len += n;
+        buf[len] = '\0';
+        while ((eol = strchr(buf, '\n'))) {
+            *eol = '\0';
+            scale_ctrl_cmd(pl, buf);
+            len -= eol + 1 - buf;
+            memmove(buf, eol + 1, len + 1);
+        }
+        if (len == sizeof(buf) - 1) {
+            MEILI_LOG_WARN("Scale command longer than %d characters dropped", SCALE_CMD_LEN - 1);
+            len = 0;
+        }
+    }
+
+    close(fd);
+
+    return NULL;
+}
+
+/* Start taking scale commands, the main lcore must be registered already */
+int
+scale_ctrl_start(struct pipeline *pl)
+{
+    const char *path = pl->conf.scale_fifo;
+    struct stat st;
+    int ret;
+
+    if (!pl->qsv)
+        return 0;
+
+    if (mkfifo(path, 0600) && errno != EEXIST) {
+        ret = -errno;
+        MEILI_LOG_ERR("Failed to create scale fifo %s", path);
+        return ret;
+    }
+    if (stat(path, &st) || !S_ISFIFO(st.st_mode)) {
+        MEILI_LOG_ERR("Scale fifo %s is not a fifo", path);
+        return -EINVAL;
+    }
+
+    ret = rte_ctrl_thread_create(&pl->scale_thread, "meili-scale", NULL, scale_ctrl_thread, pl);
+    if (ret) {
+        MEILI_LOG_ERR("Failed to start scale control thread");
+        return -ret;
+    }
+    pl->scale_thread_on = true;
+
+    MEILI_LOG_INFO("Taking scale commands on %s", path);
+
+    return 0;
+}
+
+/* Called after the end of run, once the main lcore holds no ring */
+void
+scale_ctrl_stop(struct pipeline *pl)
+{
+    if (!pl->scale_thread_on)
+        return;
+
+    pthread_join(pl->scale_thread, NULL);
+    pl->scale_thread_on = false;
+}
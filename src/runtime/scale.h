@@ -0,0 +1,68 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_SCALE_H
+#define _INCLUDE_SCALE_H
+
+#include <rte_rcu_qsbr.h>
+
+#include "pipeline.h"
+
+#define SCALE_CMD_LEN 64
+#define SCALE_POLL_US 100000        /* how often the control thread checks for commands and the end of run */
+#define SCALE_DRAIN_US 100          /* sleep between checks of a ring being drained */
+
+/* Online scaling of stage instances.
+ * Every lcore that reads ring arrays (workers and the main core) is a QSBR reader and reports a quiescent
+ * state once per loop iteration, when it holds no ring taken from an array. Rings are appended to arrays
+ * by filling the slot before bumping the count. Removing a ring swaps the last one into its slot, and the
+ * ring is only drained and freed after rte_rcu_qsbr_synchronize(), once no reader can still hold it.
+ */
+
+static inline void
+scale_register(struct pipeline *pl, unsigned int lcore_id)
+{
+    if (!pl->qsv)
+        return;
+    rte_rcu_qsbr_thread_register(pl->qsv, lcore_id);
+    rte_rcu_qsbr_thread_online(pl->qsv, lcore_id);
+}
+
+static inline void
+scale_unregister(struct pipeline *pl, unsigned int lcore_id)
+{
+    if (!pl->qsv)
+        return;
+    rte_rcu_qsbr_thread_offline(pl->qsv, lcore_id);
+    rte_rcu_qsbr_thread_unregister(pl->qsv, lcore_id);
+}
+
+/* Holds no ring, rescaling does not wait for offline lcores */
+static inline void
+scale_offline(struct pipeline *pl, unsigned int lcore_id)
+{
+    if (pl->qsv)
+        rte_rcu_qsbr_thread_offline(pl->qsv, lcore_id);
+}
+
+static inline void
+scale_online(struct pipeline *pl, unsigned int lcore_id)
+{
+    if (pl->qsv)
+        rte_rcu_qsbr_thread_online(pl->qsv, lcore_id);
+}
+
+static inline void
+scale_quiescent(struct pipeline *pl, unsigned int lcore_id)
+{
+    if (pl->qsv)
+        rte_rcu_qsbr_quiescent(pl->qsv, lcore_id);
+}
+
+int scale_init(struct pipeline *pl);
+void scale_free(struct pipeline *pl);
+int scale_ctrl_start(struct pipeline *pl);
+void scale_ctrl_stop(struct pipeline *pl);
+int scale_stage_out(struct pipeline *pl, int stage);
+int scale_stage_in(struct pipeline *pl, int stage);
+
+#endif /* _INCLUDE_SCALE_H */
@@ -0,0 +1,238 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <rte_spinlock.h>
+
+#include "stage_mem.h"
+#include "pipeline.h"
+#include "../lib/log/meili_log.h"
+
+/* Header in front of every private allocation, one cache line so the state behind it stays aligned */
+struct stage_mem_block {
+    struct stage_mem_block *next;
+    struct stage_mem_block *prev;
+    size_t size;
+    char name[STAGE_MEM_NAME_LEN];
+} __rte_cache_aligned;
+
+/* Region shared by the instances of one stage, freed with the last instance mapping it */
+struct stage_mem_shared {
+    struct stage_mem_shared *next;
+    int tenant;
+    int stage;
+    char name[STAGE_MEM_NAME_LEN];
+    size_t size;
+    int socket_id;
+    uint32_t refcnt;
+    void *ptr;
+};
+
+/* instances may be created and freed at runtime by the scaling thread */
+static rte_spinlock_t stage_mem_lock = RTE_SPINLOCK_INITIALIZER;
+static struct stage_mem_shared *stage_mem_shared_list;
+
+/* Zeroed, cache aligned memory on socket_id, any node if that one is out of hugepages */
+static void *
+stage_mem_zmalloc(const char *name, size_t size, int socket_id)
+{
+    void *ptr;
+
+    ptr = rte_zmalloc_socket(name, size, RTE_CACHE_LINE_SIZE, socket_id);
+    if (ptr || socket_id == SOCKET_ID_ANY)
+        return ptr;
+
+    MEILI_LOG_WARN("No hugepage memory for %s on socket %d, allocating on any socket", name, socket_id);
+    return rte_zmalloc_socket(name, size, RTE_CACHE_LINE_SIZE, SOCKET_ID_ANY);
+}
+
+/* The instance's lcore must be known, state then goes to its NUMA node */
+void
+stage_mem_init(struct pipeline_stage *self)
+{
+    memset(&self->mem, 0, sizeof(self->mem));
+    self->mem.socket_id = rte_lcore_to_socket_id(self->core_id);
+}
+
+void *
+stage_mem_alloc(struct pipeline_stage *self, const char *name, size_t size)
+{
+    struct stage_mem *mem = &self->mem;
+    struct stage_mem_block *block;
+
+    block = stage_mem_zmalloc(name, sizeof(*block) + size, mem->socket_id);
+    if (!block) {
+        MEILI_LOG_ERR("Failed to allocate %zu bytes of %s for stage %d", size, name, self->stage_idx);
+        return NULL;
+    }
+    block->size = size;
+    snprintf(block->name, sizeof(block->name), "%s", name ? name : "");
+
+    block->next = mem->blocks;
+    block->prev = NULL;
+    if (mem->blocks)
+        mem->blocks->prev = block;
+    mem->blocks = block;
+    mem->nb_blocks++;
+    mem->bytes += size;
+
+    return block + 1;
+}
+
+/* Map region name of the stage, zeroed by the first instance asking for it.
+ * Instances may run concurrently on it, so its contents must be accessed with atomics.
+ */
+void *
+stage_mem_alloc_shared(struct pipeline_stage *self, const char *name, size_t size)
+{
+    struct pipeline *pl = (struct pipeline *)self->pl;
+    struct stage_mem *mem = &self->mem;
+    struct stage_mem_shared *region;
+
+    if (!name || !*name) {
+        MEILI_LOG_ERR("Shared state of stage %d needs a name", self->stage_idx);
+        return NULL;
+    }
+    if (mem->nb_shared >= STAGE_MEM_SHARED_MAX) {
+        MEILI_LOG_ERR("Stage %d maps too many shared regions, max %d", self->stage_idx, STAGE_MEM_SHARED_MAX);
+        return NULL;
+    }
+
+    rte_spinlock_lock(&stage_mem_lock);
+    for (region = stage_mem_shared_list; region; region = region->next) {
+        if (region->tenant == pl->tenant_per_pl_stage[self->stage_idx] && region->stage == self->stage_idx &&
+            strcmp(region->name, name) == 0)
+            break;
+    }
+
+    if (region && region->size != size) {
+        rte_spinlock_unlock(&stage_mem_lock);
+        MEILI_LOG_ERR("Shared state %s of stage %d is %zu bytes, not %zu", name, self->stage_idx, region->size, size);
+        return NULL;
+    }
+
+    if (!region) {
+        region = rte_zmalloc(NULL, sizeof(*region), 0);
+        if (region)
+            region->ptr = stage_mem_zmalloc(name, size, mem->socket_id);
+        if (!region || !region->ptr) {
+            rte_free(region);
+            rte_spinlock_unlock(&stage_mem_lock);
+            MEILI_LOG_ERR("Failed to allocate %zu bytes of shared %s for stage %d", size, name, self->stage_idx);
+            return NULL;
+        }
+        region->tenant = pl->tenant_per_pl_stage[self->stage_idx];
+        region->stage = self->stage_idx;
+        snprintf(region->name, sizeof(region->name), "%s", name);
+        region->size = size;
+        region->socket_id = mem->socket_id;
+        region->next = stage_mem_shared_list;
+        stage_mem_shared_list = region;
+    }
+    region->refcnt++;
+    rte_spinlock_unlock(&stage_mem_lock);
+
+    mem->shared[mem->nb_shared++] = region;
+
+    return region->ptr;
+}
+
+static void
+stage_mem_unmap(struct stage_mem_shared *region)
+{
+    struct stage_mem_shared **prev;
+
+    rte_spinlock_lock(&stage_mem_lock);
+    if (--region->refcnt) {
+        rte_spinlock_unlock(&stage_mem_lock);
+        return;
+    }
+    for (prev = &stage_mem_shared_list; *prev; prev = &(*prev)->next) {
+        if (*prev == region) {
+            *prev = region->next;
+            break;
+        }
+    }
+    rte_spinlock_unlock(&stage_mem_lock);
+
+    rte_free(region->ptr);
+    rte_free(region);
+}
+
+/* Free memory from stage_mem_alloc, or unmap a region from stage_mem_alloc_shared */
+void
+stage_mem_free(struct pipeline_stage *self, void *ptr)
+{
+    struct stage_mem *mem = &self->mem;
+    struct stage_mem_block *block;
+
+    if (!ptr)
+        return;
+
+    for (int r = 0; r < mem->nb_shared; r++) {
+        if (mem->shared[r]->ptr != ptr)
+            continue;
+        stage_mem_unmap(mem->shared[r]);
+        mem->shared[r] = mem->shared[--mem->nb_shared];
+        return;
+    }
+
+    block = (struct stage_mem_block *)ptr - 1;
+    if (block->prev)
+        block->prev->next = block->next;
+    else
+        mem->blocks = block->next;
+    if (block->next)
+        block->next->prev = block->prev;
+    mem->nb_blocks--;
+    mem->bytes -= block->size;
+
+    rte_free(block);
+}
+
+/* Free whatever the app left allocated when the instance goes away */
+void
+stage_mem_release(struct pipeline_stage *self)
+{
+    struct stage_mem *mem = &self->mem;
+
+    if (mem->nb_blocks)
+        MEILI_LOG_INFO("Stage %d instance %d left %zu bytes of state in %u blocks, freeing", self->stage_idx,
+            self->inst_idx, mem->bytes, mem->nb_blocks);
+    while (mem->blocks)
+        stage_mem_free(self, mem->blocks + 1);
+    while (mem->nb_shared)
+        stage_mem_free(self, mem->shared[0]->ptr);
+}
+
+/* State allocated through Meili.state_alloc by every instance, and the shared regions */
+void
+stage_mem_report(struct pipeline *pl)
+{
+    struct pipeline_stage *self;
+    struct stage_mem_shared *region;
+    size_t tot_bytes = 0;
+
+    printf("%8s %8s %8s %8s %16s\n", "Stage", "Instance", "Socket", "Blocks", "Bytes");
+    for (int i = 0; i < pl->nb_pl_stages; i++) {
+        for (int j = 0; j < pl->nb_inst_per_pl_stage[i]; j++) {
+            self = pl->stages[i][j];
+            printf("%8d %8d %8d %8u %16zu\n", i, j, self->mem.socket_id, self->mem.nb_blocks, self->mem.bytes);
+            tot_bytes += self->mem.bytes;
+        }
+    }
+
+    rte_spinlock_lock(&stage_mem_lock);
+    for (region = stage_mem_shared_list; region; region = region->next) {
+        printf("%8d %8s %8d %8s %16zu  %s, %u instance(s)\n", region->stage, "shared", region->socket_id, "-",
+            region->size, region->name, region->refcnt);
+        tot_bytes += region->size;
+    }
+    rte_spinlock_unlock(&stage_mem_lock);
+
+    printf("%8s %8s %8s %8s %16zu\n", "Total", "", "", "", tot_bytes);
+}
@@ -0,0 +1,34 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_STAGE_MEM_H
+#define _INCLUDE_STAGE_MEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STAGE_MEM_NAME_LEN 32
+#define STAGE_MEM_SHARED_MAX 8      /* shared regions one instance may map */
+
+struct pipeline;
+struct pipeline_stage;
+struct stage_mem_block;
+struct stage_mem_shared;
+
+/* State allocated by one stage instance, on hugepages of the NUMA node of its lcore */
+struct stage_mem {
+    int socket_id;
+    uint32_t nb_blocks;
+    size_t bytes;
+    struct stage_mem_block *blocks;                         /* private allocations */
+    struct stage_mem_shared *shared[STAGE_MEM_SHARED_MAX];  /* regions mapped by all instances of the stage */
+    int nb_shared;
+};
+
+void stage_mem_init(struct pipeline_stage *self);
+void *stage_mem_alloc(struct pipeline_stage *self, const char *name, size_t size);
+void *stage_mem_alloc_shared(struct pipeline_stage *self, const char *name, size_t size);
+void stage_mem_free(struct pipeline_stage *self, void *ptr);
+void stage_mem_release(struct pipeline_stage *self);
+void stage_mem_report(struct pipeline *pl);
+
+#endif /* _INCLUDE_STAGE_MEM_H */
@@ -0,0 +1,419 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <rte_time.h>
+
+#include "tap.h"
+#include "../lib/log/meili_log.h"
+
+/* pcapng blocks, written in host byte order which the section header announces */
+#define PCAPNG_SHB_TYPE 0x0A0D0D0A
+#define PCAPNG_IDB_TYPE 0x00000001
+#define PCAPNG_EPB_TYPE 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_COMMENT 1
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_LINKTYPE_ETHERNET 1
+#define PCAPNG_PAD(x) RTE_ALIGN_CEIL(x, 4)
+
+struct pcapng_shb {
+    uint32_t type;
+    uint32_t len;
+    uint32_t magic;
+    uint16_t major;
+    uint16_t minor;
+    int64_t section_len;
+    uint32_t len_trailer;
+} __rte_packed;
+
+/* one interface, timestamps in ns */
+struct pcapng_idb {
+    uint32_t type;
+    uint32_t len;
+    uint16_t linktype;
+    uint16_t rsvd;
+    uint32_t snaplen;
+    uint16_t tsresol_code;
+    uint16_t tsresol_len;
+    uint8_t tsresol;
+    uint8_t tsresol_pad[3];
+    uint16_t end_code;
+    uint16_t end_len;
+    uint32_t len_trailer;
+} __rte_packed;
+
+/* followed by the padded packet, the comment option, the end of options and the block length */
+struct pcapng_epb {
+    uint32_t type;
+    uint32_t len;
+    uint32_t if_id;
+    uint32_t ts_high;
+    uint32_t ts_low;
+    uint32_t caplen;
+    uint32_t origlen;
+} __rte_packed;
+
+struct pcapng_opt {
+    uint16_t code;
+    uint16_t len;
+} __rte_packed;
+
+static const char *tap_verdict_names[] = {"pass", "drop", "shed"};
+
+/* Take a reference on every segment, rte_pktmbuf_free() drops one from each */
+static inline void
+tap_ref(struct rte_mbuf *mbuf)
+{
+    for (struct rte_mbuf *seg = mbuf; seg; seg = seg->next)
+        rte_mbuf_refcnt_update(seg, 1);
+}
+
+static inline void
+tap_enqueue(struct pipeline_tap *tap, struct tap_entry *entries, unsigned int nb_entries)
+{
+    unsigned int nb_enq;
+
+    nb_enq = rte_ring_enqueue_burst_elem(tap->ring, entries, sizeof(entries[0]), nb_entries, NULL);
+    if (unlikely(nb_enq < nb_entries)) {
+        for (unsigned int k = nb_enq; k < nb_entries; k++)
+            rte_pktmbuf_free(entries[k].mbuf);
+        __atomic_fetch_add(&tap->nb_lost, nb_entries - nb_enq, __ATOMIC_RELAXED);
+    }
+}
+
+/* Slow path of tap_burst() and tap_edge_burst(), at least one packet of the burst is sampled */
+void
+tap_burst_sample(struct pipeline_stage *self, struct pipeline_tap *tap, int edge, struct rte_mbuf **mbufs,
+    int nb_pkts, uint8_t verdict)
+{
+    struct pipeline *pl = self->pl;
+    struct tap_entry entries[TAP_BURST];
+    uint64_t tsc = rte_rdtsc();
+    uint16_t dst = edge >= 0 ? pl->edges[edge].dst : TAP_NO_EDGE;
+    unsigned int n = 0;
+    uint32_t i;
+
+    for (i = self->tap_skip; i < (uint32_t)nb_pkts; i += tap->sample) {
+        tap_ref(mbufs[i]);
+        entries[n].mbuf = mbufs[i];
+        entries[n].tsc = tsc;
+        entries[n].pkt_len = rte_pktmbuf_pkt_len(mbufs[i]);
+        entries[n].data_off = mbufs[i]->data_off;
+        entries[n].stage = self->stage_idx;
+        entries[n].inst = self->inst_idx;
+        entries[n].dst = dst;
+        entries[n].verdict = verdict;
+        if (++n == TAP_BURST) {
+            tap_enqueue(tap, entries, n);
+            n = 0;
+        }
+    }
+    if (n)
+        tap_enqueue(tap, entries, n);
+
+    self->tap_skip = i - nb_pkts;
+}
+
+static int
+tap_write_hdr(struct pipeline_tap *tap)
+{
+    struct pcapng_shb shb = {
+        .type = PCAPNG_SHB_TYPE,
+        .len = sizeof(shb),
+        .magic = PCAPNG_BYTE_ORDER_MAGIC,
+        .major = 1,
+        .minor = 0,
+        .section_len = -1,
+        .len_trailer = sizeof(shb),
+    };
+    struct pcapng_idb idb = {
+        .type = PCAPNG_IDB_TYPE,
+        .len = sizeof(idb),
+        .linktype = PCAPNG_LINKTYPE_ETHERNET,
+        .snaplen = tap->snaplen,
+        .tsresol_code = PCAPNG_OPT_IF_TSRESOL,
+        .tsresol_len = 1,
+        .tsresol = 9,
+        .end_code = PCAPNG_OPT_END,
+        .len_trailer = sizeof(idb),
+    };
+
+    if (fwrite(&shb, sizeof(shb), 1, tap->file) != 1 || fwrite(&idb, sizeof(idb), 1, tap->file) != 1)
+        return -EIO;
+
+    return 0;
+}
+
+static inline uint64_t
+tap_tsc_to_ns(struct pipeline_tap *tap, uint64_t tsc)
+{
+    uint64_t cycles = tsc - tap->base_tsc;
+
+    return tap->base_ns + cycles / tap->hz * NS_PER_S + cycles % tap->hz * NS_PER_S / tap->hz;
+}
+
+/* Packet bytes as they were framed at capture, *caplen is trimmed to what is still in the mbuf */
+static const void *
+tap_pkt_data(struct pipeline_tap *tap, struct tap_entry *entry, uint32_t *caplen)
+{
+    struct rte_mbuf *mbuf = entry->mbuf;
+    uint32_t off;
+
+    if (mbuf->nb_segs == 1) {
+        *caplen = RTE_MIN(*caplen, (uint32_t)(mbuf->buf_len - entry->data_off));
+        return (const uint8_t *)mbuf->buf_addr + entry->data_off;
+    }
+
+    /* segmented packets are read through the chain, headers prepended since capture are skipped over */
+    off = entry->data_off > mbuf->data_off ? entry->data_off - mbuf->data_off : 0;
+    if (off >= rte_pktmbuf_pkt_len(mbuf))
+        return NULL;
+    *caplen = RTE_MIN(*caplen, rte_pktmbuf_pkt_len(mbuf) - off);
+
+    return rte_pktmbuf_read(mbuf, off, *caplen, tap->buf);
+}
+
+static int
+tap_write_pkt(struct pipeline_tap *tap, struct tap_entry *entry)
+{
+    static const uint8_t pad[4];
+    uint32_t caplen = RTE_MIN(entry->pkt_len, tap->snaplen);
+    char comment[TAP_COMMENT_LEN];
+    struct pcapng_opt opt_comment;
+    struct pcapng_opt opt_end = {PCAPNG_OPT_END, 0};
+    struct pcapng_epb epb;
+    const void *data;
+    uint64_t ts;
+    int clen;
+
+    if (entry->dst == TAP_NO_EDGE)
+        clen = snprintf(comment, sizeof(comment), "stage=%u (%s) inst=%u verdict=%s", entry->stage,
+            tap->stage_names[entry->stage], entry->inst, tap_verdict_names[entry->verdict]);
+    else
+        clen = snprintf(comment, sizeof(comment), "stage=%u (%s) inst=%u edge=%u->%u verdict=%s", entry->stage,
+            tap->stage_names[entry->stage], entry->inst, entry->stage, entry->dst,
+            tap_verdict_names[entry->verdict]);
+    clen = RTE_MIN(clen, (int)sizeof(comment) - 1);
+    opt_comment.code = PCAPNG_OPT_COMMENT;
+    opt_comment.len = clen;
+
+    data = tap_pkt_data(tap, entry, &caplen);
+    if (!data)
+        return -EINVAL;
+
+    ts = tap_tsc_to_ns(tap, entry->tsc);
+    epb.type = PCAPNG_EPB_TYPE;
+    epb.len = sizeof(epb) + PCAPNG_PAD(caplen) + sizeof(opt_comment) + PCAPNG_PAD(clen) + sizeof(opt_end) +
+        sizeof(uint32_t);
+    epb.if_id = 0;
+    epb.ts_high = ts >> 32;
+    epb.ts_low = (uint32_t)ts;
+    epb.caplen = caplen;
+    epb.origlen = entry->pkt_len;
+
+    if (fwrite(&epb, sizeof(epb), 1, tap->file) != 1 ||
+        fwrite(data, 1, caplen, tap->file) != caplen ||
+        fwrite(pad, 1, PCAPNG_PAD(caplen) - caplen, tap->file) != PCAPNG_PAD(caplen) - caplen ||
+        fwrite(&opt_comment, sizeof(opt_comment), 1, tap->file) != 1 ||
+        fwrite(comment, 1, clen, tap->file) != (size_t)clen ||
+        fwrite(pad, 1, PCAPNG_PAD(clen) - clen, tap->file) != PCAPNG_PAD(clen) - (size_t)clen ||
+        fwrite(&opt_end, sizeof(opt_end), 1, tap->file) != 1 ||
+        fwrite(&epb.len, sizeof(epb.len), 1, tap->file) != 1)
+        return -EIO;
+
+    tap->nb_written++;
+    tap->nb_bytes += caplen;
+
+    return 0;
+}
+
+/* Control thread writing queued packets, runs until tap_stop() and everything queued before it is written */
+static void *
+tap_writer_thread(void *arg)
+{
+    struct pipeline_tap *tap = arg;
+    struct tap_entry entries[TAP_BURST];
+    bool write_err = false;
+    unsigned int nb;
+    bool quit;
+
+    for (;;) {
+        /* workers are done once quit is seen, so the ring holds all there is left */
+        quit = __atomic_load_n(&tap->quit, __ATOMIC_ACQUIRE);
+        nb = rte_ring_sc_dequeue_burst_elem(tap->ring, entries, sizeof(entries[0]), TAP_BURST, NULL);
+        if (!nb) {
+            if (quit)
+                break;
+            rte_delay_us_sleep(TAP_POLL_US);
+            continue;
+        }
+
+        for (unsigned int k = 0; k < nb; k++) {
+            /* keep draining after a failed write so no packet stays referenced */
+            if (!write_err && tap_write_pkt(tap, &entries[k]) == -EIO) {
+                MEILI_LOG_ERR("Failed to write tap file, capture stopped.");
+                write_err = true;
+            }
+            rte_pktmbuf_free(entries[k].mbuf);
+        }
+    }
+
+    fflush(tap->file);
+
+    return NULL;
+}
+
+/* Set up the capture of tapped stages to --tap, pl->tap stays NULL without it. Call before stages are created. */
+int
+tap_init(struct pipeline *pl)
+{
+    pl_conf *conf = &pl->conf;
+    struct pipeline_tap *tap;
+    struct timespec now;
+    bool any = false;
+    int ret;
+
+    pl->tap = NULL;
+    if (!conf->tap_file)
+        return 0;
+
+    tap = rte_zmalloc(NULL, sizeof(*tap), RTE_CACHE_LINE_SIZE);
+    if (!tap) {
+        MEILI_LOG_ERR("Memory failure allocating tap.");
+        return -ENOMEM;
+    }
+    tap->sample = conf->tap_sample;
+    tap->snaplen = conf->tap_snaplen;
+
+    tap->ring = rte_ring_create_elem("meili_tap", sizeof(struct tap_entry), TAP_RING_SIZE, rte_socket_id(),
+        RING_F_SC_DEQ);
+    tap->buf = malloc(tap->snaplen);
+    if (!tap->ring || !tap->buf) {
+        MEILI_LOG_ERR("Memory failure allocating tap ring.");
+        ret = -ENOMEM;
+        goto err;
+    }
+
+    tap->file = fopen(conf->tap_file, "w");
+    if (!tap->file) {
+        ret = -errno;
+        MEILI_LOG_ERR("Failed to open tap file %s.", conf->tap_file);
+        goto err;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    tap->base_tsc = rte_rdtsc();
+    tap->base_ns = (uint64_t)now.tv_sec * NS_PER_S + now.tv_nsec;
+    tap->hz = rte_get_tsc_hz();
+
+    ret = tap_write_hdr(tap);
+    if (ret) {
+        MEILI_LOG_ERR("Failed to write tap file %s.", conf->tap_file);
+        goto err;
+    }
+
+    /* without a stage or edge flagged in pl.conf everything is tapped */
+    for (int i = 0; i < pl->nb_pl_stages; i++) {
+        GET_STAGE_TYPE_STRING(pl->stage_types[i], tap->stage_names[i]);
+        any |= pl->tap_per_pl_stage[i];
+    }
+    for (int e = 0; e < pl->nb_edges; e++)
+        any |= pl->edges[e].tap;
+    if (!any) {
+        for (int i = 0; i < pl->nb_pl_stages; i++)
+            pl->tap_per_pl_stage[i] = true;
+    }
+
+    pl->tap = tap;
+    MEILI_LOG_INFO("Tapping %s stages and edges to %s, 1 in %u packets, %u bytes each.", any ? "flagged" : "all",
+        conf->tap_file, tap->sample, tap->snaplen);
+
+    return 0;
+
+err:
+    if (tap->file)
+        fclose(tap->file);
+    free(tap->buf);
+    rte_ring_free(tap->ring);
+    rte_free(tap);
+    return ret;
+}
+
+/* Start the writer, call before the workers are launched */
+int
+tap_start(struct pipeline *pl)
+{
+    struct pipeline_tap *tap = pl->tap;
+    int ret;
+
+    if (!tap)
+        return 0;
+
+    tap->quit = false;
+    ret = rte_ctrl_thread_create(&tap->thread, "meili-tap", NULL, tap_writer_thread, tap);
+    if (ret) {
+        MEILI_LOG_ERR("Failed to start tap writer thread.");
+        return -ret;
+    }
+    tap->thread_on = true;
+
+    return 0;
+}
+
+/* Write what is left and stop the writer, call once no lcore runs a stage anymore */
+void
+tap_stop(struct pipeline *pl)
+{
+    struct pipeline_tap *tap = pl->tap;
+
+    if (!tap || !tap->thread_on)
+        return;
+
+    __atomic_store_n(&tap->quit, true, __ATOMIC_RELEASE);
+    pthread_join(tap->thread, NULL);
+    tap->thread_on = false;
+}
+
+void
+tap_free(struct pipeline *pl)
+{
+    struct pipeline_tap *tap = pl->tap;
+    struct tap_entry entry;
+
+    if (!tap)
+        return;
+
+    tap_stop(pl);
+    /* the writer never ran */
+    while (!rte_ring_sc_dequeue_elem(tap->ring, &entry, sizeof(entry)))
+        rte_pktmbuf_free(entry.mbuf);
+
+    fclose(tap->file);
+    free(tap->buf);
+    rte_ring_free(tap->ring);
+    rte_free(tap);
+    pl->tap = NULL;
+}
+
+void
+tap_stats_print(struct pipeline *pl)
+{
+    struct pipeline_tap *tap = pl->tap;
+
+    if (!tap)
+        return;
+
+    printf("%16s %16s %16s %16s\n", "Tap", "Written", "Lost", "Bytes");
+    printf("%16s %16lu %16lu %16lu\n", "pcapng", tap->nb_written,
+        __atomic_load_n(&tap->nb_lost, __ATOMIC_RELAXED), tap->nb_bytes);
+}
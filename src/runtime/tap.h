@@ -0,0 +1,119 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_TAP_H
+#define _INCLUDE_TAP_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <rte_branch_prediction.h>
+#include <rte_mbuf.h>
+#include <rte_ring.h>
+
+#include "pipeline.h"
+
+#define TAP_RING_SIZE 4096                      /* packets waiting for the writer, the rest are lost */
+#define TAP_BURST 64                            /* entries enqueued or written at once */
+#define TAP_POLL_US 100                         /* writer sleep while the ring is empty */
+#define TAP_COMMENT_LEN 96
+#define TAP_NO_EDGE UINT16_MAX                  /* captured by a stage tap, not on an edge */
+
+/* why a captured packet left the stage */
+enum tap_verdict {
+    TAP_PASS,                                   /* emitted towards the next stage or the main core */
+    TAP_DROP,                                   /* filtered by the stage, freed or diverted */
+    TAP_SHED,                                   /* emitted, then freed by the backpressure policy of a full edge */
+};
+
+/* A captured packet on its way to the writer, the mbuf holds one extra reference.
+ * Length and start are recorded at capture, a downstream stage may adjust them before the writer runs.
+ */
+struct tap_entry {
+    struct rte_mbuf *mbuf;
+    uint64_t tsc;
+    uint32_t pkt_len;
+    uint16_t data_off;
+    uint16_t stage;
+    uint16_t inst;
+    uint16_t dst;                               /* downstream stage of a tapped edge, TAP_NO_EDGE otherwise */
+    uint8_t verdict;
+    uint8_t rsvd[3];
+};
+
+/* Capture of tapped stages and edges to a pcapng file (--tap).
+ * Workers take a reference on every tap_sample-th packet and queue it without copying, a control thread
+ * writes the packets with their stage, edge and verdict in the block comment and drops the reference.
+ * The payload bytes are read when written, a downstream stage may have rewritten them in place by then.
+ */
+struct pipeline_tap {
+    struct rte_ring *ring;                      /* multi producer, read by the writer only */
+    uint32_t sample;
+    uint32_t snaplen;
+
+    FILE *file;
+    uint8_t *buf;                               /* linearized head of a segmented packet */
+    char stage_names[NB_PIPELINE_STAGE_MAX][32];
+    uint64_t base_tsc;                          /* tsc at base_ns, pcapng timestamps are ns since the epoch */
+    uint64_t base_ns;
+    uint64_t hz;
+
+    pthread_t thread;
+    bool thread_on;
+    bool quit;
+
+    uint64_t nb_written;                        /* writer only */
+    uint64_t nb_bytes;
+    uint64_t nb_lost;                           /* ring full, updated atomically by the workers */
+};
+
+void tap_burst_sample(struct pipeline_stage *self, struct pipeline_tap *tap, int edge, struct rte_mbuf **mbufs,
+    int nb_pkts, uint8_t verdict);
+
+/* Capture the sampled packets of a burst leaving self with verdict, the caller keeps its packets.
+ * Costs one branch per burst without a tap and one subtraction per burst with no packet sampled.
+ */
+static inline void
+tap_burst(struct pipeline_stage *self, struct rte_mbuf **mbufs, int nb_pkts, uint8_t verdict)
+{
+    if (likely(!self->tap))
+        return;
+
+    if ((uint32_t)nb_pkts <= self->tap_skip) {
+        self->tap_skip -= nb_pkts;
+        return;
+    }
+    tap_burst_sample(self, self->tap, -1, mbufs, nb_pkts, verdict);
+}
+
+/* Same for a burst self puts on ring_out[ring_idx], captured when the ring's edge is tapped and the stage is not.
+ * Call before the enqueue, the consumer may free the packets right after it.
+ */
+static inline void
+tap_edge_burst(struct pipeline_stage *self, int ring_idx, struct rte_mbuf **mbufs, int nb_pkts, uint8_t verdict)
+{
+    if (likely(!self->out_tap[ring_idx]))
+        return;
+
+    if ((uint32_t)nb_pkts <= self->tap_skip) {
+        self->tap_skip -= nb_pkts;
+        return;
+    }
+    tap_burst_sample(self, self->out_tap[ring_idx], self->out_edge[ring_idx], mbufs, nb_pkts, verdict);
+}
+
+/* tap of ring_out on edge e (-1 for tail rings), a tapped stage already captures all it emits */
+static inline struct pipeline_tap *
+tap_edge(struct pipeline *pl, struct pipeline_stage *self, int e)
+{
+    return e >= 0 && pl->edges[e].tap && !self->tap ? pl->tap : NULL;
+}
+
+int tap_init(struct pipeline *pl);
+void tap_free(struct pipeline *pl);
+int tap_start(struct pipeline *pl);
+void tap_stop(struct pipeline *pl);
+void tap_stats_print(struct pipeline *pl);
+
+#endif /* _INCLUDE_TAP_H */
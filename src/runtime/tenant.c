@@ -0,0 +1,448 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+
+#include "tenant.h"
+#include "pipeline.h"
+#include "run_mode.h"
+#include "../lib/log/meili_log.h"
+#include "../utils/str/str_helpers.h"
+
+/* Apps registered by MEILI_REGISTER constructors, in link order */
+static struct meili_app meili_apps[MEILI_APP_MAX];
+static int meili_nb_apps;
+
+int
+meili_app_register(const char *name,
+    int (*init)(struct pipeline_stage *self),
+    int (*free)(struct pipeline_stage *self),
+    int (*exec)(struct pipeline_stage *self, meili_pkt *pkt),
+    int (*exec_batch)(struct pipeline_stage *self, meili_pkt **mbuf, int nb_enq,
+                      meili_pkt ***mbuf_out, int *nb_deq))
+{
+    struct meili_app *app;
+
+    if (meili_app_lookup(name)) {
+        MEILI_LOG_ERR("Meili app %s registered twice.", name);
+        return -EEXIST;
+    }
+    if (meili_nb_apps >= MEILI_APP_MAX) {
+        MEILI_LOG_ERR("Max %d Meili apps supported, %s is not registered.", MEILI_APP_MAX, name);
+        return -ENOSPC;
+    }
+
+    app = &meili_apps[meili_nb_apps];
+    snprintf(app->name, sizeof(app->name), "%s", name);
+    app->init = init;
+    app->free = free;
+    app->exec = exec;
+    app->exec_batch = exec_batch;
+    meili_nb_apps++;
+
+    return 0;
+}
+
+/* App registered under name, or the first registered one when name is NULL or empty */
+const struct meili_app *
+meili_app_lookup(const char *name)
+{
+    if (!name || !name[0])
+        return meili_nb_apps ? &meili_apps[0] : NULL;
+
+    for (int i = 0; i < meili_nb_apps; i++) {
+        if (strcmp(meili_apps[i].name, name) == 0)
+            return &meili_apps[i];
+    }
+    return NULL;
+}
+
+/* Stage instances run the app of the tenant their stage belongs to */
+int
+meili_pipeline_stage_func_reg(struct pipeline_stage *stage)
+{
+    struct pipeline *pl = stage->pl;
+    const struct meili_app *app = pl->tenants[stage->tenant].app;
+
+    if (!app)
+        return -ENOENT;
+
+    stage->funcs->pipeline_stage_init = app->init;
+    stage->funcs->pipeline_stage_free = app->free;
+    stage->funcs->pipeline_stage_exec = app->exec;
+    stage->funcs->pipeline_stage_exec_batch = app->exec_batch;
+
+    return 0;
+}
+
+/* TENANT [name] [app] [weight (optional)]
+ * Stage lines that follow belong to the tenant.
+ */
+int
+tenant_conf_parse(struct pipeline *pl, char **fields, int nb_fields)
+{
+    struct pipeline_tenant *tenant;
+    long val;
+
+    if (nb_fields < 3 || nb_fields > 4) {
+        MEILI_LOG_ERR("Invalid tenant, expected: %s [name] [app] [weight].", PL_CONFIG_TENANT_KEY);
+        return -EINVAL;
+    }
+    if (!pl->nb_tenants && pl->nb_pl_stages) {
+        MEILI_LOG_ERR("Stage lines must follow a %s line once tenants are used.", PL_CONFIG_TENANT_KEY);
+        return -EINVAL;
+    }
+    if (pl->nb_tenants >= NB_TENANT_MAX) {
+        MEILI_LOG_ERR("Max %d tenants supported.", NB_TENANT_MAX);
+        return -EINVAL;
+    }
+    if (strlen(fields[1]) >= TENANT_NAME_LEN || strlen(fields[2]) >= MEILI_APP_NAME_LEN) {
+        MEILI_LOG_ERR("Tenant or app name too long: %s %s.", fields[1], fields[2]);
+        return -EINVAL;
+    }
+    for (int t = 0; t < pl->nb_tenants; t++) {
+        if (strcmp(pl->tenants[t].name, fields[1]) == 0) {
+            MEILI_LOG_ERR("Duplicated tenant %s.", fields[1]);
+            return -EINVAL;
+        }
+    }
+
+    tenant = &pl->tenants[pl->nb_tenants];
+    strcpy(tenant->name, fields[1]);
+    strcpy(tenant->app_name, fields[2]);
+    tenant->app = NULL;
+    tenant->weight = TENANT_DEFAULT_WEIGHT;
+    tenant->nb_rules = 0;
+    if (nb_fields == 4) {
+        if (util_str_to_dec(fields[3], &val, 4) || val < 1 || val > TENANT_MAX_WEIGHT) {
+            MEILI_LOG_ERR("Invalid weight for tenant %s: %s, expected 1 to %d.", fields[1], fields[3], TENANT_MAX_WEIGHT);
+            return -EINVAL;
+        }
+        tenant->weight = val;
+    }
+    pl->nb_tenants++;
+
+    return 0;
+}
+
+/* a.b.c.d or a.b.c.d/len, in host order */
+static int
+tenant_prefix_parse(char *str, uint32_t *addr, uint32_t *mask)
+{
+    struct in_addr in;
+    char *slash;
+    long len = 32;
+
+    slash = strchr(str, '/');
+    if (slash) {
+        *slash = '\0';
+        if (util_str_to_dec(slash + 1, &len, 1) || len > 32)
+            return -EINVAL;
+    }
+    if (inet_pton(AF_INET, str, &in) != 1)
+        return -EINVAL;
+
+    *mask = len ? ~0u << (32 - len) : 0;
+    *addr = ntohl(in.s_addr) & *mask;
+
+    return 0;
+}
+
+/* n or n-m */
+static int
+tenant_range_parse(char *str, uint16_t *min, uint16_t *max)
+{
+    char *dash;
+    long val;
+
+    dash = strchr(str, '-');
+    if (dash) {
+        *dash = '\0';
+        if (util_str_to_dec(dash + 1, &val, 2))
+            return -EINVAL;
+        *max = val;
+    }
+    if (util_str_to_dec(str, &val, 2))
+        return -EINVAL;
+    *min = val;
+    if (!dash)
+        *max = val;
+
+    return *min <= *max ? 0 : -EINVAL;
+}
+
+/* MATCH [key] [value] ..., a rule of the last tenant.
+ * Keys: port (rx port id), vlan, proto (tcp, udp or a number), src and dst (ipv4 prefixes),
+ * sport and dport (port or port range).
+ */
+int
+tenant_rule_parse(struct pipeline *pl, char **fields, int nb_fields)
+{
+    struct tenant_rule *rule;
+    uint32_t field;
+    char *key;
+    char *value;
+    long val;
+    int ret = 0;
+
+    if (!pl->nb_tenants) {
+        MEILI_LOG_ERR("%s line before any %s line.", PL_CONFIG_MATCH_KEY, PL_CONFIG_TENANT_KEY);
+        return -EINVAL;
+    }
+    if (nb_fields < 3 || nb_fields % 2 == 0) {
+        MEILI_LOG_ERR("Invalid rule, expected: %s [key] [value] ...", PL_CONFIG_MATCH_KEY);
+        return -EINVAL;
+    }
+    if (pl->nb_rules >= NB_TENANT_RULE_MAX) {
+        MEILI_LOG_ERR("Max %d tenant rules supported.", NB_TENANT_RULE_MAX);
+        return -EINVAL;
+    }
+
+    rule = &pl->rules[pl->nb_rules];
+    memset(rule, 0, sizeof(*rule));
+    rule->tenant = pl->nb_tenants - 1;
+
+    for (int k = 1; k < nb_fields; k += 2) {
+        key = fields[k];
+        value = fields[k + 1];
+        if (strcmp(key, "port") == 0) {
+            field = TENANT_MATCH_PORT;
+            ret = util_str_to_dec(value, &val, 2);
+            rule->port = val;
+        } else if (strcmp(key, "vlan") == 0) {
+            field = TENANT_MATCH_VLAN;
+            ret = util_str_to_dec(value, &val, 2);
+            if (!ret && val > 4095)
+                ret = -EINVAL;
+            rule->vlan = val;
+        } else if (strcmp(key, "proto") == 0) {
+            field = TENANT_MATCH_PROTO;
+            if (strcmp(value, "tcp") == 0)
+                val = IPPROTO_TCP;
+            else if (strcmp(value, "udp") == 0)
+                val = IPPROTO_UDP;
+            else
+                ret = util_str_to_dec(value, &val, 1);
+            rule->proto = val;
+        } else if (strcmp(key, "src") == 0) {
+            field = TENANT_MATCH_SRC;
+            ret = tenant_prefix_parse(value, &rule->src_addr, &rule->src_mask);
+        } else if (strcmp(key, "dst") == 0) {
+            field = TENANT_MATCH_DST;
+            ret = tenant_prefix_parse(value, &rule->dst_addr, &rule->dst_mask);
+        } else if (strcmp(key, "sport") == 0) {
+            field = TENANT_MATCH_SPORT;
+            ret = tenant_range_parse(value, &rule->sport_min, &rule->sport_max);
+        } else if (strcmp(key, "dport") == 0) {
+            field = TENANT_MATCH_DPORT;
+            ret = tenant_range_parse(value, &rule->dport_min, &rule->dport_max);
+        } else {
+            MEILI_LOG_ERR("Unknown tenant match key: %s.", key);
+            return -EINVAL;
+        }
+
+        if (ret) {
+            MEILI_LOG_ERR("Invalid value for tenant match key %s: %s.", key, value);
+            return -EINVAL;
+        }
+        if (rule->fields & field) {
+            MEILI_LOG_ERR("Tenant match key %s given twice in one rule.", key);
+            return -EINVAL;
+        }
+        rule->fields |= field;
+    }
+
+    pl->tenants[rule->tenant].nb_rules++;
+    pl->nb_rules++;
+
+    return 0;
+}
+
+/* Bind tenants to apps once pl.conf is read.
+ * A config without TENANT lines is a single tenant running the first registered app.
+ * With several tenants the one without MATCH lines, if any, takes the packets no rule matches.
+ */
+int
+tenant_resolve(struct pipeline *pl)
+{
+    struct pipeline_tenant *tenant;
+    int nb_stages;
+
+    if (!pl->nb_tenants) {
+        tenant = &pl->tenants[0];
+        snprintf(tenant->name, sizeof(tenant->name), "default");
+        tenant->app_name[0] = '\0';
+        tenant->weight = TENANT_DEFAULT_WEIGHT;
+        tenant->nb_rules = 0;
+        pl->nb_tenants = 1;
+        for (int i = 0; i < pl->nb_pl_stages; i++)
+            pl->tenant_per_pl_stage[i] = 0;
+        if (meili_nb_apps > 1)
+            MEILI_LOG_WARN("%d Meili apps linked but no %s line, running %s.", meili_nb_apps,
+                PL_CONFIG_TENANT_KEY, meili_apps[0].name);
+    }
+
+    #ifdef SHARED_BUFFER
+    if (pl->nb_tenants > 1) {
+        MEILI_LOG_ERR("Shared ring buffer does not support several tenants");
+        return -ENOTSUP;
+    }
+    #endif
+
+    pl->default_tenant = pl->nb_tenants == 1 ? 0 : -1;
+    for (int t = 0; t < pl->nb_tenants; t++) {
+        tenant = &pl->tenants[t];
+
+        tenant->app = meili_app_lookup(tenant->app_name);
+        if (!tenant->app) {
+            MEILI_LOG_ERR("No Meili app %s registered for tenant %s.",
+                tenant->app_name[0] ? tenant->app_name : "at all", tenant->name);
+            return -ENOENT;
+        }
+
+        nb_stages = 0;
+        for (int i = 0; i < pl->nb_pl_stages; i++) {
+            if (pl->tenant_per_pl_stage[i] == t)
+                nb_stages++;
+        }
+        if (!nb_stages) {
+            MEILI_LOG_ERR("Tenant %s has no pipeline stage.", tenant->name);
+            return -EINVAL;
+        }
+
+        if (pl->nb_tenants > 1 && !tenant->nb_rules) {
+            if (pl->default_tenant >= 0) {
+                MEILI_LOG_ERR("Tenants %s and %s both have no %s line, only one may take unmatched packets.",
+                    pl->tenants[pl->default_tenant].name, tenant->name, PL_CONFIG_MATCH_KEY);
+                return -EINVAL;
+            }
+            pl->default_tenant = t;
+        }
+
+        MEILI_LOG_INFO("Tenant %s: app %s, weight %u, %d stage(s), %d rule(s)%s", tenant->name,
+            tenant->app->name, tenant->weight, nb_stages, tenant->nb_rules,
+            pl->nb_tenants > 1 && t == pl->default_tenant ? ", default" : "");
+    }
+
+    return 0;
+}
+
+/* Header fields rules look at, parsed once per packet */
+struct tenant_pkt_key {
+    uint16_t port;
+    uint16_t vlan;
+    uint8_t proto;
+    uint32_t src_addr;
+    uint32_t dst_addr;
+    uint16_t sport;
+    uint16_t dport;
+    uint32_t fields;            /* TENANT_MATCH_* bits present in the packet */
+};
+
+static inline void
+tenant_pkt_parse(struct rte_mbuf *mbuf, struct tenant_pkt_key *key)
+{
+    struct rte_ether_hdr *eth;
+    struct rte_vlan_hdr *vlan;
+    struct rte_ipv4_hdr *ip;
+    struct rte_udp_hdr *l4;
+    uint16_t ether_type;
+    uint32_t off;
+
+    key->port = mbuf->port;
+    key->fields = TENANT_MATCH_PORT;
+
+    if (mbuf->ol_flags & PKT_RX_VLAN_STRIPPED) {
+        key->vlan = mbuf->vlan_tci & 0xfff;
+        key->fields |= TENANT_MATCH_VLAN;
+    }
+
+    if (rte_pktmbuf_data_len(mbuf) < sizeof(*eth))
+        return;
+    eth = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+    ether_type = eth->ether_type;
+    off = sizeof(*eth);
+
+    if (ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_VLAN)) {
+        if (rte_pktmbuf_data_len(mbuf) < off + sizeof(*vlan))
+            return;
+        vlan = rte_pktmbuf_mtod_offset(mbuf, struct rte_vlan_hdr *, off);
+        if (!(key->fields & TENANT_MATCH_VLAN)) {
+            key->vlan = rte_be_to_cpu_16(vlan->vlan_tci) & 0xfff;
+            key->fields |= TENANT_MATCH_VLAN;
+        }
+        ether_type = vlan->eth_proto;
+        off += sizeof(*vlan);
+    }
+
+    if (ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4) || rte_pktmbuf_data_len(mbuf) < off + sizeof(*ip))
+        return;
+    ip = rte_pktmbuf_mtod_offset(mbuf, struct rte_ipv4_hdr *, off);
+    key->proto = ip->next_proto_id;
+    key->src_addr = rte_be_to_cpu_32(ip->src_addr);
+    key->dst_addr = rte_be_to_cpu_32(ip->dst_addr);
+    key->fields |= TENANT_MATCH_L3;
+
+    /* only first fragments carry ports */
+    if ((key->proto != IPPROTO_TCP && key->proto != IPPROTO_UDP)
+    || (rte_be_to_cpu_16(ip->fragment_offset) & RTE_IPV4_HDR_OFFSET_MASK))
+        return;
+    off += (ip->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER;
+    if (rte_pktmbuf_data_len(mbuf) < off + sizeof(*l4))
+        return;
+    /* tcp and udp ports sit at the same offsets */
+    l4 = rte_pktmbuf_mtod_offset(mbuf, struct rte_udp_hdr *, off);
+    key->sport = rte_be_to_cpu_16(l4->src_port);
+    key->dport = rte_be_to_cpu_16(l4->dst_port);
+    key->fields |= TENANT_MATCH_L4;
+}
+
+static inline bool
+tenant_rule_match(const struct tenant_rule *rule, const struct tenant_pkt_key *key)
+{
+    if ((rule->fields & key->fields) != rule->fields)
+        return false;
+    if ((rule->fields & TENANT_MATCH_PORT) && key->port != rule->port)
+        return false;
+    if ((rule->fields & TENANT_MATCH_VLAN) && key->vlan != rule->vlan)
+        return false;
+    if ((rule->fields & TENANT_MATCH_PROTO) && key->proto != rule->proto)
+        return false;
+    if ((rule->fields & TENANT_MATCH_SRC) && (key->src_addr & rule->src_mask) != rule->src_addr)
+        return false;
+    if ((rule->fields & TENANT_MATCH_DST) && (key->dst_addr & rule->dst_mask) != rule->dst_addr)
+        return false;
+    if ((rule->fields & TENANT_MATCH_SPORT) && (key->sport < rule->sport_min || key->sport > rule->sport_max))
+        return false;
+    if ((rule->fields & TENANT_MATCH_DPORT) && (key->dport < rule->dport_min || key->dport > rule->dport_max))
+        return false;
+
+    return true;
+}
+
+/* Tenant of a packet: the first rule it matches in pl.conf order, else the default tenant.
+ * Returns -1 when the packet belongs to no tenant.
+ */
+int
+tenant_classify(struct pipeline *pl, struct rte_mbuf *mbuf)
+{
+    struct tenant_pkt_key key;
+
+    if (!pl->nb_rules)
+        return pl->default_tenant;
+
+    tenant_pkt_parse(mbuf, &key);
+    for (int r = 0; r < pl->nb_rules; r++) {
+        if (tenant_rule_match(&pl->rules[r], &key))
+            return pl->rules[r].tenant;
+    }
+
+    return pl->default_tenant;
+}
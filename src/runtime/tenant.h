@@ -0,0 +1,90 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_TENANT_H
+#define _INCLUDE_TENANT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <rte_mbuf.h>
+
+#include "../lib/net/meili_pkt.h"
+
+/* apps linked into the runtime, each MEILI_REGISTER adds one */
+#define MEILI_APP_MAX 16
+#define MEILI_APP_NAME_LEN 32
+
+/* tenants sharing the main core, each runs its own stage graph */
+#define NB_TENANT_MAX 8
+#define NB_TENANT_RULE_MAX 64
+#define TENANT_NAME_LEN 32
+#define TENANT_DEFAULT_WEIGHT 1
+#define TENANT_MAX_WEIGHT 1024
+
+/* pl.conf keys */
+#define PL_CONFIG_TENANT_KEY "TENANT"
+#define PL_CONFIG_MATCH_KEY "MATCH"
+
+struct pipeline;
+struct pipeline_stage;
+
+/* Stage functions of an app, as given to MEILI_REGISTER */
+struct meili_app {
+    char name[MEILI_APP_NAME_LEN];
+    int (*init)(struct pipeline_stage *self);
+    int (*free)(struct pipeline_stage *self);
+    int (*exec)(struct pipeline_stage *self, meili_pkt *pkt);
+    int (*exec_batch)(struct pipeline_stage *self, meili_pkt **mbuf, int nb_enq,
+                      meili_pkt ***mbuf_out, int *nb_deq);
+};
+
+/* fields a rule matches on */
+#define TENANT_MATCH_PORT   (1u << 0)
+#define TENANT_MATCH_VLAN   (1u << 1)
+#define TENANT_MATCH_PROTO  (1u << 2)
+#define TENANT_MATCH_SRC    (1u << 3)
+#define TENANT_MATCH_DST    (1u << 4)
+#define TENANT_MATCH_SPORT  (1u << 5)
+#define TENANT_MATCH_DPORT  (1u << 6)
+#define TENANT_MATCH_L3     (TENANT_MATCH_PROTO | TENANT_MATCH_SRC | TENANT_MATCH_DST)
+#define TENANT_MATCH_L4     (TENANT_MATCH_SPORT | TENANT_MATCH_DPORT)
+
+/* One MATCH line: a packet matches when every field set in fields does. Addresses are in host order. */
+struct tenant_rule {
+    int tenant;
+    uint32_t fields;
+    uint16_t port;
+    uint16_t vlan;
+    uint8_t proto;
+    uint32_t src_addr;
+    uint32_t src_mask;
+    uint32_t dst_addr;
+    uint32_t dst_mask;
+    uint16_t sport_min;
+    uint16_t sport_max;
+    uint16_t dport_min;
+    uint16_t dport_max;
+};
+
+struct pipeline_tenant {
+    char name[TENANT_NAME_LEN];
+    char app_name[MEILI_APP_NAME_LEN];  /* empty: the first registered app */
+    const struct meili_app *app;
+    uint32_t weight;                    /* share of the main core dispatch under contention */
+    int nb_rules;
+};
+
+int meili_app_register(const char *name,
+    int (*init)(struct pipeline_stage *self),
+    int (*free)(struct pipeline_stage *self),
+    int (*exec)(struct pipeline_stage *self, meili_pkt *pkt),
+    int (*exec_batch)(struct pipeline_stage *self, meili_pkt **mbuf, int nb_enq,
+                      meili_pkt ***mbuf_out, int *nb_deq));
+const struct meili_app *meili_app_lookup(const char *name);
+
+int tenant_conf_parse(struct pipeline *pl, char **fields, int nb_fields);
+int tenant_rule_parse(struct pipeline *pl, char **fields, int nb_fields);
+int tenant_resolve(struct pipeline *pl);
+int tenant_classify(struct pipeline *pl, struct rte_mbuf *mbuf);
+
+#endif /* _INCLUDE_TENANT_H */
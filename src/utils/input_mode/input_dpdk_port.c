@@ -13,6 +13,7 @@
 /* Modified by Meili Authors */ 
 /* Copyright (c) 2024, Meili Authors */
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
@@ -87,8 +88,13 @@ input_dpdk_port_init_queues(uint16_t port_id, uint16_t q_id, int port_idx, unsig
 	return 0;
 }
 
+/*
+ * per_worker: queue q belongs to the q-th worker lcore and is set up on its NUMA node,
+ * otherwise only queue 0 is set up for the main core.
+ * fast_free: tx may use MBUF_FAST_FREE, only when every mbuf sent has a refcnt of 1.
+ */
 static int
-input_dpdk_port_init(uint16_t port_id, uint32_t num_queues, int port_idx)
+input_dpdk_port_init(uint16_t port_id, uint32_t num_queues, int port_idx, bool per_worker, bool fast_free)
 {
 	/* TODO: need to check what on earth is the default config for ports */
 	struct rte_eth_conf port_conf = port_conf_default;
@@ -117,7 +123,7 @@ input_dpdk_port_init(uint16_t port_id, uint32_t num_queues, int port_idx)
 	}
 
 	/* Note: all per-queue mbufs must be from the same pool. */
-	if (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE)
+	if (fast_free && (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE))
 		port_conf.txmode.offloads |= DEV_TX_OFFLOAD_MBUF_FAST_FREE;
 
 	port_conf.rx_adv_conf.rss_conf.rss_hf &= dev_info.flow_type_rss_offloads;
@@ -139,28 +145,33 @@ input_dpdk_port_init(uint16_t port_id, uint32_t num_queues, int port_idx)
 	txconf = dev_info.default_txconf;
 	txconf.offloads = port_conf.txmode.offloads;
 
-	/* Main core takes queue 0. */
-	queue_id = 0;
-	numa_id = rte_socket_id();
-	/* allocate mempool here */
-	ret = input_dpdk_port_init_queues(port_id, queue_id, port_idx, numa_id, nb_rxd, &rxconf, nb_txd, &txconf);
-	//ret = input_dpdk_port_init_queues(port_id, queue_id+1, port_idx, numa_id, nb_rxd, &rxconf, nb_txd, &txconf);
-	if (ret)
-		return ret;
-
-	/* Only init queues for main thread here */
-	// /* Assign mbufs and queues based on numa ports. */
-	// RTE_LCORE_FOREACH_WORKER(lcore_id)
-	// {
-	// 	queue_id++;
-	// 	if (queue_id >= num_queues)
-	// 		break;
-	// 	numa_id = rte_lcore_to_socket_id(lcore_id);
-	// 	ret = input_dpdk_port_init_queues(port_id, queue_id, port_idx, numa_id, nb_rxd, &rxconf, nb_txd,
-	// 					  &txconf);
-	// 	if (ret)
-	// 		return ret;
-	// }
+	if (per_worker) {
+		/* Assign mbufs and queues based on numa of the worker polling them. */
+		queue_id = 0;
+		RTE_LCORE_FOREACH_WORKER(lcore_id)
+		{
+			if (queue_id >= num_queues)
+				break;
+			numa_id = rte_lcore_to_socket_id(lcore_id);
+			ret = input_dpdk_port_init_queues(port_id, queue_id, port_idx, numa_id, nb_rxd, &rxconf, nb_txd,
+							  &txconf);
+			if (ret)
+				return ret;
+			queue_id++;
+		}
+		if (queue_id < num_queues) {
+			MEILI_LOG_ERR("%u queues on dev %u but only %u worker lcores.", num_queues, port_id, queue_id);
+			return -EINVAL;
+		}
+	} else {
+		/* Main core takes queue 0. */
+		queue_id = 0;
+		numa_id = rte_socket_id();
+		/* allocate mempool here */
+		ret = input_dpdk_port_init_queues(port_id, queue_id, port_idx, numa_id, nb_rxd, &rxconf, nb_txd, &txconf);
+		if (ret)
+			return ret;
+	}
 
 	ret = rte_eth_dev_start(port_id);
 	if (ret) {
@@ -200,6 +211,9 @@ input_dpdk_port_init_ports(pl_conf *run_conf)
 	if (run_conf->port2){
 		num_ports++;
 	}
+	/* link to a peer instance flows are offloaded to */
+	if (run_conf->offload_port)
+		num_ports++;
 
 	MEILI_LOG_INFO("Initializing dpdk ports...");
 	MEILI_LOG_INFO("# queues pairs per port : %d",num_queues);
@@ -230,7 +244,9 @@ input_dpdk_port_init_ports(pl_conf *run_conf)
 		/* Port index references mbufs - port_ids may not be 0-N. */
 		/* configure eth device here */
 		MEILI_LOG_INFO("Initializing dpdk port %d...", port_id);
-		ret = input_dpdk_port_init(port_id, num_queues, port_idx);
+		/* the tap holds references on packets that egress and offload may still send */
+		ret = input_dpdk_port_init(port_id, num_queues, port_idx, run_conf->exec_model == EXEC_MODEL_RTC,
+					   !run_conf->tap_file);
 		if (ret) {
 			MEILI_LOG_ERR("Failed to init port: %u.", port_id);
 			input_dpdk_port_clean(run_conf);
@@ -246,13 +262,15 @@ input_dpdk_port_init_ports(pl_conf *run_conf)
 static void
 input_dpdk_port_clean(pl_conf *run_conf)
 {
-	const uint32_t num_queues = run_conf->cores;
+	const uint32_t num_queues = run_conf->nb_queues_per_port;
 	uint16_t num_ports = 1;
 	uint32_t j;
 	uint16_t i;
 
 	if (run_conf->port2)
 		num_ports++;
+	if (run_conf->offload_port)
+		num_ports++;
 
 	if (mbuf_pools) {
 		for (i = 0; i < num_ports; i++) {
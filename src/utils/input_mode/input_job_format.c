@@ -0,0 +1,204 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <rte_common.h>
+#include <rte_errno.h>
+#include <rte_malloc.h>
+#include <rte_mbuf_dyn.h>
+
+#include "input.h"
+#include "input_job_format.h"
+#include "../../lib/regex/meili_regex.h"
+
+int input_job_dynfield_offset = -1;
+
+/* The file stays mapped for the whole run, the preloaded arrays point into it */
+static void *job_map;
+static uint64_t job_map_len;
+
+/* Offset of the next section of size bytes, off moves past it */
+static inline uint64_t
+input_job_format_sect(uint64_t *off, uint64_t size)
+{
+	uint64_t start = RTE_ALIGN_CEIL(*off, JOB_FORMAT_ALIGN);
+
+	*off = start + size;
+
+	return start;
+}
+
+static void
+input_job_format_clean(pl_conf *run_conf)
+{
+	rte_free(run_conf->input_subset_ids);
+	rte_free(run_conf->input_exp_matches);
+	run_conf->input_subset_ids = NULL;
+	run_conf->input_exp_matches = NULL;
+
+	/* the rest belongs to the mapping */
+	run_conf->input_job_ids = NULL;
+	run_conf->input_lens = NULL;
+	run_conf->input_data = NULL;
+	if (job_map)
+		munmap(job_map, job_map_len);
+	job_map = NULL;
+}
+
+static int
+input_job_format_read(pl_conf *run_conf)
+{
+	static const struct rte_mbuf_dynfield job_dynfield_desc = {
+		.name = "meili_job_idx",
+		.size = sizeof(uint32_t),
+		.align = __alignof__(uint32_t),
+	};
+	const char *file = run_conf->input_file;
+	const struct input_job_file_hdr *hdr;
+	uint64_t off_ids, off_match_offs, off_subsets, off_lens, off_matches, off_payload;
+	const uint32_t *match_offs;
+	exp_match_t *matches;
+	uint16_t *subsets;
+	uint64_t data_len;
+	uint32_t nb_jobs;
+	uint16_t *lens;
+	struct stat st;
+	uint64_t off;
+	char *base;
+	uint32_t i;
+	int ret;
+	int fd;
+
+	RTE_BUILD_BUG_ON(sizeof(exp_match_t) != JOB_FORMAT_ALIGN);
+
+	input_job_dynfield_offset = rte_mbuf_dynfield_register(&job_dynfield_desc);
+	if (input_job_dynfield_offset < 0) {
+		MEILI_LOG_ERR("Failed to register mbuf field for job index, rte_errno: %i", rte_errno);
+		return -ENOMEM;
+	}
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		ret = -errno;
+		MEILI_LOG_ERR("Failed to open job file: %s.", file);
+		return ret;
+	}
+	if (fstat(fd, &st) || (uint64_t)st.st_size < sizeof(*hdr)) {
+		MEILI_LOG_ERR("Job file %s is empty or unreadable.", file);
+		close(fd);
+		return -EINVAL;
+	}
+
+	/* jobs are copied into mbufs on replay, populate so no pass takes page faults */
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	if (base == MAP_FAILED) {
+		ret = -errno;
+		MEILI_LOG_ERR("Failed to map job file: %s.", file);
+		close(fd);
+		return ret;
+	}
+	close(fd);
+	job_map = base;
+	job_map_len = st.st_size;
+
+	hdr = (const struct input_job_file_hdr *)base;
+	if (memcmp(hdr->magic, JOB_FORMAT_MAGIC, sizeof(hdr->magic)) || hdr->version != JOB_FORMAT_VERSION) {
+		MEILI_LOG_ERR("%s is not a version %u job file.", file, JOB_FORMAT_VERSION);
+		ret = -EINVAL;
+		goto err;
+	}
+
+	off = sizeof(*hdr);
+	off_ids = input_job_format_sect(&off, sizeof(uint64_t) * hdr->nb_jobs);
+	off_match_offs = input_job_format_sect(&off, sizeof(uint32_t) * ((uint64_t)hdr->nb_jobs + 1));
+	off_subsets = input_job_format_sect(&off, sizeof(uint16_t) * MAX_SUBSET_IDS * (uint64_t)hdr->nb_jobs);
+	off_lens = input_job_format_sect(&off, sizeof(uint16_t) * hdr->nb_jobs);
+	off_matches = input_job_format_sect(&off, sizeof(exp_match_t) * (uint64_t)hdr->nb_matches);
+	off_payload = input_job_format_sect(&off, hdr->payload_len);
+	if (!hdr->nb_jobs || hdr->payload_len > (uint64_t)st.st_size || off > (uint64_t)st.st_size) {
+		MEILI_LOG_ERR("Job file %s holds no jobs or is truncated.", file);
+		ret = -EINVAL;
+		goto err;
+	}
+
+	match_offs = (const uint32_t *)(base + off_match_offs);
+	subsets = (uint16_t *)(base + off_subsets);
+	lens = (uint16_t *)(base + off_lens);
+	matches = (exp_match_t *)(base + off_matches);
+
+	nb_jobs = hdr->nb_jobs;
+	if (run_conf->input_packets && run_conf->input_packets < nb_jobs)
+		nb_jobs = run_conf->input_packets;
+
+	data_len = 0;
+	for (i = 0; i < nb_jobs; i++) {
+		if (!lens[i] || lens[i] > MAX_REGEX_BUF_SIZE) {
+			MEILI_LOG_ERR("Job %u of %s has invalid length %u.", i, file, lens[i]);
+			ret = -EINVAL;
+			goto err;
+		}
+		if (match_offs[i] > match_offs[i + 1] || match_offs[i + 1] > hdr->nb_matches) {
+			MEILI_LOG_ERR("Expected matches of job %u of %s are out of bounds.", i, file);
+			ret = -EINVAL;
+			goto err;
+		}
+		/* --run-bytes takes the leading jobs that fit */
+		if (run_conf->input_bytes && data_len + lens[i] > run_conf->input_bytes)
+			break;
+		data_len += lens[i];
+		if (data_len > hdr->payload_len) {
+			MEILI_LOG_ERR("Job lengths of %s exceed its payload.", file);
+			ret = -EINVAL;
+			goto err;
+		}
+	}
+	nb_jobs = i;
+	if (!nb_jobs) {
+		MEILI_LOG_ERR("No jobs extracted from %s.", file);
+		ret = -EINVAL;
+		goto err;
+	}
+
+	/* only the per job pointer tables are built, everything else is used in place */
+	run_conf->input_subset_ids = rte_malloc(NULL, sizeof(uint16_t *) * nb_jobs, 0);
+	run_conf->input_exp_matches = rte_malloc(NULL, sizeof(exp_matches_t) * nb_jobs, 0);
+	if (!run_conf->input_subset_ids || !run_conf->input_exp_matches) {
+		MEILI_LOG_ERR("Memory failure in allocating job tables.");
+		ret = -ENOMEM;
+		goto err;
+	}
+	for (i = 0; i < nb_jobs; i++) {
+		run_conf->input_subset_ids[i] = &subsets[i * MAX_SUBSET_IDS];
+		run_conf->input_exp_matches[i].num_matches = match_offs[i + 1] - match_offs[i];
+		run_conf->input_exp_matches[i].matches = &matches[match_offs[i]];
+	}
+
+	run_conf->input_job_ids = (uint64_t *)(base + off_ids);
+	run_conf->input_lens = lens;
+	run_conf->input_len_cnt = nb_jobs;
+	run_conf->input_data = base + off_payload;
+	run_conf->input_data_len = data_len;
+
+	MEILI_LOG_INFO("Mapped %u jobs (%lu bytes, %u expected matches) from %s.", nb_jobs, data_len,
+		       match_offs[nb_jobs] - match_offs[0], file);
+
+	return 0;
+
+err:
+	input_job_format_clean(run_conf);
+	return ret;
+}
+
+void
+input_job_format_reg(input_func_t *funcs)
+{
+	funcs->init = input_job_format_read;
+	funcs->clean = input_job_format_clean;
+}
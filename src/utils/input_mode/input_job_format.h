@@ -0,0 +1,46 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_INPUT_JOB_FORMAT_H_
+#define _INCLUDE_INPUT_JOB_FORMAT_H_
+
+#include <stdint.h>
+
+#include <rte_mbuf.h>
+#include <rte_mbuf_dyn.h>
+
+#define JOB_FORMAT_MAGIC	"MEILIJOB"
+#define JOB_FORMAT_VERSION	1
+#define JOB_FORMAT_ALIGN	8
+
+/*
+ * Job file of --input-mode job_format, little endian and mapped as is:
+ *
+ *   struct input_job_file_hdr
+ *   uint64_t job_ids[nb_jobs]              ids reported with the matches of each job
+ *   uint32_t match_offs[nb_jobs + 1]       job j expects matches[match_offs[j], match_offs[j + 1])
+ *   uint16_t subset_ids[nb_jobs][4]        rule subsets the job is scanned against
+ *   uint16_t lens[nb_jobs]
+ *   exp_match_t matches[nb_matches]        rule_id, start_ptr, length
+ *   char payload[payload_len]              jobs back to back
+ *
+ * Each section starts on a JOB_FORMAT_ALIGN boundary, padded with zeros.
+ */
+struct input_job_file_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t nb_jobs;
+	uint32_t nb_matches;
+	uint32_t reserved;
+	uint64_t payload_len;
+};
+
+/* Index of the job an mbuf carries, set on replay and read by the regex device */
+extern int input_job_dynfield_offset;
+
+static inline uint32_t *
+input_job_idx(struct rte_mbuf *mbuf)
+{
+	return RTE_MBUF_DYNFIELD(mbuf, input_job_dynfield_offset, uint32_t *);
+}
+
+#endif /* _INCLUDE_INPUT_JOB_FORMAT_H_ */
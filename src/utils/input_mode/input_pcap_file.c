@@ -13,205 +13,384 @@
 /* Modified by Meili Authors */ 
 /* Copyright (c) 2024, Meili Authors */
 
+/* readahead() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <fcntl.h>
 #include <pcap.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
+#include <rte_cycles.h>
+#include <rte_ether.h>
+#include <rte_lcore.h>
 #include <rte_malloc.h>
+#include <rte_memcpy.h>
 
 #include "input.h"
+#include "input_pcap_map.h"
 #include "../utils.h"
 
+/* File header of a classic pcap capture, in the byte order of the writer. */
+struct input_pcap_file_hdr {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+#define PCAP_MAGIC_USEC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+
+
+static inline void
+input_pcap_print_snap_len_warning(pl_conf *run_conf)
+{
+	static bool warning = false;
+
+	if (!warning)
+		MEILI_LOG_WARN_REC(run_conf, "PCAP cap length < packet length. Potential unexpected behaviour.");
+	warning = true;
+}
+
+/* Frames are kept whole, stages and the dispatcher parse their headers on replay */
+static inline bool
+input_pcap_frame_valid(pl_conf *run_conf, const struct pcap_pkthdr *hdr)
+{
+	if (hdr->caplen < sizeof(struct rte_ether_hdr))
+		return false;
+	if (hdr->caplen <= run_conf->input_len_threshold || hdr->caplen > MAX_REGEX_BUF_SIZE)
+		return false;
 
-// TODO: update pcap read function
-
-// static inline void
-// input_pcap_print_snap_len_warning(pl_conf *run_conf)
-// {
-// 	static bool warning = false;
-
-// 	if (!warning)
-// 		MEILI_LOG_WARN_REC(run_conf, "PCAP cap length < packet length. Potential unexpected behaviour.");
-// 	warning = true;
-// }
-
-// static int
-// input_pcap_file_read(pl_conf *run_conf)
-// {
-// 	const uint32_t len_thres = run_conf->input_len_threshold;
-// 	const bool per_pkt_len = run_conf->input_app_mode;
-// 	const uint32_t pkts_max = run_conf->input_packets;
-// 	const uint32_t bytes_max = run_conf->input_bytes;
-// 	const char *file = run_conf->input_file;
-// 	struct pcap_pkthdr pkt_header = {};
-// 	char errbuf[PCAP_ERRBUF_SIZE];
-// 	const unsigned char *pkt_data;
-// 	pkt_stats_t *pkt_stats;
-// 	pcap_t *pcap_handle;
-// 	uint32_t bytes_cnt;
-// 	uint32_t pkts_cnt;
-// 	uint64_t data_len;
-// 	uint32_t pay_len;
-// 	uint32_t cpy_len;
-// 	uint16_t *lens;
-// 	char *data_ptr;
-// 	int rte_ptype;
-// 	char *data;
-// 	int off;
-// 	int i;
-
-// 	pcap_handle = pcap_open_offline(file, errbuf);
-// 	if (!pcap_handle) {
-// 		MEILI_LOG_ERR("Failed to open pcap file: %s.", file);
-// 		return -EINVAL;
-// 	}
-
-// 	pkt_stats = run_conf->input_pkt_stats;
-// 	pkts_cnt = 0;
-// 	bytes_cnt = 0;
-// 	rte_ptype = 0;
-// 	lens = NULL;
-
-// 	/* Read size is min bytes of file size, num pkts and num bytes. */
-// 	while ((pkt_data = pcap_next(pcap_handle, &pkt_header)) && (!pkts_max || pkts_cnt < pkts_max) &&
-// 	       (!bytes_max || bytes_cnt < bytes_max)) {
-// 		if (per_pkt_len) {
-// 			off = util_get_app_layer_payload(pkt_data, &pay_len, &rte_ptype);
-// 			/* Fails if protocol is unrecognized. */
-// 			if (off < 0)
-// 				continue;
-
-// 			if (pkt_header.caplen < pkt_header.len)
-// 				input_pcap_print_snap_len_warning(run_conf);
-
-// 			if (pkt_header.caplen <= (uint32_t)off)
-// 				continue;
-
-// 			if (pkt_header.caplen - off < pay_len)
-// 				pay_len = pkt_header.caplen - off;
-
-// 			if (pay_len <= len_thres || pay_len > MAX_REGEX_BUF_SIZE)
-// 				continue;
-
-// 			bytes_cnt += pay_len;
-// 		} else {
-// 			bytes_cnt += pkt_header.caplen;
-// 		}
-
-// 		pkts_cnt++;
-// 	}
-
-// 	/* Reset the pcap_handle. */
-// 	pcap_close(pcap_handle);
-// 	pcap_handle = pcap_open_offline(file, errbuf);
-// 	if (!pcap_handle) {
-// 		MEILI_LOG_ERR("Failed to open pcap file: %s.", file);
-// 		return -EINVAL;
-// 	}
-
-// 	/* Determine data length as the max bytes or total read in first run. */
-// 	bytes_cnt = bytes_max && (bytes_max < bytes_cnt) ? bytes_max : bytes_cnt;
-
-// 	if (!bytes_cnt) {
-// 		MEILI_LOG_ERR("No data extracted from PCAP file.");
-// 		return -EINVAL;
-// 	}
-
-// 	/* Note: for pcap files, it may take up large space */
-// 	data = rte_malloc(NULL, bytes_cnt, 0);
-// 	if (!data) {
-// 		MEILI_LOG_ERR("Failed to allocate memory for pcap file - reduce num bytes or packet input size.");
-// 		return -ENOMEM;
-// 	}
-
-// 	if (per_pkt_len) {
-// 		/* If working packet by packet, create an array of lengths. */
-// 		lens = rte_malloc(NULL, sizeof(uint16_t) * pkts_cnt, 0);
-// 		if (!lens) {
-// 			rte_free(data);
-// 			MEILI_LOG_ERR("Memory failure in allocating pcap lengths array.");
-// 			return -ENOMEM;
-// 		}
-// 	}
-
-// 	data_len = bytes_cnt;
-// 	data_ptr = data;
-// 	bytes_cnt = 0;
-// 	i = 0;
-
-// 	while ((pkt_data = pcap_next(pcap_handle, &pkt_header)) && bytes_cnt < data_len) {
-// 		cpy_len = pkt_header.caplen;
-// 		off = 0;
-
-// 		if (per_pkt_len) {
-// 			rte_ptype = 0;
-// 			off = util_get_app_layer_payload(pkt_data, &cpy_len, &rte_ptype);
-// 			if (off < 0) {
-// 				pkt_stats->unsupported_pkts++;
-// 				continue;
-// 			}
-
-// 			if (cpy_len == 0) {
-// 				/* Thres check will catch this but get stats. */
-// 				pkt_stats->no_payload++;
-// 				continue;
-// 			}
-
-// 			if (pkt_header.caplen <= (uint32_t)off) {
-// 				pkt_stats->invalid_pkt++;
-// 				continue;
-// 			}
-
-// 			if (pkt_header.caplen - off < cpy_len)
-// 				cpy_len = pkt_header.caplen - off;
-
-// 			if (cpy_len <= len_thres || cpy_len > MAX_REGEX_BUF_SIZE) {
-// 				pkt_stats->thres_drop++;
-// 				continue;
-// 			}
-
-// 			stats_update_pkt_stats(pkt_stats, rte_ptype);
-
-// 		} else {
-// 			/* If not parsing packets, consider all valid. */
-// 			pkt_stats->valid_pkts++;
-// 		}
-
-// 		if (bytes_cnt + cpy_len > data_len)
-// 			cpy_len = data_len - bytes_cnt;
-
-// 		memcpy(data_ptr, pkt_data + off, cpy_len);
-// 		bytes_cnt += cpy_len;
-// 		data_ptr += cpy_len;
-// 		if (per_pkt_len)
-// 			lens[i++] = cpy_len;
-// 	}
-
-// 	run_conf->input_data = data;
-// 	run_conf->input_data_len = data_len;
-// 	if (per_pkt_len) {
-// 		run_conf->input_lens = lens;
-// 		run_conf->input_len_cnt = pkts_cnt;
-// 	}
-
-// 	return 0;
-// }
-
-// static void
-// input_pcap_file_clean(pl_conf *run_conf)
-// {
-// 	rte_free(run_conf->input_data);
-// 	rte_free(run_conf->input_lens);
-// }
+	return true;
+}
 
+/* Keeps the page cache PCAP_MAP_AHEAD bytes ahead of the replay, including the wrap over to the first record */
+static void *
+input_pcap_prefetch_thread(void *arg)
+{
+	struct input_pcap_map *map = arg;
+	const uint64_t page = sysconf(_SC_PAGESIZE);
+	uint64_t ahead = map->first;
+	uint64_t wrap_ahead = map->first;
+	uint64_t cursor;
+	uint64_t target;
+	uint64_t from;
+
+	while (!map->prefetch_quit) {
+		cursor = __atomic_load_n(&map->cursor, __ATOMIC_RELAXED);
+		/* replay went back to the start, what follows it was prefetched on the way there */
+		if (cursor < ahead && ahead - cursor > PCAP_MAP_AHEAD) {
+			ahead = RTE_MAX(cursor, wrap_ahead);
+			wrap_ahead = map->first;
+		}
+		if (ahead < cursor)
+			ahead = cursor;
+
+		target = RTE_MIN(cursor + PCAP_MAP_AHEAD, map->end);
+		if (target > ahead) {
+			from = RTE_ALIGN_FLOOR(ahead, page);
+			madvise((void *)(map->base + from), target - from, MADV_WILLNEED);
+			readahead(map->fd, from, target - from);
+			ahead = target;
+		}
+
+		/* the window runs past the end, the next pass starts from the first record */
+		if (cursor + PCAP_MAP_AHEAD > map->end) {
+			target = RTE_MIN(map->first + (cursor + PCAP_MAP_AHEAD - map->end), map->end);
+			if (target > wrap_ahead) {
+				from = RTE_ALIGN_FLOOR(wrap_ahead, page);
+				madvise((void *)(map->base + from), target - from, MADV_WILLNEED);
+				readahead(map->fd, from, target - from);
+				wrap_ahead = target;
+			}
+		}
+
+		rte_delay_us_sleep(PCAP_MAP_POLL_US);
+	}
+
+	return NULL;
+}
+
+static void
+input_pcap_file_unmap(struct input_pcap_map *map)
+{
+	if (map->prefetch_on) {
+		map->prefetch_quit = true;
+		pthread_join(map->prefetch, NULL);
+	}
+	munmap((void *)map->base, map->len);
+	close(map->fd);
+	rte_free(map);
+}
+
+/* Map the capture in place, records are walked on replay, see input_pcap_map.h */
 static int
-input_pcap_file_read(pl_conf *run_conf){return 0;}
+input_pcap_file_map(pl_conf *run_conf)
+{
+	const uint32_t pkts_max = run_conf->input_packets;
+	const uint32_t bytes_max = run_conf->input_bytes;
+	const char *file = run_conf->input_file;
+	const struct input_pcap_file_hdr *hdr;
+	struct input_pcap_map *map;
+	uint64_t bytes_cnt;
+	uint32_t pkts_cnt;
+	uint32_t linktype;
+	struct stat st;
+	uint32_t magic;
+	uint32_t caplen;
+	uint64_t off;
+	void *base;
+	int ret;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		ret = -errno;
+		MEILI_LOG_ERR("Failed to open pcap file: %s.", file);
+		return ret;
+	}
+	if (fstat(fd, &st) || (uint64_t)st.st_size < sizeof(*hdr)) {
+		MEILI_LOG_ERR("PCAP file %s is empty or unreadable.", file);
+		close(fd);
+		return -EINVAL;
+	}
+
+	/* private, writes of stages land in copy-on-write pages */
+	base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED) {
+		ret = -errno;
+		MEILI_LOG_ERR("Failed to map pcap file: %s.", file);
+		close(fd);
+		return ret;
+	}
+	madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+	map = rte_zmalloc(NULL, sizeof(*map), RTE_CACHE_LINE_SIZE);
+	if (!map) {
+		MEILI_LOG_ERR("Memory failure in allocating pcap map.");
+		munmap(base, st.st_size);
+		close(fd);
+		return -ENOMEM;
+	}
+	map->base = base;
+	map->len = st.st_size;
+	map->fd = fd;
+
+	hdr = base;
+	magic = hdr->magic;
+	if (magic == rte_bswap32(PCAP_MAGIC_USEC) || magic == rte_bswap32(PCAP_MAGIC_NSEC)) {
+		map->swapped = true;
+		magic = rte_bswap32(magic);
+	}
+	if (magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC) {
+		/* pcapng and compressed captures go through the loading reader */
+		MEILI_LOG_ERR("PCAP file %s is not a classic pcap capture, drop --pcap-mmap.", file);
+		ret = -ENOTSUP;
+		goto err;
+	}
+	linktype = map->swapped ? rte_bswap32(hdr->linktype) : hdr->linktype;
+	if (linktype != DLT_EN10MB) {
+		MEILI_LOG_ERR("PCAP file %s is not an ethernet capture.", file);
+		ret = -ENOTSUP;
+		goto err;
+	}
+
+	map->min_len = run_conf->input_len_threshold;
+	map->max_len = MAX_REGEX_BUF_SIZE;
+	map->end = map->len;
+
+	/* first record replayed, the walk on replay relies on there being one */
+	off = sizeof(*hdr);
+	while (off + sizeof(struct input_pcap_rec) <= map->end) {
+		caplen = input_pcap_map_caplen(map, off);
+		if (off + sizeof(struct input_pcap_rec) + caplen > map->end)
+			break;
+		if (caplen >= RTE_ETHER_HDR_LEN && caplen > map->min_len && caplen <= map->max_len)
+			break;
+		off += sizeof(struct input_pcap_rec) + caplen;
+	}
+	if (off + sizeof(struct input_pcap_rec) > map->end ||
+	    off + sizeof(struct input_pcap_rec) + input_pcap_map_caplen(map, off) > map->end) {
+		MEILI_LOG_ERR("No data extracted from PCAP file.");
+		ret = -EINVAL;
+		goto err;
+	}
+	map->first = off;
+
+	/* limits cut the capture short, only then are the headers walked up front */
+	if (pkts_max || bytes_max) {
+		pkts_cnt = 0;
+		bytes_cnt = 0;
+		while (off + sizeof(struct input_pcap_rec) <= map->end && (!pkts_max || pkts_cnt < pkts_max)) {
+			caplen = input_pcap_map_caplen(map, off);
+			if (off + sizeof(struct input_pcap_rec) + caplen > map->end)
+				break;
+			if (caplen >= RTE_ETHER_HDR_LEN && caplen > map->min_len && caplen <= map->max_len) {
+				if (bytes_max && bytes_cnt + caplen > bytes_max)
+					break;
+				bytes_cnt += caplen;
+				pkts_cnt++;
+			}
+			off += sizeof(struct input_pcap_rec) + caplen;
+		}
+		map->end = RTE_MAX(off, map->first + sizeof(struct input_pcap_rec) + input_pcap_map_caplen(map, map->first));
+	}
+	map->cursor = map->first;
+
+	ret = rte_ctrl_thread_create(&map->prefetch, "meili-pcap-pf", NULL, input_pcap_prefetch_thread, map);
+	if (ret) {
+		MEILI_LOG_ERR("Failed to start pcap prefetch thread.");
+		ret = -ret;
+		goto err;
+	}
+	map->prefetch_on = true;
+
+	/* every mbuf attached to the capture holds a reference, this one is never dropped */
+	rte_mbuf_ext_refcnt_set(&run_conf->shinfo, 1);
+	run_conf->input_map = map;
+
+	MEILI_LOG_INFO("Mapped %s (%lu bytes) for replay in place.", file, map->end - map->first);
+
+	return 0;
+
+err:
+	input_pcap_file_unmap(map);
+	return ret;
+}
+
+static int
+input_pcap_file_read(pl_conf *run_conf)
+{
+	const uint32_t pkts_max = run_conf->input_packets;
+	const uint32_t bytes_max = run_conf->input_bytes;
+	const char *file = run_conf->input_file;
+	struct pcap_pkthdr *pkt_header;
+	char errbuf[PCAP_ERRBUF_SIZE];
+	const unsigned char *pkt_data;
+	pkt_stats_t *pkt_stats;
+	pcap_t *pcap_handle;
+	uint64_t bytes_cnt;
+	uint32_t pkts_cnt;
+	uint64_t data_len;
+	uint16_t *lens;
+	char *data;
+	uint32_t i;
+
+	if (run_conf->input_app_mode)
+		MEILI_LOG_WARN_REC(run_conf, "run-app-layer ignored, pcap frames are replayed whole.");
+
+	if (run_conf->input_pcap_mmap)
+		return input_pcap_file_map(run_conf);
+
+	pcap_handle = pcap_open_offline(file, errbuf);
+	if (!pcap_handle) {
+		MEILI_LOG_ERR("Failed to open pcap file: %s (%s).", file, errbuf);
+		return -EINVAL;
+	}
+
+	if (pcap_datalink(pcap_handle) != DLT_EN10MB) {
+		MEILI_LOG_ERR("PCAP file %s is not an ethernet capture.", file);
+		pcap_close(pcap_handle);
+		return -ENOTSUP;
+	}
+
+	pkt_stats = run_conf->input_pkt_stats;
+	pkts_cnt = 0;
+	bytes_cnt = 0;
+
+	/* Read size is min bytes of file size, num pkts and num bytes. */
+	while (pcap_next_ex(pcap_handle, &pkt_header, &pkt_data) == 1 && (!pkts_max || pkts_cnt < pkts_max)) {
+		if (!input_pcap_frame_valid(run_conf, pkt_header))
+			continue;
+		if (bytes_max && bytes_cnt + pkt_header->caplen > bytes_max)
+			break;
+
+		bytes_cnt += pkt_header->caplen;
+		pkts_cnt++;
+	}
+
+	/* Reset the pcap_handle. */
+	pcap_close(pcap_handle);
+
+	if (!pkts_cnt) {
+		MEILI_LOG_ERR("No data extracted from PCAP file.");
+		return -EINVAL;
+	}
+
+	pcap_handle = pcap_open_offline(file, errbuf);
+	if (!pcap_handle) {
+		MEILI_LOG_ERR("Failed to open pcap file: %s (%s).", file, errbuf);
+		return -EINVAL;
+	}
+
+	/* Note: for pcap files, it may take up large space */
+	data = rte_malloc(NULL, bytes_cnt, 0);
+	if (!data) {
+		MEILI_LOG_ERR("Failed to allocate memory for pcap file - reduce num bytes or packet input size.");
+		pcap_close(pcap_handle);
+		return -ENOMEM;
+	}
+
+	lens = rte_malloc(NULL, sizeof(uint16_t) * pkts_cnt, 0);
+	if (!lens) {
+		MEILI_LOG_ERR("Memory failure in allocating pcap lengths array.");
+		rte_free(data);
+		pcap_close(pcap_handle);
+		return -ENOMEM;
+	}
+
+	data_len = bytes_cnt;
+	bytes_cnt = 0;
+	i = 0;
+
+	/* Second pass takes the same frames the first one counted. */
+	while (i < pkts_cnt && pcap_next_ex(pcap_handle, &pkt_header, &pkt_data) == 1) {
+		if (!input_pcap_frame_valid(run_conf, pkt_header)) {
+			if (pkt_header->caplen < sizeof(struct rte_ether_hdr))
+				pkt_stats->invalid_pkt++;
+			else
+				pkt_stats->thres_drop++;
+			continue;
+		}
+
+		if (pkt_header->caplen < pkt_header->len)
+			input_pcap_print_snap_len_warning(run_conf);
+
+		rte_memcpy(data + bytes_cnt, pkt_data, pkt_header->caplen);
+		bytes_cnt += pkt_header->caplen;
+		lens[i++] = pkt_header->caplen;
+		pkt_stats->valid_pkts++;
+	}
+
+	pcap_close(pcap_handle);
+
+	run_conf->input_data = data;
+	run_conf->input_data_len = data_len;
+	run_conf->input_lens = lens;
+	run_conf->input_len_cnt = i;
+
+	MEILI_LOG_INFO("Loaded %u packets (%lu bytes) from %s.", i, data_len, file);
+
+	return 0;
+}
 
 static void
 input_pcap_file_clean(pl_conf *run_conf)
 {
-	;
+	if (run_conf->input_map)
+		input_pcap_file_unmap(run_conf->input_map);
+	run_conf->input_map = NULL;
+	rte_free(run_conf->input_data);
+	rte_free(run_conf->input_lens);
 }
 
 void
@@ -0,0 +1,95 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_INPUT_PCAP_MAP_H_
+#define _INCLUDE_INPUT_PCAP_MAP_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <rte_byteorder.h>
+#include <rte_ether.h>
+
+#define PCAP_MAP_AHEAD (256UL << 20)	/* bytes prefetched ahead of the replay cursor */
+#define PCAP_MAP_POLL_US 1000		/* prefetch thread wake up interval */
+
+/* Record header as stored in the file, fields in the byte order of the writer. */
+struct input_pcap_rec {
+	uint32_t ts_sec;
+	uint32_t ts_frac;
+	uint32_t caplen;
+	uint32_t len;
+};
+
+/*
+ * A capture mapped in place with --pcap-mmap. Records are walked on replay
+ * without copying and packet data is attached to mbufs as external buffers,
+ * so captures larger than memory stream from the page cache. The mapping is
+ * private and writable: stages rewriting headers get copy-on-write pages and
+ * never touch the file.
+ */
+struct input_pcap_map {
+	const unsigned char *base;
+	uint64_t len;
+	int fd;
+	bool swapped;			/* file written on a host of the other byte order */
+
+	uint64_t first;			/* offset of the first record taken */
+	uint64_t end;			/* offset past the last record taken, see --run-packets/--run-bytes */
+	uint32_t min_len;		/* frames of at most --buf-thres bytes are skipped */
+	uint32_t max_len;
+
+	uint64_t cursor;		/* next record to replay, always a valid one */
+	uint32_t pass;			/* complete passes over the records */
+
+	pthread_t prefetch;
+	volatile bool prefetch_quit;
+	bool prefetch_on;
+};
+
+static inline uint32_t
+input_pcap_map_caplen(const struct input_pcap_map *map, uint64_t off)
+{
+	const struct input_pcap_rec *rec = (const struct input_pcap_rec *)(map->base + off);
+
+	return map->swapped ? rte_bswap32(rec->caplen) : rec->caplen;
+}
+
+/* Move the cursor forward to a record that is replayed, wrapping over at the end */
+static inline void
+input_pcap_map_settle(struct input_pcap_map *map)
+{
+	uint64_t off = map->cursor;
+	uint32_t caplen;
+
+	for (;;) {
+		/* a capture cut off mid record ends at the last complete one */
+		if (off + sizeof(struct input_pcap_rec) > map->end ||
+		    off + sizeof(struct input_pcap_rec) + (caplen = input_pcap_map_caplen(map, off)) > map->end) {
+			off = map->first;
+			map->pass++;
+			continue;
+		}
+		if (caplen >= RTE_ETHER_HDR_LEN && caplen > map->min_len && caplen <= map->max_len)
+			break;
+		off += sizeof(struct input_pcap_rec) + caplen;
+	}
+
+	/* read by the prefetch thread */
+	__atomic_store_n(&map->cursor, off, __ATOMIC_RELAXED);
+}
+
+/* Frame under the cursor, the cursor moves on to the next one */
+static inline const unsigned char *
+input_pcap_map_next(struct input_pcap_map *map, uint32_t *len)
+{
+	uint64_t off = map->cursor;
+
+	*len = input_pcap_map_caplen(map, off);
+	map->cursor = off + sizeof(struct input_pcap_rec) + *len;
+	input_pcap_map_settle(map);
+
+	return map->base + off + sizeof(struct input_pcap_rec);
+}
+
+#endif /* _INCLUDE_INPUT_PCAP_MAP_H_ */
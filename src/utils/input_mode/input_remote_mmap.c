@@ -0,0 +1,169 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <rte_ring.h>
+
+#include "input.h"
+#include "input_remote_mmap.h"
+
+/* Last reference to a submitted buffer dropped, runs on any lcore */
+static void
+input_remote_mmap_free_cb(void *addr __rte_unused, void *opaque)
+{
+	struct input_remote_mmap_slot *slot = opaque;
+
+	/* the ring holds every slot, this never fails */
+	rte_ring_mp_enqueue(slot->rmap->done, slot);
+}
+
+static void
+input_remote_mmap_free(struct input_remote_mmap *rmap)
+{
+	if (rmap->hdr)
+		munmap(rmap->hdr, rmap->len);
+	rte_ring_free(rmap->done);
+	rte_free(rmap->free_slots);
+	rte_free(rmap->slots);
+	rte_free(rmap);
+}
+
+static void
+input_remote_mmap_clean(pl_conf *run_conf)
+{
+	struct input_remote_mmap *rmap = run_conf->remote_mmap_desc;
+
+	if (!rmap)
+		return;
+
+	/* buffers the pipeline released on its way down still go back to the host */
+	while (rte_ring_count(rmap->done))
+		input_remote_mmap_complete(rmap);
+	__atomic_store_n(&rmap->hdr->meili_state, REMOTE_MMAP_STATE_DOWN, __ATOMIC_RELEASE);
+
+	MEILI_LOG_INFO("Remote mmap: %lu buffers passed, %lu dropped, %lu invalid.", rmap->nb_passed,
+		       rmap->nb_dropped, rmap->nb_invalid);
+
+	input_remote_mmap_free(rmap);
+	run_conf->remote_mmap_desc = NULL;
+	run_conf->remote_mmap_desc_len = 0;
+}
+
+static int
+input_remote_mmap_init(pl_conf *run_conf)
+{
+	const char *file = run_conf->input_file;
+	struct input_remote_mmap *rmap;
+	struct remote_mmap_hdr *hdr;
+	struct stat st;
+	uint32_t nb;
+	void *base;
+	uint32_t i;
+	int ret;
+	int fd;
+
+	fd = open(file, O_RDWR);
+	if (fd < 0) {
+		ret = -errno;
+		MEILI_LOG_ERR("Failed to open remote mmap region: %s.", file);
+		return ret;
+	}
+	if (fstat(fd, &st) || (uint64_t)st.st_size < sizeof(*hdr)) {
+		MEILI_LOG_ERR("Remote mmap region %s is empty or unreadable.", file);
+		close(fd);
+		return -EINVAL;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+	if (base == MAP_FAILED) {
+		ret = -errno;
+		MEILI_LOG_ERR("Failed to map remote mmap region: %s.", file);
+		close(fd);
+		return ret;
+	}
+	close(fd);
+
+	rmap = rte_zmalloc(NULL, sizeof(*rmap), RTE_CACHE_LINE_SIZE);
+	if (!rmap) {
+		MEILI_LOG_ERR("Memory failure in allocating remote mmap.");
+		munmap(base, st.st_size);
+		return -ENOMEM;
+	}
+	rmap->hdr = hdr = base;
+	rmap->len = st.st_size;
+
+	nb = hdr->nb_desc;
+	if (memcmp(hdr->magic, REMOTE_MMAP_MAGIC, sizeof(hdr->magic)) || hdr->version != REMOTE_MMAP_VERSION) {
+		MEILI_LOG_ERR("%s is not a version %u remote mmap region.", file, REMOTE_MMAP_VERSION);
+		ret = -EINVAL;
+		goto err;
+	}
+	if (!nb || !rte_is_power_of_2(nb) || hdr->sq_off > rmap->len ||
+	    sizeof(struct remote_mmap_desc) * (uint64_t)nb > rmap->len - hdr->sq_off || hdr->cq_off > rmap->len ||
+	    sizeof(struct remote_mmap_comp) * (uint64_t)nb > rmap->len - hdr->cq_off || hdr->data_off > rmap->len ||
+	    hdr->data_len > rmap->len - hdr->data_off) {
+		MEILI_LOG_ERR("Remote mmap region %s has a broken layout.", file);
+		ret = -EINVAL;
+		goto err;
+	}
+	if (__atomic_load_n(&hdr->meili_state, __ATOMIC_ACQUIRE) == REMOTE_MMAP_STATE_UP) {
+		MEILI_LOG_ERR("Remote mmap region %s is already served.", file);
+		ret = -EBUSY;
+		goto err;
+	}
+
+	rmap->sq = remote_mmap_sq(hdr);
+	rmap->cq = remote_mmap_cq(hdr);
+	rmap->data = remote_mmap_data(hdr);
+	rmap->data_len = hdr->data_len;
+	rmap->mask = nb - 1;
+	/* pick up where a previous run left off */
+	rmap->sq_tail = hdr->sq_tail;
+	rmap->cq_head = hdr->cq_head;
+
+	/* the host never has more than nb_desc buffers in flight */
+	rmap->slots = rte_zmalloc(NULL, sizeof(*rmap->slots) * nb, RTE_CACHE_LINE_SIZE);
+	rmap->free_slots = rte_malloc(NULL, sizeof(*rmap->free_slots) * nb, 0);
+	rmap->done = rte_ring_create("REMOTE_MMAP_DONE", nb, rte_socket_id(), RING_F_SC_DEQ | RING_F_EXACT_SZ);
+	if (!rmap->slots || !rmap->free_slots || !rmap->done) {
+		MEILI_LOG_ERR("Memory failure in allocating remote mmap slots.");
+		ret = -ENOMEM;
+		goto err;
+	}
+	for (i = 0; i < nb; i++) {
+		rmap->slots[i].shinfo.free_cb = input_remote_mmap_free_cb;
+		rmap->slots[i].shinfo.fcb_opaque = &rmap->slots[i];
+		rmap->slots[i].rmap = rmap;
+		rmap->free_slots[i] = &rmap->slots[i];
+	}
+	rmap->nb_slots = nb;
+	rmap->nb_free = nb;
+
+	__atomic_store_n(&hdr->meili_state, REMOTE_MMAP_STATE_UP, __ATOMIC_RELEASE);
+	run_conf->remote_mmap_desc = rmap;
+	run_conf->remote_mmap_desc_len = rmap->len;
+
+	MEILI_LOG_INFO("Serving remote mmap region %s, %u descriptors, %lu bytes of data.", file, nb, rmap->data_len);
+
+	return 0;
+
+err:
+	input_remote_mmap_free(rmap);
+	return ret;
+}
+
+void
+input_remote_mmap_reg(input_func_t *funcs)
+{
+	funcs->init = input_remote_mmap_init;
+	funcs->clean = input_remote_mmap_clean;
+}
@@ -0,0 +1,177 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_INPUT_REMOTE_MMAP_H_
+#define _INCLUDE_INPUT_REMOTE_MMAP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <rte_common.h>
+#include <rte_mbuf.h>
+#include <rte_ring.h>
+
+#include "../../lib/conf/meili_conf.h"
+#include "remote_mmap_ring.h"
+
+#define REMOTE_MMAP_BURST 64	/* released buffers completed per call */
+
+struct input_remote_mmap;
+
+/* A submitted buffer while it runs through the pipeline, shinfo of its mbuf */
+struct input_remote_mmap_slot {
+	struct rte_mbuf_ext_shared_info shinfo;
+	struct input_remote_mmap *rmap;
+	uint32_t id;
+	uint16_t status;
+	uint16_t len;
+} __rte_cache_aligned;
+
+/*
+ * Meili side of a region mapped with --input-mode remote_mmap, see
+ * remote_mmap_ring.h. The main core consumes submissions and posts
+ * completions. Buffers are released by whichever lcore frees their last
+ * mbuf and reach the main core through the done ring.
+ */
+struct input_remote_mmap {
+	struct remote_mmap_hdr *hdr;
+	uint64_t len;
+	struct remote_mmap_desc *sq;
+	struct remote_mmap_comp *cq;
+	unsigned char *data;
+	uint64_t data_len;
+	uint32_t mask;
+
+	/* main core copies of the indexes it owns */
+	uint32_t sq_tail;
+	uint32_t cq_head;
+
+	struct input_remote_mmap_slot *slots;
+	uint32_t nb_slots;
+	struct input_remote_mmap_slot **free_slots;
+	uint32_t nb_free;
+	struct rte_ring *done;
+
+	uint64_t nb_passed;
+	uint64_t nb_dropped;
+	uint64_t nb_invalid;
+};
+
+static inline void
+input_remote_mmap_comp(struct input_remote_mmap *rmap, uint32_t id, uint16_t status, uint16_t len)
+{
+	struct remote_mmap_comp *comp = &rmap->cq[rmap->cq_head++ & rmap->mask];
+
+	comp->id = id;
+	comp->status = status;
+	comp->len = len;
+}
+
+/* Post the completions of buffers the pipeline let go of, main core only */
+static inline void
+input_remote_mmap_complete(struct input_remote_mmap *rmap)
+{
+	struct input_remote_mmap_slot *slot;
+	void *done[REMOTE_MMAP_BURST];
+	unsigned int nb_done;
+	unsigned int i;
+
+	nb_done = rte_ring_sc_dequeue_burst(rmap->done, done, REMOTE_MMAP_BURST, NULL);
+	if (!nb_done)
+		return;
+
+	for (i = 0; i < nb_done; i++) {
+		slot = done[i];
+		input_remote_mmap_comp(rmap, slot->id, slot->status, slot->len);
+		if (slot->status == REMOTE_MMAP_COMP_PASSED)
+			rmap->nb_passed++;
+		else
+			rmap->nb_dropped++;
+		rmap->free_slots[rmap->nb_free++] = slot;
+	}
+	__atomic_store_n(&rmap->hdr->cq_head, rmap->cq_head, __ATOMIC_RELEASE);
+}
+
+/* Attach up to nb_pkts submitted buffers to mbufs of pool, no copy */
+static inline uint32_t
+input_remote_mmap_rx(struct input_remote_mmap *rmap, struct rte_mempool *pool, struct rte_mbuf **mbufs,
+		     uint32_t nb_pkts)
+{
+	const uint32_t cq_head = rmap->cq_head;
+	struct input_remote_mmap_slot *slot;
+	struct remote_mmap_desc *desc;
+	uint32_t nb_rx;
+	uint32_t head;
+	uint32_t n;
+	uint32_t i;
+
+	head = __atomic_load_n(&rmap->hdr->sq_head, __ATOMIC_ACQUIRE);
+	nb_rx = RTE_MIN(RTE_MIN(head - rmap->sq_tail, rmap->nb_free), nb_pkts);
+	if (!nb_rx)
+		return 0;
+
+	/* the pool runs dry while the pipeline holds on to its pkts, try again next iteration */
+	if (rte_pktmbuf_alloc_bulk(pool, mbufs, nb_rx))
+		return 0;
+
+	n = 0;
+	for (i = 0; i < nb_rx; i++) {
+		desc = &rmap->sq[rmap->sq_tail++ & rmap->mask];
+		if (!desc->len || desc->len > MAX_REGEX_BUF_SIZE || desc->off > rmap->data_len ||
+		    desc->len > rmap->data_len - desc->off) {
+			input_remote_mmap_comp(rmap, desc->id, REMOTE_MMAP_COMP_INVALID, 0);
+			rmap->nb_invalid++;
+			continue;
+		}
+
+		/* completed as dropped unless it shows up at the tail */
+		slot = rmap->free_slots[--rmap->nb_free];
+		slot->id = desc->id;
+		slot->status = REMOTE_MMAP_COMP_DROPPED;
+		slot->len = 0;
+		rte_mbuf_ext_refcnt_set(&slot->shinfo, 1);
+
+		/* host memory is no DMA target, fine for stages running on the cpu */
+		rte_pktmbuf_attach_extbuf(mbufs[n], rmap->data + desc->off, RTE_BAD_IOVA, desc->len, &slot->shinfo);
+		mbufs[n]->data_len = desc->len;
+		mbufs[n]->pkt_len = desc->len;
+		n++;
+	}
+
+	/* the host may reuse the descriptors */
+	__atomic_store_n(&rmap->hdr->sq_tail, rmap->sq_tail, __ATOMIC_RELEASE);
+	if (rmap->cq_head != cq_head)
+		__atomic_store_n(&rmap->hdr->cq_head, rmap->cq_head, __ATOMIC_RELEASE);
+
+	if (n < nb_rx)
+		rte_pktmbuf_free_bulk(&mbufs[n], nb_rx - n);
+
+	return n;
+}
+
+/* Pkts at the tail of the pipeline, their completions report them as passed once freed */
+static inline void
+input_remote_mmap_tx(struct input_remote_mmap *rmap, struct rte_mbuf **mbufs, uint32_t nb_pkts)
+{
+	struct input_remote_mmap_slot *slot;
+	uint32_t i;
+
+	for (i = 0; i < nb_pkts; i++) {
+		if (!RTE_MBUF_HAS_EXTBUF(mbufs[i]))
+			continue;
+		slot = (struct input_remote_mmap_slot *)mbufs[i]->shinfo;
+		if (slot < rmap->slots || slot >= rmap->slots + rmap->nb_slots)
+			continue;
+		slot->status = REMOTE_MMAP_COMP_PASSED;
+		slot->len = mbufs[i]->data_len;
+	}
+}
+
+/* The host closed the region and every submission was taken */
+static inline bool
+input_remote_mmap_closed(struct input_remote_mmap *rmap)
+{
+	return __atomic_load_n(&rmap->hdr->host_state, __ATOMIC_ACQUIRE) == REMOTE_MMAP_STATE_CLOSED &&
+	       __atomic_load_n(&rmap->hdr->sq_head, __ATOMIC_ACQUIRE) == rmap->sq_tail;
+}
+
+#endif /* _INCLUDE_INPUT_REMOTE_MMAP_H_ */
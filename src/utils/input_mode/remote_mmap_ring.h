@@ -0,0 +1,172 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_REMOTE_MMAP_RING_H_
+#define _INCLUDE_REMOTE_MMAP_RING_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Shared memory region of --input-mode remote_mmap. This is the ABI between
+ * Meili and a host process on the same machine, and it has no DPDK
+ * dependency, so host applications can include it as is.
+ *
+ * The host creates the file (preferably on hugetlbfs) and lays it out with
+ * remote_mmap_region_init(). Meili is started with -f pointing at the file.
+ * Both sides map it shared:
+ *
+ *   struct remote_mmap_hdr
+ *   struct remote_mmap_desc sq[nb_desc]	submissions, host to Meili
+ *   struct remote_mmap_comp cq[nb_desc]	completions, Meili to host
+ *   unsigned char data[data_len]		payloads, laid out by the host
+ *
+ * Both rings are single producer, single consumer, with free running 32 bit
+ * indexes. Payloads are never copied. Meili attaches them to mbufs, and
+ * stages may rewrite them in place. A buffer goes back to the host with its
+ * completion once the pipeline drops its last reference to it, so
+ * completions come back out of order. The host keeps at most nb_desc
+ * buffers in flight, which remote_mmap_host_submit() enforces.
+ */
+
+#define REMOTE_MMAP_MAGIC	"MEILIRMR"
+#define REMOTE_MMAP_VERSION	1
+#define REMOTE_MMAP_LINE	64
+
+enum remote_mmap_state {
+	REMOTE_MMAP_STATE_DOWN,
+	REMOTE_MMAP_STATE_UP,
+	REMOTE_MMAP_STATE_CLOSED,	/* host: nothing more is submitted, Meili ends the run once drained */
+};
+
+enum remote_mmap_status {
+	REMOTE_MMAP_COMP_PASSED,	/* left the tail of the pipeline */
+	REMOTE_MMAP_COMP_DROPPED,	/* filtered, shed or otherwise freed inside the pipeline */
+	REMOTE_MMAP_COMP_INVALID,	/* descriptor outside the data area, never run */
+};
+
+struct remote_mmap_desc {
+	uint64_t off;			/* from the start of the data area */
+	uint32_t len;
+	uint32_t id;			/* returned with the completion */
+};
+
+struct remote_mmap_comp {
+	uint32_t id;
+	uint16_t status;
+	uint16_t len;			/* length when the buffer left the pipeline */
+};
+
+struct remote_mmap_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t nb_desc;		/* power of two */
+	uint64_t sq_off;
+	uint64_t cq_off;
+	uint64_t data_off;
+	uint64_t data_len;
+	uint32_t host_state;		/* written by the host */
+	uint32_t meili_state;		/* written by Meili */
+
+	/* each index is written by one side only and sits on a cache line of its own */
+	uint32_t sq_head __attribute__((aligned(REMOTE_MMAP_LINE)));	/* host */
+	uint32_t sq_tail __attribute__((aligned(REMOTE_MMAP_LINE)));	/* Meili */
+	uint32_t cq_head __attribute__((aligned(REMOTE_MMAP_LINE)));	/* Meili */
+	uint32_t cq_tail __attribute__((aligned(REMOTE_MMAP_LINE)));	/* host */
+} __attribute__((aligned(REMOTE_MMAP_LINE)));
+
+#define REMOTE_MMAP_ALIGN(x)	(((x) + REMOTE_MMAP_LINE - 1) & ~((uint64_t)REMOTE_MMAP_LINE - 1))
+
+static inline struct remote_mmap_desc *
+remote_mmap_sq(struct remote_mmap_hdr *hdr)
+{
+	return (struct remote_mmap_desc *)((char *)hdr + hdr->sq_off);
+}
+
+static inline struct remote_mmap_comp *
+remote_mmap_cq(struct remote_mmap_hdr *hdr)
+{
+	return (struct remote_mmap_comp *)((char *)hdr + hdr->cq_off);
+}
+
+static inline unsigned char *
+remote_mmap_data(struct remote_mmap_hdr *hdr)
+{
+	return (unsigned char *)hdr + hdr->data_off;
+}
+
+/*
+ * Host side helpers.
+ */
+
+static inline uint64_t
+remote_mmap_region_size(uint32_t nb_desc, uint64_t data_len)
+{
+	return REMOTE_MMAP_ALIGN(sizeof(struct remote_mmap_hdr)) +
+	       REMOTE_MMAP_ALIGN(sizeof(struct remote_mmap_desc) * (uint64_t)nb_desc) +
+	       REMOTE_MMAP_ALIGN(sizeof(struct remote_mmap_comp) * (uint64_t)nb_desc) + data_len;
+}
+
+/* Lay out a zeroed region of remote_mmap_region_size() bytes, nb_desc must be a power of two */
+static inline void
+remote_mmap_region_init(void *base, uint32_t nb_desc, uint64_t data_len)
+{
+	struct remote_mmap_hdr *hdr = (struct remote_mmap_hdr *)base;
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->version = REMOTE_MMAP_VERSION;
+	hdr->nb_desc = nb_desc;
+	hdr->sq_off = REMOTE_MMAP_ALIGN(sizeof(*hdr));
+	hdr->cq_off = hdr->sq_off + REMOTE_MMAP_ALIGN(sizeof(struct remote_mmap_desc) * (uint64_t)nb_desc);
+	hdr->data_off = hdr->cq_off + REMOTE_MMAP_ALIGN(sizeof(struct remote_mmap_comp) * (uint64_t)nb_desc);
+	hdr->data_len = data_len;
+	hdr->host_state = REMOTE_MMAP_STATE_UP;
+
+	/* the magic goes last, Meili refuses a region without it */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(hdr->magic, REMOTE_MMAP_MAGIC, sizeof(hdr->magic));
+}
+
+/* Submit data[off, off + len), false while nb_desc buffers are in flight */
+static inline bool
+remote_mmap_host_submit(struct remote_mmap_hdr *hdr, uint64_t off, uint32_t len, uint32_t id)
+{
+	struct remote_mmap_desc *desc;
+	uint32_t head = hdr->sq_head;
+
+	/* a buffer is in flight until its completion is reaped */
+	if (head - hdr->cq_tail >= hdr->nb_desc)
+		return false;
+
+	desc = &remote_mmap_sq(hdr)[head & (hdr->nb_desc - 1)];
+	desc->off = off;
+	desc->len = len;
+	desc->id = id;
+	__atomic_store_n(&hdr->sq_head, head + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+/* Take the next completion, its buffer is the host's again */
+static inline bool
+remote_mmap_host_reap(struct remote_mmap_hdr *hdr, struct remote_mmap_comp *comp)
+{
+	uint32_t tail = hdr->cq_tail;
+
+	if (tail == __atomic_load_n(&hdr->cq_head, __ATOMIC_ACQUIRE))
+		return false;
+
+	*comp = remote_mmap_cq(hdr)[tail & (hdr->nb_desc - 1)];
+	__atomic_store_n(&hdr->cq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+/* No more submissions, Meili ends its run once everything submitted is done */
+static inline void
+remote_mmap_host_close(struct remote_mmap_hdr *hdr)
+{
+	__atomic_store_n(&hdr->host_state, REMOTE_MMAP_STATE_CLOSED, __ATOMIC_RELEASE);
+}
+
+#endif /* _INCLUDE_REMOTE_MMAP_RING_H_ */
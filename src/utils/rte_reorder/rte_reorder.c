@@ -9,6 +9,7 @@
 
 #include <rte_string_fns.h>
 #include <rte_log.h>
+#include <rte_cycles.h>
 #include <rte_mbuf.h>
 #include <rte_mbuf_dyn.h>
 #include <rte_eal_memconfig.h>
@@ -35,6 +36,9 @@ EAL_REGISTER_TAILQ(rte_reorder_tailq)
 #define RTE_REORDER_SEQN_DYNFIELD_NAME "rte_reorder_seqn_dynfield"
 int rte_reorder_seqn_dynfield_offset = -1;
 
+/* Order buffer entry of a sequence number that was dropped and will never arrive */
+#define RTE_REORDER_TOMBSTONE ((struct rte_mbuf *)1)
+
 /* A generic circular buffer */
 struct cir_buffer {
 	unsigned int size;   /**< Number of entries that can be stored */
@@ -50,6 +54,11 @@ struct rte_reorder_buffer {
 	uint32_t min_seqn;  /**< Lowest seq. number that can be in the buffer */
 	unsigned int memsize; /**< memory area size of reorder buffer */
 	bool is_initialized; /**< flag indicates that buffer was initialized */
+	unsigned int nb_held; /**< mbufs and tombstones in the order buffer */
+	uint64_t max_hold_cycles; /**< gap wait before it is skipped, 0 waits for overflow */
+	uint64_t gap_tsc;    /**< when drain first found the head blocked, 0 if not */
+	uint64_t timeout_cnt; /**< sequence numbers skipped after max_hold_cycles */
+	uint64_t tombstone_cnt; /**< sequence numbers released by a tombstone */
 
 	struct cir_buffer ready_buf; /**< temp buffer for dequeued entries */
 	struct cir_buffer order_buf; /**< buffer used to reorder entries */
@@ -214,10 +223,13 @@ rte_reorder_reset(struct rte_reorder_buffer *b)
 {
 	char name[RTE_REORDER_NAMESIZE];
 
+	uint64_t max_hold_cycles = b->max_hold_cycles;
+
 	rte_reorder_free_mbufs(b);
 	strlcpy(name, b->name, sizeof(name));
 	/* No error checking as current values should be valid */
 	rte_reorder_init(b, b->memsize, name, b->order_buf.size);
+	b->max_hold_cycles = max_hold_cycles;
 }
 
 static void
@@ -227,7 +239,8 @@ rte_reorder_free_mbufs(struct rte_reorder_buffer *b)
 
 	/* Free up the mbufs of order buffer & ready buffer */
 	for (i = 0; i < b->order_buf.size; i++) {
-		rte_pktmbuf_free(b->order_buf.entries[i]);
+		if (b->order_buf.entries[i] != RTE_REORDER_TOMBSTONE)
+			rte_pktmbuf_free(b->order_buf.entries[i]);
 		rte_pktmbuf_free(b->ready_buf.entries[i]);
 	}
 }
@@ -309,6 +322,7 @@ rte_reorder_fill_overflow(struct rte_reorder_buffer *b, unsigned n)
 
 	struct cir_buffer *order_buf = &b->order_buf,
 			*ready_buf = &b->ready_buf;
+	struct rte_mbuf *m;
 
 	unsigned int order_head_adv = 0;
 
@@ -325,21 +339,30 @@ rte_reorder_fill_overflow(struct rte_reorder_buffer *b, unsigned n)
 			order_head_adv++;
 		}
 
-		/* Move all ready entries that fit to the ready_buf */
-		while (order_buf->entries[order_buf->head] != NULL) {
-			ready_buf->entries[ready_buf->head] =
-					order_buf->entries[order_buf->head];
+		/*
+		 * Move all ready entries that fit to the ready_buf, tombstones
+		 * only advance the head
+		 */
+		while ((m = order_buf->entries[order_buf->head]) != NULL) {
+			if (m != RTE_REORDER_TOMBSTONE &&
+			    ((ready_buf->head + 1) & ready_buf->mask) == ready_buf->tail)
+				break;
 
 			order_buf->entries[order_buf->head] = NULL;
 			order_head_adv++;
+			b->nb_held--;
 
 			order_buf->head = (order_buf->head + 1) & order_buf->mask;
 
-			if (((ready_buf->head + 1) & ready_buf->mask) == ready_buf->tail)
-				break;
+			if (m == RTE_REORDER_TOMBSTONE) {
+				b->tombstone_cnt++;
+				continue;
+			}
 
+			ready_buf->entries[ready_buf->head] = m;
 			ready_buf->head = (ready_buf->head + 1) & ready_buf->mask;
 		}
+		b->gap_tsc = 0;
 	}
 
 	b->min_seqn += order_head_adv;
@@ -347,20 +370,17 @@ rte_reorder_fill_overflow(struct rte_reorder_buffer *b, unsigned n)
 	return order_head_adv;
 }
 
-int
-rte_reorder_insert(struct rte_reorder_buffer *b, struct rte_mbuf *mbuf)
+/* Put an mbuf or a tombstone at the position of seqn, see rte_reorder_insert() */
+static int
+rte_reorder_entry_place(struct rte_reorder_buffer *b, rte_reorder_seqn_t seqn,
+		struct rte_mbuf *entry)
 {
 	uint32_t offset, position;
 	struct cir_buffer *order_buf;
 
-	if (b == NULL || mbuf == NULL) {
-		rte_errno = EINVAL;
-		return -1;
-	}
-
 	order_buf = &b->order_buf;
 	if (!b->is_initialized) {
-		b->min_seqn = *rte_reorder_seqn(mbuf);
+		b->min_seqn = seqn;
 		b->is_initialized = 1;
 	}
 
@@ -372,7 +392,7 @@ rte_reorder_insert(struct rte_reorder_buffer *b, struct rte_mbuf *mbuf)
 	 *	mbuf_seqn = 0x0010
 	 *	offset    = 0x0010 - 0xFFFD = 0x13
 	 */
-	offset = *rte_reorder_seqn(mbuf) - b->min_seqn;
+	offset = seqn - b->min_seqn;
 
 	/*
 	 * action to take depends on offset.
@@ -394,7 +414,6 @@ rte_reorder_insert(struct rte_reorder_buffer *b, struct rte_mbuf *mbuf)
 	 */
 	if (offset < b->order_buf.size) {
 		position = (order_buf->head + offset) & order_buf->mask;
-		order_buf->entries[position] = mbuf;
 	} else if (offset < 2 * b->order_buf.size) {
 		if (rte_reorder_fill_overflow(b, offset + 1 - order_buf->size)
 				< (offset + 1 - order_buf->size)) {
@@ -402,22 +421,79 @@ rte_reorder_insert(struct rte_reorder_buffer *b, struct rte_mbuf *mbuf)
 			rte_errno = ENOSPC;
 			return -1;
 		}
-		offset = *rte_reorder_seqn(mbuf) - b->min_seqn;
+		offset = seqn - b->min_seqn;
 		position = (order_buf->head + offset) & order_buf->mask;
-		order_buf->entries[position] = mbuf;
 	} else {
 		/* Put in handling for enqueue straight to output */
 		rte_errno = ERANGE;
 		return -1;
 	}
+
+	if (order_buf->entries[position] == NULL)
+		b->nb_held++;
+	order_buf->entries[position] = entry;
+
 	return 0;
 }
 
+int
+rte_reorder_insert(struct rte_reorder_buffer *b, struct rte_mbuf *mbuf)
+{
+	if (b == NULL || mbuf == NULL) {
+		rte_errno = EINVAL;
+		return -1;
+	}
+
+	return rte_reorder_entry_place(b, *rte_reorder_seqn(mbuf), mbuf);
+}
+
+int
+rte_reorder_tombstone(struct rte_reorder_buffer *b, rte_reorder_seqn_t seqn)
+{
+	if (b == NULL) {
+		rte_errno = EINVAL;
+		return -1;
+	}
+
+	return rte_reorder_entry_place(b, seqn, RTE_REORDER_TOMBSTONE);
+}
+
+void
+rte_reorder_hold_set(struct rte_reorder_buffer *b, uint64_t max_hold_cycles)
+{
+	b->max_hold_cycles = max_hold_cycles;
+	b->gap_tsc = 0;
+}
+
+/*
+ * The head of the order buffer is missing while later entries wait behind it.
+ * The wait starts at the first drain that finds it so.
+ */
+static inline bool
+rte_reorder_gap_expired(struct rte_reorder_buffer *b)
+{
+	uint64_t now;
+
+	if (b->max_hold_cycles == 0 || b->nb_held == 0) {
+		b->gap_tsc = 0;
+		return false;
+	}
+
+	now = rte_rdtsc();
+	if (b->gap_tsc == 0) {
+		b->gap_tsc = now;
+		return false;
+	}
+
+	return now - b->gap_tsc >= b->max_hold_cycles;
+}
+
 unsigned int
 rte_reorder_drain(struct rte_reorder_buffer *b, struct rte_mbuf **mbufs,
 		unsigned max_mbufs)
 {
 	unsigned int drain_cnt = 0;
+	struct rte_mbuf *m;
 
 	struct cir_buffer *order_buf = &b->order_buf,
 			*ready_buf = &b->ready_buf;
@@ -431,12 +507,25 @@ rte_reorder_drain(struct rte_reorder_buffer *b, struct rte_mbuf **mbufs,
 
 	/*
 	 * If requested number of buffers not fetched from ready buffer, fetch
-	 * remaining buffers from order buffer
+	 * remaining buffers from order buffer. Tombstones release their
+	 * sequence number without an mbuf, a gap held for max_hold_cycles is
+	 * skipped along with the gaps right behind it.
 	 */
-	while ((drain_cnt < max_mbufs) &&
-			(order_buf->entries[order_buf->head] != NULL)) {
-		mbufs[drain_cnt++] = order_buf->entries[order_buf->head];
-		order_buf->entries[order_buf->head] = NULL;
+	while (drain_cnt < max_mbufs) {
+		m = order_buf->entries[order_buf->head];
+		if (m == NULL) {
+			if (!rte_reorder_gap_expired(b))
+				break;
+			b->timeout_cnt++;
+		} else {
+			order_buf->entries[order_buf->head] = NULL;
+			b->nb_held--;
+			b->gap_tsc = 0;
+			if (m == RTE_REORDER_TOMBSTONE)
+				b->tombstone_cnt++;
+			else
+				mbufs[drain_cnt++] = m;
+		}
 		b->min_seqn++;
 		order_buf->head = (order_buf->head + 1) & order_buf->mask;
 	}
@@ -513,9 +602,12 @@ rte_reorder_drain_up_to_seqn(struct rte_reorder_buffer *b, struct rte_mbuf **mbu
 		position = (order_buf->head + i) & order_buf->mask;
 		if (order_buf->entries[position] == NULL)
 			continue;
-		mbufs[drain_cnt++] = order_buf->entries[position];
+		b->nb_held--;
+		if (order_buf->entries[position] != RTE_REORDER_TOMBSTONE)
+			mbufs[drain_cnt++] = order_buf->entries[position];
 		order_buf->entries[position] = NULL;
 	}
+	b->gap_tsc = 0;
 	b->min_seqn += i;
 	order_buf->head = (order_buf->head + i) & order_buf->mask;
 
@@ -551,4 +643,20 @@ rte_reorder_min_seqn_set(struct rte_reorder_buffer *b, rte_reorder_seqn_t min_se
 	b->is_initialized = true;
 
 	return 0;
-}
\ No newline at end of file
+}
+
+unsigned int
+rte_reorder_held_count(const struct rte_reorder_buffer *b)
+{
+	const struct cir_buffer *ready_buf = &b->ready_buf;
+
+	return b->nb_held + ((ready_buf->head - ready_buf->tail) & ready_buf->mask);
+}
+
+void
+rte_reorder_gap_stats_get(const struct rte_reorder_buffer *b, uint64_t *timeout_cnt,
+		uint64_t *tombstone_cnt)
+{
+	*timeout_cnt = b->timeout_cnt;
+	*tombstone_cnt = b->tombstone_cnt;
+}
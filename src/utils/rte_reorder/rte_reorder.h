@@ -231,6 +231,60 @@ __rte_experimental
 unsigned int
 rte_reorder_memory_footprint_get(unsigned int size);
 
+/**
+ * Release a sequence number that will never arrive, e.g. its packet was
+ * dropped after sequencing. Drain skips it without returning an mbuf.
+ *
+ * @param b
+ *   Reorder buffer instance the sequence number belongs to
+ * @param seqn
+ *   Sequence number of the dropped packet
+ * @return
+ *   0 on success
+ *   -1 on error, with rte_errno set as for rte_reorder_insert(). ERANGE
+ *   also covers sequence numbers the buffer already skipped.
+ */
+int
+rte_reorder_tombstone(struct rte_reorder_buffer *b, rte_reorder_seqn_t seqn);
+
+/**
+ * Set the longest time drain waits on a missing sequence number while later
+ * entries are held behind it. Past it the gap is skipped and counted.
+ *
+ * @param b
+ *   Reorder buffer instance to modify
+ * @param max_hold_cycles
+ *   Hold time in TSC cycles, 0 only skips gaps when the window overflows
+ */
+void
+rte_reorder_hold_set(struct rte_reorder_buffer *b, uint64_t max_hold_cycles);
+
+/**
+ * Number of mbufs and tombstones not drained yet.
+ *
+ * @param b
+ *   Reorder buffer instance
+ * @return
+ *   Entries in the ready and order buffers
+ */
+unsigned int
+rte_reorder_held_count(const struct rte_reorder_buffer *b);
+
+/**
+ * Sequence numbers drain gave up on and sequence numbers released by a
+ * tombstone since the buffer was initialized.
+ *
+ * @param b
+ *   Reorder buffer instance
+ * @param timeout_cnt
+ *   Gaps skipped after the hold time
+ * @param tombstone_cnt
+ *   Tombstones drained
+ */
+void
+rte_reorder_gap_stats_get(const struct rte_reorder_buffer *b, uint64_t *timeout_cnt,
+		uint64_t *tombstone_cnt);
+
 #ifdef __cplusplus
 }
 #endif
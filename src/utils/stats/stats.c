@@ -100,7 +100,9 @@ int
 stats_init(pl_conf *run_conf)
 {
 	const int nq = run_conf->cores;
+	size_t custom_size;
 	rb_stats_t *stats;
+	char *custom;
 	int i, j;
 
 	run_conf->input_pkt_stats = rte_zmalloc(NULL, sizeof(pkt_stats_t), 0);
@@ -114,6 +116,8 @@ stats_init(pl_conf *run_conf)
 	stats->rm_stats = rte_zmalloc(NULL, sizeof(run_mode_stats_t) * nq, 128);
 	if (!stats->rm_stats)
 		goto err_rm_stats;
+	for (i = 0; i < nq; i++)
+		stats->rm_stats[i].stage_type = PL_NB_OF_STAGE_TYPES;
 
 	stats->lat_stats = rte_zmalloc(NULL, sizeof(lat_stats_t), 64);
 	if (!stats->lat_stats)
@@ -122,7 +126,22 @@ stats_init(pl_conf *run_conf)
 
 	stats->lat_stats->min_lat = UINT64_MAX;
 	stats->lat_stats->max_lat = 0;
-		
+
+	/* Regex stats outlive any one call into the device, the device fills in custom. */
+	stats->regex_stats = rte_zmalloc(NULL, sizeof(regex_stats_t) * nq, 64);
+	if (!stats->regex_stats)
+		goto err_regex_stats;
+
+	if (run_conf->regex_dev_type == REGEX_DEV_HYPERSCAN)
+		custom_size = RTE_ALIGN_CEIL(sizeof(hs_stats_t), CACHE_LINE_SIZE);
+	else
+		custom_size = RTE_ALIGN_CEIL(sizeof(rxp_stats_t), CACHE_LINE_SIZE);
+	custom = rte_zmalloc(NULL, custom_size * nq, 64);
+	if (!custom)
+		goto err_regex_custom;
+	for (i = 0; i < nq; i++)
+		stats->regex_stats[i].custom = custom + custom_size * i;
+
 	run_conf->stats = stats;
 
 	/* open a log file if neccessary */
@@ -137,6 +156,10 @@ stats_init(pl_conf *run_conf)
 	return 0;
 
 
+err_regex_custom:
+	rte_free(stats->regex_stats);
+err_regex_stats:
+	rte_free(stats->lat_stats);
 err_lat_stats:
 	rte_free(stats->rm_stats);
 err_rm_stats:
@@ -364,6 +387,29 @@ stats_print_config(pl_conf *run_conf)
 }
 
 
+/* share of polling cycles that found work */
+static inline double
+stats_busy_pct(run_mode_stats_t *rm)
+{
+	uint64_t tot_cycles = rm->busy_cycles + rm->idle_cycles;
+
+	return tot_cycles ? (100.0 * rm->busy_cycles) / tot_cycles : 0;
+}
+
+/* stage execution cost per packet, compare runs with and without --prefetch-distance */
+static inline double
+stats_cycles_per_pkt(run_mode_stats_t *rm)
+{
+	return rm->exec_pkt_cnt ? (double)rm->exec_cycles / rm->exec_pkt_cnt : 0;
+}
+
+/* stage type of the instance a queue runs, queues without one (spare or removed at runtime) print as unknown */
+static inline enum pipeline_type
+stats_stage_type(run_mode_stats_t *rm)
+{
+	return (enum pipeline_type)rm->stage_type;
+}
+
 #ifndef ONLY_SPLIT_THROUGHPUT
 static inline void
 stats_print_update_single(run_mode_stats_t *rm1, run_mode_stats_t *rm2, bool total, double duration)
@@ -381,12 +427,12 @@ stats_print_update_single(run_mode_stats_t *rm1, run_mode_stats_t *rm2, bool tot
 	char core1[24];
 	char core2[24];
 	sprintf(core1, "CORE %02d", rm1->lcore_id);
-	GET_STAGE_TYPE_STRING(rm1->self->type, type1);
+	GET_STAGE_TYPE_STRING(stats_stage_type(rm1), type1);
 	if (!rm2) {
 		stats_print_update_banner(core1, STATS_UPDATE_BANNER_LEN);
 	} else {
 		sprintf(core2, "CORE %02d", rm2->lcore_id);
-		GET_STAGE_TYPE_STRING(rm2->self->type, type2);
+		GET_STAGE_TYPE_STRING(stats_stage_type(rm2), type2);
 		stats_print_update_banner2(core1, core2, STATS_UPDATE_BANNER_LEN);
 	}
 
@@ -409,8 +455,17 @@ stats_print_update_single(run_mode_stats_t *rm1, run_mode_stats_t *rm2, bool tot
 			"| Perf Total (Gbps):  %14.4f |\n"
 			"| Perf Total (Mpps):  %14.4f |\n"
 			"| Perf Split (Gbps):  %14.4f |\n"
-			"| Perf Split (Mpps):  %14.4f |\n",
-			perf1, rate1, split_perf1, split_rate1);
+			"| Perf Split (Mpps):  %14.4f |\n"
+			"| Stolen Bursts:      %14lu |\n"
+			"| Filter Drops:       %14lu |\n"
+			"| Filter Diverts:     %14lu |\n"
+			"| Ring Full Events:   %14lu |\n"
+			"| Overload Drops:     %14lu |\n"
+			"| Busy Cycles (%%):    %14.2f |\n"
+			"| Cycles/Pkt:         %14.2f |\n",
+			perf1, rate1, split_perf1, split_rate1, rm1->steal_burst_cnt,
+			rm1->flt_drop_cnt, rm1->flt_divert_cnt, rm1->bp_full_cnt, rm1->bp_drop_cnt,
+			stats_busy_pct(rm1), stats_cycles_per_pkt(rm1));
 
 
 		if (total) {
@@ -451,8 +506,20 @@ stats_print_update_single(run_mode_stats_t *rm1, run_mode_stats_t *rm2, bool tot
 			"| Perf Total (Mpps):  %14.4f |    | Perf Total (Mpps):  %14.4f |\n"
 			"| Perf Split (Gbps):  %14.4f |    | Perf Split (Gbps):  %14.4f |\n"
 			"| Perf Split (Mpps):  %14.4f |    | Perf Split (Mpps):  %14.4f |\n"
+			"| Stolen Bursts:      %14lu |    | Stolen Bursts:      %14lu |\n"
+			"| Filter Drops:       %14lu |    | Filter Drops:       %14lu |\n"
+			"| Filter Diverts:     %14lu |    | Filter Diverts:     %14lu |\n"
+			"| Ring Full Events:   %14lu |    | Ring Full Events:   %14lu |\n"
+			"| Overload Drops:     %14lu |    | Overload Drops:     %14lu |\n"
+			"| Busy Cycles (%%):    %14.2f |    | Busy Cycles (%%):    %14.2f |\n"
+			"| Cycles/Pkt:         %14.2f |    | Cycles/Pkt:         %14.2f |\n"
 			STATS_UPDATE_BORDER "    " STATS_UPDATE_BORDER "\n\n",
-			perf1, perf2, rate1, rate2, split_perf1, split_perf2, split_rate1, split_rate2);
+			perf1, perf2, rate1, rate2, split_perf1, split_perf2, split_rate1, split_rate2,
+			rm1->steal_burst_cnt, rm2->steal_burst_cnt,
+			rm1->flt_drop_cnt, rm2->flt_drop_cnt, rm1->flt_divert_cnt, rm2->flt_divert_cnt,
+			rm1->bp_full_cnt, rm2->bp_full_cnt, rm1->bp_drop_cnt, rm2->bp_drop_cnt,
+			stats_busy_pct(rm1), stats_busy_pct(rm2),
+			stats_cycles_per_pkt(rm1), stats_cycles_per_pkt(rm2));
 	}
 }
 #else
@@ -474,10 +541,10 @@ stats_print_update_single(run_mode_stats_t *rm1, run_mode_stats_t *rm2, bool tot
 	char core2[24];
 	sprintf(core1, "CORE %02d", rm1->lcore_id);
 	//printf("%d\n", rm1->self->type);
-	GET_STAGE_TYPE_STRING(rm1->self->type, type1);
+	GET_STAGE_TYPE_STRING(stats_stage_type(rm1), type1);
 	
 
-	if (rm1->self->type == PL_MAIN) {
+	if (stats_stage_type(rm1) == PL_MAIN) {
 		
 		
 		perf1 = ((rm1->tx_buf_bytes * 8) / duration) / GIGA;
@@ -658,6 +725,58 @@ stats_print_lat(rb_stats_t *stats, int num_queues, enum meili_regex_dev dev __rt
 
 }
 
+/* Scores of responses against the expected matches of a job format file */
+static void
+stats_print_exp_matches(rb_stats_t *stats, int num_queues)
+{
+	rxp_exp_match_stats_t exp, max_exp;
+	uint64_t rx_valid, rx_invalid;
+	rxp_stats_t *rxp_stats;
+	int i;
+
+	memset(&exp, 0, sizeof(exp));
+	memset(&max_exp, 0, sizeof(max_exp));
+	rx_valid = 0;
+	rx_invalid = 0;
+	for (i = 0; i < num_queues; i++) {
+		rxp_stats = (rxp_stats_t *)stats->regex_stats[i].custom;
+		rx_valid += stats->regex_stats[i].rx_valid;
+		rx_invalid += rxp_stats->rx_invalid;
+		exp.score7 += rxp_stats->exp.score7;
+		exp.score6 += rxp_stats->exp.score6;
+		exp.score4 += rxp_stats->exp.score4;
+		exp.score0 += rxp_stats->exp.score0;
+		exp.false_positives += rxp_stats->exp.false_positives;
+		max_exp.score7 += rxp_stats->max_exp.score7;
+		max_exp.score6 += rxp_stats->max_exp.score6;
+		max_exp.score4 += rxp_stats->max_exp.score4;
+		max_exp.score0 += rxp_stats->max_exp.score0;
+		max_exp.false_positives += rxp_stats->max_exp.false_positives;
+	}
+
+	stats_print_banner("EXPECTED MATCH STATS", STATS_BANNER_LEN);
+	fprintf(stdout,
+		"| - JOBS SCORED:                    %-42lu |\n"
+		"| - JOBS HITTING A DEVICE LIMIT:    %-42lu |\n"
+		"|%*s|\n"
+		"| COMPLETED JOBS                                                               |\n"
+		"| - SCORE 7 (RULE, START, LENGTH):  %-42lu |\n"
+		"| - SCORE 6 (RULE, START):          %-42lu |\n"
+		"| - SCORE 4 (RULE):                 %-42lu |\n"
+		"| - SCORE 0 (MISSED):               %-42lu |\n"
+		"| - FALSE POSITIVES:                %-42lu |\n"
+		"|%*s|\n"
+		"| JOBS HITTING A DEVICE LIMIT                                                  |\n"
+		"| - SCORE 7 (RULE, START, LENGTH):  %-42lu |\n"
+		"| - SCORE 6 (RULE, START):          %-42lu |\n"
+		"| - SCORE 4 (RULE):                 %-42lu |\n"
+		"| - SCORE 0 (MISSED):               %-42lu |\n"
+		"| - FALSE POSITIVES:                %-42lu |\n"
+		STATS_BORDER "\n",
+		rx_valid + rx_invalid, rx_invalid, 78, "",
+		exp.score7, exp.score6, exp.score4, exp.score0, exp.false_positives, 78, "",
+		max_exp.score7, max_exp.score6, max_exp.score4, max_exp.score0, max_exp.false_positives);
+}
 
 void
 stats_print_end_of_run(pl_conf *run_conf, double run_time)
@@ -666,6 +785,8 @@ stats_print_end_of_run(pl_conf *run_conf, double run_time)
 
 	stats_print_update(stats, run_conf->cores, run_time, true);
 	stats_print_lat(stats, run_conf->cores, run_conf->regex_dev_type, run_conf->input_batches, run_conf->latency_mode);
+	if (run_conf->input_exp_matches)
+		stats_print_exp_matches(stats, run_conf->cores);
 	// stats_print_config(run_conf);
 	// stats_print_common_stats(stats, run_conf->cores, run_time);
 
@@ -717,6 +838,7 @@ stats_update_time_main(struct rte_mbuf **mbuf, int nb_mbuf, struct pipeline *pl)
 			lat_stats->min_lat = time_diff;
 		if (time_diff > lat_stats->max_lat)
 			lat_stats->max_lat = time_diff;
+		lat_stats->lat_hist[time_diff ? RTE_MIN(64 - __builtin_clzll(time_diff), LAT_HIST_BUCKETS - 1) : 0]++;
         
         #ifdef PKT_LATENCY_SAMPLE_ON
         lat_stats->time_diff_sample[lat_stats->nb_sampled & NUMBER_OF_SAMPLE] = time_diff;
@@ -792,6 +914,8 @@ void
 stats_clean(pl_conf *run_conf)
 {
 	rb_stats_t *stats = run_conf->stats;
+	rte_free(stats->regex_stats[0].custom);
+	rte_free(stats->regex_stats);
 	rte_free(stats->rm_stats);
 	rte_free(stats);
 	rte_free(run_conf->input_pkt_stats);
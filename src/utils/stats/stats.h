@@ -12,6 +12,7 @@
 #include <rte_udp.h>
 
 #include "../../lib/conf/meili_conf.h"
+#include "../../lib/regex/meili_regex_stats.h"
 #include "../../runtime/meili_runtime.h"
 
 // #define ONLY_SPLIT_THROUGHPUT
@@ -20,6 +21,7 @@
 #define STATS_INTERVAL_CYCLES	STATS_INTERVAL_SEC * rte_get_timer_hz()
 
 #define NUMBER_OF_SAMPLE ((1<<14) - 1) /* should be 2^n-1 for speed */ 
+#define LAT_HIST_BUCKETS 32	/* log2 of latency in cycles, the last bucket takes the rest */
 
 typedef struct pkt_stats {
 	uint64_t valid_pkts;	   /* Successfully parsed. */
@@ -53,13 +55,24 @@ typedef struct run_mode_stats {
 			uint64_t split_tx_buf_bytes;  /* Bytes last recorded. */
 			uint64_t split_tx_buf_cnt;  /* Buf last recorded. */
 			double split_duration;  /* per core duration recording. */
+			uint64_t steal_burst_cnt; /* Bursts taken from sibling rings. */
+			uint64_t steal_pkt_cnt;   /* Packets taken from sibling rings. */
+			uint64_t flt_drop_cnt;    /* Filtered packets freed. */
+			uint64_t flt_divert_cnt;  /* Filtered packets sent to the divert ring. */
+			uint64_t bp_full_cnt;     /* Bursts that found an output ring full. */
+			uint64_t bp_drop_cnt;     /* Packets dropped by backpressure, shed at rx on the main core. */
+			uint64_t busy_cycles;     /* Cycles of polls that found work. */
+			uint64_t idle_cycles;     /* Cycles of empty polls and idle backoff. */
+			uint64_t exec_cycles;     /* Cycles spent executing stage bursts. */
+			uint64_t exec_pkt_cnt;    /* Packets in those bursts. */
 
 			pkt_stats_t pkt_stats; /* Packet stats. */
 
 			struct pipeline_stage *self;/* corresponding pipeline stage */
+			int stage_type;           /* type of self by value, self may be freed under the stats and telemetry threads */
 		};
 		/* Ensure multiple cores don't access the same cache line. */
-		unsigned char cache_align[CACHE_LINE_SIZE * 2];
+		unsigned char cache_align[CACHE_LINE_SIZE * 4];
 	};
 } run_mode_stats_t;
 
@@ -73,11 +86,13 @@ typedef struct lat_stats {
 	// sample 
 	uint64_t time_diff_sample[NUMBER_OF_SAMPLE];
 	int nb_sampled;
+	uint64_t lat_hist[LAT_HIST_BUCKETS];
 } lat_stats_t;
 
 typedef struct rxpbench_stats {
 	run_mode_stats_t *rm_stats;
 	lat_stats_t *lat_stats;
+	regex_stats_t *regex_stats;	/* per regex queue, custom points to the stats of the device */
 } rb_stats_t;
 
 /* Modify packet stats (common to live and pcap modes). */
@@ -0,0 +1,209 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+#include <rte_telemetry.h>
+
+#include "../../lib/log/meili_log.h"
+#include "stats.h"
+#include "telemetry.h"
+
+/* Only one run per process, handlers have no other way to the counters */
+static pl_conf *tel_conf;
+
+static pthread_t stats_thread;
+static volatile bool stats_thread_quit;
+static bool stats_thread_on;
+
+static void
+stats_telemetry_queue(struct rte_tel_data *d, run_mode_stats_t *rm)
+{
+	char type[24];
+
+	GET_STAGE_TYPE_STRING(rm->stage_type, type);
+
+	rte_tel_data_start_dict(d);
+	rte_tel_data_add_dict_int(d, "lcore_id", rm->lcore_id);
+	rte_tel_data_add_dict_string(d, "stage_type", type);
+	rte_tel_data_add_dict_u64(d, "rx_pkts", rm->rx_buf_cnt);
+	rte_tel_data_add_dict_u64(d, "rx_bytes", rm->rx_buf_bytes);
+	rte_tel_data_add_dict_u64(d, "rx_batches", rm->rx_batch_cnt);
+	rte_tel_data_add_dict_u64(d, "tx_pkts", rm->tx_buf_cnt);
+	rte_tel_data_add_dict_u64(d, "tx_bytes", rm->tx_buf_bytes);
+	rte_tel_data_add_dict_u64(d, "tx_batches", rm->tx_batch_cnt);
+	rte_tel_data_add_dict_u64(d, "steal_bursts", rm->steal_burst_cnt);
+	rte_tel_data_add_dict_u64(d, "steal_pkts", rm->steal_pkt_cnt);
+	rte_tel_data_add_dict_u64(d, "filter_drops", rm->flt_drop_cnt);
+	rte_tel_data_add_dict_u64(d, "filter_diverts", rm->flt_divert_cnt);
+	rte_tel_data_add_dict_u64(d, "ring_full_events", rm->bp_full_cnt);
+	rte_tel_data_add_dict_u64(d, "overload_drops", rm->bp_drop_cnt);
+	rte_tel_data_add_dict_u64(d, "busy_cycles", rm->busy_cycles);
+	rte_tel_data_add_dict_u64(d, "idle_cycles", rm->idle_cycles);
+	rte_tel_data_add_dict_u64(d, "exec_cycles", rm->exec_cycles);
+	rte_tel_data_add_dict_u64(d, "exec_pkts", rm->exec_pkt_cnt);
+}
+
+static int
+stats_telemetry_queues(const char *cmd __rte_unused, const char *params __rte_unused, struct rte_tel_data *d)
+{
+	rte_tel_data_start_array(d, RTE_TEL_INT_VAL);
+	for (int q = 0; q < tel_conf->cores; q++)
+		rte_tel_data_add_array_int(d, q);
+
+	return 0;
+}
+
+static int
+stats_telemetry_queue_cmd(const char *cmd __rte_unused, const char *params, struct rte_tel_data *d)
+{
+	char *end;
+	long q;
+
+	if (!params || !*params)
+		return -EINVAL;
+
+	q = strtol(params, &end, 10);
+	if (*end || q < 0 || q >= tel_conf->cores)
+		return -EINVAL;
+
+	stats_telemetry_queue(d, &tel_conf->stats->rm_stats[q]);
+
+	return 0;
+}
+
+static int
+stats_telemetry_all(const char *cmd __rte_unused, const char *params __rte_unused, struct rte_tel_data *d)
+{
+	struct rte_tel_data *queue;
+	char name[16];
+
+	rte_tel_data_start_dict(d);
+	rte_tel_data_add_dict_u64(d, "timer_hz", rte_get_timer_hz());
+	for (int q = 0; q < tel_conf->cores; q++) {
+		queue = rte_tel_data_alloc();
+		if (!queue)
+			return -ENOMEM;
+		stats_telemetry_queue(queue, &tel_conf->stats->rm_stats[q]);
+		snprintf(name, sizeof(name), "queue_%d", q);
+		rte_tel_data_add_dict_container(d, name, queue, 0);
+	}
+
+	return 0;
+}
+
+static inline uint64_t
+stats_cycles_to_ns(uint64_t cycles)
+{
+	return (uint64_t)((double)cycles * 1000000000.0 / rte_get_timer_hz());
+}
+
+static int
+stats_telemetry_latency(const char *cmd __rte_unused, const char *params __rte_unused, struct rte_tel_data *d)
+{
+	lat_stats_t *lat_stats = tel_conf->stats->lat_stats;
+	struct rte_tel_data *le;
+	struct rte_tel_data *cnt;
+	uint64_t nb_pkts = 0;
+
+	le = rte_tel_data_alloc();
+	cnt = rte_tel_data_alloc();
+	if (!le || !cnt) {
+		rte_tel_data_free(le);
+		rte_tel_data_free(cnt);
+		return -ENOMEM;
+	}
+
+	/* bucket b holds latencies below 2^b cycles, the last one everything above */
+	rte_tel_data_start_array(le, RTE_TEL_U64_VAL);
+	rte_tel_data_start_array(cnt, RTE_TEL_U64_VAL);
+	for (int b = 0; b < LAT_HIST_BUCKETS; b++) {
+		rte_tel_data_add_array_u64(le, b < LAT_HIST_BUCKETS - 1 ? stats_cycles_to_ns(1ULL << b) : UINT64_MAX);
+		rte_tel_data_add_array_u64(cnt, lat_stats->lat_hist[b]);
+		nb_pkts += lat_stats->lat_hist[b];
+	}
+
+	rte_tel_data_start_dict(d);
+	rte_tel_data_add_dict_u64(d, "pkts", nb_pkts);
+	rte_tel_data_add_dict_u64(d, "min_ns", nb_pkts ? stats_cycles_to_ns(lat_stats->min_lat) : 0);
+	rte_tel_data_add_dict_u64(d, "avg_ns", nb_pkts ? stats_cycles_to_ns(lat_stats->tot_lat / nb_pkts) : 0);
+	rte_tel_data_add_dict_u64(d, "max_ns", stats_cycles_to_ns(lat_stats->max_lat));
+	rte_tel_data_add_dict_container(d, "hist_le_ns", le, 0);
+	rte_tel_data_add_dict_container(d, "hist_pkts", cnt, 0);
+
+	return 0;
+}
+
+/* Control thread taking the per second printout off the main core */
+static void *
+stats_print_thread(void *arg)
+{
+	pl_conf *run_conf = arg;
+	uint64_t start = rte_rdtsc();
+	uint64_t prev_cycles = 0;
+	uint64_t cycles;
+
+	while (!stats_thread_quit) {
+		rte_delay_us_sleep(STATS_THREAD_POLL_US);
+		cycles = rte_rdtsc() - start;
+		if (cycles - prev_cycles > STATS_INTERVAL_CYCLES) {
+			prev_cycles = cycles;
+			stats_print_update(run_conf->stats, run_conf->cores, (double)cycles / rte_get_timer_hz(), false);
+		}
+	}
+
+	return NULL;
+}
+
+/* Register the telemetry commands and start the printout unless --stats-quiet, call right before the run */
+int
+stats_telemetry_init(pl_conf *run_conf)
+{
+	static bool registered;
+	int ret;
+
+	tel_conf = run_conf;
+
+	if (!registered) {
+		ret = rte_telemetry_register_cmd("/meili/queues", stats_telemetry_queues, "Returns queue ids. No parameters");
+		ret |= rte_telemetry_register_cmd("/meili/queue", stats_telemetry_queue_cmd,
+			"Returns counters of a queue. Parameters: int queue_id");
+		ret |= rte_telemetry_register_cmd("/meili/stats", stats_telemetry_all,
+			"Returns counters of every queue. No parameters");
+		ret |= rte_telemetry_register_cmd("/meili/latency", stats_telemetry_latency,
+			"Returns end to end packet latency and its histogram. No parameters");
+		/* the run goes on without them, the end of run stats still print */
+		if (ret)
+			MEILI_LOG_WARN("Failed to register telemetry commands.");
+		registered = true;
+	}
+
+	if (run_conf->stats_quiet)
+		return 0;
+
+	stats_thread_quit = false;
+	ret = rte_ctrl_thread_create(&stats_thread, "meili-stats", NULL, stats_print_thread, run_conf);
+	if (ret) {
+		MEILI_LOG_ERR("Failed to start stats thread.");
+		return -ret;
+	}
+	stats_thread_on = true;
+
+	return 0;
+}
+
+void
+stats_telemetry_stop(pl_conf *run_conf __rte_unused)
+{
+	if (!stats_thread_on)
+		return;
+
+	stats_thread_quit = true;
+	pthread_join(stats_thread, NULL);
+	stats_thread_on = false;
+}
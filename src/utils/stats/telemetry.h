@@ -0,0 +1,23 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_TELEMETRY_H_
+#define _INCLUDE_TELEMETRY_H_
+
+#include "../../lib/conf/meili_conf.h"
+
+/* Per queue counters and packet latency are served through DPDK telemetry
+ * (usertools/dpdk-telemetry.py or any exporter speaking its unix socket):
+ *   /meili/queues          queue ids
+ *   /meili/queue,<id>      counters of one queue
+ *   /meili/stats           counters of every queue
+ *   /meili/latency         end to end latency and its log2 histogram
+ * Handlers run on the telemetry thread and read the counters in place, the
+ * per second printout runs on a control thread. Packet loops never format text.
+ */
+
+#define STATS_THREAD_POLL_US 100000
+
+int stats_telemetry_init(pl_conf *run_conf);
+void stats_telemetry_stop(pl_conf *run_conf);
+
+#endif /* _INCLUDE_TELEMETRY_H_ */